@@ -25,6 +25,10 @@
 #include "config.h"
 #endif
 
+#ifdef __ARM_NEON__
+#include <arm_neon.h>
+#endif
+
 #include "util.h"
 #include "msm_kgsl.h"
 #include "freedreno.h"
@@ -59,6 +63,20 @@ struct fd_param {
 			uint32_t elem_size, size, count;
 		};
 	};
+	/* FD_PARAM_ATTRIBUTE: bumped whenever the user ptr is (re)attached,
+	 * since the contents may have changed:
+	 */
+	uint32_t generation;
+	/* FD_PARAM_ATTRIBUTE: the last upload of this attribute, which can
+	 * be re-used by later draws referencing (a subset of) the same
+	 * range of vertices:
+	 */
+	struct {
+		const void *data;
+		uint32_t generation, lap;
+		uint32_t start, count;  /* in vertices */
+		uint32_t off;           /* in attributes.bo */
+	} cache;
 };
 
 #define MAX_PARAMS 32
@@ -103,12 +121,27 @@ struct fd_state {
 	/* attribute related params: */
 	struct {
 		/* gpu buffer used for passing parameters by ptr to the gpu..
-		 * it is used in a circular buffer fashion, wrapping around,
-		 * so we don't immediately overwrite the parameters for the
-		 * last draw cmd which the gpu may still be using:
+		 * it is filled linearly, and when full we switch to another
+		 * bo (see wrap_attributes()), so we don't overwrite the
+		 * parameters for earlier draws which the gpu may still use:
 		 */
 		struct fd_bo *bo;
 		uint32_t off;
+		/* incremented each time we wrap around, invalidating all
+		 * previous uploads:
+		 */
+		uint32_t lap;
+		/* timestamp of the last submit which could reference bo: */
+		uint32_t fence;
+		/* bos which filled up, kept until the submit referencing them
+		 * has completed so they can be reused.  A zero fence means
+		 * the bo is referenced by the current (unflushed) batch:
+		 */
+		struct {
+			struct fd_bo *bo;
+			uint32_t fence;
+		} *retired;
+		uint32_t nretired, maxretired;
 
 		struct fd_parameters params;
 	} attributes;
@@ -425,9 +458,15 @@ fail:
 
 void fd_fini(struct fd_state *state)
 {
+	uint32_t i;
+
 	fd_surface_del(state, state->render_target.surface);
 	fd_ringbuffer_del(state->ring);
 	fd_ringbuffer_del(state->ring_tile);
+	for (i = 0; i < state->attributes.nretired; i++)
+		fd_bo_del(state->attributes.retired[i].bo);
+	free(state->attributes.retired);
+	fd_bo_del(state->attributes.bo);
 	state->ws->destroy(state->ws);
 	free(state);
 }
@@ -512,6 +551,7 @@ int fd_attribute_pointer(struct fd_state *state, const char *name,
 	p->size  = size;
 	p->count = count;
 	p->data  = data;
+	p->generation++;
 	return 0;
 }
 
@@ -1169,28 +1209,265 @@ int fd_tex_param(struct fd_state *state, GLenum name, GLint param)
 	}
 }
 
-static int upload_attributes(struct fd_bo *bo, uint32_t off,
+/* Scan the indices for the range of vertices they reference, so for
+ * indexed draws we only need to upload that window of each attribute
+ * (rather than the whole client array), with the indices rebased to
+ * the start of the window:
+ */
+#ifdef __ARM_NEON__
+#define INDEX_RANGE(bits, lanes, half)                                      \
+static void index_range_u##bits(const uint##bits##_t *idx, uint32_t count,  \
+		uint32_t *pmin, uint32_t *pmax)                                     \
+{                                                                           \
+	uint##bits##_t lo = ~0, hi = 0;                                         \
+	uint32_t i = 0;                                                         \
+	if (count >= lanes) {                                                   \
+		uint##bits##x##lanes##_t vlo = vdupq_n_u##bits(~0);                 \
+		uint##bits##x##lanes##_t vhi = vdupq_n_u##bits(0);                  \
+		uint##bits##x##half##_t l, h;                                       \
+		for (; (i + lanes) <= count; i += lanes) {                          \
+			uint##bits##x##lanes##_t v = vld1q_u##bits(&idx[i]);            \
+			vlo = vminq_u##bits(vlo, v);                                    \
+			vhi = vmaxq_u##bits(vhi, v);                                    \
+		}                                                                   \
+		l = vmin_u##bits(vget_low_u##bits(vlo), vget_high_u##bits(vlo));    \
+		h = vmax_u##bits(vget_low_u##bits(vhi), vget_high_u##bits(vhi));    \
+		/* pairwise reduce the remaining lanes: */                          \
+		l = vpmin_u##bits(l, l);                                            \
+		h = vpmax_u##bits(h, h);                                            \
+		if (half > 2) {                                                     \
+			l = vpmin_u##bits(l, l);                                        \
+			h = vpmax_u##bits(h, h);                                        \
+		}                                                                   \
+		if (half > 4) {                                                     \
+			l = vpmin_u##bits(l, l);                                        \
+			h = vpmax_u##bits(h, h);                                        \
+		}                                                                   \
+		lo = vget_lane_u##bits(l, 0);                                       \
+		hi = vget_lane_u##bits(h, 0);                                       \
+	}                                                                       \
+	for (; i < count; i++) {                                                \
+		lo = min(lo, idx[i]);                                               \
+		hi = max(hi, idx[i]);                                               \
+	}                                                                       \
+	*pmin = lo;                                                             \
+	*pmax = hi;                                                             \
+}
+#else
+#define INDEX_RANGE(bits, lanes, half)                                      \
+static void index_range_u##bits(const uint##bits##_t *idx, uint32_t count,  \
+		uint32_t *pmin, uint32_t *pmax)                                     \
+{                                                                           \
+	uint##bits##_t lo = ~0, hi = 0;                                         \
+	uint32_t i;                                                             \
+	for (i = 0; i < count; i++) {                                           \
+		lo = min(lo, idx[i]);                                               \
+		hi = max(hi, idx[i]);                                               \
+	}                                                                       \
+	*pmin = lo;                                                             \
+	*pmax = hi;                                                             \
+}
+#endif
+
+INDEX_RANGE(8, 16, 8)
+INDEX_RANGE(16, 8, 4)
+INDEX_RANGE(32, 4, 2)
+
+static void index_range(const void *indices, uint32_t idx_bytes,
+		uint32_t count, uint32_t *pmin, uint32_t *pmax)
+{
+	switch (idx_bytes) {
+	case 1:  index_range_u8(indices, count, pmin, pmax);  break;
+	case 2:  index_range_u16(indices, count, pmin, pmax); break;
+	default: index_range_u32(indices, count, pmin, pmax); break;
+	}
+}
+
+#define COPY_INDICES(bits)                                                  \
+static void copy_indices_u##bits(uint##bits##_t *dst,                       \
+		const uint##bits##_t *src, uint32_t count, uint32_t base)           \
+{                                                                           \
+	uint32_t i;                                                             \
+	for (i = 0; i < count; i++)                                             \
+		dst[i] = src[i] - base;                                             \
+}
+
+COPY_INDICES(8)
+COPY_INDICES(16)
+COPY_INDICES(32)
+
+static void copy_indices(void *dst, const void *indices,
+		uint32_t idx_bytes, uint32_t count, uint32_t base)
+{
+	if (!base) {
+		memcpy(dst, indices, idx_bytes * count);
+		return;
+	}
+
+	switch (idx_bytes) {
+	case 1:  copy_indices_u8(dst, indices, count, base);  break;
+	case 2:  copy_indices_u16(dst, indices, count, base); break;
+	default: copy_indices_u32(dst, indices, count, base); break;
+	}
+}
+
+/* is the range of vertices still in attributes.bo from a previous draw? */
+static bool attribute_cached(struct fd_state *state, struct fd_param *p,
+		uint32_t start, uint32_t count)
+{
+	return (p->cache.data == p->data) &&
+			(p->cache.generation == p->generation) &&
+			(p->cache.lap == state->attributes.lap) &&
+			(p->cache.start <= start) &&
+			((p->cache.start + p->cache.count) >= (start + count));
+}
+
+/* bytes needed in attributes.bo for the draw: */
+static uint32_t attributes_size(struct fd_state *state,
+		struct ir_attribute **attributes, int attributes_count,
+		uint32_t start, uint32_t count, uint32_t idx_size)
+{
+	uint32_t size = ALIGN(idx_size, 32);
+	int n;
+
+	for (n = 0; n < attributes_count; n++) {
+		struct fd_param *p = find_param(&state->attributes.params,
+				attributes[n]->name);
+
+		if (p->type == FD_PARAM_ATTRIBUTE_VBO)
+			continue;
+
+		if (attribute_cached(state, p, start, count))
+			continue;
+
+		size += ALIGN(p->elem_size * p->size * count, 32);
+	}
+
+	return size;
+}
+
+/* Switch to another attributes.bo when the current one fills up.  We
+ * can't flush here, since there is no mem2gmem restore, so flushing in
+ * the middle of a frame would lose the earlier draws in every bin.
+ * Instead the full bo is retired, and an earlier retired bo which is no
+ * longer referenced by the current batch is reused (once the gpu is
+ * done with it), or else a new one is allocated:
+ */
+static void wrap_attributes(struct fd_state *state)
+{
+	struct fd_bo *bo = NULL;
+	uint32_t i;
+
+	for (i = 0; i < state->attributes.nretired; i++) {
+		if (state->attributes.retired[i].fence) {
+			bo = state->attributes.retired[i].bo;
+			fd_pipe_wait(state->ws->pipe,
+					state->attributes.retired[i].fence);
+			break;
+		}
+	}
+
+	if (bo) {
+		state->attributes.retired[i].bo = state->attributes.bo;
+		state->attributes.retired[i].fence =
+				state->dirty ? 0 : state->attributes.fence;
+	} else {
+		if (state->attributes.nretired == state->attributes.maxretired) {
+			state->attributes.maxretired =
+					state->attributes.maxretired ?
+					state->attributes.maxretired * 2 : 4;
+			state->attributes.retired = realloc(state->attributes.retired,
+					state->attributes.maxretired *
+					sizeof(state->attributes.retired[0]));
+		}
+		i = state->attributes.nretired++;
+		state->attributes.retired[i].bo = state->attributes.bo;
+		state->attributes.retired[i].fence =
+				state->dirty ? 0 : state->attributes.fence;
+		bo = fd_bo_new(state->ws->dev,
+				fd_bo_size(state->attributes.bo), 0);
+	}
+
+	state->attributes.bo = bo;
+	state->attributes.off = 0;
+	state->attributes.lap++;
+}
+
+/* Reserve space for the draw's attributes/indices, and figure out the
+ * window of vertices it references.  Returns zero on success.
+ */
+static int prepare_attributes(struct fd_state *state,
+		uint32_t *start, uint32_t *count, uint32_t idx_bytes,
+		uint32_t idx_count, const void *indices)
+{
+	struct fd_bo *bo = state->attributes.bo;
+	struct ir_attribute **attributes;
+	int attributes_count;
+	uint32_t size, idx_size = idx_bytes * idx_count;
+
+	if (indices && idx_count) {
+		uint32_t lo, hi;
+		index_range(indices, idx_bytes, idx_count, &lo, &hi);
+		*start = lo;
+		*count = hi - lo + 1;
+	}
+
+	attributes = fd_program_attributes(state->program,
+			FD_SHADER_VERTEX, &attributes_count);
+
+	size = attributes_size(state, attributes, attributes_count,
+			*start, *count, idx_size);
+	if ((state->attributes.off + size) <= fd_bo_size(bo))
+		return 0;
+
+	wrap_attributes(state);
+	bo = state->attributes.bo;
+
+	/* previous uploads are invalid now, so recalculate: */
+	size = attributes_size(state, attributes, attributes_count,
+			*start, *count, idx_size);
+	if (size > fd_bo_size(bo)) {
+		ERROR_MSG("draw too large: %u bytes of attributes", size);
+		return -1;
+	}
+
+	return 0;
+}
+
+static uint32_t upload_attribute(struct fd_state *state,
 		struct fd_param *p, uint32_t start, uint32_t count)
 {
+	struct fd_bo *bo = state->attributes.bo;
+	uint32_t off = state->attributes.off;
 	uint32_t group_size = p->elem_size * p->size;
 	uint32_t total_size = group_size * count;
 	uint32_t align_size = ALIGN(total_size, 32);
 	uint32_t data_off   = group_size * start;
 
-	if ((off + align_size) > fd_bo_size(bo))
-		return -1;
-
 	memcpy(fd_bo_map(bo) + off, p->data + data_off, total_size);
 
 	/* zero pad up to multiple of 32 */
 	memset(fd_bo_map(bo) + off + total_size, 0, align_size - total_size);
 
-	return align_size;
+	p->cache.data = p->data;
+	p->cache.generation = p->generation;
+	p->cache.lap = state->attributes.lap;
+	p->cache.start = start;
+	p->cache.count = count;
+	p->cache.off = off;
+
+	state->attributes.off += align_size;
+
+	return off;
 }
 
+/* emit the attributes for the window of vertices [start, start+count),
+ * and the (rebased) indices, returning the offset of the indices.  Space
+ * was already reserved by prepare_attributes().
+ */
 static uint32_t emit_attributes(struct fd_state *state,
-		uint32_t start, uint32_t count,
-		uint32_t idx_size, const void *indices)
+		uint32_t start, uint32_t count, uint32_t idx_bytes,
+		uint32_t idx_count, const void *indices)
 {
 	struct fd_bo *bo = state->attributes.bo;
 	struct fd_shader_const shader_const[MAX_PARAMS];
@@ -1200,7 +1477,7 @@ static uint32_t emit_attributes(struct fd_state *state,
 
 	attributes = fd_program_attributes(state->program,
 			FD_SHADER_VERTEX, &attributes_count);
-retry:
+
 	for (n = 0; n < attributes_count; n++) {
 		struct fd_param *p = find_param(&state->attributes.params,
 				attributes[n]->name);
@@ -1210,21 +1487,15 @@ retry:
 			shader_const[n].bo = p->bo;
 			shader_const[n].sz = fd_bo_size(p->bo);
 		} else {
-			int align_size = upload_attributes(bo, state->attributes.off,
-					p, start, indices ? p->count : count);
-
-			/* if we reach end of bo, then wrap-around: */
-			if (align_size < 0) {
-				state->attributes.off = 0;
-				n = 0;
-				goto retry;
-			}
+			uint32_t group_size = p->elem_size * p->size;
 
-			shader_const[n].offset = state->attributes.off;
-			shader_const[n].bo = bo;
-			shader_const[n].sz = align_size;
+			if (!attribute_cached(state, p, start, count))
+				upload_attribute(state, p, start, count);
 
-			state->attributes.off += align_size;
+			shader_const[n].offset = p->cache.off +
+					(group_size * (start - p->cache.start));
+			shader_const[n].bo = bo;
+			shader_const[n].sz = ALIGN(group_size * count, 32);
 		}
 
 		shader_const[n].format  = COLORX_8;
@@ -1233,17 +1504,12 @@ retry:
 	if (n > 0) {
 		emit_shader_const(state->ring, 0x78, shader_const, n);
 		if (indices) {
-			uint32_t align_size = ALIGN(idx_size, 32);
+			uint32_t idx_size = idx_bytes * idx_count;
 
-			if ((state->attributes.off + align_size) > fd_bo_size(bo)) {
-				state->attributes.off = 0;
-				n = 0;
-				goto retry;
-			}
-
-			memcpy(fd_bo_map(bo) + state->attributes.off, indices, idx_size);
 			idx_offset = state->attributes.off;
-			state->attributes.off += align_size;
+			copy_indices(fd_bo_map(bo) + idx_offset, indices,
+					idx_bytes, idx_count, start);
+			state->attributes.off += ALIGN(idx_size, 32);
 		}
 	}
 
@@ -1376,26 +1642,28 @@ static int draw_impl(struct fd_state *state, GLenum mode,
 	struct fd_surface *surface = state->render_target.surface;
 	enum pc_di_index_size idx_type = INDEX_SIZE_IGN;
 	enum pc_di_src_sel src_sel;
-	uint32_t idx_offset, idx_size;
+	uint32_t idx_offset, idx_size, idx_bytes = 0;
+	uint32_t vtx_start = first, vtx_count = count;
 
 	if (indices) {
 		switch (type) {
 		case GL_UNSIGNED_BYTE:
 			idx_type = INDEX_SIZE_8_BIT;
-			idx_size = count;
+			idx_bytes = 1;
 			break;
 		case GL_UNSIGNED_SHORT:
 			idx_type = INDEX_SIZE_16_BIT;
-			idx_size = 2 * count;
+			idx_bytes = 2;
 			break;
 		case GL_UNSIGNED_INT:
 			idx_type = INDEX_SIZE_32_BIT;
-			idx_size = 4 * count;
+			idx_bytes = 4;
 			break;
 		default:
 			ERROR_MSG("invalid type");
 			return -1;
 		}
+		idx_size = idx_bytes * count;
 		src_sel = DI_SRC_SEL_DMA;
 	} else {
 		idx_type = INDEX_SIZE_IGN;
@@ -1403,6 +1671,11 @@ static int draw_impl(struct fd_state *state, GLenum mode,
 		src_sel = DI_SRC_SEL_AUTO_INDEX;
 	}
 
+	/* before emitting anything, since this may need to flush: */
+	if (prepare_attributes(state, &vtx_start, &vtx_count,
+			idx_bytes, count, indices))
+		return -1;
+
 	/*
 	 * vertex shader consts start at 0x80 <-> C0
 	 * fragment shader consts start at 0x480?  Or is this controlled by some reg?
@@ -1460,7 +1733,8 @@ static int draw_impl(struct fd_state *state, GLenum mode,
 	emit_constants(state, FD_SHADER_VERTEX);
 	emit_constants(state, FD_SHADER_FRAGMENT);
 
-	idx_offset = emit_attributes(state, first, count, idx_size, indices);
+	idx_offset = emit_attributes(state, vtx_start, vtx_count,
+			idx_bytes, count, indices);
 
 	fd_program_emit_shader(state->program, FD_SHADER_VERTEX, ring);
 
@@ -1552,6 +1826,7 @@ int fd_flush(struct fd_state *state)
 {
 	struct fd_surface *surface = state->render_target.surface;
 	struct fd_ringbuffer *ring;
+	uint32_t i;
 
 	if (!state->dirty)
 		return 0;
@@ -1567,7 +1842,7 @@ int fd_flush(struct fd_state *state)
 		/* binning required, build cmds to setup for each tile in
 		 * the tile ringbuffer, w/ IB's to the primary ringbuffer:
 		 */
-		uint32_t i, yoff = 0;
+		uint32_t yoff = 0;
 		ring = state->ring_tile;
 
 		for (i = 0; i < state->render_target.nbins_y; i++) {
@@ -1614,7 +1889,11 @@ int fd_flush(struct fd_state *state)
 	}
 
 	fd_ringbuffer_flush(ring);
-	fd_pipe_wait(state->ws->pipe, fd_ringbuffer_timestamp(ring));
+	state->attributes.fence = fd_ringbuffer_timestamp(ring);
+	for (i = 0; i < state->attributes.nretired; i++)
+		if (!state->attributes.retired[i].fence)
+			state->attributes.retired[i].fence = state->attributes.fence;
+	fd_pipe_wait(state->ws->pipe, state->attributes.fence);
 	fd_ringbuffer_reset(state->ring);
 	fd_ringbuffer_reset(state->ring_tile);
 
@@ -0,0 +1,459 @@
+/*
+ * Copyright (c) 2012 Rob Clark <robdclark@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "ir-a3xx.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "util.h"
+#include "cache-version.h"
+
+/* On-disk cache of assembled shaders, so attaching a shader we have
+ * seen before is a file read rather than a parse + assemble.  Entries
+ * are named by a hash of the source, and hold the source itself (to
+ * rule out collisions), the binary, and the @ header metadata that
+ * fd_program_emit_state() needs.
+ *
+ * The cache lives in $FD_SHADER_CACHE if set (set it to "0" to disable
+ * the cache), otherwise $XDG_CACHE_HOME/fdre or ~/.cache/fdre.
+ *
+ * CACHE_BUILD_ID is a checksum of the assembler sources, generated at
+ * build time, so anything that changes the binary produced for a given
+ * source (encoding, scheduler, etc) invalidates the cache.  Bump
+ * CACHE_VERSION when the file layout changes.
+ */
+
+#define CACHE_MAGIC    0x63337269   /* "ir3c" */
+#define CACHE_VERSION  2
+
+struct cache_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t build;
+	uint32_t flags;
+	uint32_t srclen;
+	uint32_t sizedwords;
+	int32_t  max_reg, max_half_reg, max_const;
+	uint32_t attributes_count;
+	uint32_t consts_count;
+	uint32_t samplers_count;
+	uint32_t uniforms_count;
+	uint32_t varyings_count;
+	uint32_t bufs_count;
+	uint32_t outs_count;
+};
+
+static uint64_t cache_key(const char *src, uint32_t srclen, unsigned flags)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;   /* FNV-1a */
+	uint32_t i;
+
+#define HASH(v) do { hash ^= (v); hash *= 0x100000001b3ULL; } while (0)
+	HASH(CACHE_VERSION);
+	HASH(CACHE_BUILD_ID);
+	HASH(flags);
+	for (i = 0; i < srclen; i++)
+		HASH((uint8_t)src[i]);
+#undef HASH
+
+	return hash;
+}
+
+static int mkdir_p(char *path)
+{
+	char *p;
+
+	for (p = path + 1; *p; p++) {
+		if (*p != '/')
+			continue;
+		*p = '\0';
+		mkdir(path, 0755);
+		*p = '/';
+	}
+
+	if ((mkdir(path, 0755) < 0) && (errno != EEXIST))
+		return -errno;
+
+	return 0;
+}
+
+static bool cache_path(uint64_t key, bool create, char *path, size_t size)
+{
+	const char *dir = getenv("FD_SHADER_CACHE");
+	char base[4096];
+
+	if (dir) {
+		if (!strcmp(dir, "0"))
+			return false;
+		snprintf(base, sizeof(base), "%s", dir);
+	} else if ((dir = getenv("XDG_CACHE_HOME"))) {
+		snprintf(base, sizeof(base), "%s/fdre", dir);
+	} else if ((dir = getenv("HOME"))) {
+		snprintf(base, sizeof(base), "%s/.cache/fdre", dir);
+	} else {
+		return false;
+	}
+
+	if (create && mkdir_p(base))
+		return false;
+
+	snprintf(path, size, "%s/%016llx.ir3", base, (unsigned long long)key);
+
+	return true;
+}
+
+/*
+ * Serialization:
+ */
+
+struct cache_buf {
+	uint8_t *data;
+	uint32_t size, off;
+};
+
+static void put(struct cache_buf *buf, const void *data, uint32_t size)
+{
+	uint32_t aligned = ALIGN(size, 4);
+	if ((buf->off + aligned) > buf->size) {
+		buf->size = max(2 * buf->size, buf->off + aligned);
+		buf->data = realloc(buf->data, buf->size);
+		assert(buf->data);
+	}
+	memcpy(buf->data + buf->off, data, size);
+	memset(buf->data + buf->off + size, 0, aligned - size);
+	buf->off += aligned;
+}
+
+static void put_u32(struct cache_buf *buf, uint32_t val)
+{
+	put(buf, &val, 4);
+}
+
+static void put_reg(struct cache_buf *buf, struct ir3_register *reg)
+{
+	/* same encoding that the parser uses, and ir3_*_create() expect: */
+	put_u32(buf, (reg->num << 1) | !!(reg->flags & IR3_REG_HALF));
+}
+
+static void put_str(struct cache_buf *buf, const char *str)
+{
+	if (!str) {
+		put_u32(buf, ~0);
+		return;
+	}
+	put_u32(buf, strlen(str));
+	put(buf, str, strlen(str));
+}
+
+static const void * get(struct cache_buf *buf, uint32_t size)
+{
+	const void *ptr = buf->data + buf->off;
+	if ((size > buf->size) || ((buf->off + size) > buf->size))
+		return NULL;
+	buf->off += ALIGN(size, 4);
+	buf->off = min(buf->off, buf->size);
+	return ptr;
+}
+
+static bool get_u32(struct cache_buf *buf, uint32_t *val)
+{
+	const uint32_t *ptr = get(buf, 4);
+	if (!ptr)
+		return false;
+	*val = *ptr;
+	return true;
+}
+
+/* returns a nul-terminated copy (or NULL for a NULL string) in
+ * tmp, which ir3_*_create() will in turn copy:
+ */
+static bool get_str(struct cache_buf *buf, char *tmp, uint32_t tmpsize,
+		const char **str)
+{
+	const char *ptr;
+	uint32_t len;
+
+	if (!get_u32(buf, &len))
+		return false;
+
+	if (len == ~0) {
+		*str = NULL;
+		return true;
+	}
+
+	if (len >= tmpsize)
+		return false;
+
+	ptr = get(buf, len);
+	if (!ptr)
+		return false;
+
+	memcpy(tmp, ptr, len);
+	tmp[len] = '\0';
+	*str = tmp;
+
+	return true;
+}
+
+void ir3_cache_store(const char *src, unsigned flags,
+		struct ir3_shader *shader, const uint32_t *dwords, int sizedwords,
+		const struct ir3_shader_info *info)
+{
+	struct cache_buf buf = {0};
+	struct cache_header hdr = {
+			.magic            = CACHE_MAGIC,
+			.version          = CACHE_VERSION,
+			.build            = CACHE_BUILD_ID,
+			.flags            = flags,
+			.srclen           = strlen(src),
+			.sizedwords       = sizedwords,
+			.max_reg          = info->max_reg,
+			.max_half_reg     = info->max_half_reg,
+			.max_const        = info->max_const,
+			.attributes_count = shader->attributes_count,
+			.consts_count     = shader->consts_count,
+			.samplers_count   = shader->samplers_count,
+			.uniforms_count   = shader->uniforms_count,
+			.varyings_count   = shader->varyings_count,
+			.bufs_count       = shader->bufs_count,
+			.outs_count       = shader->outs_count,
+	};
+	char path[4096 + 32], tmp[4096 + 64];
+	uint32_t i;
+	int fd;
+
+	if (!cache_path(cache_key(src, hdr.srclen, flags), true,
+			path, sizeof(path)))
+		return;
+
+	put(&buf, &hdr, sizeof(hdr));
+	put(&buf, src, hdr.srclen);
+	put(&buf, dwords, 4 * sizedwords);
+
+	for (i = 0; i < shader->attributes_count; i++) {
+		struct ir3_attribute *a = shader->attributes[i];
+		put_reg(&buf, a->rstart);
+		put_u32(&buf, a->num);
+		put_str(&buf, a->name);
+	}
+
+	for (i = 0; i < shader->consts_count; i++) {
+		struct ir3_const *c = shader->consts[i];
+		put_reg(&buf, c->cstart);
+		put(&buf, c->val, sizeof(c->val));
+	}
+
+	for (i = 0; i < shader->samplers_count; i++) {
+		struct ir3_sampler *s = shader->samplers[i];
+		put_u32(&buf, s->idx);
+		put_str(&buf, s->name);
+	}
+
+	for (i = 0; i < shader->uniforms_count; i++) {
+		struct ir3_uniform *u = shader->uniforms[i];
+		put_reg(&buf, u->cstart);
+		put_u32(&buf, u->num);
+		put_str(&buf, u->name);
+	}
+
+	for (i = 0; i < shader->varyings_count; i++) {
+		struct ir3_varying *v = shader->varyings[i];
+		put_reg(&buf, v->rstart);
+		put_u32(&buf, v->num);
+		put_str(&buf, v->name);
+	}
+
+	for (i = 0; i < shader->bufs_count; i++) {
+		struct ir3_buf *b = shader->bufs[i];
+		put_reg(&buf, b->cstart);
+		put_str(&buf, b->name);
+	}
+
+	for (i = 0; i < shader->outs_count; i++) {
+		struct ir3_out *o = shader->outs[i];
+		put_reg(&buf, o->rstart);
+		put_u32(&buf, o->num);
+		put_str(&buf, o->name);
+	}
+
+	/* write to a temporary file and rename, so that concurrent test
+	 * runs never see a partially written entry:
+	 */
+	snprintf(tmp, sizeof(tmp), "%s.%d", path, getpid());
+
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		goto out;
+
+	if (write(fd, buf.data, buf.off) != (ssize_t)buf.off) {
+		close(fd);
+		unlink(tmp);
+		goto out;
+	}
+	close(fd);
+
+	if (rename(tmp, path))
+		unlink(tmp);
+
+out:
+	free(buf.data);
+}
+
+struct ir3_shader * ir3_cache_load(const char *src, unsigned flags,
+		uint32_t *dwords, uint32_t sizedwords, int *psizedwords,
+		struct ir3_shader_info *info)
+{
+	struct ir3_shader *shader = NULL;
+	struct cache_buf buf = {0};
+	const struct cache_header *hdr;
+	uint32_t srclen = strlen(src);
+	const void *ptr;
+	struct stat st;
+	char path[4096 + 32], name[256];
+	uint32_t i, r, n, v[4];
+	const char *str;
+	int fd;
+
+	if (!cache_path(cache_key(src, srclen, flags), false,
+			path, sizeof(path)))
+		return NULL;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &st) || (st.st_size < (off_t)sizeof(*hdr)))
+		goto fail;
+
+	buf.size = st.st_size;
+	buf.data = malloc(buf.size);
+	if (!buf.data || (read(fd, buf.data, buf.size) != (ssize_t)buf.size))
+		goto fail;
+
+	hdr = get(&buf, sizeof(*hdr));
+	if ((hdr->magic != CACHE_MAGIC) || (hdr->version != CACHE_VERSION) ||
+			(hdr->build != CACHE_BUILD_ID) ||
+			(hdr->flags != flags) || (hdr->srclen != srclen) ||
+			(hdr->sizedwords > sizedwords))
+		goto fail;
+
+	ptr = get(&buf, srclen);
+	if (!ptr || memcmp(ptr, src, srclen))
+		goto fail;
+
+	ptr = get(&buf, 4 * hdr->sizedwords);
+	if (!ptr)
+		goto fail;
+	memcpy(dwords, ptr, 4 * hdr->sizedwords);
+
+	/* the metadata can't take more heap than it does file: */
+	shader = ir3_shader_create_sized(1024 + buf.size);
+	if (!shader)
+		goto fail;
+
+#define CHECK_COUNT(name) \
+		if (hdr->name##s_count > ARRAY_SIZE(shader->name##s)) goto fail
+	CHECK_COUNT(attribute);
+	CHECK_COUNT(const);
+	CHECK_COUNT(sampler);
+	CHECK_COUNT(uniform);
+	CHECK_COUNT(varying);
+	CHECK_COUNT(buf);
+	CHECK_COUNT(out);
+#undef CHECK_COUNT
+
+	for (i = 0; i < hdr->attributes_count; i++) {
+		if (!get_u32(&buf, &r) || !get_u32(&buf, &n) ||
+				!get_str(&buf, name, sizeof(name), &str))
+			goto fail;
+		ir3_attribute_create(shader, r, n, str);
+	}
+
+	for (i = 0; i < hdr->consts_count; i++) {
+		if (!get_u32(&buf, &r) || !(ptr = get(&buf, sizeof(v))))
+			goto fail;
+		memcpy(v, ptr, sizeof(v));
+		ir3_const_create(shader, r, v[0], v[1], v[2], v[3]);
+	}
+
+	for (i = 0; i < hdr->samplers_count; i++) {
+		if (!get_u32(&buf, &n) ||
+				!get_str(&buf, name, sizeof(name), &str))
+			goto fail;
+		ir3_sampler_create(shader, n, str);
+	}
+
+	for (i = 0; i < hdr->uniforms_count; i++) {
+		if (!get_u32(&buf, &r) || !get_u32(&buf, &n) ||
+				!get_str(&buf, name, sizeof(name), &str))
+			goto fail;
+		ir3_uniform_create(shader, r, n, str);
+	}
+
+	for (i = 0; i < hdr->varyings_count; i++) {
+		if (!get_u32(&buf, &r) || !get_u32(&buf, &n) ||
+				!get_str(&buf, name, sizeof(name), &str))
+			goto fail;
+		ir3_varying_create(shader, r, n, str);
+	}
+
+	for (i = 0; i < hdr->bufs_count; i++) {
+		if (!get_u32(&buf, &r) ||
+				!get_str(&buf, name, sizeof(name), &str))
+			goto fail;
+		ir3_buf_create(shader, r, str);
+	}
+
+	for (i = 0; i < hdr->outs_count; i++) {
+		if (!get_u32(&buf, &r) || !get_u32(&buf, &n) ||
+				!get_str(&buf, name, sizeof(name), &str))
+			goto fail;
+		ir3_out_create(shader, r, n, str);
+	}
+
+	info->max_reg      = hdr->max_reg;
+	info->max_half_reg = hdr->max_half_reg;
+	info->max_const    = hdr->max_const;
+	*psizedwords       = hdr->sizedwords;
+
+	free(buf.data);
+	close(fd);
+
+	return shader;
+
+fail:
+	if (shader)
+		ir3_shader_destroy(shader);
+	free(buf.data);
+	close(fd);
+	return NULL;
+}
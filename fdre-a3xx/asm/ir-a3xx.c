@@ -38,7 +38,8 @@
 static void * ir3_alloc(struct ir3_shader *shader, int sz)
 {
 	void *ptr = &shader->heap[shader->heap_idx];
-	shader->heap_idx += ALIGN(sz, 4);
+	shader->heap_idx += ALIGN(sz, 8) / 4;
+	assert(shader->heap_idx <= shader->heap_size);
 	return ptr;
 }
 
@@ -56,8 +57,23 @@ static char * ir3_strdup(struct ir3_shader *shader, const char *str)
 
 struct ir3_shader * ir3_shader_create(void)
 {
-	DEBUG_MSG("");
-	return calloc(1, sizeof(struct ir3_shader));
+	return ir3_shader_create_sized(128 * MAX_INSTRS);
+}
+
+/* heap_size is in dwords.  Shaders which only need the @ header
+ * metadata (ie. loaded from the cache) can get by with a much
+ * smaller heap than one being parsed:
+ */
+struct ir3_shader * ir3_shader_create_sized(unsigned heap_size)
+{
+	struct ir3_shader *shader;
+	DEBUG_MSG("%u", heap_size);
+	shader = calloc(1, sizeof(*shader) + 4 * heap_size);
+	if (!shader)
+		return NULL;
+	shader->heap = (uint32_t *)(shader + 1);
+	shader->heap_size = heap_size;
+	return shader;
 }
 
 void ir3_shader_destroy(struct ir3_shader *shader)
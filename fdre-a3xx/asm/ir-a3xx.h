@@ -180,8 +180,8 @@ struct ir3_out {
 struct ir3_shader {
 	unsigned instrs_count;
 	struct ir3_instruction *instrs[MAX_INSTRS];
-	uint32_t heap[128 * MAX_INSTRS];
-	unsigned heap_idx;
+	uint32_t *heap;           /* allocated along with the shader */
+	unsigned heap_idx, heap_size;
 
 	/* @ headers: */
 	uint32_t attributes_count;
@@ -210,10 +210,22 @@ struct ir3_shader {
 };
 
 struct ir3_shader * ir3_shader_create(void);
+struct ir3_shader * ir3_shader_create_sized(unsigned heap_size);
 void ir3_shader_destroy(struct ir3_shader *shader);
 int ir3_shader_assemble(struct ir3_shader *shader,
 		uint32_t *dwords, uint32_t sizedwords,
 		struct ir3_shader_info *info);
+int ir3_shader_schedule(struct ir3_shader *shader);
+
+/* on-disk cache of assembled shaders, keyed by source: */
+#define IR3_CACHE_SCHED   0x1   /* binary was run through ir3_shader_schedule() */
+
+struct ir3_shader * ir3_cache_load(const char *src, unsigned flags,
+		uint32_t *dwords, uint32_t sizedwords, int *psizedwords,
+		struct ir3_shader_info *info);
+void ir3_cache_store(const char *src, unsigned flags,
+		struct ir3_shader *shader, const uint32_t *dwords, int sizedwords,
+		const struct ir3_shader_info *info);
 
 struct ir3_attribute * ir3_attribute_create(struct ir3_shader *shader,
 		int rstart, int num, const char *name);
@@ -42,10 +42,16 @@ int main(int argc, char **argv)
 	static uint32_t dwords[64 * 1024];
 	static int sizedwords;
 	char *infile, *outfile;
-	int fd, ret;
+	int fd, ret, sched = 0;
+
+	if ((argc == 4) && !strcmp(argv[1], "--sched")) {
+		sched = 1;
+		argv++;
+		argc--;
+	}
 
 	if (argc != 3) {
-		ERROR_MSG("usage: %s [infile] [outfile]", argv[0]);
+		ERROR_MSG("usage: %s [--sched] [infile] [outfile]", argv[0]);
 		return -1;
 	}
 
@@ -73,6 +79,14 @@ int main(int argc, char **argv)
 		return -1;
 	}
 
+	if (sched) {
+		ret = ir3_shader_schedule(shader);
+		if (ret) {
+			ERROR_MSG("scheduler failed: %d", ret);
+			return -1;
+		}
+	}
+
 	sizedwords = ir3_shader_assemble(shader, dwords, ARRAY_SIZE(dwords), &info);
 	if (sizedwords <= 0) {
 		ERROR_MSG("assembler failed");
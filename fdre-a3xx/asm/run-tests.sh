@@ -14,3 +14,18 @@ for f in tests/*.asm; do
 	diff $f $disfile > /dev/null || meld $f $disfile
 done
 
+# scheduler tests, the output has to match the expected disassembly:
+for f in tests/sched/*.asm; do
+	o3file=${f%%.asm}.co3
+	disfile=${f%%.asm}.dasm
+	./fdasm --sched $f $o3file
+	if [ $? != 0 ]; then
+		echo "assembler failed at: $f"
+		exit 1
+	fi
+	../../pgmdump $o3file | grep "\[" | sed 's/[0-9]*\[[0-9a-f]*x_[0-9a-f]*x\] //' > $disfile
+	if ! diff -u ${f%%.asm}.expected $disfile; then
+		echo "scheduler test failed: $f"
+		exit 1
+	fi
+done
@@ -0,0 +1,1047 @@
+/*
+ * Copyright (c) 2012 Rob Clark <robdclark@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "ir-a3xx.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <stdbool.h>
+#include <errno.h>
+
+#include "util.h"
+#include "instr-a3xx.h"
+
+/* Optional pass run between parse and emit, which re-orders the
+ * instructions within each basic block to hide ALU/SFU/texture latency
+ * and then re-derives the (ss)/(sy) flags and nop padding, replacing
+ * whatever was hand-placed in the source.
+ *
+ * Scheduling never crosses flow control (cat0), branch targets, or
+ * instructions using relative (a0.x) register addressing, which are
+ * left in place.  Branch offsets are fixed up afterwards to account
+ * for removed/inserted nops.
+ *
+ * Delay rules (same as the blob seems to follow):
+ *   alu -> alu:             3 delay slots (1 for 3rd src of mad)
+ *   alu -> sfu/tex/mem/flow: 6 delay slots
+ *   write a0.x -> anything: 6 delay slots
+ *   sfu -> anything:        (ss) on consumer
+ *   tex/mem -> anything:    (sy) on consumer
+ */
+
+/* full regs, followed by half regs.  The a0/p0 special regs live
+ * in the full range regardless of the half flag:
+ */
+#define NUM_REGS    (2 * 4 * 64)
+#define MAX_ACCESS  64
+#define NO_CYCLE    (-1000)
+
+enum sched_class {
+	CLASS_FLOW,
+	CLASS_ALU,
+	CLASS_SFU,
+	CLASS_TEX,
+	CLASS_MEM,
+};
+
+/* estimated result latency, used only to prioritize the schedule: */
+static const int class_latency[] = {
+		[CLASS_FLOW] = 1,
+		[CLASS_ALU]  = 4,
+		[CLASS_SFU]  = 10,
+		[CLASS_TEX]  = 64,
+		[CLASS_MEM]  = 64,
+};
+
+struct sched_access {
+	int16_t reg;     /* index into register file, see reg_id() */
+	int16_t n;       /* operand #, 0 for dst */
+	int16_t cycle;   /* cycle offset within (rpt)'d instruction */
+};
+
+struct sched_node {
+	struct ir3_instruction *instr;
+	enum sched_class cls;
+	int cycles;
+	unsigned nsrcs, ndsts;
+	struct sched_access srcs[MAX_ACCESS];
+	struct sched_access dsts[MAX_ACCESS];
+	bool rel_read, rel_write;   /* could touch any register */
+	bool leader;                /* target of a branch */
+	bool unknown_preds;         /* reachable from somewhere unknown */
+	bool pinned;                /* not moved by scheduler */
+	bool jp;                    /* original (jp) flag */
+	int target;                 /* node # of branch target, or -1 */
+	int branch;                 /* index into branch snapshots, or -1 */
+
+	/* new position of the instruction, and of the first thing
+	 * emitted for it (including nops), for fixing up branches:
+	 */
+	int pos, start;
+
+	/* scheduler state: */
+	int height, earliest, npreds;
+	unsigned first_succ, nsuccs;
+	bool scheduled;
+};
+
+struct sched_edge {
+	int from, to, lat;
+};
+
+typedef uint32_t regmask_t[NUM_REGS / 32];
+
+/* legalize state at a branch, relative to the cycle after the branch,
+ * so it can be merged in at the target:
+ */
+#define MAX_AGE 8
+struct sched_state {
+	regmask_t needs_ss, needs_ss_war, needs_sy;
+	int8_t age[NUM_REGS];   /* cycles since alu write, up to MAX_AGE */
+};
+
+static void regmask_set(regmask_t mask, int r)
+{
+	mask[r / 32] |= 1u << (r % 32);
+}
+
+static bool regmask_get(regmask_t mask, int r)
+{
+	return !!(mask[r / 32] & (1u << (r % 32)));
+}
+
+static bool regmask_any(regmask_t mask)
+{
+	unsigned i;
+	for (i = 0; i < NUM_REGS / 32; i++)
+		if (mask[i])
+			return true;
+	return false;
+}
+
+static void regmask_or(regmask_t dst, regmask_t src)
+{
+	unsigned i;
+	for (i = 0; i < NUM_REGS / 32; i++)
+		dst[i] |= src[i];
+}
+
+struct sched_ctx {
+	struct ir3_shader *shader;
+	struct sched_node *nodes;
+	unsigned nnodes;
+
+	/* dependency graph for current region: */
+	struct sched_edge *edges, *succs;
+	unsigned nedges, maxedges;
+
+	/* legalize state: */
+	int cycle;
+	int alu_cycle[NUM_REGS];   /* cycle alu result is written */
+	regmask_t needs_ss, needs_ss_war, needs_sy;
+
+	/* worst case state at a branch target: */
+	regmask_t all_ss, all_ss_war, all_sy, all_alu;
+
+	bool jp;   /* pending branch target flag */
+
+	/* final order of all nodes: */
+	struct sched_node **order;
+
+	/* state at each branch, from the current and previous pass.
+	 * Backward branches are legalized after their target, so the
+	 * target uses the state from the previous pass:
+	 */
+	struct sched_state *snap, *prev_snap;
+	unsigned nbranches;
+	bool prev_valid;
+
+	/* nops get re-used from one pass to the next: */
+	struct ir3_instruction **nops;
+	unsigned nnops, nallocated, maxnops;
+};
+
+static enum sched_class instr_class(struct ir3_instruction *instr)
+{
+	switch (instr->category) {
+	case 0:  return CLASS_FLOW;
+	case 4:  return CLASS_SFU;
+	case 5:  return CLASS_TEX;
+	case 6:  return CLASS_MEM;
+	default: return CLASS_ALU;
+	}
+}
+
+static bool is_store(struct ir3_instruction *instr)
+{
+	if (instr->category != 6)
+		return false;
+	switch (instr->opc) {
+	case OPC_STG:
+	case OPC_STP:
+	case OPC_STL:
+	case OPC_STLW:
+	case OPC_STI:
+	case OPC_STIB:
+	case OPC_PREFETCH:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static bool is_mad(struct ir3_instruction *instr)
+{
+	return (instr->category == 3) && (instr->opc <= OPC_MAD_F32);
+}
+
+static bool is_branch(struct ir3_instruction *instr)
+{
+	return (instr->category == 0) && ((instr->opc == OPC_BR) ||
+			(instr->opc == OPC_JUMP) || (instr->opc == OPC_CALL));
+}
+
+static int reg_id(struct ir3_register *reg, int off)
+{
+	int num = reg->num + off;
+	int n = num >> 2;
+
+	if (num >= (NUM_REGS / 2))
+		return -1;
+	if ((n == REG_A0) || (n == REG_P0) || !(reg->flags & IR3_REG_HALF))
+		return num;
+	return (NUM_REGS / 2) + num;
+}
+
+static void add_access(struct sched_node *node, bool dst,
+		int reg, int n, int cycle)
+{
+	unsigned *cnt = dst ? &node->ndsts : &node->nsrcs;
+	struct sched_access *a;
+
+	if (reg < 0)
+		return;
+
+	/* too much to track individually, so just treat it as touching
+	 * every register:
+	 */
+	if (*cnt >= MAX_ACCESS) {
+		if (dst)
+			node->rel_write = true;
+		else
+			node->rel_read = true;
+		return;
+	}
+
+	a = &(dst ? node->dsts : node->srcs)[(*cnt)++];
+	a->reg   = reg;
+	a->n     = n;
+	a->cycle = cycle;
+}
+
+static void add_reg(struct sched_node *node, struct ir3_register *reg,
+		int n, bool dst, uint32_t compmask, int repeat)
+{
+	int i, j;
+
+	if (!reg || (reg->flags & IR3_REG_IMMED))
+		return;
+
+	if (reg->flags & IR3_REG_RELATIV) {
+		add_access(node, false, REG_A0 << 2, n, 0);
+		if (reg->flags & IR3_REG_CONST)
+			return;
+		if (dst)
+			node->rel_write = true;
+		else
+			node->rel_read = true;
+		return;
+	}
+
+	if (reg->flags & IR3_REG_CONST)
+		return;
+
+	for (i = 0; i <= repeat; i++) {
+		int off = (reg->flags & IR3_REG_R) ? i : 0;
+		for (j = 0; j < 32; j++)
+			if (compmask & (1u << j))
+				add_access(node, dst, reg_id(reg, off + j), n, i);
+	}
+}
+
+static uint32_t comp_mask(int ncomp)
+{
+	if (ncomp >= 32)
+		return ~0;
+	return (1u << max(ncomp, 1)) - 1;
+}
+
+static void gather(struct sched_node *node, struct ir3_instruction *instr)
+{
+	unsigned i;
+
+	node->instr  = instr;
+	node->cls    = instr_class(instr);
+	node->cycles = instr->repeat + 1;
+
+	switch (instr->category) {
+	case 0:
+		if ((instr->opc == OPC_BR) || (instr->opc == OPC_KILL))
+			add_access(node, false, (REG_P0 << 2) + instr->cat0.comp, 1, 0);
+		break;
+	case 1:
+	case 2:
+	case 3:
+	case 4:
+		add_reg(node, instr->regs[0], 0, true, 0x1, instr->repeat);
+		for (i = 1; i < instr->regs_count; i++)
+			add_reg(node, instr->regs[i], i, false, 0x1, instr->repeat);
+		break;
+	case 5:
+		/* coordinates are a vector of unknown size, so be
+		 * conservative and assume a full vec4:
+		 */
+		node->cycles = 1;
+		add_reg(node, instr->regs[0], 0, true,
+				instr->regs[0]->wrmask ? instr->regs[0]->wrmask : 0xf, 0);
+		for (i = 1; i < instr->regs_count; i++)
+			add_reg(node, instr->regs[i], i, false, (i == 3) ? 0x1 : 0xf, 0);
+		break;
+	case 6:
+		node->cycles = 1;
+		if (is_store(instr)) {
+			/* dst is the address: */
+			if (instr->opc != OPC_PREFETCH)
+				add_reg(node, instr->regs[0], 0, false, 0x3, 0);
+			add_reg(node, instr->regs[1], 1, false,
+					(instr->opc == OPC_PREFETCH) ? 0x3 :
+							comp_mask(instr->cat6.iim_val), 0);
+		} else {
+			add_reg(node, instr->regs[0], 0, true,
+					comp_mask(instr->cat6.iim_val), 0);
+			add_reg(node, instr->regs[1], 1, false, 0x3, 0);
+		}
+		for (i = 2; i < instr->regs_count; i++)
+			add_reg(node, instr->regs[i], i, false, 0x1, 0);
+		break;
+	}
+
+	node->pinned = (node->cls == CLASS_FLOW) ||
+			node->rel_read || node->rel_write;
+}
+
+/* delay slots needed between an alu instruction writing 'reg' and
+ * 'consumer' reading it as operand 'n':
+ */
+static int delayslots(int reg, struct sched_node *consumer, int n)
+{
+	if ((reg >> 2) == REG_A0)
+		return 6;
+	if (consumer->cls != CLASS_ALU)
+		return 6;
+	if (is_mad(consumer->instr) && (n == 3))
+		return 1;
+	return 3;
+}
+
+/*
+ * Dependency graph and list scheduling of a single region:
+ */
+
+static void add_edge(struct sched_ctx *ctx, int from, int to, int lat)
+{
+	if (from == to)
+		return;
+	if (ctx->nedges == ctx->maxedges) {
+		ctx->maxedges = max(2 * ctx->maxedges, 256);
+		ctx->edges = realloc(ctx->edges,
+				ctx->maxedges * sizeof(ctx->edges[0]));
+		ctx->succs = realloc(ctx->succs,
+				ctx->maxedges * sizeof(ctx->succs[0]));
+		assert(ctx->edges && ctx->succs);
+	}
+	ctx->edges[ctx->nedges++] = (struct sched_edge){ from, to, lat };
+}
+
+static int raw_latency(struct sched_node *producer, int reg,
+		struct sched_node *consumer, int n)
+{
+	if (producer->cls == CLASS_ALU)
+		return delayslots(reg, consumer, n) + 1;
+	return class_latency[producer->cls];
+}
+
+struct reader {
+	int node, next;
+};
+
+static void build_graph(struct sched_ctx *ctx, struct sched_node *nodes,
+		unsigned n, struct reader *pool)
+{
+	int last_writer[NUM_REGS], readers[NUM_REGS];
+	int last_mem = -1, last_bary = -1, npool = 0;
+	unsigned i, j;
+
+	for (i = 0; i < NUM_REGS; i++)
+		last_writer[i] = readers[i] = -1;
+
+	ctx->nedges = 0;
+
+	for (j = 0; j < n; j++) {
+		struct sched_node *node = &nodes[j];
+
+		for (i = 0; i < node->nsrcs; i++) {
+			struct sched_access *a = &node->srcs[i];
+			int w = last_writer[a->reg];
+			if (w >= 0)
+				add_edge(ctx, w, j, raw_latency(&nodes[w],
+						a->reg, node, a->n));
+			pool[npool] = (struct reader){ j, readers[a->reg] };
+			readers[a->reg] = npool++;
+		}
+
+		for (i = 0; i < node->ndsts; i++) {
+			struct sched_access *a = &node->dsts[i];
+			int r;
+			if (last_writer[a->reg] >= 0)
+				add_edge(ctx, last_writer[a->reg], j, 1);
+			for (r = readers[a->reg]; r >= 0; r = pool[r].next)
+				add_edge(ctx, pool[r].node, j, 1);
+			last_writer[a->reg] = j;
+			readers[a->reg] = -1;
+		}
+
+		/* keep memory accesses in order, and bary.f in order so
+		 * the (ei) flag stays on the last one:
+		 */
+		if (node->cls == CLASS_MEM) {
+			if (last_mem >= 0)
+				add_edge(ctx, last_mem, j, 1);
+			last_mem = j;
+		}
+
+		if ((node->instr->category == 2) &&
+				(node->instr->opc == OPC_BARY_F)) {
+			if (last_bary >= 0)
+				add_edge(ctx, last_bary, j, 1);
+			last_bary = j;
+		}
+	}
+
+	/* sort into per-node successor lists: */
+	for (j = 0; j < n; j++) {
+		nodes[j].nsuccs = 0;
+		nodes[j].npreds = 0;
+		nodes[j].earliest = 0;
+		nodes[j].scheduled = false;
+	}
+
+	for (i = 0; i < ctx->nedges; i++) {
+		nodes[ctx->edges[i].from].nsuccs++;
+		nodes[ctx->edges[i].to].npreds++;
+	}
+
+	for (i = 0, j = 0; j < n; j++) {
+		nodes[j].first_succ = i;
+		i += nodes[j].nsuccs;
+		nodes[j].nsuccs = 0;
+	}
+
+	for (i = 0; i < ctx->nedges; i++) {
+		struct sched_node *from = &nodes[ctx->edges[i].from];
+		ctx->succs[from->first_succ + from->nsuccs++] = ctx->edges[i];
+	}
+
+	/* critical path length to the end of the region.  Edges always
+	 * point forward in the original order, so one reverse pass does:
+	 */
+	for (j = n; j-- > 0; ) {
+		struct sched_node *node = &nodes[j];
+		int height = 1;
+		for (i = 0; i < node->nsuccs; i++) {
+			struct sched_edge *e = &ctx->succs[node->first_succ + i];
+			height = max(height, e->lat + nodes[e->to].height);
+		}
+		node->height = node->cycles - 1 + height;
+	}
+}
+
+/* pick the next instruction: prefer one which can issue without
+ * stalling, with the longest critical path; otherwise the one which
+ * stalls the least:
+ */
+static int pick(struct sched_node *nodes, unsigned n, int cycle)
+{
+	int best = -1;
+	unsigned j;
+
+	for (j = 0; j < n; j++) {
+		struct sched_node *node = &nodes[j];
+		struct sched_node *b;
+		bool ready, bready;
+
+		if (node->scheduled || node->npreds)
+			continue;
+
+		if (best < 0) {
+			best = j;
+			continue;
+		}
+
+		b = &nodes[best];
+		ready  = node->earliest <= cycle;
+		bready = b->earliest <= cycle;
+
+		if (ready != bready) {
+			if (ready)
+				best = j;
+		} else if (ready) {
+			if (node->height > b->height)
+				best = j;
+		} else if ((node->earliest < b->earliest) ||
+				((node->earliest == b->earliest) &&
+						(node->height > b->height))) {
+			best = j;
+		}
+	}
+
+	return best;
+}
+
+static void schedule_region(struct sched_ctx *ctx, struct sched_node *nodes,
+		unsigned n, struct reader *pool, struct sched_node **order)
+{
+	int cycle = 0;
+	unsigned i, k;
+
+	build_graph(ctx, nodes, n, pool);
+
+	for (k = 0; k < n; k++) {
+		int j = pick(nodes, n, cycle);
+		struct sched_node *node = &nodes[j];
+
+		assert(j >= 0);
+
+		cycle = max(cycle, node->earliest);
+		node->scheduled = true;
+		order[k] = node;
+
+		for (i = 0; i < node->nsuccs; i++) {
+			struct sched_edge *e = &ctx->succs[node->first_succ + i];
+			struct sched_node *succ = &nodes[e->to];
+			succ->earliest = max(succ->earliest,
+					cycle + node->cycles - 1 + e->lat);
+			succ->npreds--;
+		}
+
+		cycle += node->cycles;
+	}
+}
+
+/*
+ * Legalize: walk the final order, inserting nops and sync flags:
+ */
+
+static int append(struct sched_ctx *ctx, struct ir3_instruction *instr)
+{
+	struct ir3_shader *shader = ctx->shader;
+
+	if (shader->instrs_count >= ARRAY_SIZE(shader->instrs))
+		return -ENOSPC;
+
+	/* branch target flag moves to whatever is emitted first: */
+	if (ctx->jp) {
+		instr->flags |= IR3_INSTR_JP;
+		ctx->jp = false;
+	}
+
+	shader->instrs[shader->instrs_count++] = instr;
+
+	return 0;
+}
+
+static struct ir3_instruction * get_nop(struct sched_ctx *ctx)
+{
+	struct ir3_shader *shader = ctx->shader;
+
+	if (ctx->nnops == ctx->nallocated) {
+		struct ir3_instruction *nop;
+
+		if (shader->instrs_count >= ARRAY_SIZE(shader->instrs))
+			return NULL;
+
+		/* ir3_instr_create() appends, which append() redoes: */
+		nop = ir3_instr_create(shader, 0, OPC_NOP);
+		shader->instrs_count--;
+
+		if (ctx->nallocated == ctx->maxnops) {
+			ctx->maxnops = max(2 * ctx->maxnops, 64);
+			ctx->nops = realloc(ctx->nops,
+					ctx->maxnops * sizeof(ctx->nops[0]));
+			assert(ctx->nops);
+		}
+		ctx->nops[ctx->nallocated++] = nop;
+	}
+
+	return ctx->nops[ctx->nnops++];
+}
+
+static int emit_nops(struct sched_ctx *ctx, int cycles, int flags)
+{
+	while ((cycles > 0) || flags) {
+		struct ir3_instruction *nop = get_nop(ctx);
+		int n = min(max(cycles, 1), 8);
+		int ret;
+
+		if (!nop)
+			return -ENOSPC;
+
+		nop->repeat = n - 1;
+		nop->flags  = flags;
+
+		ret = append(ctx, nop);
+		if (ret)
+			return ret;
+
+		ctx->cycle += n;
+		cycles -= n;
+		flags = 0;
+	}
+	return 0;
+}
+
+static void merge_worst_case(struct sched_ctx *ctx)
+{
+	int r;
+
+	regmask_or(ctx->needs_ss, ctx->all_ss);
+	regmask_or(ctx->needs_ss_war, ctx->all_ss_war);
+	regmask_or(ctx->needs_sy, ctx->all_sy);
+	for (r = 0; r < NUM_REGS; r++)
+		if (regmask_get(ctx->all_alu, r))
+			ctx->alu_cycle[r] = max(ctx->alu_cycle[r], ctx->cycle - 1);
+}
+
+static void merge_state(struct sched_ctx *ctx, struct sched_state *state)
+{
+	int r;
+
+	regmask_or(ctx->needs_ss, state->needs_ss);
+	regmask_or(ctx->needs_ss_war, state->needs_ss_war);
+	regmask_or(ctx->needs_sy, state->needs_sy);
+	for (r = 0; r < NUM_REGS; r++)
+		if (state->age[r] < MAX_AGE)
+			ctx->alu_cycle[r] = max(ctx->alu_cycle[r],
+					ctx->cycle - state->age[r]);
+}
+
+static void save_state(struct sched_ctx *ctx, struct sched_state *state)
+{
+	int r;
+
+	memcpy(state->needs_ss, ctx->needs_ss, sizeof(state->needs_ss));
+	memcpy(state->needs_ss_war, ctx->needs_ss_war, sizeof(state->needs_ss_war));
+	memcpy(state->needs_sy, ctx->needs_sy, sizeof(state->needs_sy));
+	for (r = 0; r < NUM_REGS; r++) {
+		if (ctx->alu_cycle[r] == NO_CYCLE)
+			state->age[r] = MAX_AGE;
+		else
+			state->age[r] = min(ctx->cycle - ctx->alu_cycle[r], MAX_AGE);
+	}
+}
+
+/* merge in the state from everywhere which could branch to node: */
+static void merge_preds(struct sched_ctx *ctx, struct sched_node *node)
+{
+	int idx = node - ctx->nodes;
+	unsigned i;
+
+	if (node->unknown_preds) {
+		merge_worst_case(ctx);
+		return;
+	}
+
+	for (i = 0; i < ctx->nnodes; i++) {
+		struct sched_node *b = &ctx->nodes[i];
+
+		if ((b->branch < 0) || (b->target != idx))
+			continue;
+
+		if ((int)i < idx)
+			merge_state(ctx, &ctx->snap[b->branch]);
+		else if (ctx->prev_valid)
+			merge_state(ctx, &ctx->prev_snap[b->branch]);
+		else
+			merge_worst_case(ctx);
+	}
+}
+
+static int legalize(struct sched_ctx *ctx, struct sched_node *node)
+{
+	struct ir3_instruction *instr = node->instr;
+	bool ss = false, sy = false;
+	int stall = 0, ret, r;
+	unsigned i;
+
+	instr->flags &= ~(IR3_INSTR_SS | IR3_INSTR_SY | IR3_INSTR_JP);
+
+	if (node->leader) {
+		merge_preds(ctx, node);
+		ctx->jp = node->jp;
+	}
+
+	/* sfu/tex/mem results from before the shader started could still
+	 * be outstanding, so like the blob, sync on the first instruction:
+	 */
+	if (!ctx->shader->instrs_count)
+		ss = sy = true;
+
+	node->start = ctx->shader->instrs_count;
+
+	for (i = 0; i < node->nsrcs; i++) {
+		struct sched_access *a = &node->srcs[i];
+		ss |= regmask_get(ctx->needs_ss, a->reg);
+		sy |= regmask_get(ctx->needs_sy, a->reg);
+		if (ctx->alu_cycle[a->reg] != NO_CYCLE)
+			stall = max(stall, ctx->alu_cycle[a->reg] +
+					delayslots(a->reg, node, a->n) + 1 -
+					(ctx->cycle + a->cycle));
+	}
+
+	for (i = 0; i < node->ndsts; i++) {
+		struct sched_access *a = &node->dsts[i];
+		ss |= regmask_get(ctx->needs_ss, a->reg) ||
+				regmask_get(ctx->needs_ss_war, a->reg);
+		sy |= regmask_get(ctx->needs_sy, a->reg);
+	}
+
+	if (node->rel_read) {
+		ss |= regmask_any(ctx->needs_ss);
+		sy |= regmask_any(ctx->needs_sy);
+		for (r = 0; r < NUM_REGS; r++)
+			if (ctx->alu_cycle[r] != NO_CYCLE)
+				stall = max(stall, ctx->alu_cycle[r] +
+						delayslots(r, node, 1) + 1 - ctx->cycle);
+	}
+
+	/* outputs are read by end, but not visible as operands: */
+	if (node->rel_write || ((instr->category == 0) &&
+			(instr->opc == OPC_END))) {
+		ss |= regmask_any(ctx->needs_ss) || regmask_any(ctx->needs_ss_war);
+		sy |= regmask_any(ctx->needs_sy);
+	}
+
+	/* cat5 and cat6 have no (ss) bit, so it needs to go on a nop: */
+	ret = emit_nops(ctx, stall,
+			(ss && (instr->category >= 5)) ? IR3_INSTR_SS : 0);
+	if (ret)
+		return ret;
+
+	if (ss && (instr->category < 5))
+		instr->flags |= IR3_INSTR_SS;
+	if (sy)
+		instr->flags |= IR3_INSTR_SY;
+
+	if (ss) {
+		memset(ctx->needs_ss, 0, sizeof(ctx->needs_ss));
+		memset(ctx->needs_ss_war, 0, sizeof(ctx->needs_ss_war));
+	}
+	if (sy)
+		memset(ctx->needs_sy, 0, sizeof(ctx->needs_sy));
+
+	node->pos = ctx->shader->instrs_count;
+
+	ret = append(ctx, instr);
+	if (ret)
+		return ret;
+
+	switch (node->cls) {
+	case CLASS_ALU:
+		for (i = 0; i < node->ndsts; i++)
+			ctx->alu_cycle[node->dsts[i].reg] =
+					ctx->cycle + node->dsts[i].cycle;
+		if (node->rel_write)
+			for (r = 0; r < NUM_REGS; r++)
+				ctx->alu_cycle[r] = ctx->cycle + instr->repeat;
+		break;
+	case CLASS_SFU:
+		for (i = 0; i < node->ndsts; i++) {
+			regmask_set(ctx->needs_ss, node->dsts[i].reg);
+			ctx->alu_cycle[node->dsts[i].reg] = NO_CYCLE;
+		}
+		for (i = 0; i < node->nsrcs; i++)
+			regmask_set(ctx->needs_ss_war, node->srcs[i].reg);
+		break;
+	case CLASS_TEX:
+	case CLASS_MEM:
+		for (i = 0; i < node->ndsts; i++) {
+			regmask_set(ctx->needs_sy, node->dsts[i].reg);
+			ctx->alu_cycle[node->dsts[i].reg] = NO_CYCLE;
+		}
+		/* like sfu, the sources are read late, so overwriting them
+		 * needs (ss):
+		 */
+		for (i = 0; i < node->nsrcs; i++)
+			regmask_set(ctx->needs_ss_war, node->srcs[i].reg);
+		break;
+	case CLASS_FLOW:
+		break;
+	}
+
+	ctx->cycle += node->cycles;
+
+	if (node->branch >= 0)
+		save_state(ctx, &ctx->snap[node->branch]);
+
+	return 0;
+}
+
+static int legalize_all(struct sched_ctx *ctx)
+{
+	unsigned i;
+	int ret;
+
+	ctx->shader->instrs_count = 0;
+	ctx->cycle = 0;
+	ctx->nnops = 0;
+	ctx->jp = false;
+	memset(ctx->needs_ss, 0, sizeof(ctx->needs_ss));
+	memset(ctx->needs_ss_war, 0, sizeof(ctx->needs_ss_war));
+	memset(ctx->needs_sy, 0, sizeof(ctx->needs_sy));
+	for (i = 0; i < NUM_REGS; i++)
+		ctx->alu_cycle[i] = NO_CYCLE;
+
+	for (i = 0; i < ctx->nnodes; i++) {
+		ret = legalize(ctx, ctx->order[i]);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+/* accumulate the worst case state that could be live at a branch
+ * target:
+ */
+static void worst_case(struct sched_ctx *ctx, struct sched_node *node)
+{
+	regmask_t *dst;
+	unsigned i;
+
+	switch (node->cls) {
+	case CLASS_ALU: dst = &ctx->all_alu; break;
+	case CLASS_SFU: dst = &ctx->all_ss;  break;
+	case CLASS_TEX:
+	case CLASS_MEM: dst = &ctx->all_sy;  break;
+	default:        return;
+	}
+
+	if (node->rel_write)
+		memset(*dst, 0xff, sizeof(*dst));
+
+	for (i = 0; i < node->ndsts; i++)
+		regmask_set(*dst, node->dsts[i].reg);
+
+	/* sfu/tex/mem all read their sources late: */
+	for (i = 0; i < node->nsrcs; i++)
+		regmask_set(ctx->all_ss_war, node->srcs[i].reg);
+}
+
+#define MAX_PASSES 8
+
+int ir3_shader_schedule(struct ir3_shader *shader)
+{
+	struct sched_ctx *ctx;
+	struct ir3_instruction **instrs;
+	struct reader *pool;
+	unsigned n = shader->instrs_count;
+	unsigned i, j, s, pass;
+	int *nodeidx;
+	bool *leader, backward = false;
+	int ret = 0;
+
+	ctx     = calloc(1, sizeof(*ctx));
+	instrs  = malloc(n * sizeof(instrs[0]) + 1);
+	pool    = malloc(n * MAX_ACCESS * sizeof(pool[0]) + 1);
+	nodeidx = calloc(n + 1, sizeof(nodeidx[0]));
+	leader  = calloc(n + 1, sizeof(leader[0]));
+	if (!ctx || !instrs || !pool || !nodeidx || !leader) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	ctx->nodes = calloc(n + 1, sizeof(ctx->nodes[0]));
+	ctx->order = calloc(n + 1, sizeof(ctx->order[0]));
+	ctx->snap  = calloc(n + 1, sizeof(ctx->snap[0]));
+	ctx->prev_snap = calloc(n + 1, sizeof(ctx->prev_snap[0]));
+	if (!ctx->nodes || !ctx->order || !ctx->snap || !ctx->prev_snap) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	ctx->shader = shader;
+	memcpy(instrs, shader->instrs, n * sizeof(instrs[0]));
+
+	/* find branch targets: */
+	for (i = 0; i < n; i++) {
+		struct ir3_instruction *instr = instrs[i];
+		if (instr->flags & IR3_INSTR_JP)
+			leader[i] = true;
+		if (is_branch(instr)) {
+			int target = i + instr->cat0.immed;
+			if ((target >= 0) && (target < (int)n))
+				leader[target] = true;
+		}
+	}
+
+	/* drop existing nops, other than those that are branch targets,
+	 * since delay slots get recalculated:
+	 */
+	for (i = 0; i < n; i++) {
+		struct ir3_instruction *instr = instrs[i];
+		struct sched_node *node = &ctx->nodes[ctx->nnodes];
+
+		nodeidx[i] = ctx->nnodes;
+
+		if ((instr->category == 0) && (instr->opc == OPC_NOP) && !leader[i])
+			continue;
+
+		gather(node, instr);
+		node->leader = leader[i];
+		node->jp     = !!(instr->flags & IR3_INSTR_JP);
+		node->pinned |= node->leader;
+		node->target = node->branch = -1;
+		if (is_branch(instr)) {
+			int target = i + instr->cat0.immed;
+			if ((target >= 0) && (target < (int)n))
+				node->target = target;
+		}
+		worst_case(ctx, node);
+		ctx->nnodes++;
+	}
+	nodeidx[n] = ctx->nnodes;
+
+	/* link up branches to their targets.  A target not reached by
+	 * any branch we know about (ie. the return from a call) has to
+	 * assume the worst:
+	 */
+	for (i = 0; i < ctx->nnodes; i++) {
+		struct sched_node *node = &ctx->nodes[i];
+		node->unknown_preds = node->leader;
+	}
+
+	for (i = 0; i < ctx->nnodes; i++) {
+		struct sched_node *node = &ctx->nodes[i];
+		struct ir3_instruction *instr = node->instr;
+
+		if ((instr->category == 0) && (instr->opc == OPC_CALL) &&
+				((i + 1) < ctx->nnodes)) {
+			ctx->nodes[i + 1].leader = true;
+			ctx->nodes[i + 1].pinned = true;
+			ctx->nodes[i + 1].unknown_preds = true;
+		}
+
+		if (node->target < 0)
+			continue;
+
+		node->target = nodeidx[node->target];
+		node->branch = ctx->nbranches++;
+		ctx->nodes[node->target].unknown_preds = false;
+		backward |= (node->target <= (int)i);
+	}
+
+	/* schedule each run of un-pinned nodes: */
+	for (s = 0; s < ctx->nnodes; s += j) {
+		struct sched_node *node = &ctx->nodes[s];
+
+		if (node->pinned) {
+			ctx->order[s] = node;
+			j = 1;
+		} else {
+			for (j = 0; (s + j) < ctx->nnodes; j++)
+				if (ctx->nodes[s + j].pinned)
+					break;
+			schedule_region(ctx, node, j, pool, &ctx->order[s]);
+		}
+	}
+
+	/* and then legalize, repeating until the state at backward
+	 * branches settles.  The first pass assumes the worst at their
+	 * targets, so it is always correct to fall back to:
+	 */
+	for (pass = 0; ; pass++) {
+		ret = legalize_all(ctx);
+		if (ret)
+			goto out;
+
+		if (!backward)
+			break;
+
+		if (ctx->prev_valid && !memcmp(ctx->snap, ctx->prev_snap,
+				ctx->nbranches * sizeof(ctx->snap[0])))
+			break;
+
+		if (pass == MAX_PASSES) {
+			ctx->prev_valid = false;
+			ret = legalize_all(ctx);
+			if (ret)
+				goto out;
+			break;
+		}
+
+		memcpy(ctx->prev_snap, ctx->snap,
+				ctx->nbranches * sizeof(ctx->snap[0]));
+		ctx->prev_valid = true;
+	}
+
+	/* fix up branch offsets.  A dropped nop maps to the instruction
+	 * following it:
+	 */
+	ctx->nodes[ctx->nnodes].start = shader->instrs_count;
+	for (i = 0; i < ctx->nnodes; i++) {
+		struct sched_node *node = &ctx->nodes[i];
+		if (node->target >= 0)
+			node->instr->cat0.immed =
+					ctx->nodes[node->target].start - node->pos;
+	}
+
+out:
+	if (ctx) {
+		free(ctx->prev_snap);
+		free(ctx->snap);
+		free(ctx->order);
+		free(ctx->nodes);
+		free(ctx->edges);
+		free(ctx->succs);
+		free(ctx->nops);
+	}
+	free(ctx);
+	free(leader);
+	free(nodeidx);
+	free(pool);
+	free(instrs);
+
+	return ret;
+}
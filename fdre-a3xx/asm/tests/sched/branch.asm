@@ -0,0 +1,15 @@
+; nops are dropped or inserted around branches, so the offsets need
+; to be fixed up, and the loop target keeps its position
+mov.f32f32 r0.x, c0.x
+(rpt5)nop
+(jp)add.f r0.x, r0.x, c0.y
+cmps.f.lt p0.x, r0.x, c0.z
+br p0.x, #-2
+(rpt2)nop
+(rpt2)nop
+cmps.f.gt p0.x, r0.x, c1.x
+br !p0.x, #3
+(rpt2)nop
+mov.f32f32 r0.y, c1.y
+(jp)mov.f32f32 r0.z, r0.x
+end
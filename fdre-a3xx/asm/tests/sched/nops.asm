@@ -0,0 +1,8 @@
+; dependent alu chain, with an independent op that can fill a delay slot
+mov.f32f32 r0.x, c0.x
+add.f r0.y, r0.x, c0.y
+mul.f r0.z, r0.y, r0.y
+mov.f32f32 r1.x, c1.x
+mov.f32f32 r1.y, c1.y
+add.f r0.w, r0.z, r1.x
+end
@@ -0,0 +1,11 @@
+; sfu and tex results need (ss)/(sy) before they are used, and
+; hand-placed flags and nops are replaced
+(sy)(ss)rcp r1.x, c0.x
+(rpt5)nop
+isam (f32)(xyzw)r2.x, r0.x, s#0, t#0
+(ss)mov.f32f32 r3.x, r1.x
+(sy)mov.f32f32 r3.y, r2.x
+rsq r0.x, r3.x
+isam (f32)(xyzw)r4.x, r0.x, s#0, t#0
+add.f r3.z, r4.x, r3.y
+end
@@ -0,0 +1,9 @@
+; tex sources are read late, so overwriting the coordinate right
+; after the sample needs (ss)
+mov.f32f32 r0.x, c0.x
+mov.f32f32 r0.y, c0.y
+isam (f32)(xyzw)r2.x, r0.x, s#0, t#0
+mov.f32f32 r0.x, c1.x
+add.f r1.x, r0.x, c1.y
+mov.f32f32 r1.y, r2.x
+end
@@ -0,0 +1,699 @@
+/*
+ * Copyright (c) 2012 Rob Clark <robdclark@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* Null device backend: implements the subset of the libdrm_freedreno API
+ * that fdre uses, without any GPU.  Buffers live in host memory and get
+ * fake gpu addresses, and submits are written straight to .rd file (in
+ * the same format as libwrap), so the cmdstream can be looked at with
+ * cffdump.  It also keeps some statistics about the emitted cmdstream
+ * and the cost of each fd_* call, which are dumped when the device is
+ * destroyed.
+ *
+ * Environment variables:
+ *   FD_NULL_RD        - if set to 0, don't write .rd files
+ *   FD_NULL_GPU_ID    - emulated gpu id (default 320)
+ *   FD_NULL_GMEM_SIZE - emulated gmem size (default 512KB)
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <fcntl.h>
+#include <stdarg.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <freedreno_drmif.h>
+#include <freedreno_ringbuffer.h>
+
+#include "util.h"
+#include "redump.h"
+
+struct fd_device {
+	int fd;
+	int refcnt;
+};
+
+struct fd_pipe {
+	struct fd_device *dev;
+	enum fd_pipe_id id;
+	uint32_t timestamp;
+};
+
+struct fd_bo {
+	struct fd_device *dev;
+	void *map;
+	uint32_t size;
+	uint32_t gpuaddr;
+	int refcnt;
+	/* list of live bo's, which get dumped at each submit: */
+	struct fd_bo *prev, *next;
+	/* index in the reloc'd bo table of the last ring it was reloc'd in: */
+	uint32_t idx;
+};
+
+struct fd_ringmarker {
+	struct fd_ringbuffer *ring;
+	uint32_t *cur;
+};
+
+/* the ringbuffer is backed by a bo, so it's contents end up in the .rd.
+ * Like msm, the ring holds a reference to each bo it has a reloc to, so
+ * bo's deleted mid-batch are still around (and dumped) at flush:
+ */
+struct fd_null_ringbuffer {
+	struct fd_ringbuffer base;
+	struct fd_bo *bo;
+	struct fd_bo **bos;
+	uint32_t nr_bos, max_bos;
+};
+
+static inline struct fd_null_ringbuffer * to_null_ringbuffer(
+		struct fd_ringbuffer *ring)
+{
+	return (struct fd_null_ringbuffer *)ring;
+}
+
+/* ************************************************************************* */
+/* statistics: */
+
+enum fd_null_call {
+	CALL_BO_NEW,
+	CALL_BO_DEL,
+	CALL_BO_MAP,
+	CALL_BO_CPU_PREP,
+	CALL_RINGBUFFER_FLUSH,
+	CALL_RINGBUFFER_RESET,
+	CALL_RINGBUFFER_RELOC,
+	CALL_RINGBUFFER_EMIT_RELOC_RING,
+	CALL_RINGMARKER_MARK,
+	CALL_RINGMARKER_FLUSH,
+	CALL_PIPE_WAIT,
+	CALL_MAX,
+};
+
+static const char *call_names[CALL_MAX] = {
+		[CALL_BO_NEW]                     = "fd_bo_new",
+		[CALL_BO_DEL]                     = "fd_bo_del",
+		[CALL_BO_MAP]                     = "fd_bo_map",
+		[CALL_BO_CPU_PREP]                = "fd_bo_cpu_prep",
+		[CALL_RINGBUFFER_FLUSH]           = "fd_ringbuffer_flush",
+		[CALL_RINGBUFFER_RESET]           = "fd_ringbuffer_reset",
+		[CALL_RINGBUFFER_RELOC]           = "fd_ringbuffer_reloc",
+		[CALL_RINGBUFFER_EMIT_RELOC_RING] = "fd_ringbuffer_emit_reloc_ring",
+		[CALL_RINGMARKER_MARK]            = "fd_ringmarker_mark",
+		[CALL_RINGMARKER_FLUSH]           = "fd_ringmarker_flush",
+		[CALL_PIPE_WAIT]                  = "fd_pipe_wait",
+};
+
+static struct {
+	uint64_t start_ns;
+	uint32_t submits;
+	uint64_t dwords;
+	uint32_t draws;
+	uint32_t allocs;
+	uint64_t alloc_bytes;
+	struct {
+		uint32_t count;
+		uint64_t ns;
+	} calls[CALL_MAX];
+} stats;
+
+static uint64_t gettime_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000000) + ts.tv_nsec;
+}
+
+#define CALL_BEGIN() \
+	uint64_t call_start_ns = gettime_ns()
+#define CALL_END(call) do { \
+		__sync_add_and_fetch(&stats.calls[call].count, 1); \
+		__sync_add_and_fetch(&stats.calls[call].ns, \
+				gettime_ns() - call_start_ns); \
+	} while (0)
+
+static const char *test_name = "unknown";
+
+static void dump_stats(void)
+{
+	uint64_t elapsed_ns = gettime_ns() - stats.start_ns;
+	uint32_t draws = max(stats.draws, 1);
+	int i;
+
+	printf("null: %s: %u draws, %u submits in %.3f ms: "
+			"%.1f draws/s, %.1f dwords/draw, %.2f allocations/draw\n",
+			test_name, stats.draws, stats.submits,
+			(double)elapsed_ns / 1000000.0,
+			(double)stats.draws * 1000000000.0 / (double)max(elapsed_ns, 1),
+			(double)stats.dwords / draws,
+			(double)stats.allocs / draws);
+	printf("null: %s: %u allocations, %llu bytes\n", test_name,
+			stats.allocs, (unsigned long long)stats.alloc_bytes);
+
+	for (i = 0; i < CALL_MAX; i++) {
+		if (!stats.calls[i].count)
+			continue;
+		printf("null: %s:   %-32s %8u calls %8.1f ns/call\n",
+				test_name, call_names[i], stats.calls[i].count,
+				(double)stats.calls[i].ns / stats.calls[i].count);
+	}
+}
+
+/* count the draws in a range of submitted cmdstream: */
+static void count_draws(uint32_t *dwords, uint32_t sizedwords)
+{
+	uint32_t *end = dwords + sizedwords;
+
+	while (dwords < end) {
+		uint32_t hdr = *dwords;
+		uint32_t cnt = ((hdr >> 16) & 0x3fff) + 1;
+
+		switch (hdr & 0xc0000000) {
+		case CP_TYPE0_PKT:
+			dwords += cnt + 1;
+			break;
+		case CP_TYPE1_PKT:
+			dwords += 3;
+			break;
+		case CP_TYPE2_PKT:
+			dwords += 1;
+			break;
+		case CP_TYPE3_PKT:
+			switch ((hdr >> 8) & 0xff) {
+			case CP_DRAW_INDX:
+			case CP_DRAW_INDX_2:
+			case CP_DRAW_INDX_BIN:
+			case CP_DRAW_INDX_2_BIN:
+				stats.draws++;
+				break;
+			}
+			dwords += cnt + 1;
+			break;
+		}
+	}
+}
+
+/* ************************************************************************* */
+/* .rd output: */
+
+static int rd_fd = -1;
+
+static uint32_t get_gpu_id(void)
+{
+	static uint32_t gpu_id;
+	if (!gpu_id) {
+		const char *str = getenv("FD_NULL_GPU_ID");
+		gpu_id = str ? strtol(str, NULL, 0) : 320;
+	}
+	return gpu_id;
+}
+
+static bool rd_enabled(void)
+{
+	static int val = -1;
+	if (val == -1) {
+		const char *str = getenv("FD_NULL_RD");
+		val = str ? strtol(str, NULL, 0) : 1;
+	}
+	return val;
+}
+
+static void rd_write(const void *buf, int sz)
+{
+	const uint8_t *cbuf = buf;
+	while (sz > 0) {
+		int ret = write(rd_fd, cbuf, sz);
+		if (ret < 0) {
+			ERROR_MSG("error writing rd: %d (%s)", ret, strerror(errno));
+			exit(-1);
+		}
+		cbuf += ret;
+		sz -= ret;
+	}
+}
+
+/* these override the weak symbols from redump.h, so tests that call
+ * RD_START() get an .rd file just like they would w/ libwrap:
+ */
+void rd_start(const char *name, const char *fmt, ...)
+{
+	char buf[256];
+	uint32_t gpu_id;
+	va_list args;
+
+	test_name = strdup(name);
+
+	if (!rd_enabled())
+		return;
+
+	snprintf(buf, sizeof(buf), "%s.rd", name);
+
+	rd_fd = open(buf, O_WRONLY | O_TRUNC | O_CREAT, 0644);
+	if (rd_fd < 0) {
+		ERROR_MSG("could not open %s: %s", buf, strerror(errno));
+		return;
+	}
+
+	va_start(args, fmt);
+	vsnprintf(buf, sizeof(buf), fmt, args);
+	va_end(args);
+
+	rd_write_section(RD_TEST, buf, strlen(buf));
+	gpu_id = get_gpu_id();
+	rd_write_section(RD_GPU_ID, &gpu_id, sizeof(gpu_id));
+}
+
+void rd_end(void)
+{
+	if (rd_fd >= 0)
+		close(rd_fd);
+	rd_fd = -1;
+}
+
+void rd_write_section(enum rd_sect_type type, const void *buf, int sz)
+{
+	uint32_t val = ~0;
+
+	if (rd_fd < 0)
+		return;
+
+	rd_write(&val, 4);
+	rd_write(&val, 4);
+
+	rd_write(&type, 4);
+	val = ALIGN(sz, 4);
+	rd_write(&val, 4);
+	rd_write(buf, sz);
+
+	val = 0;
+	rd_write(&val, ALIGN(sz, 4) - sz);
+}
+
+/* ************************************************************************* */
+/* device/pipe: */
+
+/* bo's can be allocated/freed from threads recording cmdbuf's, so
+ * the bo list (and gpuaddr allocator) is protected by bo_lock:
+ */
+static pthread_mutex_t bo_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct fd_bo *bo_list;
+
+int drmOpen(const char *name, const char *busid)
+{
+	/* no real device, but give the caller something to close(): */
+	return open("/dev/null", O_RDWR);
+}
+
+struct fd_device * fd_device_new(int fd)
+{
+	struct fd_device *dev = calloc(1, sizeof(*dev));
+
+	dev->fd = fd;
+	dev->refcnt = 1;
+
+	stats.start_ns = gettime_ns();
+
+	return dev;
+}
+
+struct fd_device * fd_device_ref(struct fd_device *dev)
+{
+	dev->refcnt++;
+	return dev;
+}
+
+void fd_device_del(struct fd_device *dev)
+{
+	if (--dev->refcnt > 0)
+		return;
+	dump_stats();
+	rd_end();
+	if (dev->fd >= 0)
+		close(dev->fd);
+	free(dev);
+}
+
+struct fd_pipe * fd_pipe_new(struct fd_device *dev, enum fd_pipe_id id)
+{
+	struct fd_pipe *pipe = calloc(1, sizeof(*pipe));
+	pipe->dev = dev;
+	pipe->id = id;
+	return pipe;
+}
+
+void fd_pipe_del(struct fd_pipe *pipe)
+{
+	free(pipe);
+}
+
+int fd_pipe_get_param(struct fd_pipe *pipe, enum fd_param_id param,
+		uint64_t *value)
+{
+	const char *str;
+
+	switch (param) {
+	case FD_DEVICE_ID:
+		*value = get_gpu_id();
+		return 0;
+	case FD_GMEM_SIZE:
+		str = getenv("FD_NULL_GMEM_SIZE");
+		*value = str ? strtol(str, NULL, 0) : 0x80000;
+		return 0;
+	default:
+		ERROR_MSG("invalid param id: %d", param);
+		return -1;
+	}
+}
+
+int fd_pipe_wait(struct fd_pipe *pipe, uint32_t timestamp)
+{
+	CALL_BEGIN();
+	/* everything is already "done": */
+	CALL_END(CALL_PIPE_WAIT);
+	return 0;
+}
+
+/* ************************************************************************* */
+/* buffer objects: */
+
+/* fake gpu address space.  Addresses are not reused, and just wrap
+ * around (which only matters for decoding very long .rd files):
+ */
+static uint32_t alloc_gpuaddr(uint32_t size)
+{
+	static uint32_t gpuaddr = 0x10000000;
+	uint32_t addr;
+
+	if ((gpuaddr + size) >= 0xf0000000)
+		gpuaddr = 0x10000000;
+
+	addr = gpuaddr;
+	gpuaddr += ALIGN(size, 0x1000);
+
+	return addr;
+}
+
+struct fd_bo * fd_bo_new(struct fd_device *dev, uint32_t size, uint32_t flags)
+{
+	struct fd_bo *bo;
+	CALL_BEGIN();
+
+	bo = calloc(1, sizeof(*bo));
+	bo->dev = dev;
+	bo->size = size;
+	bo->map = calloc(1, ALIGN(size, 4));
+	bo->refcnt = 1;
+
+	pthread_mutex_lock(&bo_lock);
+	bo->gpuaddr = alloc_gpuaddr(size);
+	bo->next = bo_list;
+	if (bo_list)
+		bo_list->prev = bo;
+	bo_list = bo;
+	pthread_mutex_unlock(&bo_lock);
+
+	__sync_add_and_fetch(&stats.allocs, 1);
+	__sync_add_and_fetch(&stats.alloc_bytes, size);
+
+	CALL_END(CALL_BO_NEW);
+
+	return bo;
+}
+
+/* there is no real fbdev, use FD_FBDEV_MEM for an in-memory one: */
+struct fd_bo * fd_bo_from_fbdev(struct fd_pipe *pipe, int fbfd, uint32_t size)
+{
+	return NULL;
+}
+
+struct fd_bo * fd_bo_ref(struct fd_bo *bo)
+{
+	__sync_add_and_fetch(&bo->refcnt, 1);
+	return bo;
+}
+
+static void bo_unref(struct fd_bo *bo)
+{
+	if (__sync_sub_and_fetch(&bo->refcnt, 1) > 0)
+		return;
+
+	pthread_mutex_lock(&bo_lock);
+	if (bo->prev)
+		bo->prev->next = bo->next;
+	else
+		bo_list = bo->next;
+	if (bo->next)
+		bo->next->prev = bo->prev;
+	pthread_mutex_unlock(&bo_lock);
+
+	free(bo->map);
+	free(bo);
+}
+
+void fd_bo_del(struct fd_bo *bo)
+{
+	CALL_BEGIN();
+	bo_unref(bo);
+	CALL_END(CALL_BO_DEL);
+}
+
+uint32_t fd_bo_handle(struct fd_bo *bo)
+{
+	return bo->gpuaddr;
+}
+
+uint32_t fd_bo_size(struct fd_bo *bo)
+{
+	return bo->size;
+}
+
+void * fd_bo_map(struct fd_bo *bo)
+{
+	CALL_BEGIN();
+	CALL_END(CALL_BO_MAP);
+	return bo->map;
+}
+
+int fd_bo_cpu_prep(struct fd_bo *bo, struct fd_pipe *pipe, uint32_t op)
+{
+	CALL_BEGIN();
+	CALL_END(CALL_BO_CPU_PREP);
+	return 0;
+}
+
+void fd_bo_cpu_fini(struct fd_bo *bo)
+{
+}
+
+/* ************************************************************************* */
+/* ringbuffer: */
+
+struct fd_ringbuffer * fd_ringbuffer_new(struct fd_pipe *pipe,
+		uint32_t size)
+{
+	struct fd_null_ringbuffer *null_ring = calloc(1, sizeof(*null_ring));
+	struct fd_ringbuffer *ring = &null_ring->base;
+
+	null_ring->bo = fd_bo_new(pipe->dev, size, DRM_FREEDRENO_GEM_TYPE_KMEM);
+
+	ring->size = size;
+	ring->pipe = pipe;
+	ring->start = null_ring->bo->map;
+	ring->end = &(ring->start[size/4]);
+	ring->cur = ring->last_start = ring->start;
+
+	return ring;
+}
+
+static void ring_ref_bo(struct fd_ringbuffer *ring, struct fd_bo *bo)
+{
+	struct fd_null_ringbuffer *null_ring = to_null_ringbuffer(ring);
+
+	if ((bo->idx < null_ring->nr_bos) && (null_ring->bos[bo->idx] == bo))
+		return;
+
+	if (null_ring->nr_bos == null_ring->max_bos) {
+		null_ring->max_bos = max(2 * null_ring->max_bos, 64);
+		null_ring->bos = realloc(null_ring->bos,
+				null_ring->max_bos * sizeof(null_ring->bos[0]));
+	}
+
+	bo->idx = null_ring->nr_bos;
+	null_ring->bos[null_ring->nr_bos++] = bo;
+	__sync_add_and_fetch(&bo->refcnt, 1);
+}
+
+static void ring_unref_bos(struct fd_ringbuffer *ring)
+{
+	struct fd_null_ringbuffer *null_ring = to_null_ringbuffer(ring);
+	uint32_t i;
+
+	for (i = 0; i < null_ring->nr_bos; i++)
+		bo_unref(null_ring->bos[i]);
+	null_ring->nr_bos = 0;
+}
+
+void fd_ringbuffer_del(struct fd_ringbuffer *ring)
+{
+	struct fd_null_ringbuffer *null_ring = to_null_ringbuffer(ring);
+	ring_unref_bos(ring);
+	free(null_ring->bos);
+	fd_bo_del(null_ring->bo);
+	free(null_ring);
+}
+
+void fd_ringbuffer_set_parent(struct fd_ringbuffer *ring,
+		struct fd_ringbuffer *parent)
+{
+	ring->parent = parent;
+}
+
+void fd_ringbuffer_reset(struct fd_ringbuffer *ring)
+{
+	CALL_BEGIN();
+	ring_unref_bos(ring);
+	ring->cur = ring->last_start = ring->start;
+	CALL_END(CALL_RINGBUFFER_RESET);
+}
+
+static uint32_t ring_gpuaddr(struct fd_ringbuffer *ring, uint32_t *ptr)
+{
+	struct fd_null_ringbuffer *null_ring = to_null_ringbuffer(ring);
+	return null_ring->bo->gpuaddr + ((ptr - ring->start) * 4);
+}
+
+static void submit(struct fd_ringbuffer *ring, uint32_t *last_start,
+		uint32_t *end)
+{
+	uint32_t sizedwords = end - last_start;
+	struct fd_bo *bo;
+
+	if (!sizedwords)
+		return;
+
+	stats.submits++;
+	stats.dwords += sizedwords;
+	count_draws(last_start, sizedwords);
+
+	ring->last_timestamp = ++ring->pipe->timestamp;
+
+	if (rd_fd < 0)
+		return;
+
+	/* like libwrap, dump all buffers w/ each submit: */
+	pthread_mutex_lock(&bo_lock);
+	for (bo = bo_list; bo; bo = bo->next) {
+		uint32_t sect[2] = { bo->gpuaddr, bo->size };
+		rd_write_section(RD_GPUADDR, sect, sizeof(sect));
+		rd_write_section(RD_BUFFER_CONTENTS, bo->map, bo->size);
+	}
+	pthread_mutex_unlock(&bo_lock);
+
+	{
+		uint32_t sect[2] = { ring_gpuaddr(ring, last_start), sizedwords };
+		rd_write_section(RD_CMDSTREAM_ADDR, sect, sizeof(sect));
+	}
+}
+
+int fd_ringbuffer_flush(struct fd_ringbuffer *ring)
+{
+	CALL_BEGIN();
+	submit(ring, ring->last_start, ring->cur);
+	ring->last_start = ring->cur;
+	ring_unref_bos(ring);
+	CALL_END(CALL_RINGBUFFER_FLUSH);
+	return 0;
+}
+
+uint32_t fd_ringbuffer_timestamp(struct fd_ringbuffer *ring)
+{
+	return ring->last_timestamp;
+}
+
+static void emit_reloc(struct fd_ringbuffer *ring, uint32_t addr,
+		uint32_t or, int32_t shift)
+{
+	if (shift < 0)
+		addr >>= -shift;
+	else
+		addr <<= shift;
+	(*ring->cur++) = addr | or;
+}
+
+void fd_ringbuffer_reloc(struct fd_ringbuffer *ring,
+		const struct fd_reloc *reloc)
+{
+	CALL_BEGIN();
+	ring_ref_bo(ring, reloc->bo);
+	emit_reloc(ring, reloc->bo->gpuaddr + reloc->offset,
+			reloc->or, reloc->shift);
+	CALL_END(CALL_RINGBUFFER_RELOC);
+}
+
+void fd_ringbuffer_emit_reloc_ring(struct fd_ringbuffer *ring,
+		struct fd_ringmarker *target, struct fd_ringmarker *end)
+{
+	CALL_BEGIN();
+	emit_reloc(ring, ring_gpuaddr(target->ring, target->cur), 0, 0);
+	CALL_END(CALL_RINGBUFFER_EMIT_RELOC_RING);
+}
+
+struct fd_ringmarker * fd_ringmarker_new(struct fd_ringbuffer *ring)
+{
+	struct fd_ringmarker *marker = calloc(1, sizeof(*marker));
+	marker->ring = ring;
+	fd_ringmarker_mark(marker);
+	return marker;
+}
+
+void fd_ringmarker_del(struct fd_ringmarker *marker)
+{
+	free(marker);
+}
+
+void fd_ringmarker_mark(struct fd_ringmarker *marker)
+{
+	CALL_BEGIN();
+	marker->cur = marker->ring->cur;
+	CALL_END(CALL_RINGMARKER_MARK);
+}
+
+uint32_t fd_ringmarker_dwords(struct fd_ringmarker *start,
+		struct fd_ringmarker *end)
+{
+	return end->cur - start->cur;
+}
+
+int fd_ringmarker_flush(struct fd_ringmarker *marker)
+{
+	struct fd_ringbuffer *ring = marker->ring;
+	CALL_BEGIN();
+	/* the refs are kept, since the rest of the ring isn't submitted yet: */
+	submit(ring, ring->last_start, marker->cur);
+	ring->last_start = marker->cur;
+	CALL_END(CALL_RINGMARKER_FLUSH);
+	return 0;
+}
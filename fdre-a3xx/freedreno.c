@@ -25,10 +25,15 @@
 #include "config.h"
 #endif
 
+#include <stddef.h>
+
 #include "util.h"
 #include "msm_kgsl.h"
 #include "freedreno.h"
 #include "program.h"
+#include "perfcntr.h"
+#include "mipmap.h"
+#include "tile.h"
 #include "ring.h"
 #include "ir-a3xx.h"
 #include "ws.h"
@@ -39,11 +44,14 @@ emit_marker(struct fd_ringbuffer *ring, int scratch_idx)
 {
 	static unsigned marker_cnt = 0;
 	OUT_PKT0(ring, REG_AXXX_CP_SCRATCH_REG0 + scratch_idx, 1);
-	OUT_RING(ring, ++marker_cnt);
+	OUT_RING(ring, __sync_add_and_fetch(&marker_cnt, 1));
 }
 
 struct fd_state {
 
+	/* for the state of a cmdbuf, the state it was copied from: */
+	struct fd_state *parent;
+
 	struct fd_winsys *ws;
 	struct fd_device *dev;
 	struct fd_pipe *pipe;
@@ -72,6 +80,9 @@ struct fd_state {
 	/* shader program: */
 	struct fd_program *program;
 
+	/* constant upload stream/cache, shared by all programs: */
+	struct fd_constbuf *constbuf;
+
 	/* uniform related params: */
 	struct fd_parameters uniforms, solid_uniforms;
 
@@ -82,6 +93,12 @@ struct fd_state {
 	struct {
 		enum a3xx_tex_filter min_filter, mag_filter;
 		enum a3xx_tex_clamp clamp_s, clamp_t;
+		/* filtering between mip levels, from the MIN_FILTER: */
+		enum {
+			MIP_NONE,
+			MIP_NEAREST,
+			MIP_LINEAR,
+		} mip_filter;
 
 		struct fd_parameters params;
 	} textures;
@@ -92,19 +109,63 @@ struct fd_state {
 	struct {
 		/* render target: */
 		struct fd_surface *surface;
-		/* for now just keep things simple and split the
-		 * render target into horizontal strips:
-		 */
+		/* uniform grid of bins, picked by calculate_bins(): */
 		uint16_t bin_h, nbins_y;
 		uint16_t bin_w, nbins_x;
+		/* GMEM offset (in bytes) of the depth/stencil buffer: */
+		uint32_t zsbuf_base;
+
+		/* per-bin damage tracking, so bins that nothing has touched
+		 * since the last clear can skip both the IB replay and the
+		 * gmem2mem resolve at flush time:
+		 */
+		struct fd_bin {
+			/* drawn to since the last full clear (or since the last
+			 * flush, if there was no clear):
+			 */
+			bool damaged;
+			/* if non-zero, the surface contents under this bin are
+			 * known to be the result of the clear w/ this seqno:
+			 */
+			uint32_t clear_seqno;
+			/* resolved to the surface since it was last posted: */
+			bool unposted;
+		} *bins;
+
+		/* bin state of the other surfaces of the winsys swapchain, so
+		 * it survives flipping between them:
+		 */
+		struct {
+			struct fd_surface *surface;
+			struct fd_bin *bins;
+		} swapchain[4];
+
+		/* scratch space for the damage rects passed to the winsys: */
+		struct fd_rect *damage;
+
+		/* seqno of the last full clear in the current batch, or zero
+		 * if there was no clear since the last flush:
+		 */
+		uint32_t batch_clear_seqno;
 	} render_target;
 
+	/* the last surface the winsys handed us for the screen: */
+	struct fd_surface *screen;
+
 	struct {
 		float color[4];
 		uint32_t stencil;
 		float depth;
+		/* incremented whenever the clear color changes: */
+		uint32_t seqno;
 	} clear;
 
+	struct {
+		bool enabled;
+		/* in window coordinates, inclusive: */
+		uint32_t x1, y1, x2, y2;
+	} scissor;
+
 	/* have there been any render cmds since last flush? */
 	bool dirty;
 
@@ -123,6 +184,37 @@ struct fd_state {
 		uint32_t offset;
 	} query;
 
+	/* compute batch being recorded, between fd_compute_begin() and
+	 * fd_compute_end():
+	 */
+	struct {
+		bool active;
+		struct fd_program *program;
+		uint32_t ndispatch;
+	} compute;
+
+	/* profiling related state: */
+	struct {
+		struct fd_perfcntrs *ctrs;
+		/* ring of query slots, results are read back in order: */
+		struct fd_profile_slot {
+			struct fd_bo *bo;
+			enum {
+				PROFILE_FREE,
+				PROFILE_ACTIVE,
+				PROFILE_ENDED,
+			} state;
+			uint32_t ncounters, ndraws, ntiles, dropped;
+			/* seqno of the last flush w/ samples into this slot: */
+			uint32_t seqno;
+		} slots[4];
+		uint32_t head, tail;
+		/* slot which is active, or ended but not yet flushed: */
+		struct fd_profile_slot *cur;
+		/* seqno of the last flush: */
+		uint32_t seqno;
+	} profile;
+
 	uint32_t pc_prim_vtx_cntl;
 	uint32_t gras_su_mode_control;
 	struct {
@@ -216,6 +308,13 @@ struct fd_state * fd_init(void)
 	state = calloc(1, sizeof(*state));
 	assert(state);
 
+#ifdef NULL_DEVICE
+	/* fbdev w/ an in-memory framebuffer, to test the swapchain: */
+	if (getenv("FD_FBDEV_MEM"))
+		state->ws = fd_winsys_fbdev_open();
+	else
+		state->ws = fd_winsys_null_open();
+#else
 #ifdef HAVE_X11
 	state->ws = fd_winsys_dri2_open();
 	if (!state->ws)
@@ -223,6 +322,7 @@ struct fd_state * fd_init(void)
 #endif
 	if (!state->ws)
 		state->ws = fd_winsys_fbdev_open();
+#endif
 
 	if (state->ws) {
 		state->dev  = state->ws->dev;
@@ -261,6 +361,10 @@ struct fd_state * fd_init(void)
 
 	state->program = fd_program_new(state);
 
+	state->constbuf = fd_constbuf_new(state);
+
+	state->profile.ctrs = fd_perfcntrs_new();
+
 	state->solid_program = fd_program_new(state);
 
 	ret = fd_program_attach_asm(state->solid_program,
@@ -288,6 +392,13 @@ struct fd_state * fd_init(void)
 	p->count = 1;
 	p->data  = &state->clear.color[0];
 
+	ret = fd_program_link(state->solid_program, &state->solid_uniforms,
+			&state->solid_attributes, NULL, NULL);
+	if (ret) {
+		ERROR_MSG("failed to link solid program: %d", ret);
+		goto fail;
+	}
+
 	/* setup initial GL state: */
 	state->cull_mode = GL_BACK;
 
@@ -311,6 +422,7 @@ struct fd_state * fd_init(void)
 
 	state->clear.depth = 1;
 	state->clear.stencil = 0;
+	state->clear.seqno = 1;
 
 	for (i = 0; i < ARRAY_SIZE(state->rb_mrt); i++) {
 		state->rb_mrt[i].blendcontrol =
@@ -337,7 +449,29 @@ fail:
 
 void fd_fini(struct fd_state *state)
 {
-	fd_surface_del(state, state->render_target.surface);
+	uint32_t i;
+
+	assert(!state->parent);
+	/* the screen surfaces belong to the winsys: */
+	if (state->render_target.surface != state->screen)
+		fd_surface_del(state, state->render_target.surface);
+	for (i = 0; i < ARRAY_SIZE(state->render_target.swapchain); i++)
+		free(state->render_target.swapchain[i].bins);
+	free(state->render_target.bins);
+	free(state->render_target.damage);
+	free_params(&state->uniforms);
+	free_params(&state->solid_uniforms);
+	free_params(&state->attributes);
+	free_params(&state->solid_attributes);
+	free_params(&state->textures.params);
+	free_params(&state->bufs);
+	if (state->constbuf)
+		fd_constbuf_del(state->constbuf);
+	for (i = 0; i < ARRAY_SIZE(state->profile.slots); i++)
+		if (state->profile.slots[i].bo)
+			fd_bo_del(state->profile.slots[i].bo);
+	if (state->profile.ctrs)
+		fd_perfcntrs_del(state->profile.ctrs);
 	fd_ringbuffer_del(state->ring);
 	if (state->ws)
 		state->ws->destroy(state->ws);
@@ -358,8 +492,11 @@ int fd_fragment_shader_attach_asm(struct fd_state *state, const char *src)
 
 int fd_link(struct fd_state *state)
 {
-	/* nothing really to do yet */
-	return 0;
+	/* resolve the program's uniforms/attributes/etc to slots in our
+	 * parameter tables, this is a no-op if already linked:
+	 */
+	return fd_program_link(state->program, &state->uniforms,
+			&state->attributes, &state->bufs, &state->textures.params);
 }
 
 int fd_set_program(struct fd_state *state, struct fd_program *program)
@@ -379,10 +516,52 @@ struct fd_bo * fd_attribute_bo_new(struct fd_state *state,
 	return bo;
 }
 
-int fd_attribute_bo(struct fd_state *state, const char *name,
+/* Named params are resolved to slots in the state's parameter tables
+ * at link time.  The *_slot() functions return the slot for a name, so
+ * that params bound per-frame/per-draw can be written by index rather
+ * than looked up by name on every call.  Slots don't change for the
+ * life of the state, including in cmdbufs recorded from it.
+ */
+
+static int param_slot(struct fd_parameters *params, const char *name)
+{
+	struct fd_param *p = find_param(params, name);
+	if (!p)
+		return -1;
+	return p - params->params;
+}
+
+static struct fd_param * get_param(struct fd_parameters *params, int slot)
+{
+	if ((slot < 0) || (slot >= params->nparams))
+		return NULL;
+	return &params->params[slot];
+}
+
+int fd_attribute_slot(struct fd_state *state, const char *name)
+{
+	return param_slot(&state->attributes, name);
+}
+
+int fd_uniform_slot(struct fd_state *state, const char *name)
+{
+	return param_slot(&state->uniforms, name);
+}
+
+int fd_texture_slot(struct fd_state *state, const char *name)
+{
+	return param_slot(&state->textures.params, name);
+}
+
+int fd_buf_slot(struct fd_state *state, const char *name)
+{
+	return param_slot(&state->bufs, name);
+}
+
+int fd_attribute_bo_slot(struct fd_state *state, int slot,
 		enum a3xx_vtx_fmt fmt, struct fd_bo * bo)
 {
-	struct fd_param *p = find_param(&state->attributes, name);
+	struct fd_param *p = get_param(&state->attributes, slot);
 	if (!p)
 		return -1;
 	p->fmt  = fmt;
@@ -390,20 +569,20 @@ int fd_attribute_bo(struct fd_state *state, const char *name,
 	return 0;
 }
 
-int fd_attribute_pointer(struct fd_state *state, const char *name,
+int fd_attribute_pointer_slot(struct fd_state *state, int slot,
 		enum a3xx_vtx_fmt fmt, uint32_t count, const void *data)
 {
 	uint32_t size = fmt2size(fmt) * count;
 	struct fd_bo *bo = fd_bo_new(state->dev, size,
 			DRM_FREEDRENO_GEM_TYPE_KMEM);
 	memcpy(fd_bo_map(bo), data, size);
-	return fd_attribute_bo(state, name, fmt, bo);
+	return fd_attribute_bo_slot(state, slot, fmt, bo);
 }
 
-int fd_uniform_attach(struct fd_state *state, const char *name,
+int fd_uniform_attach_slot(struct fd_state *state, int slot,
 		uint32_t size, uint32_t count, const void *data)
 {
-	struct fd_param *p = find_param(&state->uniforms, name);
+	struct fd_param *p = get_param(&state->uniforms, slot);
 	if (!p)
 		return -1;
 	p->elem_size = 4;  /* for now just 32bit types */
@@ -414,25 +593,57 @@ int fd_uniform_attach(struct fd_state *state, const char *name,
 }
 
 /* use tex=NULL to clear */
-int fd_set_texture(struct fd_state *state, const char *name,
+int fd_set_texture_slot(struct fd_state *state, int slot,
 		struct fd_surface *tex)
 {
-	struct fd_param *p = find_param(&state->textures.params, name);
+	struct fd_param *p = get_param(&state->textures.params, slot);
 	if (!p)
 		return -1;
 	p->tex = tex;
 	return 0;
 }
 
-int fd_set_buf(struct fd_state *state, const char *name, struct fd_bo *bo)
+int fd_set_buf_slot(struct fd_state *state, int slot, struct fd_bo *bo)
 {
-	struct fd_param *p = find_param(&state->bufs, name);
+	struct fd_param *p = get_param(&state->bufs, slot);
 	if (!p)
 		return -1;
 	p->bo = bo;
 	return 0;
 }
 
+int fd_attribute_bo(struct fd_state *state, const char *name,
+		enum a3xx_vtx_fmt fmt, struct fd_bo * bo)
+{
+	return fd_attribute_bo_slot(state,
+			fd_attribute_slot(state, name), fmt, bo);
+}
+
+int fd_attribute_pointer(struct fd_state *state, const char *name,
+		enum a3xx_vtx_fmt fmt, uint32_t count, const void *data)
+{
+	return fd_attribute_pointer_slot(state,
+			fd_attribute_slot(state, name), fmt, count, data);
+}
+
+int fd_uniform_attach(struct fd_state *state, const char *name,
+		uint32_t size, uint32_t count, const void *data)
+{
+	return fd_uniform_attach_slot(state,
+			fd_uniform_slot(state, name), size, count, data);
+}
+
+int fd_set_texture(struct fd_state *state, const char *name,
+		struct fd_surface *tex)
+{
+	return fd_set_texture_slot(state, fd_texture_slot(state, name), tex);
+}
+
+int fd_set_buf(struct fd_state *state, const char *name, struct fd_bo *bo)
+{
+	return fd_set_buf_slot(state, fd_buf_slot(state, name), bo);
+}
+
 static void emit_draw_indx(struct fd_ringbuffer *ring, enum pc_di_primtype primtype,
 		enum pc_di_index_size index_size, uint32_t count,
 		struct fd_bo *indx_bo, uint32_t idx_offset, uint32_t idx_size)
@@ -476,13 +687,80 @@ static void emit_mrt(struct fd_state *state,
 	}
 }
 
+/* get the current scissor rect in window coordinates (inclusive), or
+ * the full render target if scissor test is disabled.  Returns false
+ * if the scissor rect is empty.
+ */
+static bool get_scissor(struct fd_state *state,
+		uint32_t *x1, uint32_t *y1, uint32_t *x2, uint32_t *y2)
+{
+	struct fd_surface *surface = state->render_target.surface;
+
+	*x1 = 0;
+	*y1 = 0;
+	*x2 = surface->width - 1;
+	*y2 = surface->height - 1;
+
+	if (state->scissor.enabled) {
+		*x1 = max(*x1, state->scissor.x1);
+		*y1 = max(*y1, state->scissor.y1);
+		*x2 = min(*x2, state->scissor.x2);
+		*y2 = min(*y2, state->scissor.y2);
+	}
+
+	return (*x1 <= *x2) && (*y1 <= *y2);
+}
+
+static void emit_scissor(struct fd_state *state, struct fd_ringbuffer *ring)
+{
+	uint32_t x1, y1, x2, y2;
+
+	if (!get_scissor(state, &x1, &y1, &x2, &y2)) {
+		/* TL > BR, so nothing passes: */
+		x1 = y1 = 1;
+		x2 = y2 = 0;
+	}
+
+	OUT_PKT0(ring, REG_A3XX_GRAS_SC_WINDOW_SCISSOR_TL, 2);
+	OUT_RING(ring, A3XX_GRAS_SC_WINDOW_SCISSOR_TL_X(x1) |
+			A3XX_GRAS_SC_WINDOW_SCISSOR_TL_Y(y1));
+	OUT_RING(ring, A3XX_GRAS_SC_WINDOW_SCISSOR_BR_X(x2) |
+			A3XX_GRAS_SC_WINDOW_SCISSOR_BR_Y(y2));
+}
+
+/* mark the bins covered by the current scissor as damaged: */
+static void mark_damage(struct fd_state *state)
+{
+	uint32_t bin_w = state->render_target.bin_w;
+	uint32_t bin_h = state->render_target.bin_h;
+	uint32_t nbins_x = state->render_target.nbins_x;
+	uint32_t x1, y1, x2, y2, i, j;
+
+	if (!get_scissor(state, &x1, &y1, &x2, &y2))
+		return;
+
+	for (i = y1 / bin_h; i <= y2 / bin_h; i++)
+		for (j = x1 / bin_w; j <= x2 / bin_w; j++)
+			state->render_target.bins[(i * nbins_x) + j].damaged = true;
+}
+
 /* emit cmdstream to blit from GMEM back to the surface */
 static void emit_gmem2mem(struct fd_state *state,
 		struct fd_ringbuffer *ring, struct fd_surface *surface,
 		uint32_t xoff, uint32_t yoff)
 {
 	fd_program_emit_state(state->solid_program, 0,
-			NULL, &state->solid_attributes, NULL, ring);
+			NULL, &state->solid_attributes, NULL,
+			state->constbuf, ring);
+
+	/* the last draw in the IB could have left a scissor that would
+	 * clip the resolve:
+	 */
+	OUT_PKT0(ring, REG_A3XX_GRAS_SC_WINDOW_SCISSOR_TL, 2);
+	OUT_RING(ring, A3XX_GRAS_SC_WINDOW_SCISSOR_TL_X(0) |
+			A3XX_GRAS_SC_WINDOW_SCISSOR_TL_Y(0));
+	OUT_RING(ring, A3XX_GRAS_SC_WINDOW_SCISSOR_BR_X(surface->width - 1) |
+			A3XX_GRAS_SC_WINDOW_SCISSOR_BR_Y(surface->height - 1));
 
 	OUT_PKT0(ring, REG_A3XX_RB_DEPTH_CONTROL, 1);
 	OUT_RING(ring, A3XX_RB_DEPTH_CONTROL_ZFUNC(FUNC_NEVER));
@@ -529,9 +807,9 @@ static void emit_gmem2mem(struct fd_state *state,
 	OUT_RING(ring, A3XX_RB_COPY_CONTROL_MSAA_RESOLVE(MSAA_ONE) |
 			A3XX_RB_COPY_CONTROL_MODE(RB_COPY_RESOLVE) |
 			A3XX_RB_COPY_CONTROL_GMEM_BASE(0));
-	OUT_RELOCS(ring, surface->bo, 0, 0, -1);     /* RB_COPY_DEST_BASE */
+	OUT_RELOCS(ring, surface->bo, surface->offset, 0, -1); /* RB_COPY_DEST_BASE */
 	OUT_RING(ring, A3XX_RB_COPY_DEST_PITCH_PITCH(surface->pitch * surface->cpp));
-	OUT_RING(ring, A3XX_RB_COPY_DEST_INFO_TILE(LINEAR) |
+	OUT_RING(ring, A3XX_RB_COPY_DEST_INFO_TILE(surface->tile_mode) |
 			A3XX_RB_COPY_DEST_INFO_FORMAT(surface->color) |
 			A3XX_RB_COPY_DEST_INFO_COMPONENT_ENABLE(0xf) |
 			A3XX_RB_COPY_DEST_INFO_ENDIAN(ENDIAN_NONE));
@@ -569,6 +847,8 @@ static void emit_gmem2mem(struct fd_state *state,
 /* color in RGBA */
 void fd_clear_color(struct fd_state *state, float color[4])
 {
+	if (memcmp(state->clear.color, color, sizeof(state->clear.color)))
+		state->clear.seqno++;
 	state->clear.color[0] = color[0];
 	state->clear.color[1] = color[1];
 	state->clear.color[2] = color[2];
@@ -588,10 +868,29 @@ void fd_clear_depth(struct fd_state *state, float depth)
 int fd_clear(struct fd_state *state, GLbitfield mask)
 {
 	struct fd_ringbuffer *ring = state->ring;
-	int i;
+	uint32_t i;
 
 	state->dirty = true;
 
+	/* only the color buffer is resolved, so a depth/stencil only clear
+	 * doesn't change what the bins need.  In a cmdbuf, we don't know
+	 * what was drawn before the clear, so just treat it like any other
+	 * draw:
+	 */
+	if (!(mask & GL_COLOR_BUFFER_BIT)) {
+		/* nothing to track */
+	} else if (state->scissor.enabled || state->parent) {
+		mark_damage(state);
+	} else {
+		/* a full clear overwrites whatever was drawn before it: */
+		for (i = 0; i < state->render_target.nbins_x *
+				state->render_target.nbins_y; i++)
+			state->render_target.bins[i].damaged = false;
+		state->render_target.batch_clear_seqno = state->clear.seqno;
+	}
+
+	emit_scissor(state, ring);
+
 	OUT_PKT3(ring, CP_REG_RMW, 3);
 	OUT_RING(ring, REG_A3XX_RB_RENDER_CONTROL);
 	OUT_RING(ring, A3XX_RB_RENDER_CONTROL_BIN_WIDTH__MASK);
@@ -631,7 +930,8 @@ int fd_clear(struct fd_state *state, GLbitfield mask)
 		OUT_PKT0(ring, REG_A3XX_RB_MRT_CONTROL(i), 1);
 		OUT_RING(ring, A3XX_RB_MRT_CONTROL_ROP_CODE(ROP_COPY) |
 				A3XX_RB_MRT_CONTROL_DITHER_MODE(DITHER_ALWAYS) |
-				A3XX_RB_MRT_CONTROL_COMPONENT_ENABLE(0xf));
+				A3XX_RB_MRT_CONTROL_COMPONENT_ENABLE(
+						(mask & GL_COLOR_BUFFER_BIT) ? 0xf : 0x0));
 
 		OUT_PKT0(ring, REG_A3XX_RB_MRT_BLEND_CONTROL(i), 1);
 		OUT_RING(ring, A3XX_RB_MRT_BLEND_CONTROL_RGB_SRC_FACTOR(FACTOR_ONE) |
@@ -645,7 +945,7 @@ int fd_clear(struct fd_state *state, GLbitfield mask)
 
 	fd_program_emit_state(state->solid_program, 0,
 			&state->solid_uniforms, &state->solid_attributes,
-			NULL, ring);
+			NULL, state->constbuf, ring);
 
 	emit_draw_indx(ring, DI_PT_RECTLIST, INDEX_SIZE_IGN, 2, NULL, 0, 0);
 
@@ -701,6 +1001,9 @@ int fd_enable(struct fd_state *state, GLenum cap)
 	case GL_DITHER:
 		state->rb_mrt[0].control |= A3XX_RB_MRT_CONTROL_DITHER_MODE(DITHER_ALWAYS);
 		return 0;
+	case GL_SCISSOR_TEST:
+		state->scissor.enabled = true;
+		return 0;
 	default:
 		ERROR_MSG("unsupported cap: 0x%04x", cap);
 		return -1;
@@ -731,12 +1034,54 @@ int fd_disable(struct fd_state *state, GLenum cap)
 	case GL_DITHER:
 		state->rb_mrt[0].control &= ~A3XX_RB_MRT_CONTROL_DITHER_MODE(DITHER_ALWAYS);
 		return 0;
+	case GL_SCISSOR_TEST:
+		state->scissor.enabled = false;
+		return 0;
 	default:
 		ERROR_MSG("unsupported cap: 0x%04x", cap);
 		return -1;
 	}
 }
 
+/* like glScissor(), x/y are relative to the lower left corner: */
+int fd_scissor(struct fd_state *state, GLint x, GLint y,
+		GLsizei width, GLsizei height)
+{
+	struct fd_surface *surface = state->render_target.surface;
+	int x1, y1, x2, y2;
+
+	if ((width < 0) || (height < 0)) {
+		ERROR_MSG("invalid scissor: %dx%d", width, height);
+		return -1;
+	}
+
+	if (!surface) {
+		ERROR_MSG("no render target");
+		return -1;
+	}
+
+	/* convert to window coordinates (origin at upper left): */
+	y = surface->height - (y + height);
+
+	x1 = max(x, 0);
+	y1 = max(y, 0);
+	x2 = x + width - 1;
+	y2 = y + height - 1;
+
+	if ((x2 < x1) || (y2 < y1)) {
+		/* empty rect, TL > BR so nothing passes: */
+		x1 = y1 = 1;
+		x2 = y2 = 0;
+	}
+
+	state->scissor.x1 = x1;
+	state->scissor.y1 = y1;
+	state->scissor.x2 = x2;
+	state->scissor.y2 = y2;
+
+	return 0;
+}
+
 int fd_blend_func(struct fd_state *state, GLenum sfactor, GLenum dfactor)
 {
 	uint32_t bc = 0;
@@ -925,9 +1270,13 @@ static int set_filter(enum a3xx_tex_filter *filter, GLint param)
 {
 	switch (param) {
 	case GL_LINEAR:
+	case GL_LINEAR_MIPMAP_NEAREST:
+	case GL_LINEAR_MIPMAP_LINEAR:
 		*filter = A3XX_TEX_LINEAR;
 		return 0;
 	case GL_NEAREST:
+	case GL_NEAREST_MIPMAP_NEAREST:
+	case GL_NEAREST_MIPMAP_LINEAR:
 		*filter = A3XX_TEX_NEAREST;
 		return 0;
 	default:
@@ -961,6 +1310,19 @@ int fd_tex_param(struct fd_state *state, GLenum name, GLint param)
 	case GL_TEXTURE_MAG_FILTER:
 		return set_filter(&state->textures.mag_filter, param);
 	case GL_TEXTURE_MIN_FILTER:
+		switch (param) {
+		case GL_NEAREST_MIPMAP_NEAREST:
+		case GL_LINEAR_MIPMAP_NEAREST:
+			state->textures.mip_filter = MIP_NEAREST;
+			break;
+		case GL_NEAREST_MIPMAP_LINEAR:
+		case GL_LINEAR_MIPMAP_LINEAR:
+			state->textures.mip_filter = MIP_LINEAR;
+			break;
+		default:
+			state->textures.mip_filter = MIP_NONE;
+			break;
+		}
 		return set_filter(&state->textures.min_filter, param);
 	case GL_TEXTURE_WRAP_S:
 		return set_clamp(&state->textures.clamp_s, param);
@@ -971,17 +1333,28 @@ int fd_tex_param(struct fd_state *state, GLenum name, GLint param)
 	}
 }
 
+/* number of mip levels the sampler should use, 1 unless both the texture
+ * is mipmapped and the min filter uses mipmaps:
+ */
+static uint32_t tex_levels(struct fd_state *state, struct fd_surface *tex)
+{
+	if (state->textures.mip_filter == MIP_NONE)
+		return 1;
+	return max(tex->nlevels, 1);
+}
+
 static void emit_textures(struct fd_state *state)
 {
 	struct fd_ringbuffer *ring = state->ring;
-	struct ir3_sampler **samplers;
-	int n, samplers_count;
+	struct fd_param *params = state->textures.params.params;
+	const uint8_t *slots;
+	int n, l, samplers_count;
 
 	/* this dst_off should align w/ values in TPL1_TP_FS_TEX_OFFSET:
 	 */
 	int dst_off = 16;
 
-	samplers = fd_program_samplers(state->program,
+	slots = fd_program_sampler_slots(state->program,
 			FD_SHADER_FRAGMENT, &samplers_count);
 
 	if (!samplers_count)
@@ -996,12 +1369,17 @@ static void emit_textures(struct fd_state *state)
 	OUT_RING(ring, CP_LOAD_STATE_1_STATE_TYPE(ST_SHADER) |
 			CP_LOAD_STATE_1_EXT_SRC_ADDR(0));
 	for (n = 0; n < samplers_count; n++) {
+		uint32_t nlevels = tex_levels(state, params[slots[n]].tex);
 		OUT_RING(ring, A3XX_TEX_SAMP_0_XY_MAG(state->textures.mag_filter) |
 				A3XX_TEX_SAMP_0_XY_MIN(state->textures.min_filter) |
+				COND((nlevels > 1) && (state->textures.mip_filter == MIP_LINEAR),
+						A3XX_TEX_SAMP_0_MIPFILTER_LINEAR) |
 				A3XX_TEX_SAMP_0_WRAP_S(state->textures.clamp_s) |
 				A3XX_TEX_SAMP_0_WRAP_T(state->textures.clamp_t) |
 				A3XX_TEX_SAMP_0_WRAP_R(A3XX_TEX_REPEAT));
-		OUT_RING(ring, 0x00000000);
+		OUT_RING(ring, COND(nlevels > 1,
+				A3XX_TEX_SAMP_1_MAX_LOD(nlevels - 1) |
+				A3XX_TEX_SAMP_1_MIN_LOD(0)));
 	}
 
 	/* emit texture state: */
@@ -1013,14 +1391,14 @@ static void emit_textures(struct fd_state *state)
 	OUT_RING(ring, CP_LOAD_STATE_1_STATE_TYPE(ST_CONSTANTS) |
 			CP_LOAD_STATE_1_EXT_SRC_ADDR(0));
 	for (n = 0; n < samplers_count; n++) {
-		struct fd_param *p = find_param(&state->textures.params,
-				samplers[n]->name);
-		struct fd_surface *tex = p->tex;
+		struct fd_surface *tex = params[slots[n]].tex;
 		OUT_RING(ring, 0x00c00000 | // XXX
 				A3XX_TEX_CONST_0_SWIZ_X(A3XX_TEX_X) |
 				A3XX_TEX_CONST_0_SWIZ_Y(A3XX_TEX_Y) |
 				A3XX_TEX_CONST_0_SWIZ_Z(A3XX_TEX_Z) |
 				A3XX_TEX_CONST_0_SWIZ_W(A3XX_TEX_W) |
+				COND(tex->tile_mode != LINEAR, A3XX_TEX_CONST_0_TILED) |
+				A3XX_TEX_CONST_0_MIPLVLS(tex_levels(state, tex) - 1) |
 				A3XX_TEX_CONST_0_FMT(color2fmt[tex->color]));
 		OUT_RING(ring, 0x30000000 | // XXX
 				A3XX_TEX_CONST_1_WIDTH(tex->width) |
@@ -1030,7 +1408,7 @@ static void emit_textures(struct fd_state *state)
 		OUT_RING(ring, 0x00000000);
 	}
 
-	/* emit mipaddrs: */
+	/* emit mipaddrs, the levels which are not used are left zero: */
 	OUT_PKT3(ring, CP_LOAD_STATE, 2 + (14 * samplers_count));
 	OUT_RING(ring, CP_LOAD_STATE_0_DST_OFF(14 * dst_off) |
 			CP_LOAD_STATE_0_STATE_SRC(SS_DIRECT) |
@@ -1039,22 +1417,18 @@ static void emit_textures(struct fd_state *state)
 	OUT_RING(ring, CP_LOAD_STATE_1_STATE_TYPE(ST_CONSTANTS) |
 			CP_LOAD_STATE_1_EXT_SRC_ADDR(0));
 	for (n = 0; n < samplers_count; n++) {
-		struct fd_param *p = find_param(&state->textures.params,
-				samplers[n]->name);
-		OUT_RELOC(ring, p->tex->bo, 0, 0);
-		OUT_RING(ring, 0x00000000);
-		OUT_RING(ring, 0x00000000);
-		OUT_RING(ring, 0x00000000);
-		OUT_RING(ring, 0x00000000);
-		OUT_RING(ring, 0x00000000);
-		OUT_RING(ring, 0x00000000);
-		OUT_RING(ring, 0x00000000);
-		OUT_RING(ring, 0x00000000);
-		OUT_RING(ring, 0x00000000);
-		OUT_RING(ring, 0x00000000);
-		OUT_RING(ring, 0x00000000);
-		OUT_RING(ring, 0x00000000);
-		OUT_RING(ring, 0x00000000);
+		struct fd_surface *tex = params[slots[n]].tex;
+		uint32_t nlevels = tex_levels(state, tex);
+
+		OUT_RELOC(ring, tex->bo, tex->offset, 0);
+		for (l = 1; l < FD_MAX_MIP_LEVELS; l++) {
+			if (l < nlevels) {
+				OUT_RELOC(ring, tex->bo,
+						tex->offset + tex->levels[l].offset, 0);
+			} else {
+				OUT_RING(ring, 0x00000000);
+			}
+		}
 	}
 }
 
@@ -1139,13 +1513,92 @@ static void emit_query(struct fd_state *state, bool flush)
 	}
 }
 
+/* Layout of a profile slot's buffer.  The samples for each draw/tile
+ * are accumulated (since draws are replayed once per tile, and a tile
+ * may be rendered in several flushes), so the result is the sum of the
+ * end samples minus the sum of the begin samples:
+ */
+struct profile_record {
+	uint32_t seqno, pad;
+	uint64_t begin[MAX_PERFCNTRS];
+	uint64_t end[MAX_PERFCNTRS];
+};
+
+struct profile_buf {
+	uint32_t seqno, pad;
+	struct profile_record draws[FD_PROFILE_MAX_DRAWS];
+	struct profile_record tiles[FD_PROFILE_MAX_TILES];
+};
+
+#if FD_PROFILE_MAX_COUNTERS != MAX_PERFCNTRS
+#  error "FD_PROFILE_MAX_COUNTERS does not match MAX_PERFCNTRS"
+#endif
+
+static uint32_t draw_record(uint32_t n)
+{
+	return offsetof(struct profile_buf, draws) +
+			(n * sizeof(struct profile_record));
+}
+
+static uint32_t tile_record(uint32_t n)
+{
+	return offsetof(struct profile_buf, tiles) +
+			(n * sizeof(struct profile_record));
+}
+
+static void emit_profile_sample(struct fd_state *state,
+		struct fd_ringbuffer *ring, uint32_t record, bool end)
+{
+	struct fd_profile_slot *slot = state->profile.cur;
+
+	/* wait for preceding cmds to finish, so their cost lands on the
+	 * correct side of the sample:
+	 */
+	OUT_PKT3(ring, CP_WAIT_FOR_IDLE, 1);
+	OUT_RING(ring, 0x00000000);
+
+	fd_perfcntrs_emit_sample(state->profile.ctrs, ring, slot->bo,
+			record + (end ? offsetof(struct profile_record, end) :
+					offsetof(struct profile_record, begin)), true);
+
+	if (end) {
+		/* timestamp w/ the seqno of the flush which executes it: */
+		OUT_PKT3(ring, CP_EVENT_WRITE, 3);
+		OUT_RING(ring, CACHE_FLUSH_TS);
+		OUT_RELOC(ring, slot->bo, record, 0);
+		OUT_RING(ring, state->profile.seqno + 1);
+	}
+}
+
+/* returns the record to sample the next draw into, or zero if the draw
+ * is not profiled:
+ */
+static uint32_t profile_draw(struct fd_state *state)
+{
+	struct fd_profile_slot *slot = state->profile.cur;
+
+	if (!slot || (slot->state != PROFILE_ACTIVE))
+		return 0;
+
+	if (slot->ndraws >= FD_PROFILE_MAX_DRAWS) {
+		slot->dropped++;
+		return 0;
+	}
+
+	return draw_record(slot->ndraws++);
+}
+
 static int draw_impl(struct fd_state *state, GLenum mode,
 		GLint first, GLsizei count, GLenum type, const GLvoid *indices)
 {
 	struct fd_ringbuffer *ring = state->ring;
 	enum pc_di_index_size idx_type = INDEX_SIZE_IGN;
 	struct fd_bo *indx_bo = NULL;
-	uint32_t idx_size, stride_in_vpc;
+	uint32_t idx_size, stride_in_vpc, record;
+
+	/* in case shaders were attached since last link: */
+	if (fd_link(state))
+		return -1;
 
 	if (indices) {
 		switch (type) {
@@ -1177,8 +1630,14 @@ static int draw_impl(struct fd_state *state, GLenum mode,
 
 	state->dirty = true;
 
+	mark_damage(state);
+
+	record = profile_draw(state);
+	if (record)
+		emit_profile_sample(state, ring, record, false);
+
 	fd_program_emit_state(state->program, first, &state->uniforms,
-			&state->attributes, &state->bufs, ring);
+			&state->attributes, &state->bufs, state->constbuf, ring);
 
 	/*
 	 * +----------- max outloc
@@ -1270,6 +1729,8 @@ static int draw_impl(struct fd_state *state, GLenum mode,
 	OUT_PKT0(ring, REG_A3XX_RB_STENCIL_CONTROL, 1);
 	OUT_RING(ring, state->rb_stencil_control);
 
+	emit_scissor(state, ring);
+
 	emit_textures(state);
 
 	emit_mrt(state, ring, state->render_target.surface);
@@ -1279,6 +1740,9 @@ static int draw_impl(struct fd_state *state, GLenum mode,
 	if (state->query.active)
 		emit_query(state, false);
 
+	if (record)
+		emit_profile_sample(state, ring, record, true);
+
 	if (indx_bo)
 		fd_bo_del(indx_bo);
 
@@ -1297,22 +1761,29 @@ int fd_draw_arrays(struct fd_state *state, GLenum mode,
 	return draw_impl(state, mode, first, count, 0, NULL);
 }
 
-int fd_run_compute(struct fd_state *state, uint32_t workdim,
-		uint32_t *globaloff, uint32_t *globalsize, uint32_t *localsize)
+/* Batched compute: the setup, and the program state, is emitted once by
+ * fd_compute_begin().  Each fd_compute_dispatch() only emits the grid
+ * and the uniforms/buf bindings which changed since the previous one,
+ * and everything is submitted in one go by fd_compute_end().  The
+ * program can't change within a batch.
+ */
+int fd_compute_begin(struct fd_state *state)
 {
 	struct fd_ringbuffer *ring = state->ring;
-	uint32_t local[3] = {1, 1, 1};
-	uint32_t global[3] = {1, 1, 1};
-	uint32_t off[3] = {0, 0, 0};
 	uint32_t i;
 
-	for (i = 0; i < workdim; i++) {
-		if (globaloff)
-			off[i] = globaloff[i];
-		global[i] = globalsize[i];
-		local[i] = localsize[i];
+	/* compute kicks off it's own submit, so not in a cmdbuf: */
+	assert(!state->parent);
+
+	if (state->compute.active) {
+		ERROR_MSG("compute batch already active");
+		return -1;
 	}
 
+	/* in case shaders were attached since last link: */
+	if (fd_link(state))
+		return -1;
+
 	OUT_PKT3(ring, CP_NOP, 2);
 	OUT_RING(ring, 0xdeec0ded);
 	OUT_RING(ring, 0x00000001);
@@ -1343,29 +1814,6 @@ int fd_run_compute(struct fd_state *state, uint32_t workdim,
 	OUT_RING(ring, A3XX_RB_RENDER_CONTROL_BIN_WIDTH(0) |
 			A3XX_RB_RENDER_CONTROL_ALPHA_TEST_FUNC(FUNC_NEVER));
 
-	OUT_PKT0(ring, REG_A3XX_HLSQ_CL_NDRANGE_0_REG, 9);
-	OUT_RING(ring, A3XX_HLSQ_CL_NDRANGE_0_REG_WORKDIM(workdim) |
-			A3XX_HLSQ_CL_NDRANGE_0_REG_LOCALSIZE0(local[0]) |
-			A3XX_HLSQ_CL_NDRANGE_0_REG_LOCALSIZE1(local[1]) |
-			A3XX_HLSQ_CL_NDRANGE_0_REG_LOCALSIZE2(local[2]));
-	OUT_RING(ring, global[0]);    /* HLSQ_CL_GLOBAL_WORK[0].SIZE */
-	OUT_RING(ring, off[0]);       /* HLSQ_CL_GLOBAL_WORK[0].OFFSET */
-	OUT_RING(ring, global[1]);    /* HLSQ_CL_GLOBAL_WORK[1].SIZE */
-	OUT_RING(ring, off[1]);       /* HLSQ_CL_GLOBAL_WORK[1].OFFSET */
-	OUT_RING(ring, global[2]);    /* HLSQ_CL_GLOBAL_WORK[2].SIZE */
-	OUT_RING(ring, off[2]);       /* HLSQ_CL_GLOBAL_WORK[2].OFFSET */
-	OUT_RING(ring, 0x0001200c);   /* HLSQ_CL_CONTROL_0_REG */
-	OUT_RING(ring, 0x0000f000);   /* HLSQ_CL_CONTROL_1_REG */
-
-	OUT_PKT0(ring, REG_A3XX_HLSQ_CL_KERNEL_CONST_REG, 4);
-	OUT_RING(ring, 0x00003006);   /* HLSQ_CL_KERNEL_CONST_REG */
-	OUT_RING(ring, global[0] / local[0]);  /* HLSQ_CL_KERNEL_GROUP[0].RATIO */
-	OUT_RING(ring, global[1] / local[1]);  /* HLSQ_CL_KERNEL_GROUP[1].RATIO */
-	OUT_RING(ring, global[2] / local[2]);  /* HLSQ_CL_KERNEL_GROUP[2].RATIO */
-
-	OUT_PKT0(ring, REG_A3XX_HLSQ_CL_WG_OFFSET_REG, 1);
-	OUT_RING(ring, 0x00000009);
-
 	for (i = 0; i < 4; i++) {
 		enum a3xx_color_fmt format = 0x11; // XXX
 
@@ -1405,21 +1853,105 @@ int fd_run_compute(struct fd_state *state, uint32_t workdim,
 	OUT_RING(ring, 0x00000000);        /* TPL1_TP_FS_BORDER_COLOR_BASE_ADDR */
 
 	fd_program_emit_compute_state(state->program, &state->uniforms,
-			&state->attributes, &state->bufs, ring);
-
-	emit_marker(ring, 6);
+			&state->attributes, &state->bufs, state->constbuf, ring);
 
-	/* kick the compute: */
-	OUT_PKT3(ring, CP_RUN_OPENCL, 1);
-	OUT_RING(ring, 0x00000000);
+	/* the const file layout is per-program, so the first dispatch
+	 * loads everything:
+	 */
+	fd_constbuf_reset(state->constbuf);
 
-	emit_marker(ring, 6);
+	state->compute.active = true;
+	state->compute.program = state->program;
+	state->compute.ndispatch = 0;
 
-	OUT_PKT3(ring, CP_NOP, 2);
-	OUT_RING(ring, 0xdeec0ded);
-	OUT_RING(ring, 0x00000002);
+	return 0;
+}
 
-	emit_marker(ring, 6);
+int fd_compute_dispatch(struct fd_state *state, uint32_t workdim,
+		uint32_t *globaloff, uint32_t *globalsize, uint32_t *localsize)
+{
+	struct fd_ringbuffer *ring = state->ring;
+	uint32_t local[3] = {1, 1, 1};
+	uint32_t global[3] = {1, 1, 1};
+	uint32_t off[3] = {0, 0, 0};
+	uint32_t i;
+
+	if (!state->compute.active) {
+		ERROR_MSG("no active compute batch");
+		return -1;
+	}
+
+	if (state->program != state->compute.program) {
+		ERROR_MSG("cannot change program within a compute batch");
+		return -1;
+	}
+
+	for (i = 0; i < workdim; i++) {
+		if (globaloff)
+			off[i] = globaloff[i];
+		global[i] = globalsize[i];
+		local[i] = localsize[i];
+	}
+
+	/* a dispatch could be reading what the previous one wrote: */
+	if (state->compute.ndispatch > 0) {
+		OUT_PKT3(ring, CP_WAIT_FOR_IDLE, 1);
+		OUT_RING(ring, 0x00000000);
+	}
+
+	OUT_PKT0(ring, REG_A3XX_HLSQ_CL_NDRANGE_0_REG, 9);
+	OUT_RING(ring, A3XX_HLSQ_CL_NDRANGE_0_REG_WORKDIM(workdim) |
+			A3XX_HLSQ_CL_NDRANGE_0_REG_LOCALSIZE0(local[0]) |
+			A3XX_HLSQ_CL_NDRANGE_0_REG_LOCALSIZE1(local[1]) |
+			A3XX_HLSQ_CL_NDRANGE_0_REG_LOCALSIZE2(local[2]));
+	OUT_RING(ring, global[0]);    /* HLSQ_CL_GLOBAL_WORK[0].SIZE */
+	OUT_RING(ring, off[0]);       /* HLSQ_CL_GLOBAL_WORK[0].OFFSET */
+	OUT_RING(ring, global[1]);    /* HLSQ_CL_GLOBAL_WORK[1].SIZE */
+	OUT_RING(ring, off[1]);       /* HLSQ_CL_GLOBAL_WORK[1].OFFSET */
+	OUT_RING(ring, global[2]);    /* HLSQ_CL_GLOBAL_WORK[2].SIZE */
+	OUT_RING(ring, off[2]);       /* HLSQ_CL_GLOBAL_WORK[2].OFFSET */
+	OUT_RING(ring, 0x0001200c);   /* HLSQ_CL_CONTROL_0_REG */
+	OUT_RING(ring, 0x0000f000);   /* HLSQ_CL_CONTROL_1_REG */
+
+	OUT_PKT0(ring, REG_A3XX_HLSQ_CL_KERNEL_CONST_REG, 4);
+	OUT_RING(ring, 0x00003006);   /* HLSQ_CL_KERNEL_CONST_REG */
+	OUT_RING(ring, global[0] / local[0]);  /* HLSQ_CL_KERNEL_GROUP[0].RATIO */
+	OUT_RING(ring, global[1] / local[1]);  /* HLSQ_CL_KERNEL_GROUP[1].RATIO */
+	OUT_RING(ring, global[2] / local[2]);  /* HLSQ_CL_KERNEL_GROUP[2].RATIO */
+
+	OUT_PKT0(ring, REG_A3XX_HLSQ_CL_WG_OFFSET_REG, 1);
+	OUT_RING(ring, 0x00000009);
+
+	fd_program_emit_compute_params(state->program, &state->uniforms,
+			&state->bufs, state->constbuf, ring);
+
+	emit_marker(ring, 6);
+
+	/* kick the compute: */
+	OUT_PKT3(ring, CP_RUN_OPENCL, 1);
+	OUT_RING(ring, 0x00000000);
+
+	emit_marker(ring, 6);
+
+	state->compute.ndispatch++;
+
+	return 0;
+}
+
+int fd_compute_end(struct fd_state *state)
+{
+	struct fd_ringbuffer *ring = state->ring;
+
+	if (!state->compute.active) {
+		ERROR_MSG("no active compute batch");
+		return -1;
+	}
+
+	OUT_PKT3(ring, CP_NOP, 2);
+	OUT_RING(ring, 0xdeec0ded);
+	OUT_RING(ring, 0x00000002);
+
+	emit_marker(ring, 6);
 
 	OUT_PKT3(ring, CP_WAIT_FOR_IDLE, 1);
 	OUT_RING(ring, 0x00000000);
@@ -1442,16 +1974,148 @@ int fd_run_compute(struct fd_state *state, uint32_t workdim,
 	fd_ringbuffer_reset(state->ring);
 
 	fd_ringmarker_mark(state->draw_start);
+	fd_constbuf_reset(state->constbuf);
+	fd_constbuf_retire(state->constbuf);
+
+	state->compute.active = false;
 
 	return 0;
 }
 
+int fd_run_compute(struct fd_state *state, uint32_t workdim,
+		uint32_t *globaloff, uint32_t *globalsize, uint32_t *localsize)
+{
+	if (fd_compute_begin(state))
+		return -1;
+	if (fd_compute_dispatch(state, workdim, globaloff, globalsize, localsize)) {
+		fd_compute_end(state);
+		return -1;
+	}
+	return fd_compute_end(state);
+}
+
+/* collect the rects covered by bins resolved since the last post, merging
+ * runs of neighboring bins within a row:
+ */
+static uint32_t get_damage(struct fd_state *state)
+{
+	struct fd_surface *surface = state->render_target.surface;
+	uint32_t bin_w = state->render_target.bin_w;
+	uint32_t bin_h = state->render_target.bin_h;
+	uint32_t nbins_x = state->render_target.nbins_x;
+	uint32_t nbins_y = state->render_target.nbins_y;
+	uint32_t i, j, n = 0;
+
+	for (i = 0; i < nbins_y; i++) {
+		struct fd_rect *rect = NULL;
+
+		for (j = 0; j < nbins_x; j++) {
+			struct fd_bin *bin = &state->render_target.bins[(i * nbins_x) + j];
+
+			if (!bin->unposted) {
+				rect = NULL;
+				continue;
+			}
+
+			bin->unposted = false;
+
+			if (!rect) {
+				rect = &state->render_target.damage[n++];
+				rect->x1 = j * bin_w;
+				rect->y1 = i * bin_h;
+				rect->y2 = min((i + 1) * bin_h, surface->height) - 1;
+			}
+
+			rect->x2 = min((j + 1) * bin_w, surface->width) - 1;
+		}
+	}
+
+	return n;
+}
+
+/* switch rendering to the next back buffer of the winsys swapchain, which
+ * has the same size and format as the current one:
+ */
+static void flip_render_target(struct fd_state *state,
+		struct fd_surface *surface)
+{
+	struct fd_bin *bins = state->render_target.bins;
+	uint32_t nbins = state->render_target.nbins_x *
+			state->render_target.nbins_y;
+	uint32_t i;
+
+	for (i = 0; i < ARRAY_SIZE(state->render_target.swapchain); i++) {
+		if (state->render_target.swapchain[i].surface == surface)
+			break;
+	}
+
+	if (i == ARRAY_SIZE(state->render_target.swapchain)) {
+		/* first time we see this surface, so find an empty slot: */
+		for (i = 0; i < ARRAY_SIZE(state->render_target.swapchain); i++) {
+			if (!state->render_target.swapchain[i].surface) {
+				state->render_target.swapchain[i].bins =
+						calloc(nbins, sizeof(*bins));
+				break;
+			}
+		}
+	}
+
+	if (i == ARRAY_SIZE(state->render_target.swapchain)) {
+		/* too many surfaces, just forget what we knew: */
+		memset(bins, 0, nbins * sizeof(*bins));
+	} else {
+		state->render_target.bins = state->render_target.swapchain[i].bins;
+		state->render_target.swapchain[i].surface =
+				state->render_target.surface;
+		state->render_target.swapchain[i].bins = bins;
+	}
+
+	state->render_target.surface = surface;
+	state->render_target.batch_clear_seqno = 0;
+}
+
+static void free_swapchain(struct fd_state *state)
+{
+	uint32_t i;
+
+	for (i = 0; i < ARRAY_SIZE(state->render_target.swapchain); i++) {
+		free(state->render_target.swapchain[i].bins);
+		state->render_target.swapchain[i].surface = NULL;
+		state->render_target.swapchain[i].bins = NULL;
+	}
+}
+
 int fd_swap_buffers(struct fd_state *state)
 {
+	struct fd_surface *surface = state->render_target.surface;
+	uint32_t ndamage;
+	int ret;
+
+	/* the winsys only scans out linear surfaces: */
+	if (surface->tile_mode != LINEAR) {
+		ERROR_MSG("cannot post tiled surface");
+		return -1;
+	}
+
 	fd_flush(state);
 
-	state->ws->post_surface(state->ws,
-			state->render_target.surface);
+	ndamage = get_damage(state);
+
+	DEBUG_MSG("posting %u damaged rect(s)", ndamage);
+
+	ret = state->ws->post_surface(state->ws, surface,
+			state->render_target.damage, ndamage);
+	if (ret)
+		return ret;
+
+	/* if the winsys flipped to the surface, continue w/ the next back
+	 * buffer.  Without a swapchain, this gives us the same surface:
+	 */
+	if (surface == state->screen) {
+		state->screen = state->ws->get_surface(state->ws, NULL, NULL);
+		if (state->screen != surface)
+			flip_render_target(state, state->screen);
+	}
 
 	return 0;
 }
@@ -1486,7 +2150,11 @@ int fd_flush(struct fd_state *state)
 {
 	struct fd_surface *surface = state->render_target.surface;
 	struct fd_ringbuffer *ring = state->ring;
-	uint32_t i, yoff = 0;
+	struct fd_profile_slot *prof = state->profile.cur;
+	uint32_t batch_clear_seqno = state->render_target.batch_clear_seqno;
+	uint32_t i, yoff = 0, skipped = 0;
+
+	assert(!state->parent);
 
 	if (!state->dirty)
 		return 0;
@@ -1501,6 +2169,9 @@ int fd_flush(struct fd_state *state)
 
 	flush_setup(state, ring);
 
+	if (prof)
+		fd_perfcntrs_emit_select(state->profile.ctrs, ring);
+
 	for (i = 0; i < state->render_target.nbins_y; i++) {
 		uint32_t j, xoff = 0;
 		uint32_t bin_h = state->render_target.bin_h;
@@ -1509,12 +2180,30 @@ int fd_flush(struct fd_state *state)
 		bin_h = min(bin_h, surface->height - yoff);
 
 		for (j = 0; j < state->render_target.nbins_x; j++) {
+			uint32_t n = (i * state->render_target.nbins_x) + j;
+			struct fd_bin *bin = &state->render_target.bins[n];
 			uint32_t bin_w = state->render_target.bin_w;
 			uint32_t x1, y1, x2, y2;
+			bool prof_tile = prof && (n < FD_PROFILE_MAX_TILES);
 
 			/* clip bin width: */
 			bin_w = min(bin_w, surface->width - xoff);
 
+			/* if nothing drew to the bin, then either there was no
+			 * clear and the surface contents are still valid, or the
+			 * surface already contains the result of the same clear:
+			 */
+			if (!bin->damaged && (!batch_clear_seqno ||
+					(bin->clear_seqno == batch_clear_seqno))) {
+				skipped++;
+				xoff += bin_w;
+				continue;
+			}
+
+			bin->clear_seqno = bin->damaged ? 0 : batch_clear_seqno;
+			bin->damaged = false;
+			bin->unposted = true;
+
 			x1 = xoff;
 			y1 = yoff;
 			x2 = xoff + bin_w - 1;
@@ -1523,6 +2212,9 @@ int fd_flush(struct fd_state *state)
 			DEBUG_MSG("bin_h=%d, yoff=%d, bin_w=%d, xoff=%d",
 					bin_h, yoff, bin_w, xoff);
 
+			if (prof_tile)
+				emit_profile_sample(state, ring, tile_record(n), false);
+
 			OUT_PKT3(ring, CP_SET_BIN, 3);
 			OUT_RING(ring, 0x00000000);
 			OUT_RING(ring, CP_SET_BIN_1_X1(x1) | CP_SET_BIN_1_Y1(y1));
@@ -1554,19 +2246,45 @@ int fd_flush(struct fd_state *state)
 			OUT_PKT3(ring, CP_WAIT_FOR_IDLE, 1);
 			OUT_RING(ring, 0x00000000);
 
+			if (prof_tile)
+				emit_profile_sample(state, ring, tile_record(n), true);
+
 			xoff += bin_w;
 		}
 
 		yoff += bin_h;
 	}
 
+	DEBUG_MSG("skipped %u of %u bins", skipped,
+			state->render_target.nbins_x * state->render_target.nbins_y);
+
+	if (prof) {
+		uint32_t nbins = state->render_target.nbins_x *
+				state->render_target.nbins_y;
+
+		prof->seqno = ++state->profile.seqno;
+		prof->ntiles = max(prof->ntiles, min(nbins, FD_PROFILE_MAX_TILES));
+
+		OUT_PKT3(ring, CP_EVENT_WRITE, 3);
+		OUT_RING(ring, CACHE_FLUSH_TS);
+		OUT_RELOC(ring, prof->bo, offsetof(struct profile_buf, seqno), 0);
+		OUT_RING(ring, prof->seqno);
+
+		/* once ended, the last of it's samples are now flushed: */
+		if (prof->state == PROFILE_ENDED)
+			state->profile.cur = NULL;
+	}
+
 	fd_ringmarker_flush(state->draw_end);
 	fd_ringbuffer_flush(ring);
 	fd_pipe_wait(state->pipe, fd_ringbuffer_timestamp(ring));
 	fd_ringbuffer_reset(state->ring);
 
 	fd_ringmarker_mark(state->draw_start);
+	fd_constbuf_reset(state->constbuf);
+	fd_constbuf_retire(state->constbuf);
 
+	state->render_target.batch_clear_seqno = 0;
 	state->dirty = false;
 
 	return 0;
@@ -1574,31 +2292,261 @@ int fd_flush(struct fd_state *state)
 
 /* ************************************************************************* */
 
-struct fd_surface * fd_surface_new_fmt(struct fd_state *state,
-		uint32_t width, uint32_t height, enum a3xx_color_fmt color_format)
+/* A cmdbuf is a secondary cmdstream, recorded into it's own ringbuffer
+ * with it's own copy of the state, so that several can be recorded in
+ * parallel (one thread per cmdbuf).  The state returned from
+ * fd_cmdbuf_begin() can be used with the normal draw/state functions,
+ * but not to flush, make_current, run compute, query or profile.  Programs
+ * used in a cmdbuf must be linked (fd_link()/fd_set_program()) on the
+ * parent state before fd_cmdbuf_begin(), and not modified while any
+ * cmdbuf is recording.
+ *
+ * Once recorded, fd_cmdbuf_execute() stitches the cmdbuf into the
+ * parent's cmdstream, as an IB, so it gets replayed per bin like the
+ * rest of the draw cmds.  A cmdbuf should not be re-recorded until
+ * the parent state has been flushed.
+ */
+
+struct fd_cmdbuf {
+	struct fd_state *parent;
+
+	/* copy of the parent's state, that the cmdbuf is recorded with: */
+	struct fd_state state;
+
+	struct fd_ringbuffer *ring;
+	struct fd_ringmarker *start, *end;
+	struct fd_constbuf *constbuf;
+	struct fd_bin *bins;
+	uint32_t nbins;
+
+	bool recording;
+};
+
+struct fd_cmdbuf * fd_cmdbuf_new(struct fd_state *state)
+{
+	struct fd_cmdbuf *cmdbuf = calloc(1, sizeof(*cmdbuf));
+
+	assert(!state->parent);
+
+	cmdbuf->parent = state;
+	cmdbuf->ring = fd_ringbuffer_new(state->pipe, 0x10000);
+	fd_ringbuffer_set_parent(cmdbuf->ring, state->ring);
+	cmdbuf->start = fd_ringmarker_new(cmdbuf->ring);
+	cmdbuf->end = fd_ringmarker_new(cmdbuf->ring);
+	cmdbuf->constbuf = fd_constbuf_new(state);
+
+	return cmdbuf;
+}
+
+static void cmdbuf_free_params(struct fd_cmdbuf *cmdbuf)
+{
+	struct fd_state *state = &cmdbuf->state;
+	free_params(&state->uniforms);
+	free_params(&state->solid_uniforms);
+	free_params(&state->attributes);
+	free_params(&state->solid_attributes);
+	free_params(&state->textures.params);
+	free_params(&state->bufs);
+}
+
+void fd_cmdbuf_del(struct fd_cmdbuf *cmdbuf)
+{
+	cmdbuf_free_params(cmdbuf);
+	fd_constbuf_del(cmdbuf->constbuf);
+	fd_ringmarker_del(cmdbuf->start);
+	fd_ringmarker_del(cmdbuf->end);
+	fd_ringbuffer_del(cmdbuf->ring);
+	free(cmdbuf->bins);
+	free(cmdbuf);
+}
+
+/* snapshot the parent's current state, and start recording.  Must be
+ * called from the thread owning the parent state, but the returned
+ * state can then be handed off to another thread:
+ */
+struct fd_state * fd_cmdbuf_begin(struct fd_cmdbuf *cmdbuf)
+{
+	struct fd_state *parent = cmdbuf->parent;
+	struct fd_state *state = &cmdbuf->state;
+	uint32_t nbins = parent->render_target.nbins_x *
+			parent->render_target.nbins_y;
+	struct fd_param *p;
+
+	assert(!cmdbuf->recording);
+	assert(parent->render_target.surface);
+
+	cmdbuf_free_params(cmdbuf);
+
+	*state = *parent;
+	state->parent = parent;
+
+	copy_params(&state->uniforms, &parent->uniforms);
+	copy_params(&state->solid_uniforms, &parent->solid_uniforms);
+	copy_params(&state->attributes, &parent->attributes);
+	copy_params(&state->solid_attributes, &parent->solid_attributes);
+	copy_params(&state->textures.params, &parent->textures.params);
+	copy_params(&state->bufs, &parent->bufs);
+
+	/* the solid program's color should come from our own state: */
+	p = find_param(&state->solid_uniforms, "uColor");
+	p->data = &state->clear.color[0];
+
+	state->ring = cmdbuf->ring;
+	state->draw_start = state->draw_end = NULL;
+	state->constbuf = cmdbuf->constbuf;
+	state->query.active = false;
+	state->query.bo = NULL;
+	state->profile.cur = NULL;
+	state->dirty = false;
+
+	if (cmdbuf->nbins != nbins) {
+		free(cmdbuf->bins);
+		cmdbuf->bins = calloc(nbins, sizeof(*cmdbuf->bins));
+		cmdbuf->nbins = nbins;
+	}
+	memset(cmdbuf->bins, 0, nbins * sizeof(*cmdbuf->bins));
+	state->render_target.bins = cmdbuf->bins;
+	state->render_target.batch_clear_seqno = 0;
+
+	/* like the ring, the previous recording must be done executing: */
+	fd_ringbuffer_reset(cmdbuf->ring);
+	fd_ringmarker_mark(cmdbuf->start);
+	fd_constbuf_reset(cmdbuf->constbuf);
+	fd_constbuf_retire(cmdbuf->constbuf);
+
+	cmdbuf->recording = true;
+
+	return state;
+}
+
+int fd_cmdbuf_end(struct fd_cmdbuf *cmdbuf)
+{
+	if (!cmdbuf->recording)
+		return -1;
+
+	fd_ringmarker_mark(cmdbuf->end);
+	cmdbuf->recording = false;
+
+	return 0;
+}
+
+/* stitch a recorded cmdbuf into the parent's cmdstream: */
+int fd_cmdbuf_execute(struct fd_state *state, struct fd_cmdbuf *cmdbuf)
+{
+	uint32_t i;
+
+	if (cmdbuf->recording || (cmdbuf->parent != state)) {
+		ERROR_MSG("invalid cmdbuf");
+		return -1;
+	}
+
+	if (!cmdbuf->state.dirty)
+		return 0;
+
+	/* render target must not have changed since the cmdbuf was
+	 * recorded:
+	 */
+	if (cmdbuf->state.render_target.surface != state->render_target.surface) {
+		ERROR_MSG("render target changed");
+		return -1;
+	}
+
+	OUT_IB(state->ring, cmdbuf->start, cmdbuf->end);
+
+	for (i = 0; i < cmdbuf->nbins; i++)
+		if (cmdbuf->bins[i].damaged)
+			state->render_target.bins[i].damaged = true;
+
+	/* we don't know what the cmdbuf left in the const file: */
+	fd_constbuf_reset(state->constbuf);
+
+	state->dirty = true;
+
+	return 0;
+}
+
+/* ************************************************************************* */
+
+static struct fd_surface * surface_new(struct fd_state *state,
+		uint32_t width, uint32_t height, enum a3xx_color_fmt color_format,
+		uint32_t nlevels, enum a3xx_tile_mode tile_mode)
 {
 	struct fd_surface *surface;
 	int cpp = color2cpp[color_format];
+	uint32_t l, size = 0, maxlevels = 1;
 
 	if (!cpp) {
 		ERROR_MSG("invalid color format: %d", color_format);
 		return NULL;
 	}
 
+	while ((maxlevels < FD_MAX_MIP_LEVELS) &&
+			(((width | height) >> maxlevels) != 0))
+		maxlevels++;
+
+	if (!nlevels)
+		nlevels = maxlevels;
+
+	if (nlevels > maxlevels) {
+		ERROR_MSG("too many levels for %ux%u: %u", width, height, nlevels);
+		return NULL;
+	}
+
 	surface = calloc(1, sizeof(*surface));
 	assert(surface);
-	surface->color  = color_format;
-	surface->width  = width;
-	surface->height = height;
-	surface->pitch  = ALIGN(width, 32);
-	surface->cpp    = cpp;
-
-	surface->bo = fd_bo_new(state->dev,
-			surface->pitch * surface->height * surface->cpp,
-			DRM_FREEDRENO_GEM_TYPE_KMEM);
+	surface->color   = color_format;
+	surface->width   = width;
+	surface->height  = height;
+	surface->pitch   = ALIGN(width, 32);
+	surface->cpp     = cpp;
+	surface->nlevels = nlevels;
+	surface->tile_mode = tile_mode;
+
+	/* levels are packed, each w/ it's own 32 pixel aligned pitch.  For
+	 * tiled surfaces the height is padded out to whole tiles too:
+	 */
+	for (l = 0; l < nlevels; l++) {
+		uint32_t lw = max(width >> l, 1);
+		uint32_t lh = max(height >> l, 1);
+
+		if (tile_mode != LINEAR)
+			lh = ALIGN(lh, TILE_H);
+
+		surface->levels[l].offset = size;
+		surface->levels[l].pitch  = ALIGN(lw, 32);
+
+		size += surface->levels[l].pitch * lh * cpp;
+	}
+
+	surface->bo = fd_bo_new(state->dev, size, DRM_FREEDRENO_GEM_TYPE_KMEM);
 	return surface;
 }
 
+/* nlevels of zero means the full mip chain, down to 1x1: */
+struct fd_surface * fd_surface_new_mip(struct fd_state *state,
+		uint32_t width, uint32_t height, enum a3xx_color_fmt color_format,
+		uint32_t nlevels)
+{
+	return surface_new(state, width, height, color_format, nlevels, LINEAR);
+}
+
+/* like fd_surface_new_mip(), but w/ TILE_32X32 layout.  Can be used as
+ * a texture or render target, but not posted to the winsys:
+ */
+struct fd_surface * fd_surface_new_tiled(struct fd_state *state,
+		uint32_t width, uint32_t height, enum a3xx_color_fmt color_format,
+		uint32_t nlevels)
+{
+	return surface_new(state, width, height, color_format, nlevels,
+			TILE_32X32);
+}
+
+struct fd_surface * fd_surface_new_fmt(struct fd_state *state,
+		uint32_t width, uint32_t height, enum a3xx_color_fmt color_format)
+{
+	return fd_surface_new_mip(state, width, height, color_format, 1);
+}
+
 struct fd_surface * fd_surface_new(struct fd_state *state,
 		uint32_t width, uint32_t height)
 {
@@ -1609,7 +2557,8 @@ struct fd_surface * fd_surface_new(struct fd_state *state,
 struct fd_surface * fd_surface_screen(struct fd_state *state,
 		uint32_t *width, uint32_t *height)
 {
-	return state->ws->get_surface(state->ws, width, height);
+	state->screen = state->ws->get_surface(state->ws, width, height);
+	return state->screen;
 }
 
 void fd_surface_del(struct fd_state *state, struct fd_surface *surface)
@@ -1622,52 +2571,210 @@ void fd_surface_del(struct fd_state *state, struct fd_surface *surface)
 	free(surface);
 }
 
-void fd_surface_upload(struct fd_surface *surface, const void *data)
+static uint8_t * level_map(struct fd_surface *surface, uint32_t level)
+{
+	return (uint8_t *)fd_bo_map(surface->bo) + surface->offset +
+			(level ? surface->levels[level].offset : 0);
+}
+
+static uint32_t level_pitch(struct fd_surface *surface, uint32_t level)
+{
+	return level ? surface->levels[level].pitch : surface->pitch;
+}
+
+void fd_surface_upload_level(struct fd_surface *surface, uint32_t level,
+		const void *data)
 {
 	uint32_t i;
-	uint8_t *surfp = fd_bo_map(surface->bo);
+	uint32_t width  = max(surface->width >> level, 1);
+	uint32_t height = max(surface->height >> level, 1);
+	uint32_t pitch  = level_pitch(surface, level);
+	uint8_t *surfp = level_map(surface, level);
 	const uint8_t *datap = data;
 
-	for (i = 0; i < surface->height; i++) {
-		memcpy(surfp, datap, surface->width * surface->cpp);
-		surfp += surface->pitch * surface->cpp;
-		datap += surface->width * surface->cpp;
+	assert(level < max(surface->nlevels, 1));
+
+	if (surface->tile_mode != LINEAR) {
+		fd_tile(surfp, pitch, data, width * surface->cpp,
+				width, height, surface->cpp);
+		return;
+	}
+
+	for (i = 0; i < height; i++) {
+		memcpy(surfp, datap, width * surface->cpp);
+		surfp += pitch * surface->cpp;
+		datap += width * surface->cpp;
 	}
 }
 
-static void attach_render_target(struct fd_state *state,
-		struct fd_surface *surface)
+void fd_surface_upload(struct fd_surface *surface, const void *data)
 {
-	uint32_t nbins_x = 1, nbins_y = 1;
-	uint32_t bin_w, bin_h;
-	uint32_t cpp = color2cpp[surface->color];
-	uint32_t gmem_size = state->gmemsize_bytes;
-	uint32_t max_width = 256;
+	fd_surface_upload_level(surface, 0, data);
+}
 
-	if ((state->rb_depth_control & A3XX_RB_DEPTH_CONTROL_Z_ENABLE) |
-			(state->rb_stencil_control & A3XX_RB_STENCIL_CONTROL_STENCIL_ENABLE)) {
-		gmem_size /= 2;
+/* for tiled surfaces, the downsampling is done on linear copies of
+ * each level, and the result re-tiled:
+ */
+static int gen_mipmaps_tiled(struct fd_surface *surface)
+{
+	uint32_t cpp = surface->cpp;
+	uint32_t l, w = surface->width, h = surface->height;
+	uint8_t *src, *dst;
+	int ret = 0;
+
+	src = malloc(w * h * cpp);
+	dst = malloc(max(w >> 1, 1) * max(h >> 1, 1) * cpp);
+	if (!src || !dst) {
+		ret = -1;
+		goto out;
 	}
 
-	state->render_target.surface = surface;
+	fd_untile(src, w * cpp, level_map(surface, 0), level_pitch(surface, 0),
+			w, h, cpp);
 
-	bin_w = ALIGN(surface->width, 32);
-	bin_h = ALIGN(surface->height, 32);
+	for (l = 1; l < surface->nlevels; l++) {
+		uint32_t lw = max(w >> 1, 1), lh = max(h >> 1, 1);
+		uint8_t *tmp;
 
-	/* first, find a bin width that satisfies the maximum width
-	 * restrictions:
-	 */
-	while (bin_w > max_width) {
-		nbins_x++;
-		bin_w = ALIGN(surface->width / nbins_x, 32);
+		ret = fd_mip_downsample(surface->color, src, w * cpp, w, h,
+				dst, lw * cpp);
+		if (ret)
+			break;
+
+		fd_tile(level_map(surface, l), level_pitch(surface, l),
+				dst, lw * cpp, lw, lh, cpp);
+
+		/* the next level is downsampled from this one, and the
+		 * buffers only shrink from here:
+		 */
+		tmp = src; src = dst; dst = tmp;
+		w = lw;
+		h = lh;
+	}
+
+out:
+	free(src);
+	free(dst);
+	return ret;
+}
+
+/* fill in levels 1..N from level 0: */
+int fd_surface_gen_mipmaps(struct fd_surface *surface)
+{
+	uint32_t l;
+
+	if (surface->tile_mode != LINEAR)
+		return gen_mipmaps_tiled(surface);
+
+	for (l = 1; l < surface->nlevels; l++) {
+		int ret = fd_mip_downsample(surface->color,
+				level_map(surface, l - 1),
+				level_pitch(surface, l - 1) * surface->cpp,
+				max(surface->width >> (l - 1), 1),
+				max(surface->height >> (l - 1), 1),
+				level_map(surface, l),
+				level_pitch(surface, l) * surface->cpp);
+		if (ret)
+			return ret;
 	}
 
-	/* then find a bin height that satisfies the memory constraints:
+	return 0;
+}
+
+/* bytes per pixel of GMEM needed for color and depth/stencil: */
+static void gmem_cpp(struct fd_state *state, struct fd_surface *surface,
+		uint32_t *cbuf_cpp, uint32_t *zsbuf_cpp)
+{
+	/* the render target is the single surface passed to
+	 * fd_make_current(), and the fs only writes SP_FS_MRT[0], so
+	 * there is exactly one color buffer in GMEM:
 	 */
-	while ((bin_w * bin_h * cpp) > gmem_size) {
-		nbins_y++;
-		bin_h = ALIGN(surface->height / nbins_y, 32);
+	assert(surface == state->render_target.surface);
+	*cbuf_cpp = color2cpp[surface->color];
+
+	if (state->rb_stencil_control & A3XX_RB_STENCIL_CONTROL_STENCIL_ENABLE)
+		*zsbuf_cpp = 4;     /* DEPTHX_24_8 */
+	else if (state->rb_depth_control & A3XX_RB_DEPTH_CONTROL_Z_ENABLE)
+		*zsbuf_cpp = 2;     /* DEPTHX_16 */
+	else
+		*zsbuf_cpp = 0;
+}
+
+/* depth/stencil buffer follows the color buffer(s) in GMEM: */
+static uint32_t zsbuf_base(uint32_t bin_w, uint32_t bin_h, uint32_t cbuf_cpp)
+{
+	return ALIGN(bin_w * bin_h * cbuf_cpp, 0x4000);
+}
+
+static bool bin_fits(struct fd_state *state, uint32_t bin_w, uint32_t bin_h,
+		uint32_t cbuf_cpp, uint32_t zsbuf_cpp)
+{
+	uint32_t size = bin_w * bin_h * cbuf_cpp;
+	if (zsbuf_cpp)
+		size = zsbuf_base(bin_w, bin_h, cbuf_cpp) + (bin_w * bin_h * zsbuf_cpp);
+	return size <= state->gmemsize_bytes;
+}
+
+/* Pick the bin layout.  Each bin replays the entire IB and pays for
+ * the gmem2mem setup, so first minimize the number of bins.  Among
+ * layouts with the same number of bins, prefer the one which wastes
+ * the fewest pixels of padding past the edge of the render target,
+ * and then the one with the widest bins (longer rows for resolve).
+ */
+static void calculate_bins(struct fd_state *state, struct fd_surface *surface,
+		uint32_t *nbins_x, uint32_t *nbins_y,
+		uint32_t *bin_w, uint32_t *bin_h)
+{
+	uint32_t width = ALIGN(surface->width, 32);
+	uint32_t height = ALIGN(surface->height, 32);
+	uint32_t max_width = 256;
+	uint32_t cbuf_cpp, zsbuf_cpp, nx, best_area = ~0;
+
+	gmem_cpp(state, surface, &cbuf_cpp, &zsbuf_cpp);
+
+	*nbins_x = *nbins_y = *bin_w = *bin_h = 0;
+
+	for (nx = (width + max_width - 1) / max_width; nx <= width / 32; nx++) {
+		uint32_t w = ALIGN((width + nx - 1) / nx, 32);
+		uint32_t h, ny, area;
+
+		/* different # of bins could round up to same bin width: */
+		if ((nx > 1) && (w == ALIGN((width + nx - 2) / (nx - 1), 32)))
+			continue;
+
+		/* tallest bin that fits: */
+		for (h = height; (h > 32) && !bin_fits(state, w, h, cbuf_cpp, zsbuf_cpp); )
+			h -= 32;
+		if (!bin_fits(state, w, h, cbuf_cpp, zsbuf_cpp))
+			continue;
+
+		/* then balance the rows: */
+		ny = (height + h - 1) / h;
+		h = ALIGN((height + ny - 1) / ny, 32);
+
+		area = (nx * w) * (ny * h);
+		if (!*nbins_x || ((nx * ny) < (*nbins_x * *nbins_y)) ||
+				(((nx * ny) == (*nbins_x * *nbins_y)) && (area < best_area))) {
+			*nbins_x = nx;
+			*nbins_y = ny;
+			*bin_w = w;
+			*bin_h = h;
+			best_area = area;
+		}
 	}
+}
+
+static void attach_render_target(struct fd_state *state,
+		struct fd_surface *surface)
+{
+	uint32_t nbins_x, nbins_y, bin_w, bin_h, cbuf_cpp, zsbuf_cpp, i;
+
+	state->render_target.surface = surface;
+
+	calculate_bins(state, surface, &nbins_x, &nbins_y, &bin_w, &bin_h);
+	assert(nbins_x && nbins_y);
+
+	gmem_cpp(state, surface, &cbuf_cpp, &zsbuf_cpp);
 
 	INFO_MSG("using %d bins of size %dx%d", nbins_x*nbins_y, bin_w, bin_h);
 
@@ -1681,6 +2788,21 @@ static void attach_render_target(struct fd_state *state,
 	state->render_target.nbins_y = nbins_y;
 	state->render_target.bin_w = bin_w;
 	state->render_target.bin_h = bin_h;
+	state->render_target.zsbuf_base = zsbuf_base(bin_w, bin_h, cbuf_cpp);
+
+	/* nothing is known about the contents of the new render target, and
+	 * the first post needs to copy all of it:
+	 */
+	free_swapchain(state);
+	free(state->render_target.bins);
+	state->render_target.bins = calloc(nbins_x * nbins_y,
+			sizeof(state->render_target.bins[0]));
+	for (i = 0; i < nbins_x * nbins_y; i++)
+		state->render_target.bins[i].unposted = true;
+	free(state->render_target.damage);
+	state->render_target.damage = calloc(nbins_x * nbins_y,
+			sizeof(state->render_target.damage[0]));
+	state->render_target.batch_clear_seqno = 0;
 }
 
 static void set_viewport(struct fd_state *state, uint32_t x, uint32_t y,
@@ -1704,6 +2826,8 @@ void fd_make_current(struct fd_state *state,
 	uint32_t bw, bh;
 	int i;
 
+	assert(!state->parent);
+
 	attach_render_target(state, surface);
 	set_viewport(state, 0, 0, surface->width, surface->height);
 
@@ -1855,11 +2979,11 @@ void fd_make_current(struct fd_state *state,
 	OUT_PKT0(ring, REG_A3XX_RB_DEPTH_INFO, 2);
 	if (state->rb_stencil_control & A3XX_RB_STENCIL_CONTROL_STENCIL_ENABLE) {
 		OUT_RING(ring, A3XX_RB_DEPTH_INFO_DEPTH_FORMAT(DEPTHX_24_8) |
-				A3XX_RB_DEPTH_INFO_DEPTH_BASE(bw * bh));
+				A3XX_RB_DEPTH_INFO_DEPTH_BASE(state->render_target.zsbuf_base));
 		OUT_RING(ring, A3XX_RB_DEPTH_PITCH(bw * 4));
 	} else {
 		OUT_RING(ring, A3XX_RB_DEPTH_INFO_DEPTH_FORMAT(DEPTHX_16) |
-				A3XX_RB_DEPTH_INFO_DEPTH_BASE(bw * bh));
+				A3XX_RB_DEPTH_INFO_DEPTH_BASE(state->render_target.zsbuf_base));
 		OUT_RING(ring, A3XX_RB_DEPTH_PITCH(bw * 2));
 	}
 
@@ -1910,6 +3034,7 @@ void fd_make_current(struct fd_state *state,
 	fd_ringbuffer_flush(ring);
 
 	fd_ringmarker_mark(state->draw_start);
+	fd_constbuf_reset(state->constbuf);
 }
 
 static int dump_hex(void *buf, uint32_t w, uint32_t h, uint32_t p, bool flt)
@@ -1940,11 +3065,39 @@ static int dump_hex(void *buf, uint32_t w, uint32_t h, uint32_t p, bool flt)
 
 }
 
+/* returns a linear copy of level 0 of a tiled surface, w/ the same
+ * pitch, or NULL on failure.  Caller frees:
+ */
+static void * untile_surface(struct fd_surface *surface)
+{
+	uint32_t pitch = surface->pitch * surface->cpp;
+	void *buf = malloc(pitch * surface->height);
+	if (!buf) {
+		ERROR_MSG("allocation failed");
+		return NULL;
+	}
+	fd_untile(buf, pitch, level_map(surface, 0), surface->pitch,
+			surface->width, surface->height, surface->cpp);
+	return buf;
+}
+
 /* really just for float32 buffers.. */
 int fd_dump_hex(struct fd_surface *surface)
 {
-	return dump_hex(fd_bo_map(surface->bo), surface->width,
-			surface->height, surface->pitch, true);
+	void *buf;
+	int ret;
+
+	if (surface->tile_mode == LINEAR)
+		return dump_hex(level_map(surface, 0), surface->width,
+				surface->height, surface->pitch, true);
+
+	buf = untile_surface(surface);
+	if (!buf)
+		return -1;
+	ret = dump_hex(buf, surface->width, surface->height,
+			surface->pitch, true);
+	free(buf);
+	return ret;
 }
 
 int fd_dump_hex_bo(struct fd_bo *bo, bool flt)
@@ -1955,15 +3108,28 @@ int fd_dump_hex_bo(struct fd_bo *bo, bool flt)
 
 int fd_dump_bmp(struct fd_surface *surface, const char *filename)
 {
-	return bmp_dump(fd_bo_map(surface->bo),
-			surface->width, surface->height,
-			surface->pitch * surface->cpp,
-			filename);
+	void *buf;
+	int ret;
+
+	if (surface->tile_mode == LINEAR)
+		return bmp_dump((char *)level_map(surface, 0),
+				surface->width, surface->height,
+				surface->pitch * surface->cpp,
+				filename);
+
+	buf = untile_surface(surface);
+	if (!buf)
+		return -1;
+	ret = bmp_dump(buf, surface->width, surface->height,
+			surface->pitch * surface->cpp, filename);
+	free(buf);
+	return ret;
 }
 
 int fd_query_start(struct fd_state *state)
 {
-	if (state->query.active)
+	/* TODO queries in cmdbufs: */
+	if (state->query.active || state->parent)
 		return -1;
 
 	state->query.active = true;
@@ -2042,3 +3208,218 @@ void fd_query_dump(struct fd_perfctrs *ctrs)
 	dump_ctr(ctrE);
 	dump_ctr(ctrF);
 }
+
+/* ************************************************************************* */
+
+/* Select the counters to sample, in addition to the gpu cycle count.
+ * Names are either a selectable name ("SP_FS_INSTRUCTIONS"), or block
+ * and selectable ("SP:SP_FS_INSTRUCTIONS" or "SP:18").  Counters can
+ * only be changed when there are no un-read profile results.
+ */
+int fd_profile_counters(struct fd_state *state,
+		const char * const *names, uint32_t n)
+{
+	uint32_t i;
+
+	if (state->parent || (state->profile.head != state->profile.tail)) {
+		ERROR_MSG("cannot change counters while profiling");
+		return -1;
+	}
+
+	fd_perfcntrs_reset(state->profile.ctrs);
+
+	for (i = 0; i < n; i++) {
+		if (fd_perfcntrs_add(state->profile.ctrs, names[i])) {
+			fd_perfcntrs_reset(state->profile.ctrs);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+int fd_profile_begin(struct fd_state *state)
+{
+	struct fd_profile_slot *slot;
+	uint32_t nslots = ARRAY_SIZE(state->profile.slots);
+
+	if (state->parent || state->profile.cur)
+		return -1;
+
+	if ((state->profile.head - state->profile.tail) >= nslots) {
+		ERROR_MSG("no free profile slots, results must be read first");
+		return -1;
+	}
+
+	slot = &state->profile.slots[state->profile.head++ % nslots];
+
+	if (!slot->bo) {
+		slot->bo = fd_bo_new(state->dev, sizeof(struct profile_buf),
+				DRM_FREEDRENO_GEM_TYPE_KMEM);
+	}
+
+	/* the slot was already read back, so the gpu is done with it: */
+	memset(fd_bo_map(slot->bo), 0, sizeof(struct profile_buf));
+
+	slot->state = PROFILE_ACTIVE;
+	slot->ncounters = fd_perfcntrs_count(state->profile.ctrs);
+	slot->ndraws = slot->ntiles = slot->dropped = 0;
+	slot->seqno = 0;
+
+	state->profile.cur = slot;
+
+	return 0;
+}
+
+int fd_profile_end(struct fd_state *state)
+{
+	struct fd_profile_slot *slot = state->profile.cur;
+
+	if (!slot || (slot->state != PROFILE_ACTIVE))
+		return -1;
+
+	slot->state = PROFILE_ENDED;
+
+	/* if nothing is pending, all the samples are already flushed: */
+	if (!state->dirty)
+		state->profile.cur = NULL;
+
+	return 0;
+}
+
+static void read_sample(struct profile_record *rec, uint32_t ncounters,
+		struct fd_profile_sample *sample)
+{
+	uint32_t i;
+
+	for (i = 0; i < ncounters; i++)
+		sample->ctr[i] = rec->end[i] - rec->begin[i];
+	sample->seqno = rec->seqno;
+}
+
+/* Read back the results of the oldest profile slot.  Returns zero on
+ * success, or if !wait, one if the results are not available yet.
+ */
+int fd_profile_read(struct fd_state *state, struct fd_profile *profile,
+		bool wait)
+{
+	uint32_t nslots = ARRAY_SIZE(state->profile.slots);
+	struct fd_profile_slot *slot;
+	struct profile_buf *buf;
+	uint32_t i, j;
+
+	if (state->profile.tail == state->profile.head)
+		return -1;
+
+	slot = &state->profile.slots[state->profile.tail % nslots];
+
+	if (slot->state != PROFILE_ENDED)
+		return -1;
+
+	if (slot == state->profile.cur) {
+		if (!wait)
+			return 1;
+		fd_flush(state);
+	}
+
+	buf = fd_bo_map(slot->bo);
+
+	if (!wait && ((int32_t)(*(volatile uint32_t *)&buf->seqno - slot->seqno) < 0))
+		return 1;
+
+	fd_bo_cpu_prep(slot->bo, state->pipe, DRM_FREEDRENO_PREP_READ);
+
+	memset(profile, 0, sizeof(*profile));
+
+	profile->ncounters = slot->ncounters;
+	profile->ndraws = slot->ndraws;
+	profile->ntiles = slot->ntiles;
+	profile->dropped = slot->dropped;
+
+	for (i = 0; i < slot->ncounters; i++)
+		profile->names[i] = fd_perfcntrs_name(state->profile.ctrs, i);
+
+	for (i = 0; i < slot->ndraws; i++)
+		read_sample(&buf->draws[i], slot->ncounters, &profile->draws[i]);
+
+	/* the tile passes include all the draws, so they add up to the
+	 * total:
+	 */
+	for (i = 0; i < slot->ntiles; i++) {
+		read_sample(&buf->tiles[i], slot->ncounters, &profile->tiles[i]);
+		for (j = 0; j < slot->ncounters; j++)
+			profile->total.ctr[j] += profile->tiles[i].ctr[j];
+	}
+	profile->total.seqno = buf->seqno;
+
+	fd_bo_cpu_fini(slot->bo);
+
+	slot->state = PROFILE_FREE;
+	state->profile.tail++;
+
+	return 0;
+}
+
+static void dump_sample(const char *name, uint32_t n,
+		struct fd_profile_sample *sample, uint32_t ncounters,
+		uint64_t total)
+{
+	uint32_t i;
+
+	printf("%s%-4u %5.1f%%", name, n,
+			100.0 * (double)sample->ctr[0] / (double)max(total, 1));
+	for (i = 0; i < ncounters; i++)
+		printf(" %12llu", (unsigned long long)sample->ctr[i]);
+	printf("\n");
+}
+
+void fd_profile_dump(struct fd_profile *profile)
+{
+	uint64_t total = profile->total.ctr[0];
+	uint32_t i, slowest[5], nslowest = 0;
+
+	printf("profile: %u draws, %u tiles, %llu cycles\n", profile->ndraws,
+			profile->ntiles, (unsigned long long)total);
+	if (profile->dropped)
+		printf("profile: %u draws not sampled\n", profile->dropped);
+
+	for (i = 0; i < profile->ncounters; i++)
+		printf("  c%u: %s\n", i, profile->names[i]);
+
+	printf("%-8s %6s", "", "%");
+	for (i = 0; i < profile->ncounters; i++)
+		printf("%10sc%-2u", "", i);
+	printf("\n");
+
+	for (i = 0; i < profile->ndraws; i++)
+		dump_sample("draw", i, &profile->draws[i],
+				profile->ncounters, total);
+
+	for (i = 0; i < profile->ntiles; i++)
+		dump_sample("tile", i, &profile->tiles[i],
+				profile->ncounters, total);
+
+	/* and the most expensive draws: */
+	for (i = 0; i < profile->ndraws; i++) {
+		uint64_t cycles = profile->draws[i].ctr[0];
+		uint32_t j;
+
+		if (nslowest < ARRAY_SIZE(slowest))
+			nslowest++;
+		else if (cycles <= profile->draws[slowest[nslowest - 1]].ctr[0])
+			continue;
+
+		/* insertion sort, most expensive first: */
+		for (j = nslowest - 1; (j > 0) &&
+				(cycles > profile->draws[slowest[j - 1]].ctr[0]); j--)
+			slowest[j] = slowest[j - 1];
+		slowest[j] = i;
+	}
+
+	for (i = 0; i < nslowest; i++) {
+		struct fd_profile_sample *s = &profile->draws[slowest[i]];
+		printf("slowest #%u: draw%u, %llu cycles (%.1f%%)\n", i,
+				slowest[i], (unsigned long long)s->ctr[0],
+				100.0 * (double)s->ctr[0] / (double)max(total, 1));
+	}
+}
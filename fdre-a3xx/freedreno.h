@@ -53,6 +53,21 @@ int fd_set_texture(struct fd_state *state, const char *name,
 		struct fd_surface *tex);
 int fd_set_buf(struct fd_state *state, const char *name, struct fd_bo *bo);
 
+/* look up a param's slot once, after link, then bind it by slot: */
+int fd_attribute_slot(struct fd_state *state, const char *name);
+int fd_uniform_slot(struct fd_state *state, const char *name);
+int fd_texture_slot(struct fd_state *state, const char *name);
+int fd_buf_slot(struct fd_state *state, const char *name);
+int fd_attribute_bo_slot(struct fd_state *state, int slot,
+		enum a3xx_vtx_fmt fmt, struct fd_bo * bo);
+int fd_attribute_pointer_slot(struct fd_state *state, int slot,
+		enum a3xx_vtx_fmt fmt, uint32_t count, const void *data);
+int fd_uniform_attach_slot(struct fd_state *state, int slot,
+		uint32_t size, uint32_t count, const void *data);
+int fd_set_texture_slot(struct fd_state *state, int slot,
+		struct fd_surface *tex);
+int fd_set_buf_slot(struct fd_state *state, int slot, struct fd_bo *bo);
+
 void fd_clear_color(struct fd_state *state, float color[4]);
 void fd_clear_stencil(struct fd_state *state, uint32_t s);
 void fd_clear_depth(struct fd_state *state, float depth);
@@ -67,6 +82,8 @@ int fd_stencil_func(struct fd_state *state, GLenum func,
 int fd_stencil_op(struct fd_state *state, GLenum sfail,
 		GLenum zfail, GLenum zpass);
 int fd_stencil_mask(struct fd_state *state, GLuint mask);
+int fd_scissor(struct fd_state *state, GLint x, GLint y,
+		GLsizei width, GLsizei height);
 int fd_tex_param(struct fd_state *state, GLenum name, GLint param);
 
 int fd_draw_elements(struct fd_state *state, GLenum mode, GLsizei count,
@@ -76,17 +93,42 @@ int fd_draw_arrays(struct fd_state *state, GLenum mode,
 int fd_run_compute(struct fd_state *state, uint32_t workdim,
 		uint32_t *globaloff, uint32_t *globalsize, uint32_t *localsize);
 
+/* record many dispatches of the current program in one submit, buf
+ * bindings and uniforms can be changed between dispatches:
+ */
+int fd_compute_begin(struct fd_state *state);
+int fd_compute_dispatch(struct fd_state *state, uint32_t workdim,
+		uint32_t *globaloff, uint32_t *globalsize, uint32_t *localsize);
+int fd_compute_end(struct fd_state *state);
+
 int fd_swap_buffers(struct fd_state *state);
 int fd_flush(struct fd_state *state);
 
+struct fd_cmdbuf;
+
+struct fd_cmdbuf * fd_cmdbuf_new(struct fd_state *state);
+void fd_cmdbuf_del(struct fd_cmdbuf *cmdbuf);
+struct fd_state * fd_cmdbuf_begin(struct fd_cmdbuf *cmdbuf);
+int fd_cmdbuf_end(struct fd_cmdbuf *cmdbuf);
+int fd_cmdbuf_execute(struct fd_state *state, struct fd_cmdbuf *cmdbuf);
+
 struct fd_surface * fd_surface_screen(struct fd_state *state,
 		uint32_t *width, uint32_t *height);
 struct fd_surface * fd_surface_new(struct fd_state *state,
 		uint32_t width, uint32_t height);
 struct fd_surface * fd_surface_new_fmt(struct fd_state *state,
 		uint32_t width, uint32_t height, enum a3xx_color_fmt color_format);
+struct fd_surface * fd_surface_new_mip(struct fd_state *state,
+		uint32_t width, uint32_t height, enum a3xx_color_fmt color_format,
+		uint32_t nlevels);
+struct fd_surface * fd_surface_new_tiled(struct fd_state *state,
+		uint32_t width, uint32_t height, enum a3xx_color_fmt color_format,
+		uint32_t nlevels);
 void fd_surface_del(struct fd_state *state, struct fd_surface *surface);
 void fd_surface_upload(struct fd_surface *surface, const void *data);
+void fd_surface_upload_level(struct fd_surface *surface, uint32_t level,
+		const void *data);
+int fd_surface_gen_mipmaps(struct fd_surface *surface);
 
 void fd_make_current(struct fd_state *state,
 		struct fd_surface *surface);
@@ -124,4 +166,38 @@ int fd_query_end(struct fd_state *state);
 int fd_query_read(struct fd_state *state, struct fd_perfctrs *ctrs);
 void fd_query_dump(struct fd_perfctrs *ctrs);
 
+/* per-draw/per-tile profiling.  Counters are selected by name (see
+ * perfcntr.c), and sampled around each draw and each tile pass between
+ * fd_profile_begin() and fd_profile_end().  Counter 0 is always the gpu
+ * cycle count.
+ */
+#define FD_PROFILE_MAX_COUNTERS 16
+#define FD_PROFILE_MAX_DRAWS    256
+#define FD_PROFILE_MAX_TILES    128
+
+struct fd_profile_sample {
+	uint64_t ctr[FD_PROFILE_MAX_COUNTERS];
+	/* seqno of the flush that (last) executed it: */
+	uint32_t seqno;
+};
+
+struct fd_profile {
+	uint32_t ncounters;
+	const char *names[FD_PROFILE_MAX_COUNTERS];
+	uint32_t ndraws, ntiles;
+	/* draws that were not sampled, because the slot was full: */
+	uint32_t dropped;
+	struct fd_profile_sample total;
+	struct fd_profile_sample draws[FD_PROFILE_MAX_DRAWS];
+	struct fd_profile_sample tiles[FD_PROFILE_MAX_TILES];
+};
+
+int fd_profile_counters(struct fd_state *state,
+		const char * const *names, uint32_t n);
+int fd_profile_begin(struct fd_state *state);
+int fd_profile_end(struct fd_state *state);
+int fd_profile_read(struct fd_state *state, struct fd_profile *profile,
+		bool wait);
+void fd_profile_dump(struct fd_profile *profile);
+
 #endif /* FREEDRENO_H_ */
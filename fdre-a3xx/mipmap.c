@@ -0,0 +1,370 @@
+/*
+ * Copyright (c) 2012 Rob Clark <robdclark@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef __ARM_NEON__
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "mipmap.h"
+
+/* The common case, a power-of-two 8888 or A8 texture (or 32F), is
+ * handled by the SIMD box filters, a full row of destination texels at
+ * a time.  Everything else goes through a generic path which converts
+ * rows to float, filters, and converts back.
+ */
+
+struct mip_format {
+	uint32_t ncomp;    /* components per texel */
+	enum {
+		COMP_UNORM8,
+		COMP_FLOAT16,
+		COMP_FLOAT32,
+	} type;
+};
+
+static int get_format(enum a3xx_color_fmt fmt, struct mip_format *f)
+{
+	switch (fmt) {
+	case RB_R8G8B8A8_UNORM:     f->ncomp = 4; f->type = COMP_UNORM8;  return 0;
+	case RB_R8G8B8_UNORM:       f->ncomp = 3; f->type = COMP_UNORM8;  return 0;
+	case RB_A8_UNORM:           f->ncomp = 1; f->type = COMP_UNORM8;  return 0;
+	case RB_R16G16B16A16_FLOAT: f->ncomp = 4; f->type = COMP_FLOAT16; return 0;
+	case RB_R32G32B32A32_FLOAT: f->ncomp = 4; f->type = COMP_FLOAT32; return 0;
+	default:
+		ERROR_MSG("unsupported mipmap format: %d", fmt);
+		return -1;
+	}
+}
+
+static float half_to_float(uint16_t h)
+{
+	union { uint32_t u; float f; } v;
+	uint32_t s = (h & 0x8000) << 16;
+	uint32_t e = (h >> 10) & 0x1f;
+	uint32_t m = h & 0x3ff;
+
+	if (e == 0x1f) {
+		v.u = s | 0x7f800000 | (m << 13);       /* inf/nan */
+	} else if (e) {
+		v.u = s | ((e + 112) << 23) | (m << 13);
+	} else {
+		/* zero/denorm: */
+		v.f = m * (1.0f / (1 << 24));
+		v.u |= s;
+	}
+
+	return v.f;
+}
+
+static uint16_t float_to_half(float f)
+{
+	union { uint32_t u; float f; } v = { .f = f };
+	uint16_t s = (v.u >> 16) & 0x8000;
+	int32_t e = ((v.u >> 23) & 0xff) - 112;
+	uint32_t m = v.u & 0x7fffff;
+
+	if (((v.u >> 23) & 0xff) == 0xff)
+		return s | 0x7c00 | (m ? 0x200 : 0);    /* inf/nan */
+	if (e >= 0x1f)
+		return s | 0x7c00;                      /* overflow */
+	if (e <= 0) {
+		/* denorm/underflow: */
+		if (e < -10)
+			return s;
+		m |= 0x800000;
+		return s | ((m + (1 << (13 - e))) >> (14 - e));
+	}
+
+	/* round to nearest: */
+	m += 0x1000;
+	if (m & 0x800000) {
+		m = 0;
+		if (++e >= 0x1f)
+			return s | 0x7c00;
+	}
+	return s | (e << 10) | (m >> 13);
+}
+
+static void row_to_float(const struct mip_format *f, const void *row,
+		uint32_t n, float *out)
+{
+	uint32_t i;
+
+	n *= f->ncomp;
+
+	switch (f->type) {
+	case COMP_UNORM8:
+		for (i = 0; i < n; i++)
+			out[i] = ((const uint8_t *)row)[i];
+		break;
+	case COMP_FLOAT16:
+		for (i = 0; i < n; i++)
+			out[i] = half_to_float(((const uint16_t *)row)[i]);
+		break;
+	case COMP_FLOAT32:
+		memcpy(out, row, n * 4);
+		break;
+	}
+}
+
+static void float_to_row(const struct mip_format *f, const float *in,
+		uint32_t n, void *row)
+{
+	uint32_t i;
+
+	n *= f->ncomp;
+
+	switch (f->type) {
+	case COMP_UNORM8:
+		for (i = 0; i < n; i++)
+			((uint8_t *)row)[i] = (uint8_t)min(max(in[i] + 0.5f, 0.0f), 255.0f);
+		break;
+	case COMP_FLOAT16:
+		for (i = 0; i < n; i++)
+			((uint16_t *)row)[i] = float_to_half(in[i]);
+		break;
+	case COMP_FLOAT32:
+		memcpy(row, in, n * 4);
+		break;
+	}
+}
+
+/* taps/weights for destination texel i along an axis of size n: */
+static uint32_t get_taps(uint32_t n, uint32_t i, uint32_t taps[3], float w[3])
+{
+	if (n == 1) {
+		taps[0] = 0;
+		w[0] = 1.0f;
+		return 1;
+	} else if (!(n & 1)) {
+		taps[0] = 2 * i;
+		taps[1] = 2 * i + 1;
+		w[0] = w[1] = 0.5f;
+		return 2;
+	} else {
+		taps[0] = 2 * i;
+		taps[1] = 2 * i + 1;
+		taps[2] = 2 * i + 2;
+		w[0] = w[2] = 0.25f;
+		w[1] = 0.5f;
+		return 3;
+	}
+}
+
+static int downsample_generic(const struct mip_format *f,
+		const uint8_t *src, uint32_t src_pitch, uint32_t src_w, uint32_t src_h,
+		uint8_t *dst, uint32_t dst_pitch)
+{
+	uint32_t dst_w = max(src_w >> 1, 1);
+	uint32_t dst_h = max(src_h >> 1, 1);
+	uint32_t nc = f->ncomp;
+	uint32_t x, y, c, t, u;
+	float *tmp, *vrow, *hrow;
+
+	tmp  = malloc(sizeof(float) * nc * (src_w + src_w + dst_w));
+	if (!tmp)
+		return -1;
+	vrow = tmp + (nc * src_w);
+	hrow = vrow + (nc * src_w);
+
+	for (y = 0; y < dst_h; y++) {
+		uint32_t vtaps[3], htaps[3];
+		float vw[3], hw[3];
+		uint32_t nv = get_taps(src_h, y, vtaps, vw);
+
+		/* vertical pass: */
+		memset(vrow, 0, sizeof(float) * nc * src_w);
+		for (t = 0; t < nv; t++) {
+			row_to_float(f, src + (vtaps[t] * src_pitch), src_w, tmp);
+			for (x = 0; x < (nc * src_w); x++)
+				vrow[x] += vw[t] * tmp[x];
+		}
+
+		/* horizontal pass: */
+		for (x = 0; x < dst_w; x++) {
+			uint32_t nh = get_taps(src_w, x, htaps, hw);
+			for (c = 0; c < nc; c++) {
+				float v = 0.0f;
+				for (u = 0; u < nh; u++)
+					v += hw[u] * vrow[(htaps[u] * nc) + c];
+				hrow[(x * nc) + c] = v;
+			}
+		}
+
+		float_to_row(f, hrow, dst_w, dst + (y * dst_pitch));
+	}
+
+	free(tmp);
+
+	return 0;
+}
+
+#if defined(__ARM_NEON__) || defined(__SSE2__)
+/* 2x2 box filter of n destination texels, for even sized levels.  Note
+ * that the two rounding averages of 8bit texels round up slightly, which
+ * is not noticeable:
+ */
+static void box_8888(const uint8_t *s0, const uint8_t *s1, uint8_t *d, uint32_t n)
+{
+	uint32_t x = 0;
+#ifdef __ARM_NEON__
+	for (; x + 4 <= n; x += 4) {
+		uint32x4x2_t a = vld2q_u32((const uint32_t *)(s0 + (x * 8)));
+		uint32x4x2_t b = vld2q_u32((const uint32_t *)(s1 + (x * 8)));
+		uint8x16_t ta = vrhaddq_u8(vreinterpretq_u8_u32(a.val[0]),
+				vreinterpretq_u8_u32(a.val[1]));
+		uint8x16_t tb = vrhaddq_u8(vreinterpretq_u8_u32(b.val[0]),
+				vreinterpretq_u8_u32(b.val[1]));
+		vst1q_u8(d + (x * 4), vrhaddq_u8(ta, tb));
+	}
+#else
+	for (; x + 4 <= n; x += 4) {
+		__m128i lo = _mm_avg_epu8(
+				_mm_loadu_si128((const __m128i *)(s0 + (x * 8))),
+				_mm_loadu_si128((const __m128i *)(s1 + (x * 8))));
+		__m128i hi = _mm_avg_epu8(
+				_mm_loadu_si128((const __m128i *)(s0 + (x * 8) + 16)),
+				_mm_loadu_si128((const __m128i *)(s1 + (x * 8) + 16)));
+		__m128 even = _mm_shuffle_ps(_mm_castsi128_ps(lo),
+				_mm_castsi128_ps(hi), _MM_SHUFFLE(2, 0, 2, 0));
+		__m128 odd  = _mm_shuffle_ps(_mm_castsi128_ps(lo),
+				_mm_castsi128_ps(hi), _MM_SHUFFLE(3, 1, 3, 1));
+		_mm_storeu_si128((__m128i *)(d + (x * 4)),
+				_mm_avg_epu8(_mm_castps_si128(even), _mm_castps_si128(odd)));
+	}
+#endif
+	for (; x < n; x++) {
+		uint32_t c;
+		for (c = 0; c < 4; c++) {
+			uint32_t a = (s0[(x * 8) + c] + s0[(x * 8) + 4 + c] + 1) >> 1;
+			uint32_t b = (s1[(x * 8) + c] + s1[(x * 8) + 4 + c] + 1) >> 1;
+			d[(x * 4) + c] = (a + b + 1) >> 1;
+		}
+	}
+}
+
+static void box_8(const uint8_t *s0, const uint8_t *s1, uint8_t *d, uint32_t n)
+{
+	uint32_t x = 0;
+#ifdef __ARM_NEON__
+	for (; x + 16 <= n; x += 16) {
+		uint8x16x2_t a = vld2q_u8(s0 + (x * 2));
+		uint8x16x2_t b = vld2q_u8(s1 + (x * 2));
+		vst1q_u8(d + x, vrhaddq_u8(vrhaddq_u8(a.val[0], a.val[1]),
+				vrhaddq_u8(b.val[0], b.val[1])));
+	}
+#else
+	const __m128i mask = _mm_set1_epi16(0x00ff);
+	for (; x + 16 <= n; x += 16) {
+		__m128i lo = _mm_avg_epu8(
+				_mm_loadu_si128((const __m128i *)(s0 + (x * 2))),
+				_mm_loadu_si128((const __m128i *)(s1 + (x * 2))));
+		__m128i hi = _mm_avg_epu8(
+				_mm_loadu_si128((const __m128i *)(s0 + (x * 2) + 16)),
+				_mm_loadu_si128((const __m128i *)(s1 + (x * 2) + 16)));
+		/* average each byte w/ it's odd neighbour, in the low byte: */
+		lo = _mm_and_si128(_mm_avg_epu8(lo, _mm_srli_epi16(lo, 8)), mask);
+		hi = _mm_and_si128(_mm_avg_epu8(hi, _mm_srli_epi16(hi, 8)), mask);
+		_mm_storeu_si128((__m128i *)(d + x), _mm_packus_epi16(lo, hi));
+	}
+#endif
+	for (; x < n; x++) {
+		uint32_t a = (s0[x * 2] + s0[(x * 2) + 1] + 1) >> 1;
+		uint32_t b = (s1[x * 2] + s1[(x * 2) + 1] + 1) >> 1;
+		d[x] = (a + b + 1) >> 1;
+	}
+}
+
+static void box_32f(const float *s0, const float *s1, float *d, uint32_t n)
+{
+	uint32_t x;
+	for (x = 0; x < n; x++) {
+#ifdef __ARM_NEON__
+		float32x4_t v = vaddq_f32(
+				vaddq_f32(vld1q_f32(s0 + (x * 8)), vld1q_f32(s0 + (x * 8) + 4)),
+				vaddq_f32(vld1q_f32(s1 + (x * 8)), vld1q_f32(s1 + (x * 8) + 4)));
+		vst1q_f32(d + (x * 4), vmulq_n_f32(v, 0.25f));
+#else
+		__m128 v = _mm_add_ps(
+				_mm_add_ps(_mm_loadu_ps(s0 + (x * 8)), _mm_loadu_ps(s0 + (x * 8) + 4)),
+				_mm_add_ps(_mm_loadu_ps(s1 + (x * 8)), _mm_loadu_ps(s1 + (x * 8) + 4)));
+		_mm_storeu_ps(d + (x * 4), _mm_mul_ps(v, _mm_set1_ps(0.25f)));
+#endif
+	}
+}
+
+static int downsample_box(enum a3xx_color_fmt fmt,
+		const uint8_t *src, uint32_t src_pitch, uint32_t src_w, uint32_t src_h,
+		uint8_t *dst, uint32_t dst_pitch)
+{
+	uint32_t dst_w = src_w >> 1;
+	uint32_t dst_h = src_h >> 1;
+	uint32_t y;
+
+	for (y = 0; y < dst_h; y++) {
+		const uint8_t *s0 = src + (2 * y * src_pitch);
+		const uint8_t *s1 = s0 + src_pitch;
+		uint8_t *d = dst + (y * dst_pitch);
+
+		switch (fmt) {
+		case RB_R8G8B8A8_UNORM:
+			box_8888(s0, s1, d, dst_w);
+			break;
+		case RB_A8_UNORM:
+			box_8(s0, s1, d, dst_w);
+			break;
+		case RB_R32G32B32A32_FLOAT:
+			box_32f((const float *)s0, (const float *)s1, (float *)d, dst_w);
+			break;
+		default:
+			return -1;
+		}
+	}
+
+	return 0;
+}
+#endif
+
+int fd_mip_downsample(enum a3xx_color_fmt fmt,
+		const void *src, uint32_t src_pitch, uint32_t src_w, uint32_t src_h,
+		void *dst, uint32_t dst_pitch)
+{
+	struct mip_format f;
+
+	if (get_format(fmt, &f))
+		return -1;
+
+#if defined(__ARM_NEON__) || defined(__SSE2__)
+	if (!(src_w & 1) && !(src_h & 1) &&
+			!downsample_box(fmt, src, src_pitch, src_w, src_h, dst, dst_pitch))
+		return 0;
+#endif
+
+	return downsample_generic(&f, src, src_pitch, src_w, src_h, dst, dst_pitch);
+}
@@ -0,0 +1,42 @@
+/*
+ * Copyright (c) 2012 Rob Clark <robdclark@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef MIPMAP_H_
+#define MIPMAP_H_
+
+#include "util.h"
+
+/* CPU mip-chain generation.  Generates the next smaller level (half the
+ * size, rounded down, but at least 1) from the given level.  Along each
+ * axis the filter is a 2 tap box if the source size is even, or a 3 tap
+ * (1/4, 1/2, 1/4) linear filter if it is odd, so that every source texel
+ * contributes.  Pitches are in bytes.
+ *
+ * Supported formats are the ones we can sample from (see color2fmt):
+ * 8888, 888, A8, 16F and 32F.  Returns -1 for anything else.
+ */
+int fd_mip_downsample(enum a3xx_color_fmt fmt,
+		const void *src, uint32_t src_pitch, uint32_t src_w, uint32_t src_h,
+		void *dst, uint32_t dst_pitch);
+
+#endif /* MIPMAP_H_ */
@@ -0,0 +1,380 @@
+/*
+ * Copyright (c) 2012 Rob Clark <robdclark@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "perfcntr.h"
+#include "ring.h"
+#include "util.h"
+
+#ifdef HAVE_RNN
+#include "rnnutil.h"
+#endif
+
+/* Each block has a number of counters, each with it's own select
+ * register (except for VBIF, where both counters share a single select
+ * register, and the VBIF power counters which are not selectable).  The
+ * select and counter registers are looked up by name in rnn (when we
+ * are built with rnn), as are the selectable names, using the enum type
+ * of the block's select register.  Without rnn, we fall back to the
+ * register addresses from the generated headers, and counters can only
+ * be selected by number (ie. "SP:18").
+ */
+struct fd_perfcntr_group {
+	const char *name;
+	const char *enumname;
+	uint32_t num;
+	/* name formats for the n'th select/counter reg: */
+	const char *select_fmt;
+	const char *counter_fmt;
+	/* fallback addresses, when we don't have rnn: */
+	uint32_t select_reg;
+	uint32_t counter_reg;
+	/* first select reg index (GRAS TSE/RAS share select regs): */
+	uint32_t select_base;
+	/* allocated counters: */
+	uint32_t allocated;
+};
+
+#define GROUP(_name, _enum, _num, _sel, _ctr, _selreg, _ctrreg, _base) { \
+		.name = _name, .enumname = _enum, .num = _num, \
+		.select_fmt = _sel, .counter_fmt = _ctr, \
+		.select_reg = _selreg, .counter_reg = _ctrreg, \
+		.select_base = _base, \
+	}
+
+static const struct fd_perfcntr_group groups[] = {
+	GROUP("CP", "a3xx_cp_perfcounter_select", 1,
+			"CP_PERFCOUNTER_SELECT", "RBBM_PERFCTR_CP_%d_LO",
+			REG_A3XX_CP_PERFCOUNTER_SELECT,
+			REG_A3XX_RBBM_PERFCTR_CP_0_LO, 0),
+	GROUP("RBBM", "a3xx_rbbm_perfcounter_select", 2,
+			"RBBM_PERFCOUNTER%d_SELECT", "RBBM_PERFCTR_RBBM_%d_LO",
+			REG_A3XX_RBBM_PERFCOUNTER0_SELECT,
+			REG_A3XX_RBBM_PERFCTR_RBBM_0_LO, 0),
+	GROUP("PC", "a3xx_pc_perfcounter_select", 4,
+			"PC_PERFCOUNTER%d_SELECT", "RBBM_PERFCTR_PC_%d_LO",
+			REG_A3XX_PC_PERFCOUNTER0_SELECT,
+			REG_A3XX_RBBM_PERFCTR_PC_0_LO, 0),
+	GROUP("VFD", "a3xx_vfd_perfcounter_select", 2,
+			"VFD_PERFCOUNTER%d_SELECT", "RBBM_PERFCTR_VFD_%d_LO",
+			REG_A3XX_VFD_PERFCOUNTER0_SELECT,
+			REG_A3XX_RBBM_PERFCTR_VFD_0_LO, 0),
+	GROUP("HLSQ", "a3xx_hlsq_perfcounter_select", 6,
+			"HLSQ_PERFCOUNTER%d_SELECT", "RBBM_PERFCTR_HLSQ_%d_LO",
+			REG_A3XX_HLSQ_PERFCOUNTER0_SELECT,
+			REG_A3XX_RBBM_PERFCTR_HLSQ_0_LO, 0),
+	GROUP("VPC", "a3xx_vpc_perfcounter_select", 2,
+			"VPC_PERFCOUNTER%d_SELECT", "RBBM_PERFCTR_VPC_%d_LO",
+			REG_A3XX_VPC_PERFCOUNTER0_SELECT,
+			REG_A3XX_RBBM_PERFCTR_VPC_0_LO, 0),
+	GROUP("TSE", "a3xx_gras_tse_perfcounter_select", 2,
+			"GRAS_PERFCOUNTER%d_SELECT", "RBBM_PERFCTR_TSE_%d_LO",
+			REG_A3XX_GRAS_PERFCOUNTER0_SELECT,
+			REG_A3XX_RBBM_PERFCTR_TSE_0_LO, 0),
+	GROUP("RAS", "a3xx_gras_ras_perfcounter_select", 2,
+			"GRAS_PERFCOUNTER%d_SELECT", "RBBM_PERFCTR_RAS_%d_LO",
+			REG_A3XX_GRAS_PERFCOUNTER0_SELECT,
+			REG_A3XX_RBBM_PERFCTR_RAS_0_LO, 2),
+	GROUP("UCHE", "a3xx_uche_perfcounter_select", 6,
+			"UCHE_PERFCOUNTER%d_SELECT", "RBBM_PERFCTR_UCHE_%d_LO",
+			REG_A3XX_UCHE_PERFCOUNTER0_SELECT,
+			REG_A3XX_RBBM_PERFCTR_UCHE_0_LO, 0),
+	GROUP("TP", "a3xx_tp_perfcounter_select", 6,
+			"TP_PERFCOUNTER%d_SELECT", "RBBM_PERFCTR_TP_%d_LO",
+			REG_A3XX_TP_PERFCOUNTER0_SELECT,
+			REG_A3XX_RBBM_PERFCTR_TP_0_LO, 0),
+	GROUP("SP", "a3xx_sp_perfcounter_select", 8,
+			"SP_PERFCOUNTER%d_SELECT", "RBBM_PERFCTR_SP_%d_LO",
+			REG_A3XX_SP_PERFCOUNTER0_SELECT,
+			REG_A3XX_RBBM_PERFCTR_SP_0_LO, 0),
+	GROUP("RB", "a3xx_rb_perfcounter_select", 2,
+			"RB_PERFCOUNTER%d_SELECT", "RBBM_PERFCTR_RB_%d_LO",
+			REG_A3XX_RB_PERFCOUNTER0_SELECT,
+			REG_A3XX_RBBM_PERFCTR_RB_0_LO, 0),
+	/* no enum for the VBIF selectables, so these are by number only: */
+	GROUP("VBIF", NULL, 2,
+			"VBIF_PERF_CNT_SEL", "VBIF_PERF_CNT%d_LO",
+			REG_A3XX_VBIF_PERF_CNT_SEL,
+			REG_A3XX_VBIF_PERF_CNT0_LO, 0),
+	GROUP("VBIF_PWR", NULL, 3,
+			NULL, "VBIF_PERF_PWR_CNT%d_LO",
+			0,
+			REG_A3XX_VBIF_PERF_PWR_CNT0_LO, 0),
+};
+
+#define GROUP_CP       0
+#define GROUP_VBIF     (ARRAY_SIZE(groups) - 2)
+#define GROUP_VBIF_PWR (ARRAY_SIZE(groups) - 1)
+
+struct fd_perfcntr {
+	char *name;
+	uint32_t group, idx;
+	uint32_t select_reg, select_val;
+	uint32_t counter_reg;     /* _LO, followed by _HI */
+};
+
+struct fd_perfcntrs {
+	struct fd_perfcntr_group groups[ARRAY_SIZE(groups)];
+	struct fd_perfcntr ctrs[MAX_PERFCNTRS];
+	uint32_t num;
+};
+
+#ifdef HAVE_RNN
+static struct rnn *rnn;
+
+static struct rnn * get_rnn(void)
+{
+	if (!rnn) {
+		rnn = rnn_new(1);
+		if (rnn)
+			rnn_load(rnn, "a3xx");
+	}
+	return rnn;
+}
+
+static uint32_t lookup_reg(const char *fmt, uint32_t n, uint32_t fallback)
+{
+	struct rnn *rnn = get_rnn();
+	char name[64];
+	uint32_t reg;
+
+	if (!rnn)
+		return fallback;
+
+	snprintf(name, sizeof(name), fmt, n);
+	reg = rnn_regbase(rnn, name);
+	if (!reg) {
+		WARN_MSG("could not find %s in rnn", name);
+		return fallback;
+	}
+
+	return reg;
+}
+
+static int lookup_selectable(const struct fd_perfcntr_group *g,
+		const char *name, uint32_t *val)
+{
+	struct rnn *rnn = get_rnn();
+	if (!rnn || !g->enumname)
+		return -1;
+	return rnn_enumval(rnn, g->enumname, name, val);
+}
+#else
+static uint32_t lookup_reg(const char *fmt, uint32_t n, uint32_t fallback)
+{
+	return fallback;
+}
+
+static int lookup_selectable(const struct fd_perfcntr_group *g,
+		const char *name, uint32_t *val)
+{
+	return -1;
+}
+#endif
+
+static int find_group(const char *name, size_t len)
+{
+	int i;
+	for (i = 0; i < ARRAY_SIZE(groups); i++)
+		if ((strlen(groups[i].name) == len) &&
+				!strncmp(groups[i].name, name, len))
+			return i;
+	return -1;
+}
+
+/* resolve "GROUP:SELECTABLE", "GROUP:<n>" or just "SELECTABLE": */
+static int resolve(const char *name, uint32_t *group, uint32_t *val)
+{
+	const char *sep = strchr(name, ':');
+	char *end;
+	int i;
+
+	if (sep) {
+		const char *sel = sep + 1;
+
+		i = find_group(name, sep - name);
+		if (i < 0) {
+			ERROR_MSG("invalid perfcounter group: %s", name);
+			return -1;
+		}
+
+		*group = i;
+
+		*val = strtoul(sel, &end, 0);
+		if ((end != sel) && !*end)
+			return 0;
+
+		if (!lookup_selectable(&groups[i], sel, val))
+			return 0;
+	} else {
+		for (i = 0; i < ARRAY_SIZE(groups); i++) {
+			if (!lookup_selectable(&groups[i], name, val)) {
+				*group = i;
+				return 0;
+			}
+		}
+	}
+
+#ifdef HAVE_RNN
+	ERROR_MSG("unknown perfcounter: %s", name);
+#else
+	ERROR_MSG("unknown perfcounter: %s (built without rnn, counters "
+			"must be selected by number)", name);
+#endif
+	return -1;
+}
+
+static int add(struct fd_perfcntrs *ctrs, const char *name,
+		uint32_t group, uint32_t val)
+{
+	struct fd_perfcntr_group *g = &ctrs->groups[group];
+	struct fd_perfcntr *ctr;
+
+	if (ctrs->num >= ARRAY_SIZE(ctrs->ctrs)) {
+		ERROR_MSG("too many perfcounters, cannot add %s", name);
+		return -1;
+	}
+
+	if (g->allocated >= g->num) {
+		ERROR_MSG("no free %s counters, cannot add %s", g->name, name);
+		return -1;
+	}
+
+	ctr = &ctrs->ctrs[ctrs->num++];
+	ctr->name = strdup(name);
+	ctr->group = group;
+	ctr->idx = g->allocated++;
+	ctr->select_val = val;
+	ctr->counter_reg = lookup_reg(g->counter_fmt, ctr->idx,
+			g->counter_reg + (2 * ctr->idx));
+	if (group == GROUP_VBIF) {
+		/* both counters share the one select reg: */
+		ctr->select_reg = lookup_reg(g->select_fmt, 0, g->select_reg);
+	} else if (g->select_fmt) {
+		uint32_t n = g->select_base + ctr->idx;
+		ctr->select_reg = lookup_reg(g->select_fmt, n, g->select_reg + n);
+	}
+
+	return 0;
+}
+
+struct fd_perfcntrs * fd_perfcntrs_new(void)
+{
+	struct fd_perfcntrs *ctrs = calloc(1, sizeof(*ctrs));
+	fd_perfcntrs_reset(ctrs);
+	return ctrs;
+}
+
+void fd_perfcntrs_del(struct fd_perfcntrs *ctrs)
+{
+	uint32_t i;
+	for (i = 0; i < ctrs->num; i++)
+		free(ctrs->ctrs[i].name);
+	free(ctrs);
+}
+
+void fd_perfcntrs_reset(struct fd_perfcntrs *ctrs)
+{
+	uint32_t i;
+
+	for (i = 0; i < ctrs->num; i++)
+		free(ctrs->ctrs[i].name);
+
+	memset(ctrs, 0, sizeof(*ctrs));
+	memcpy(ctrs->groups, groups, sizeof(groups));
+
+	add(ctrs, "cycles", GROUP_CP, CP_ALWAYS_COUNT);
+}
+
+int fd_perfcntrs_add(struct fd_perfcntrs *ctrs, const char *name)
+{
+	uint32_t group, val;
+
+	if (resolve(name, &group, &val))
+		return -1;
+
+	return add(ctrs, name, group, val);
+}
+
+uint32_t fd_perfcntrs_count(struct fd_perfcntrs *ctrs)
+{
+	return ctrs->num;
+}
+
+const char * fd_perfcntrs_name(struct fd_perfcntrs *ctrs, uint32_t n)
+{
+	return ctrs->ctrs[n].name;
+}
+
+void fd_perfcntrs_emit_select(struct fd_perfcntrs *ctrs,
+		struct fd_ringbuffer *ring)
+{
+	uint32_t vbif_sel = 0, vbif_en = 0;
+	uint32_t i;
+
+	for (i = 0; i < ctrs->num; i++) {
+		struct fd_perfcntr *ctr = &ctrs->ctrs[i];
+
+		if (ctr->group == GROUP_VBIF) {
+			vbif_sel |= ctr->select_val << (8 * ctr->idx);
+			vbif_en |= A3XX_VBIF_PERF_CNT_EN_CNT0 << ctr->idx;
+		} else if (ctr->group == GROUP_VBIF_PWR) {
+			vbif_en |= A3XX_VBIF_PERF_CNT_EN_PWRCNT0 << ctr->idx;
+		} else {
+			OUT_PKT0(ring, ctr->select_reg, 1);
+			OUT_RING(ring, ctr->select_val);
+		}
+	}
+
+	if (vbif_en) {
+		OUT_PKT0(ring, REG_A3XX_VBIF_PERF_CNT_SEL, 1);
+		OUT_RING(ring, vbif_sel);
+
+		OUT_PKT0(ring, REG_A3XX_VBIF_PERF_CNT_EN, 1);
+		OUT_RING(ring, vbif_en);
+	}
+
+	OUT_PKT0(ring, REG_A3XX_RBBM_PERFCTR_CTL, 1);
+	OUT_RING(ring, A3XX_RBBM_PERFCTR_CTL_ENABLE);
+}
+
+/* write (or accumulate) the current values of all the selected counters
+ * as an array of uint64_t at bo+offset:
+ */
+void fd_perfcntrs_emit_sample(struct fd_perfcntrs *ctrs,
+		struct fd_ringbuffer *ring, struct fd_bo *bo,
+		uint32_t offset, bool accumulate)
+{
+	uint32_t i;
+
+	for (i = 0; i < ctrs->num; i++) {
+		OUT_PKT3(ring, CP_REG_TO_MEM, 2);
+		OUT_RING(ring, CP_REG_TO_MEM_0_REG(ctrs->ctrs[i].counter_reg) |
+				CP_REG_TO_MEM_0_64B | CP_REG_TO_MEM_0_CNT(2 - 1) |
+				COND(accumulate, CP_REG_TO_MEM_0_ACCUMULATE));
+		OUT_RELOC(ring, bo, offset + (i * sizeof(uint64_t)), 0);
+	}
+}
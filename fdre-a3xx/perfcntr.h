@@ -0,0 +1,49 @@
+/*
+ * Copyright (c) 2012 Rob Clark <robdclark@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef PERFCNTR_H_
+#define PERFCNTR_H_
+
+#include "ring.h"
+
+/* A set of selected perfcounters.  The first counter in the set is
+ * always the CP "always count" counter, which is used as the clock
+ * (in gpu cycles) for profiling.
+ */
+struct fd_perfcntrs;
+
+#define MAX_PERFCNTRS 16
+
+struct fd_perfcntrs * fd_perfcntrs_new(void);
+void fd_perfcntrs_del(struct fd_perfcntrs *ctrs);
+void fd_perfcntrs_reset(struct fd_perfcntrs *ctrs);
+int fd_perfcntrs_add(struct fd_perfcntrs *ctrs, const char *name);
+uint32_t fd_perfcntrs_count(struct fd_perfcntrs *ctrs);
+const char * fd_perfcntrs_name(struct fd_perfcntrs *ctrs, uint32_t n);
+void fd_perfcntrs_emit_select(struct fd_perfcntrs *ctrs,
+		struct fd_ringbuffer *ring);
+void fd_perfcntrs_emit_sample(struct fd_perfcntrs *ctrs,
+		struct fd_ringbuffer *ring, struct fd_bo *bo,
+		uint32_t offset, bool accumulate);
+
+#endif /* PERFCNTR_H_ */
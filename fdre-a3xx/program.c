@@ -32,17 +32,99 @@
 #include "util.h"
 
 
+/* the different kinds of named parameters that get resolved to slots
+ * in the corresponding fd_parameters table at link time:
+ */
+#define MAX_CONST_DWORDS 512
+
+enum fd_param_type {
+	FD_PARAM_UNIFORM,
+	FD_PARAM_ATTRIBUTE,
+	FD_PARAM_BUF,
+	FD_PARAM_TEXTURE,
+	FD_PARAM_MAX,
+};
+
 struct fd_shader {
 	uint32_t bin[512];
 	uint32_t sizedwords;
 	struct fd_bo *bo;
 	struct ir3_shader_info info;
 	struct ir3_shader *ir;
+
+	/* index into the linked fd_parameters table, for each of the
+	 * shader's uniforms/attributes/bufs/samplers (in the same order
+	 * as in the ir):
+	 */
+	uint8_t slots[FD_PARAM_MAX][MAX_PARAMS];
+
+	/* unique id, assigned when the shader is attached, to identify the
+	 * shader's cached constant images:
+	 */
+	uint32_t id;
+};
+
+/* size of the bo that constants are streamed from: */
+#define CONST_STREAM_SIZE 0x10000
+
+/* number of cached constant images: */
+#define CONST_IMAGES      4
+
+struct fd_constbuf {
+	struct fd_state *state;
+
+	/* current stream bo, and offset (in dwords) of next upload: */
+	struct fd_bo *bo;
+	uint32_t *map;
+	uint32_t off;
+
+	/* stream bo's filled up since the last retire, which could still
+	 * be referenced by pending cmdstream:
+	 */
+	struct fd_bo **retired;
+	uint32_t nretired, maxretired;
+
+	/* shadow of the vert/frag const file contents, as of the last
+	 * uploads, so only what changed needs to be loaded:
+	 */
+	struct {
+		uint32_t dwords[MAX_CONST_DWORDS];
+		uint8_t valid[MAX_CONST_DWORDS / 4];
+		/* for vec4's holding buf addresses, the bo loaded to each
+		 * dword (NULL for plain consts), and whether any is set:
+		 */
+		struct fd_bo *bos[MAX_CONST_DWORDS];
+		uint8_t hasbo[MAX_CONST_DWORDS / 4];
+	} shadow[2];
+
+	/* recently packed constant images (immediates and uniforms at the
+	 * offsets they are loaded at), and the hash of the uniforms they
+	 * were packed from, so they only need to be repacked when some
+	 * uniform changed:
+	 */
+	struct fd_const_image {
+		uint32_t shader_id;
+		uint64_t hash;
+		uint32_t consts[MAX_CONST_DWORDS];
+		/* vec4 aligned range that is used: */
+		uint32_t base, end;
+	} images[CONST_IMAGES];
+	uint32_t next_image;
 };
 
 struct fd_program {
 	struct fd_state *state;
 	struct fd_shader vertex_shader, fragment_shader, compute_shader;
+
+	/* the parameter tables the slots were resolved against, or NULL
+	 * if not linked (yet), and the number of table entries used:
+	 */
+	struct fd_parameters *linked[FD_PARAM_MAX];
+	uint32_t nslots[FD_PARAM_MAX];
+
+	/* output registers, resolved when the shader is attached: */
+	uint32_t posregid, psizeregid, colorregid;
+	bool colorhalf;
 };
 
 static struct fd_shader *get_shader(struct fd_program *program,
@@ -64,10 +146,32 @@ struct fd_program * fd_program_new(struct fd_state *state)
 	return program;
 }
 
+static uint32_t getpos(struct fd_shader *shader, const char *name,
+		uint32_t default_regid)
+{
+	uint32_t i;
+	for (i = 0; i < shader->ir->outs_count; i++)
+		if (!strcmp(shader->ir->outs[i]->name, name))
+			return shader->ir->outs[i]->rstart->num;
+	return default_regid;
+}
+
+static bool ishalf(struct fd_shader *shader, const char *name)
+{
+	uint32_t i;
+	for (i = 0; i < shader->ir->outs_count; i++)
+		if (!strcmp(shader->ir->outs[i]->name, name))
+			return !!(shader->ir->outs[i]->rstart->flags & IR3_REG_HALF);
+	return 0;
+}
+
+static uint32_t shader_id;
+
 int fd_program_attach_asm(struct fd_program *program,
 		enum fd_shader_type type, const char *src)
 {
 	struct fd_shader *shader = get_shader(program, type);
+	unsigned cache_flags = 0;
 	int sizedwords;
 
 	if (shader->ir)
@@ -75,31 +179,170 @@ int fd_program_attach_asm(struct fd_program *program,
 
 	memset(shader, 0, sizeof(*shader));
 
-	shader->ir = fd_asm_parse(src);
+	/* slots need to be resolved again for the new shader: */
+	memset(program->linked, 0, sizeof(program->linked));
+	memset(program->nslots, 0, sizeof(program->nslots));
+
+	shader->id = __sync_add_and_fetch(&shader_id, 1);
+
+	if (getenv("FD_ASM_SCHED"))
+		cache_flags |= IR3_CACHE_SCHED;
+
+	shader->ir = ir3_cache_load(src, cache_flags, shader->bin,
+			ARRAY_SIZE(shader->bin), &sizedwords, &shader->info);
 	if (!shader->ir) {
-		ERROR_MSG("parse failed");
-		return -1;
-	}
-	sizedwords = ir3_shader_assemble(shader->ir, shader->bin,
-			ARRAY_SIZE(shader->bin), &shader->info);
-	if (sizedwords <= 0) {
-		ERROR_MSG("assembler failed");
-		return -1;
+		shader->ir = fd_asm_parse(src);
+		if (!shader->ir) {
+			ERROR_MSG("parse failed");
+			return -1;
+		}
+		if ((cache_flags & IR3_CACHE_SCHED) &&
+				ir3_shader_schedule(shader->ir)) {
+			ERROR_MSG("scheduler failed");
+			return -1;
+		}
+		sizedwords = ir3_shader_assemble(shader->ir, shader->bin,
+				ARRAY_SIZE(shader->bin), &shader->info);
+		if (sizedwords <= 0) {
+			ERROR_MSG("assembler failed");
+			return -1;
+		}
+		ir3_cache_store(src, cache_flags, shader->ir, shader->bin,
+				sizedwords, &shader->info);
 	}
 	shader->sizedwords = sizedwords;
 
 	shader->bo = fd_attribute_bo_new(program->state,
 			sizedwords * 4, shader->bin);
 
+	switch (type) {
+	case FD_SHADER_VERTEX:
+		program->posregid   = getpos(shader, "gl_Position", 0);
+		program->psizeregid = getpos(shader, "gl_PointSize", (63 << 2));
+		break;
+	case FD_SHADER_FRAGMENT:
+		program->colorregid = getpos(shader, "gl_FragColor", 0);
+		program->colorhalf  = ishalf(shader, "gl_FragColor");
+		break;
+	case FD_SHADER_COMPUTE:
+		break;
+	}
+
 	return 0;
 }
 
-struct ir3_sampler ** fd_program_samplers(struct fd_program *program,
+static uint32_t param_count(struct fd_shader *shader, enum fd_param_type type)
+{
+	switch (type) {
+	case FD_PARAM_UNIFORM:   return shader->ir->uniforms_count;
+	case FD_PARAM_ATTRIBUTE: return shader->ir->attributes_count;
+	case FD_PARAM_BUF:       return shader->ir->bufs_count;
+	case FD_PARAM_TEXTURE:   return shader->ir->samplers_count;
+	default:                 break;
+	}
+	assert(0);
+	return 0;
+}
+
+static const char * param_name(struct fd_shader *shader,
+		enum fd_param_type type, uint32_t n)
+{
+	switch (type) {
+	case FD_PARAM_UNIFORM:   return shader->ir->uniforms[n]->name;
+	case FD_PARAM_ATTRIBUTE: return shader->ir->attributes[n]->name;
+	case FD_PARAM_BUF:       return shader->ir->bufs[n]->name;
+	case FD_PARAM_TEXTURE:   return shader->ir->samplers[n]->name;
+	default:                 break;
+	}
+	assert(0);
+	return NULL;
+}
+
+static int link_params(struct fd_program *program, enum fd_param_type type,
+		struct fd_parameters *params)
+{
+	enum fd_shader_type t;
+	uint32_t nslots = 0;
+
+	if (!params || (program->linked[type] == params))
+		return 0;
+
+	/* a copy of the table that we are linked against (see
+	 * fd_cmdbuf_begin()) has the same slots, as long as they
+	 * existed at the time of the copy.  Otherwise we'd need to
+	 * relink, which can't be done while recording, since the
+	 * program can be in use by other threads:
+	 */
+	if (params->parent) {
+		if ((program->linked[type] == params->parent) &&
+				(program->nslots[type] <= params->nparent))
+			return 0;
+		ERROR_MSG("program not linked before recording");
+		return -1;
+	}
+
+	for (t = FD_SHADER_VERTEX; t <= FD_SHADER_COMPUTE; t++) {
+		struct fd_shader *shader = get_shader(program, t);
+		uint32_t i, n;
+
+		if (!shader->ir)
+			continue;
+
+		n = param_count(shader, type);
+		if (n > MAX_PARAMS) {
+			ERROR_MSG("too many params: %u", n);
+			return -1;
+		}
+
+		for (i = 0; i < n; i++) {
+			struct fd_param *p = find_param(params,
+					param_name(shader, type, i));
+			if (!p)
+				return -1;
+			shader->slots[type][i] = p - params->params;
+			nslots = max(nslots, shader->slots[type][i] + 1);
+		}
+	}
+
+	program->linked[type] = params;
+	program->nslots[type] = nslots;
+
+	return 0;
+}
+
+/* Resolve the program's named parameters to slots in the passed
+ * parameter tables, so nothing needs to be looked up by name when
+ * emitting state.  Params which are not bound yet get a slot allocated,
+ * which is filled in when they are later bound.  Since slots are never
+ * removed from a table, this only needs to be redone when a shader is
+ * (re)attached, or the program is used with a different table.
+ */
+int fd_program_link(struct fd_program *program,
+		struct fd_parameters *uniforms, struct fd_parameters *attr,
+		struct fd_parameters *bufs, struct fd_parameters *textures)
+{
+	if (link_params(program, FD_PARAM_UNIFORM, uniforms) ||
+			link_params(program, FD_PARAM_ATTRIBUTE, attr) ||
+			link_params(program, FD_PARAM_BUF, bufs) ||
+			link_params(program, FD_PARAM_TEXTURE, textures)) {
+		ERROR_MSG("link failed");
+		return -1;
+	}
+	return 0;
+}
+
+const uint8_t * fd_program_sampler_slots(struct fd_program *program,
 		enum fd_shader_type type, int *cnt)
 {
 	struct fd_shader *shader = get_shader(program, type);
 	*cnt = shader->ir->samplers_count;
-	return shader->ir->samplers;
+	return shader->slots[FD_PARAM_TEXTURE];
+}
+
+static struct fd_param * get_param(struct fd_parameters *params,
+		struct fd_shader *shader, enum fd_param_type type, uint32_t n)
+{
+	return &params->params[shader->slots[type][n]];
 }
 
 uint32_t fd_program_outloc(struct fd_program *program)
@@ -111,25 +354,6 @@ uint32_t fd_program_outloc(struct fd_program *program)
 	return 8 + (4 * vs->ir->varyings_count);
 }
 
-static uint32_t getpos(struct fd_shader *shader, const char *name,
-		uint32_t default_regid)
-{
-	uint32_t i;
-	for (i = 0; i < shader->ir->outs_count; i++)
-		if (!strcmp(shader->ir->outs[i]->name, name))
-			return shader->ir->outs[i]->rstart->num;
-	return default_regid;
-}
-
-static bool ishalf(struct fd_shader *shader, const char *name)
-{
-	uint32_t i;
-	for (i = 0; i < shader->ir->outs_count; i++)
-		if (!strcmp(shader->ir->outs[i]->name, name))
-			return !!(shader->ir->outs[i]->rstart->flags & IR3_REG_HALF);
-	return 0;
-}
-
 static uint32_t instrlen(struct fd_shader *shader)
 {
 	/* the instructions length is in units of instruction groups
@@ -186,7 +410,7 @@ static void emit_vtx_fetch(struct fd_ringbuffer *ring,
 	for (i = 0; i < shader->ir->attributes_count; i++) {
 		bool switchnext = (i != (shader->ir->attributes_count - 1));
 		struct ir3_attribute *a = shader->ir->attributes[i];
-		struct fd_param *p = find_param(attr, a->name);
+		struct fd_param *p = get_param(attr, shader, FD_PARAM_ATTRIBUTE, i);
 		uint32_t s = fmt2size(p->fmt);
 
 		OUT_PKT0(ring, REG_A3XX_VFD_FETCH(i), 2);
@@ -219,39 +443,124 @@ static struct fd_bo *get_buf(struct fd_shader *shader,
 	for (i = 0; i < shader->ir->bufs_count; i++) {
 		struct ir3_buf *b = shader->ir->bufs[i];
 
-		if (b->cstart->num == num) {
-			struct fd_param *p = find_param(bufs, b->name);
-			if (p)
-				return p->bo;
-		}
+		if (b->cstart->num == num)
+			return get_param(bufs, shader, FD_PARAM_BUF, i)->bo;
 	}
 
 	return NULL;
 }
 
-static void emit_uniconst(struct fd_ringbuffer *ring,
-		struct fd_shader *shader, struct fd_parameters *uniforms,
-		struct fd_parameters *bufs, enum adreno_state_block state_block)
+static struct fd_bo *stream_bo_new(struct fd_constbuf *constbuf)
+{
+	return fd_attribute_bo_new(constbuf->state, CONST_STREAM_SIZE, NULL);
+}
+
+struct fd_constbuf * fd_constbuf_new(struct fd_state *state)
+{
+	struct fd_constbuf *constbuf = calloc(1, sizeof(*constbuf));
+	constbuf->state = state;
+	constbuf->bo = stream_bo_new(constbuf);
+	constbuf->map = fd_bo_map(constbuf->bo);
+	return constbuf;
+}
+
+void fd_constbuf_del(struct fd_constbuf *constbuf)
 {
-	static uint32_t buf[512]; /* cheesy, but test code isn't multithreaded */
+	fd_constbuf_retire(constbuf);
+	free(constbuf->retired);
+	fd_bo_del(constbuf->bo);
+	free(constbuf);
+}
+
+/* called once the cmdstream the constants were uploaded for has been
+ * flushed and completed, so the filled up stream bo's can be freed and
+ * the current one reused from the start:
+ */
+void fd_constbuf_retire(struct fd_constbuf *constbuf)
+{
+	uint32_t i;
+
+	for (i = 0; i < constbuf->nretired; i++)
+		fd_bo_del(constbuf->retired[i]);
+	constbuf->nretired = 0;
+	constbuf->off = 0;
+}
+
+/* forget what we think is in the const file, for when starting a new
+ * cmdstream (ie. we can't know what the previous one left behind):
+ */
+void fd_constbuf_reset(struct fd_constbuf *constbuf)
+{
+	memset(constbuf->shadow, 0, sizeof(constbuf->shadow));
+}
+
+static uint32_t shadow_idx(enum adreno_state_block state_block)
+{
+	switch (state_block) {
+	case SB_VERT_SHADER: return 0;
+	case SB_FRAG_SHADER: return 1;
+	default:             break;
+	}
+	assert(0);
+	return 0;
+}
+
+/* hash of everything that goes into the packed constants: */
+static uint64_t hash_uniforms(struct fd_shader *shader,
+		struct fd_parameters *uniforms)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;   /* FNV-1a */
+	uint32_t i, j, n;
+
+#define HASH(v) do { hash ^= (v); hash *= 0x100000001b3ULL; } while (0)
+
+	HASH((uintptr_t)uniforms);
+
+	for (i = 0; i < shader->ir->uniforms_count; i++) {
+		struct fd_param *p = get_param(uniforms, shader, FD_PARAM_UNIFORM, i);
+		const uint32_t *dwords = p->data;
+
+		HASH((uintptr_t)p->data);
+		HASH(p->size);
+		HASH(p->count);
+
+		n = p->size * p->count;
+		for (j = 0; j < n; j++)
+			HASH(dwords[j]);
+	}
+
+#undef HASH
+
+	return hash;
+}
+
+/* pack immediates and uniforms into a constant image: */
+static void pack_uniconst(struct fd_const_image *image,
+		struct fd_shader *shader, struct fd_parameters *uniforms)
+{
+	uint32_t *buf = image->consts;
 	uint32_t i, j, k, sz = 0, base = ~0;
 
-	memset(buf, 0, sizeof(buf));
+	memset(buf, 0, sizeof(image->consts));
 
 	for (i = 0; i < shader->ir->consts_count; i++) {
 		struct ir3_const *c = shader->ir->consts[i];
 		uint32_t off = c->cstart->num;
+		assert((off + ARRAY_SIZE(c->val)) <= ARRAY_SIZE(image->consts));
 		base = min(base, off);
 		memcpy(&buf[off], c->val, sizeof(c->val));
-		sz = max(sz, off + (sizeof(c->val) / sizeof(buf[0])));
+		sz = max(sz, off + ARRAY_SIZE(c->val));
 	}
 
 	for (i = 0; i < shader->ir->uniforms_count; i++) {
 		struct ir3_uniform *u = shader->ir->uniforms[i];
-		struct fd_param *p = find_param(uniforms, u->name);
+		struct fd_param *p = get_param(uniforms, shader, FD_PARAM_UNIFORM, i);
 		const uint32_t *dwords = p->data;
 		uint32_t off = u->cstart->num;
 
+		assert((off + (p->count * ALIGN(p->size, 4))) <=
+				ARRAY_SIZE(image->consts));
+
 		base = min(base, off);
 
 		for (j = 0; j < p->count; j++) {
@@ -265,38 +574,192 @@ static void emit_uniconst(struct fd_ringbuffer *ring,
 		sz = max(sz, off);
 	}
 
-	/* don't forget buf's: */
+	/* don't forget buf's (which are emitted separately, since they
+	 * need a reloc):
+	 */
 	for (i = 0; i < shader->ir->bufs_count; i++) {
 		struct ir3_buf *b = shader->ir->bufs[i];
 		uint32_t off = b->cstart->num;
 		base = min(base, off);
-		sz = max(sz, off);
+		sz = max(sz, off + 1);
 	}
 
-	/* if no constants, don't emit the CP_LOAD_STATE */
-	if (sz == 0)
-		return;
-
 	/* align things to vec4: */
-	base &= ~0x3;
-	sz = ALIGN(sz, 4);
-	sz -= base;
+	if (sz) {
+		base &= ~0x3;
+		sz = ALIGN(sz, 4);
+	} else {
+		base = 0;
+	}
 
-	OUT_PKT3(ring, CP_LOAD_STATE, 2 + sz);
-	OUT_RING(ring, CP_LOAD_STATE_0_DST_OFF(base/2) |
-			CP_LOAD_STATE_0_STATE_SRC(SS_DIRECT) |
+	image->base = base;
+	image->end  = sz;
+}
+
+/* find the shader's constant image, repacking it if needed: */
+static struct fd_const_image * get_image(struct fd_constbuf *constbuf,
+		struct fd_shader *shader, struct fd_parameters *uniforms)
+{
+	uint64_t hash = hash_uniforms(shader, uniforms);
+	struct fd_const_image *image = NULL;
+	uint32_t i;
+
+	for (i = 0; i < ARRAY_SIZE(constbuf->images); i++) {
+		if (constbuf->images[i].shader_id == shader->id) {
+			image = &constbuf->images[i];
+			break;
+		}
+	}
+
+	if (image && (image->hash == hash))
+		return image;
+
+	if (!image) {
+		image = &constbuf->images[constbuf->next_image];
+		constbuf->next_image = (constbuf->next_image + 1) %
+				ARRAY_SIZE(constbuf->images);
+	}
+
+	pack_uniconst(image, shader, uniforms);
+	image->shader_id = shader->id;
+	image->hash = hash;
+
+	return image;
+}
+
+/* upload a range of vec4's from a constant image, via the constant
+ * stream bo:
+ */
+static void emit_const_range(struct fd_ringbuffer *ring,
+		struct fd_constbuf *constbuf, struct fd_const_image *image,
+		enum adreno_state_block state_block, uint32_t off, uint32_t sz)
+{
+	uint32_t *shadow = constbuf->shadow[shadow_idx(state_block)].dwords;
+	uint8_t *valid = constbuf->shadow[shadow_idx(state_block)].valid;
+	uint8_t *hasbo = constbuf->shadow[shadow_idx(state_block)].hasbo;
+	uint32_t i;
+
+	/* the constants for earlier draws could still be unread, so each
+	 * upload gets it's own range of the stream bo.  When it is full,
+	 * start a new one, and keep the old one around until it is no
+	 * longer referenced, see fd_constbuf_retire():
+	 */
+	if ((constbuf->off + sz) > (CONST_STREAM_SIZE / 4)) {
+		if (constbuf->nretired == constbuf->maxretired) {
+			constbuf->maxretired = max(2 * constbuf->maxretired, 4);
+			constbuf->retired = realloc(constbuf->retired,
+					constbuf->maxretired * sizeof(constbuf->retired[0]));
+		}
+		constbuf->retired[constbuf->nretired++] = constbuf->bo;
+		constbuf->bo  = stream_bo_new(constbuf);
+		constbuf->map = fd_bo_map(constbuf->bo);
+		constbuf->off = 0;
+	}
+
+	memcpy(&constbuf->map[constbuf->off], &image->consts[off], sz * 4);
+
+	OUT_PKT3(ring, CP_LOAD_STATE, 2);
+	OUT_RING(ring, CP_LOAD_STATE_0_DST_OFF(off/2) |
+			CP_LOAD_STATE_0_STATE_SRC(SS_INDIRECT) |
 			CP_LOAD_STATE_0_STATE_BLOCK(state_block) |
 			CP_LOAD_STATE_0_NUM_UNIT(sz/2));
-	OUT_RING(ring, CP_LOAD_STATE_1_STATE_TYPE(ST_CONSTANTS) |
-			CP_LOAD_STATE_1_EXT_SRC_ADDR(0));
-	for (i = 0; i < sz; i++) {
-		struct fd_bo *bo = get_buf(shader, bufs, i + base);
-		if (bo) {
-			OUT_RELOC(ring, bo, 0, 0);
-		} else {
-			OUT_RING(ring, buf[i]);
+	OUT_RELOC(ring, constbuf->bo, constbuf->off * 4,
+			CP_LOAD_STATE_1_STATE_TYPE(ST_CONSTANTS));
+
+	constbuf->off += sz;
+
+	memcpy(&shadow[off], &image->consts[off], sz * 4);
+	for (i = off / 4; i < (off + sz) / 4; i++) {
+		valid[i] = true;
+		hasbo[i] = false;
+	}
+}
+
+static bool is_buf_vec4(struct fd_shader *shader, uint32_t off)
+{
+	uint32_t i;
+	for (i = 0; i < shader->ir->bufs_count; i++)
+		if ((shader->ir->bufs[i]->cstart->num & ~0x3) == off)
+			return true;
+	return false;
+}
+
+/* returns true if any of the vec4's holding buf addresses was loaded: */
+static bool emit_uniconst(struct fd_ringbuffer *ring,
+		struct fd_shader *shader, struct fd_parameters *uniforms,
+		struct fd_parameters *bufs, struct fd_constbuf *constbuf,
+		enum adreno_state_block state_block)
+{
+	uint32_t *shadow = constbuf->shadow[shadow_idx(state_block)].dwords;
+	uint8_t *valid = constbuf->shadow[shadow_idx(state_block)].valid;
+	struct fd_bo **bos = constbuf->shadow[shadow_idx(state_block)].bos;
+	uint8_t *hasbo = constbuf->shadow[shadow_idx(state_block)].hasbo;
+	struct fd_const_image *image = get_image(constbuf, shader, uniforms);
+	uint32_t i, j, start = ~0;
+	bool bufs_changed = false;
+
+	/* if no constants, don't emit the CP_LOAD_STATE */
+	if (image->end == 0)
+		return false;
+
+	/* upload the vec4's which differ from what was last loaded (the
+	 * ones containing buf's are handled below):
+	 */
+	for (i = image->base; i <= image->end; i += 4) {
+		bool dirty = (i < image->end) &&
+				!is_buf_vec4(shader, i) && (!valid[i / 4] || hasbo[i / 4] ||
+						memcmp(&shadow[i], &image->consts[i], 16));
+		if (dirty && (start == ~0)) {
+			start = i;
+		} else if (!dirty && (start != ~0)) {
+			emit_const_range(ring, constbuf, image, state_block,
+					start, i - start);
+			start = ~0;
 		}
 	}
+
+	/* buf's need to be emitted directly, since they need a reloc.  But
+	 * skip the ones where the same bo's (and consts) are still loaded:
+	 */
+	for (i = 0; i < shader->ir->bufs_count; i++) {
+		uint32_t off = shader->ir->bufs[i]->cstart->num & ~0x3;
+		struct fd_bo *bo[4];
+		bool dirty = !valid[off / 4] || !hasbo[off / 4];
+
+		for (j = 0; j < 4; j++) {
+			bo[j] = get_buf(shader, bufs, off + j);
+			if ((bos[off + j] != bo[j]) ||
+					(!bo[j] && (shadow[off + j] != image->consts[off + j])))
+				dirty = true;
+		}
+
+		if (!dirty)
+			continue;
+
+		OUT_PKT3(ring, CP_LOAD_STATE, 2 + 4);
+		OUT_RING(ring, CP_LOAD_STATE_0_DST_OFF(off/2) |
+				CP_LOAD_STATE_0_STATE_SRC(SS_DIRECT) |
+				CP_LOAD_STATE_0_STATE_BLOCK(state_block) |
+				CP_LOAD_STATE_0_NUM_UNIT(4/2));
+		OUT_RING(ring, CP_LOAD_STATE_1_STATE_TYPE(ST_CONSTANTS) |
+				CP_LOAD_STATE_1_EXT_SRC_ADDR(0));
+		for (j = 0; j < 4; j++) {
+			if (bo[j]) {
+				OUT_RELOC(ring, bo[j], 0, 0);
+				shadow[off + j] = 0;
+			} else {
+				OUT_RING(ring, image->consts[off + j]);
+				shadow[off + j] = image->consts[off + j];
+			}
+			bos[off + j] = bo[j];
+		}
+
+		valid[off / 4] = true;
+		hasbo[off / 4] = true;
+		bufs_changed = true;
+	}
+
+	return bufs_changed;
 }
 
 static void emit_global_mem(struct fd_ringbuffer *ring,
@@ -305,8 +768,7 @@ static void emit_global_mem(struct fd_ringbuffer *ring,
 	uint32_t i;
 
 	for (i = 0; i < shader->ir->bufs_count; i++) {
-		struct ir3_buf *b = shader->ir->bufs[i];
-		struct fd_param *p = find_param(bufs, b->name);
+		struct fd_param *p = get_param(bufs, shader, FD_PARAM_BUF, i);
 
 		OUT_PKT0(ring, REG_A3XX_SP_GLOBAL_MEM_ADDR, 1);
 		OUT_RELOC(ring, p->bo, 0, 0);       /* SP_GLOBAL_MEM_ADDR */
@@ -318,7 +780,8 @@ static void emit_global_mem(struct fd_ringbuffer *ring,
 
 void fd_program_emit_state(struct fd_program *program, uint32_t first,
 		struct fd_parameters *uniforms, struct fd_parameters *attr,
-		struct fd_parameters *bufs, struct fd_ringbuffer *ring)
+		struct fd_parameters *bufs, struct fd_constbuf *constbuf,
+		struct fd_ringbuffer *ring)
 {
 	struct fd_shader *vs = get_shader(program, FD_SHADER_VERTEX);
 	struct fd_shader *fs = get_shader(program, FD_SHADER_FRAGMENT);
@@ -328,10 +791,6 @@ void fd_program_emit_state(struct fd_program *program, uint32_t first,
 	uint32_t fsconstlen = fsi->max_const + 1;
 	uint32_t i, outloc;
 
-	uint32_t posregid   = getpos(vs, "gl_Position", 0);
-	uint32_t psizeregid = getpos(vs, "gl_PointSize", (63 << 2));
-	uint32_t colorregid = getpos(fs, "gl_FragColor", 0);
-
 	uint32_t numvar = totalvar(fs);
 
 	assert (vs->ir->varyings_count == fs->ir->varyings_count);
@@ -387,8 +846,8 @@ void fd_program_emit_state(struct fd_program *program, uint32_t first,
 	OUT_RING(ring, A3XX_SP_VS_CTRL_REG1_CONSTLENGTH(vsconstlen) |
 			A3XX_SP_VS_CTRL_REG1_INITIALOUTSTANDING(totalattr(vs)) |
 			A3XX_SP_VS_CTRL_REG1_CONSTFOOTPRINT(max(vsi->max_const, 0)));
-	OUT_RING(ring, A3XX_SP_VS_PARAM_REG_POSREGID(posregid) |
-			A3XX_SP_VS_PARAM_REG_PSIZEREGID(psizeregid) |
+	OUT_RING(ring, A3XX_SP_VS_PARAM_REG_POSREGID(program->posregid) |
+			A3XX_SP_VS_PARAM_REG_PSIZEREGID(program->psizeregid) |
 			A3XX_SP_VS_PARAM_REG_TOTALVSOUTVAR(fs->ir->varyings_count));
 
 	for (i = 0; i < vs->ir->varyings_count; ) {
@@ -481,8 +940,8 @@ void fd_program_emit_state(struct fd_program *program, uint32_t first,
 	OUT_RING(ring, 0x00000000);        /* SP_FS_OUTPUT_REG */
 
 	OUT_PKT0(ring, REG_A3XX_SP_FS_MRT_REG(0), 4);
-	OUT_RING(ring, A3XX_SP_FS_MRT_REG_REGID(colorregid) |  /* SP_FS_MRT[0].REG */
-			COND(ishalf(fs, "gl_FragColor"), A3XX_SP_FS_MRT_REG_HALF_PRECISION));
+	OUT_RING(ring, A3XX_SP_FS_MRT_REG_REGID(program->colorregid) |  /* SP_FS_MRT[0].REG */
+			COND(program->colorhalf, A3XX_SP_FS_MRT_REG_HALF_PRECISION));
 	OUT_RING(ring, A3XX_SP_FS_MRT_REG_REGID(0));           /* SP_FS_MRT[1].REG */
 	OUT_RING(ring, A3XX_SP_FS_MRT_REG_REGID(0));           /* SP_FS_MRT[2].REG */
 	OUT_RING(ring, A3XX_SP_FS_MRT_REG_REGID(0));           /* SP_FS_MRT[3].REG */
@@ -542,14 +1001,15 @@ void fd_program_emit_state(struct fd_program *program, uint32_t first,
 
 	/* for RB_RESOLVE_PASS, I think the consts are not needed: */
 	if (uniforms) {
-		emit_uniconst(ring, vs, uniforms, bufs, SB_VERT_SHADER);
-		emit_uniconst(ring, fs, uniforms, bufs, SB_FRAG_SHADER);
+		emit_uniconst(ring, vs, uniforms, bufs, constbuf, SB_VERT_SHADER);
+		emit_uniconst(ring, fs, uniforms, bufs, constbuf, SB_FRAG_SHADER);
 	}
 }
 
 void fd_program_emit_compute_state(struct fd_program *program,
 		struct fd_parameters *uniforms, struct fd_parameters *attr,
-		struct fd_parameters *bufs, struct fd_ringbuffer *ring)
+		struct fd_parameters *bufs, struct fd_constbuf *constbuf,
+		struct fd_ringbuffer *ring)
 {
 	struct fd_shader *cs = get_shader(program, FD_SHADER_COMPUTE);
 	struct ir3_shader_info *csi = &cs->info;
@@ -622,6 +1082,17 @@ void fd_program_emit_compute_state(struct fd_program *program,
 			A3XX_UCHE_CACHE_INVALIDATE1_REG_OPCODE(INVALIDATE) |
 			A3XX_UCHE_CACHE_INVALIDATE1_REG_ENTIRE_CACHE);
 
-	emit_uniconst(ring, cs, uniforms, bufs, SB_FRAG_SHADER);
-	emit_global_mem(ring, cs, bufs);
+}
+
+/* the parts of the compute state which can change between dispatches
+ * of a batch, only what changed since the last dispatch is emitted:
+ */
+void fd_program_emit_compute_params(struct fd_program *program,
+		struct fd_parameters *uniforms, struct fd_parameters *bufs,
+		struct fd_constbuf *constbuf, struct fd_ringbuffer *ring)
+{
+	struct fd_shader *cs = get_shader(program, FD_SHADER_COMPUTE);
+
+	if (emit_uniconst(ring, cs, uniforms, bufs, constbuf, SB_FRAG_SHADER))
+		emit_global_mem(ring, cs, bufs);
 }
@@ -27,6 +27,7 @@
 #include "ring.h"
 
 struct fd_program;
+struct fd_constbuf;
 
 enum fd_shader_type {
 	FD_SHADER_VERTEX   = 0,
@@ -38,19 +39,30 @@ struct fd_state;
 
 struct fd_program * fd_program_new(struct fd_state *state);
 
+struct fd_constbuf * fd_constbuf_new(struct fd_state *state);
+void fd_constbuf_del(struct fd_constbuf *constbuf);
+void fd_constbuf_reset(struct fd_constbuf *constbuf);
+void fd_constbuf_retire(struct fd_constbuf *constbuf);
+
 int fd_program_attach_asm(struct fd_program *program,
 		enum fd_shader_type type, const char *src);
 
-struct ir3_sampler;
-
-struct ir3_sampler ** fd_program_samplers(struct fd_program *program,
+int fd_program_link(struct fd_program *program,
+		struct fd_parameters *uniforms, struct fd_parameters *attr,
+		struct fd_parameters *bufs, struct fd_parameters *textures);
+const uint8_t * fd_program_sampler_slots(struct fd_program *program,
 		enum fd_shader_type type, int *cnt);
 uint32_t fd_program_outloc(struct fd_program *program);
 void fd_program_emit_state(struct fd_program *program, uint32_t first,
 		struct fd_parameters *uniforms, struct fd_parameters *attr,
-		struct fd_parameters *bufs, struct fd_ringbuffer *ring);
+		struct fd_parameters *bufs, struct fd_constbuf *constbuf,
+		struct fd_ringbuffer *ring);
 void fd_program_emit_compute_state(struct fd_program *program,
 		struct fd_parameters *uniforms, struct fd_parameters *attr,
-		struct fd_parameters *bufs, struct fd_ringbuffer *ring);
+		struct fd_parameters *bufs, struct fd_constbuf *constbuf,
+		struct fd_ringbuffer *ring);
+void fd_program_emit_compute_params(struct fd_program *program,
+		struct fd_parameters *uniforms, struct fd_parameters *bufs,
+		struct fd_constbuf *constbuf, struct fd_ringbuffer *ring);
 
 #endif /* PROGRAM_H_ */
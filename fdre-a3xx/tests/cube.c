@@ -23,6 +23,7 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "freedreno.h"
 #include "redump.h"
@@ -32,6 +33,11 @@ int main(int argc, char **argv)
 {
 	struct fd_state *state;
 	struct fd_surface *surface;
+	static struct fd_profile profile;
+	/* if set, profile the last frame, w/ a comma separated list of
+	 * additional counters to sample (ie. FD_PROFILE=SP_FS_INSTRUCTIONS):
+	 */
+	char *prof = getenv("FD_PROFILE");
 
 	GLfloat vVertices[] = {
 	  // front
@@ -218,6 +224,8 @@ int main(int argc, char **argv)
 #endif
 	uint32_t width = 0, height = 0;
 	int i, n = 1;
+	int position_slot, normal_slot, color_slot;
+	int modelview_slot, modelviewprojection_slot, normalmatrix_slot;
 
 	if (argc == 2)
 		n = atoi(argv[1]);
@@ -240,8 +248,31 @@ int main(int argc, char **argv)
 
 	fd_link(state);
 
+	/* resolve the names once, rather than per frame: */
+	position_slot = fd_attribute_slot(state, "in_position");
+	normal_slot = fd_attribute_slot(state, "in_normal");
+	color_slot = fd_attribute_slot(state, "in_color");
+	modelview_slot = fd_uniform_slot(state, "modelviewMatrix");
+	modelviewprojection_slot = fd_uniform_slot(state, "modelviewprojectionMatrix");
+	normalmatrix_slot = fd_uniform_slot(state, "normalMatrix");
+
 	fd_enable(state, GL_CULL_FACE);
 
+	if (prof) {
+		const char *names[FD_PROFILE_MAX_COUNTERS];
+		char *list = strdup(prof), *name;
+		uint32_t cnt = 0;
+
+		for (name = strtok(list, ","); name && (cnt < ARRAY_SIZE(names));
+				name = strtok(NULL, ","))
+			names[cnt++] = name;
+
+		if (fd_profile_counters(state, names, cnt))
+			return -1;
+
+		free(list);
+	}
+
 	for (i = 0; i < n; i++) {
 		GLfloat aspect = (GLfloat)height / (GLfloat)width;
 		ESMatrix modelview;
@@ -275,21 +306,24 @@ int main(int argc, char **argv)
 		normal[7] = modelview.m[2][1];
 		normal[8] = modelview.m[2][2];
 
+		if (prof && (i == (n - 1)))
+			fd_profile_begin(state);
+
 		fd_clear_color(state, (float[]){ 0.2, 0.2, 0.2, 1.0 });
 		fd_clear(state, GL_COLOR_BUFFER_BIT);
 
-		fd_attribute_pointer(state, "in_position",
+		fd_attribute_pointer_slot(state, position_slot,
 				VFMT_FLOAT_32_32_32, 24, vVertices);
-		fd_attribute_pointer(state, "in_normal",
+		fd_attribute_pointer_slot(state, normal_slot,
 				VFMT_FLOAT_32_32_32, 24, vNormals);
-		fd_attribute_pointer(state, "in_color",
+		fd_attribute_pointer_slot(state, color_slot,
 				VFMT_FLOAT_32_32_32, 24, vColors);
 
-		fd_uniform_attach(state, "modelviewMatrix",
+		fd_uniform_attach_slot(state, modelview_slot,
 				4, 4, &modelview.m[0][0]);
-		fd_uniform_attach(state, "modelviewprojectionMatrix",
+		fd_uniform_attach_slot(state, modelviewprojection_slot,
 				4, 4,  &modelviewprojection.m[0][0]);
-		fd_uniform_attach(state, "normalMatrix",
+		fd_uniform_attach_slot(state, normalmatrix_slot,
 				3, 3, normal);
 
 		fd_draw_arrays(state, GL_TRIANGLE_STRIP, 0, 4);
@@ -300,6 +334,12 @@ int main(int argc, char **argv)
 		fd_draw_arrays(state, GL_TRIANGLE_STRIP, 20, 4);
 
 		fd_swap_buffers(state);
+
+		if (prof && (i == (n - 1))) {
+			fd_profile_end(state);
+			if (!fd_profile_read(state, &profile, true))
+				fd_profile_dump(&profile);
+		}
 	}
 
 	fd_flush(state);
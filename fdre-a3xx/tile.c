@@ -0,0 +1,124 @@
+/*
+ * Copyright (c) 2012 Rob Clark <robdclark@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef __ARM_NEON__
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "tile.h"
+
+/* Both directions walk the surface one tile at a time, so that the
+ * tiled side is accessed sequentially (a tile is 4KB for 32bpp, ie. a
+ * page), and the linear side touches only 32 rows at a time.  A full
+ * tile row is 32 * cpp bytes, which is a multiple of 16 for all our
+ * formats (even 24bpp), so it is copied w/ 16 byte vectors.  Partial
+ * tiles at the right edge fall back to memcpy().
+ */
+
+static inline void copy_row(uint8_t *dst, const uint8_t *src, uint32_t n)
+{
+#if defined(__ARM_NEON__) || defined(__SSE2__)
+	uint32_t i;
+	for (i = 0; i < n; i += 16) {
+#ifdef __ARM_NEON__
+		vst1q_u8(dst + i, vld1q_u8(src + i));
+#else
+		_mm_storeu_si128((__m128i *)(dst + i),
+				_mm_loadu_si128((const __m128i *)(src + i)));
+#endif
+	}
+#else
+	memcpy(dst, src, n);
+#endif
+}
+
+static void copy_tile(uint8_t *dst, uint32_t dst_stride,
+		const uint8_t *src, uint32_t src_stride,
+		uint32_t rowbytes, uint32_t rows, bool full)
+{
+	uint32_t y;
+
+	if (full) {
+		for (y = 0; y < rows; y++)
+			copy_row(dst + (y * dst_stride), src + (y * src_stride), rowbytes);
+	} else {
+		for (y = 0; y < rows; y++)
+			memcpy(dst + (y * dst_stride), src + (y * src_stride), rowbytes);
+	}
+}
+
+static void convert(uint8_t *tiled, uint32_t tiled_pitch,
+		uint8_t *linear, uint32_t linear_pitch,
+		uint32_t width, uint32_t height, uint32_t cpp, bool to_tiled)
+{
+	uint32_t tile_row = TILE_W * cpp;
+	uint32_t tile_size = TILE_W * TILE_H * cpp;
+	uint32_t tiles_x = tiled_pitch / TILE_W;
+	uint32_t tx, ty;
+
+	assert(!(tiled_pitch % TILE_W));
+	assert(!(tile_row % 16));
+
+	for (ty = 0; ty < height; ty += TILE_H) {
+		uint32_t rows = min(TILE_H, height - ty);
+		uint8_t *t = tiled + ((ty / TILE_H) * tiles_x * tile_size);
+		uint8_t *l = linear + (ty * linear_pitch);
+
+		for (tx = 0; tx < width; tx += TILE_W) {
+			uint32_t cols = min(TILE_W, width - tx);
+			bool full = (cols == TILE_W);
+
+			if (to_tiled) {
+				copy_tile(t, tile_row, l + (tx * cpp), linear_pitch,
+						cols * cpp, rows, full);
+			} else {
+				copy_tile(l + (tx * cpp), linear_pitch, t, tile_row,
+						cols * cpp, rows, full);
+			}
+
+			t += tile_size;
+		}
+	}
+}
+
+void fd_tile(void *tiled, uint32_t tiled_pitch,
+		const void *linear, uint32_t linear_pitch,
+		uint32_t width, uint32_t height, uint32_t cpp)
+{
+	convert(tiled, tiled_pitch, (uint8_t *)linear, linear_pitch,
+			width, height, cpp, true);
+}
+
+void fd_untile(void *linear, uint32_t linear_pitch,
+		const void *tiled, uint32_t tiled_pitch,
+		uint32_t width, uint32_t height, uint32_t cpp)
+{
+	convert((uint8_t *)tiled, tiled_pitch, linear, linear_pitch,
+			width, height, cpp, false);
+}
@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) 2012 Rob Clark <robdclark@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef TILE_H_
+#define TILE_H_
+
+#include "util.h"
+
+/* CPU conversion between linear and TILE_32X32 layouts.
+ *
+ * A tiled surface is split into 32x32 pixel tiles, each stored as 32
+ * contiguous rows of 32 pixels, and the tiles are stored in row-major
+ * order.  The tiled pitch (in pixels) is aligned to 32, and the height
+ * is padded to a multiple of 32, so every tile is complete in memory.
+ *
+ * Linear pitches are in bytes, tiled pitches in pixels (like
+ * fd_surface::pitch).
+ */
+
+#define TILE_W 32
+#define TILE_H 32
+
+static inline uint32_t fd_tile_offset(uint32_t x, uint32_t y,
+		uint32_t cpp, uint32_t pitch)
+{
+	uint32_t tile = ((y / TILE_H) * (pitch / TILE_W)) + (x / TILE_W);
+	return ((tile * TILE_W * TILE_H) +
+			((y % TILE_H) * TILE_W) + (x % TILE_W)) * cpp;
+}
+
+void fd_tile(void *tiled, uint32_t tiled_pitch,
+		const void *linear, uint32_t linear_pitch,
+		uint32_t width, uint32_t height, uint32_t cpp);
+void fd_untile(void *linear, uint32_t linear_pitch,
+		const void *tiled, uint32_t tiled_pitch,
+		uint32_t width, uint32_t height, uint32_t cpp);
+
+#endif /* TILE_H_ */
@@ -185,6 +185,11 @@ struct fd_param {
 struct fd_parameters {
 	struct fd_param params[MAX_PARAMS];
 	uint32_t nparams;
+	/* for a copy, the table it was copied from, and the number of
+	 * params that table had at the time:
+	 */
+	struct fd_parameters *parent;
+	uint32_t nparent;
 };
 
 static inline struct fd_param * find_param(struct fd_parameters *params,
@@ -206,12 +211,37 @@ static inline struct fd_param * find_param(struct fd_parameters *params,
 		return NULL;
 	}
 
+	/* the name could be coming from a shader, which could go away
+	 * before the params do, so keep our own copy:
+	 */
 	p = &params->params[params->nparams++];
-	p->name = name;
+	p->name = strdup(name);
 
 	return p;
 }
 
+static inline void free_params(struct fd_parameters *params)
+{
+	uint32_t i;
+	for (i = 0; i < params->nparams; i++)
+		free((char *)params->params[i].name);
+	params->nparams = 0;
+}
+
+/* copy params, so they can be bound independently of the original
+ * table, while keeping the same slots:
+ */
+static inline void copy_params(struct fd_parameters *dst,
+		struct fd_parameters *src)
+{
+	uint32_t i;
+	*dst = *src;
+	for (i = 0; i < dst->nparams; i++)
+		dst->params[i].name = strdup(src->params[i].name);
+	dst->parent  = src;
+	dst->nparent = src->nparams;
+}
+
 static inline uint32_t fmt2size(enum a3xx_vtx_fmt fmt)
 {
 	switch (fmt) {
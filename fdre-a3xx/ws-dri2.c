@@ -101,7 +101,8 @@ static struct fd_surface * get_surface(struct fd_winsys *ws,
 	return surface;
 }
 
-static int post_surface(struct fd_winsys *ws, struct fd_surface *surface)
+static int post_surface(struct fd_winsys *ws, struct fd_surface *surface,
+		const struct fd_rect *damage, uint32_t ndamage)
 {
 	struct fd_winsys_dri2 *ws_dri2 = to_dri2_ws(ws);
 	CARD64 count;
@@ -109,21 +110,16 @@ static int post_surface(struct fd_winsys *ws, struct fd_surface *surface)
 	if (!ws_dri2->surface)
 		get_surface(ws, NULL, NULL);
 
-	/* if we are rendering to front-buffer, we can skip this */
+	/* if we are rendering to front-buffer, we can skip this.  Otherwise
+	 * we only need to copy what changed, since the back buffer is kept
+	 * across swaps (we never re-fetch the dri2 buffers, so already rely
+	 * on the server swapping by copy):
+	 */
 	if (surface != ws_dri2->surface) {
-		char *dstptr = fd_bo_map(ws_dri2->surface->bo);
-		char *srcptr = fd_bo_map(surface->bo);
-		uint32_t len = surface->pitch * surface->cpp;
-		uint32_t i;
-
-		if (len > ws_dri2->dri2buf->pitch[0])
-			len = ws_dri2->dri2buf->pitch[0];
-
-		for (i = 0; i < surface->height; i++) {
-			memcpy(dstptr, srcptr, len);
-			dstptr += ws_dri2->dri2buf->pitch[0];
-			srcptr += len;
-		}
+		fd_surface_copy_damage(surface,
+				(uint8_t *)fd_bo_map(ws_dri2->surface->bo),
+				ws_dri2->dri2buf->pitch[0], ws_dri2->width,
+				ws_dri2->height, damage, ndamage);
 	}
 
 	DRI2SwapBuffers(ws_dri2->dpy, ws_dri2->win, 0, 0, 0, &count);
@@ -21,6 +21,16 @@
  * SOFTWARE.
  */
 
+/* fbdev winsys.  If the virtual framebuffer is tall enough to hold more
+ * than one screen worth of pages, they are used as a swapchain and posting
+ * a surface is just a pan, otherwise we render to the front buffer.  Use
+ * FD_FBDEV_BUFFERS to limit the number of pages used.
+ *
+ * For testing w/out a display, FD_FBDEV_MEM=<w>x<h>[x<n>] replaces
+ * /dev/fb0 with an in-memory stand-in w/ n pages (default 2), where
+ * panning just updates the yoffset.
+ */
+
 #include <fcntl.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
@@ -30,14 +40,23 @@
 #include "ws.h"
 #include "util.h"
 
+#define MAX_BUFFERS 3
+
 struct fd_winsys_fbdev {
 	struct fd_winsys base;
 
-	struct fd_surface *surface;
+	/* one surface per page of the framebuffer, all sharing bo: */
+	struct fd_surface *surfaces[MAX_BUFFERS];
+	uint32_t nbufs;
+	/* index of the page currently scanned out: */
+	uint32_t front;
+	struct fd_bo *bo;
 	struct fb_var_screeninfo var;
 	struct fb_fix_screeninfo fix;
 	void *ptr;
 	int fd;
+	/* in-memory stand-in rather than a real fbdev: */
+	bool mem;
 };
 
 static inline struct fd_winsys_fbdev * to_fbdev_ws(struct fd_winsys *ws)
@@ -49,6 +68,13 @@ static inline struct fd_winsys_fbdev * to_fbdev_ws(struct fd_winsys *ws)
 static void destroy(struct fd_winsys *ws)
 {
 	struct fd_winsys_fbdev *ws_fbdev = to_fbdev_ws(ws);
+	uint32_t i;
+
+	for (i = 0; i < ARRAY_SIZE(ws_fbdev->surfaces); i++)
+		free(ws_fbdev->surfaces[i]);
+
+	if (ws_fbdev->bo)
+		fd_bo_del(ws_fbdev->bo);
 
 	if (ws->pipe)
 		fd_pipe_del(ws->pipe);
@@ -62,31 +88,71 @@ static void destroy(struct fd_winsys *ws)
 	free(ws_fbdev);
 }
 
+static int pan(struct fd_winsys_fbdev *ws_fbdev, uint32_t idx)
+{
+	int ret;
+
+	ws_fbdev->var.xoffset = 0;
+	ws_fbdev->var.yoffset = idx * ws_fbdev->var.yres;
+
+	if (!ws_fbdev->mem) {
+		ret = ioctl(ws_fbdev->fd, FBIOPAN_DISPLAY, &ws_fbdev->var);
+		if (ret) {
+			WARN_MSG("failed to pan: %d (%s)",
+					ret, strerror(errno));
+			return ret;
+		}
+	}
+
+	ws_fbdev->front = idx;
+
+	return 0;
+}
+
 static struct fd_surface * get_surface(struct fd_winsys *ws,
 		uint32_t *width, uint32_t *height)
 {
 	struct fd_winsys_fbdev *ws_fbdev = to_fbdev_ws(ws);
 	struct fd_surface *surface;
+	uint32_t i;
+
+	if (!ws_fbdev->surfaces[0]) {
+		if (ws_fbdev->mem) {
+			ws_fbdev->bo = fd_bo_new(ws->dev,
+					ws_fbdev->var.yres_virtual * ws_fbdev->fix.line_length,
+					DRM_FREEDRENO_GEM_TYPE_KMEM);
+			ws_fbdev->ptr = fd_bo_map(ws_fbdev->bo);
+		} else {
+			ws_fbdev->bo = fd_bo_from_fbdev(ws->pipe, ws_fbdev->fd,
+					ws_fbdev->var.yres_virtual * ws_fbdev->fix.line_length);
+		}
 
-	if (!ws_fbdev->surface) {
-		surface = calloc(1, sizeof(*surface));
-		assert(surface);
-
-		/* TODO don't hardcode: */
-		surface->color  = RB_R8G8B8A8_UNORM;
-		surface->cpp    = 4;
-		surface->width  = ws_fbdev->var.xres;
-		surface->height = ws_fbdev->var.yres;
-		surface->pitch  = ws_fbdev->fix.line_length / surface->cpp;
-
-		surface->bo = fd_bo_from_fbdev(ws->pipe, ws_fbdev->fd,
-				ws_fbdev->var.yres_virtual * ws_fbdev->fix.line_length);
-
-		ws_fbdev->surface = surface;
-	} else {
-		surface = ws_fbdev->surface;
+		for (i = 0; i < ws_fbdev->nbufs; i++) {
+			surface = calloc(1, sizeof(*surface));
+			assert(surface);
+
+			/* TODO don't hardcode: */
+			surface->color  = RB_R8G8B8A8_UNORM;
+			surface->cpp    = 4;
+			surface->width  = ws_fbdev->var.xres;
+			surface->height = ws_fbdev->var.yres;
+			surface->pitch  = ws_fbdev->fix.line_length / surface->cpp;
+			surface->offset = i * ws_fbdev->var.yres *
+					ws_fbdev->fix.line_length;
+			surface->bo     = ws_fbdev->bo;
+
+			ws_fbdev->surfaces[i] = surface;
+		}
 	}
 
+	/* render to the page after the one being scanned out, or to the
+	 * front buffer if there is no swapchain:
+	 */
+	if (ws_fbdev->nbufs > 1)
+		surface = ws_fbdev->surfaces[(ws_fbdev->front + 1) % ws_fbdev->nbufs];
+	else
+		surface = ws_fbdev->surfaces[ws_fbdev->front];
+
 	if (width)
 		*width = surface->width;
 
@@ -96,27 +162,55 @@ static struct fd_surface * get_surface(struct fd_winsys *ws,
 	return surface;
 }
 
-static int post_surface(struct fd_winsys *ws, struct fd_surface *surface)
+static int post_surface(struct fd_winsys *ws, struct fd_surface *surface,
+		const struct fd_rect *damage, uint32_t ndamage)
 {
 	struct fd_winsys_fbdev *ws_fbdev = to_fbdev_ws(ws);
+	uint32_t i;
 
-	/* if we are rendering to front-buffer, we can skip this */
-	if (surface != ws_fbdev->surface) {
-		char *dstptr = ws_fbdev->ptr;
-		char *srcptr = fd_bo_map(surface->bo);
-		uint32_t len = surface->pitch * surface->cpp;
-		uint32_t i;
+	for (i = 0; i < ws_fbdev->nbufs; i++) {
+		if (surface != ws_fbdev->surfaces[i])
+			continue;
 
-		if (len > ws_fbdev->fix.line_length)
-			len = ws_fbdev->fix.line_length;
+		/* if we are rendering to front-buffer, we can skip this */
+		if (i == ws_fbdev->front)
+			return 0;
 
-		for (i = 0; i < surface->height; i++) {
-			memcpy(dstptr, srcptr, len);
-			dstptr += ws_fbdev->fix.line_length;
-			srcptr += len;
-		}
+		if (!pan(ws_fbdev, i))
+			return 0;
+
+		/* if we can't pan, fall back to rendering to the front
+		 * buffer, after copying over what we rendered:
+		 */
+		ws_fbdev->nbufs = 1;
+		damage = NULL;
+		break;
+	}
+
+	fd_surface_copy_damage(surface,
+			(uint8_t *)ws_fbdev->ptr + ws_fbdev->surfaces[ws_fbdev->front]->offset,
+			ws_fbdev->fix.line_length, ws_fbdev->var.xres,
+			ws_fbdev->var.yres, damage, ndamage);
+
+	return 0;
+}
+
+static int open_mem(struct fd_winsys_fbdev *ws_fbdev, const char *str)
+{
+	uint32_t w, h, n = 2;
+
+	if (sscanf(str, "%ux%ux%u", &w, &h, &n) < 2) {
+		ERROR_MSG("invalid FD_FBDEV_MEM: %s", str);
+		return -1;
 	}
 
+	ws_fbdev->mem = true;
+	ws_fbdev->var.xres = ws_fbdev->var.xres_virtual = w;
+	ws_fbdev->var.yres = h;
+	ws_fbdev->var.yres_virtual = h * max(n, 1);
+	ws_fbdev->var.bits_per_pixel = 32;
+	ws_fbdev->fix.line_length = ALIGN(w, 32) * 4;
+
 	return 0;
 }
 
@@ -124,6 +218,8 @@ struct fd_winsys * fd_winsys_fbdev_open(void)
 {
 	struct fd_winsys_fbdev *ws_fbdev = calloc(1, sizeof(*ws_fbdev));
 	struct fd_winsys *ws = &ws_fbdev->base;
+	const char *str;
+	uint32_t nbufs;
 	int fd, ret;
 
 	fd = drmOpen("kgsl", NULL);
@@ -136,6 +232,13 @@ struct fd_winsys * fd_winsys_fbdev_open(void)
 	ws->dev = fd_device_new(fd);
 	ws->pipe = fd_pipe_new(ws->dev, FD_PIPE_3D);
 
+	str = getenv("FD_FBDEV_MEM");
+	if (str) {
+		if (open_mem(ws_fbdev, str))
+			goto fail;
+		goto done;
+	}
+
 	fd = open("/dev/fb0", O_RDWR);
 	ret = ioctl(fd, FBIOGET_VSCREENINFO, &ws_fbdev->var);
 	if (ret) {
@@ -150,19 +253,6 @@ struct fd_winsys * fd_winsys_fbdev_open(void)
 		goto fail;
 	}
 
-	INFO_MSG("res %dx%d virtual %dx%d, line_len %d",
-			ws_fbdev->var.xres, ws_fbdev->var.yres,
-			ws_fbdev->var.xres_virtual,
-			ws_fbdev->var.yres_virtual,
-			ws_fbdev->fix.line_length);
-
-	ws_fbdev->var.yoffset = ws_fbdev->var.xoffset = 0;
-	ret = ioctl(fd, FBIOPAN_DISPLAY, &ws_fbdev->var);
-	if (ret) {
-		WARN_MSG("failed to pan: %d (%s)",
-				ret, strerror(errno));
-	}
-
 	ws_fbdev->fd = fd;
 	ws_fbdev->ptr = mmap(0,
 			ws_fbdev->var.yres_virtual * ws_fbdev->fix.line_length,
@@ -172,6 +262,26 @@ struct fd_winsys * fd_winsys_fbdev_open(void)
 		goto fail;
 	}
 
+done:
+	INFO_MSG("res %dx%d virtual %dx%d, line_len %d",
+			ws_fbdev->var.xres, ws_fbdev->var.yres,
+			ws_fbdev->var.xres_virtual,
+			ws_fbdev->var.yres_virtual,
+			ws_fbdev->fix.line_length);
+
+	nbufs = ws_fbdev->var.yres_virtual / ws_fbdev->var.yres;
+	str = getenv("FD_FBDEV_BUFFERS");
+	if (str)
+		nbufs = min(nbufs, strtoul(str, NULL, 0));
+	ws_fbdev->nbufs = max(min(nbufs, MAX_BUFFERS), 1);
+
+	INFO_MSG("using %u buffer(s)", ws_fbdev->nbufs);
+
+	if (pan(ws_fbdev, 0) && (ws_fbdev->nbufs > 1)) {
+		WARN_MSG("can't pan, not using swapchain");
+		ws_fbdev->nbufs = 1;
+	}
+
 	ws->destroy = destroy;
 	ws->get_surface = get_surface;
 	ws->post_surface = post_surface;
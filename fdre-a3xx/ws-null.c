@@ -0,0 +1,133 @@
+/*
+ * Copyright (c) 2012 Rob Clark <robdclark@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* Offscreen winsys for the null device backend (see drm-null.c), so
+ * tests can run headless.  Surface size can be overridden with the
+ * FD_NULL_WIDTH/FD_NULL_HEIGHT environment variables.
+ */
+
+#include "ws.h"
+#include "util.h"
+
+struct fd_winsys_null {
+	struct fd_winsys base;
+
+	struct fd_surface *surface;
+};
+
+static inline struct fd_winsys_null * to_null_ws(struct fd_winsys *ws)
+{
+	return (struct fd_winsys_null *)ws;
+}
+
+static uint32_t getenv_u32(const char *name, uint32_t def)
+{
+	const char *str = getenv(name);
+	return str ? strtoul(str, NULL, 0) : def;
+}
+
+static void destroy(struct fd_winsys *ws)
+{
+	struct fd_winsys_null *ws_null = to_null_ws(ws);
+
+	if (ws_null->surface) {
+		fd_bo_del(ws_null->surface->bo);
+		free(ws_null->surface);
+	}
+
+	if (ws->pipe)
+		fd_pipe_del(ws->pipe);
+
+	if (ws->dev)
+		fd_device_del(ws->dev);
+
+	free(ws_null);
+}
+
+static struct fd_surface * get_surface(struct fd_winsys *ws,
+		uint32_t *width, uint32_t *height)
+{
+	struct fd_winsys_null *ws_null = to_null_ws(ws);
+	struct fd_surface *surface;
+
+	if (!ws_null->surface) {
+		surface = calloc(1, sizeof(*surface));
+		assert(surface);
+
+		surface->color  = RB_R8G8B8A8_UNORM;
+		surface->cpp    = 4;
+		surface->width  = getenv_u32("FD_NULL_WIDTH", 800);
+		surface->height = getenv_u32("FD_NULL_HEIGHT", 480);
+		surface->pitch  = ALIGN(surface->width, 32);
+
+		surface->bo = fd_bo_new(ws->dev,
+				surface->pitch * surface->height * surface->cpp,
+				DRM_FREEDRENO_GEM_TYPE_KMEM);
+
+		ws_null->surface = surface;
+	} else {
+		surface = ws_null->surface;
+	}
+
+	if (width)
+		*width = surface->width;
+
+	if (height)
+		*height = surface->height;
+
+	return surface;
+}
+
+static int post_surface(struct fd_winsys *ws, struct fd_surface *surface,
+		const struct fd_rect *damage, uint32_t ndamage)
+{
+	/* nothing to display on.. */
+	return 0;
+}
+
+struct fd_winsys * fd_winsys_null_open(void)
+{
+	struct fd_winsys_null *ws_null = calloc(1, sizeof(*ws_null));
+	struct fd_winsys *ws = &ws_null->base;
+	int fd;
+
+	fd = drmOpen("msm", NULL);
+	if (fd < 0) {
+		ERROR_MSG("could not open null device: %d (%s)",
+				fd, strerror(errno));
+		goto fail;
+	}
+
+	ws->dev = fd_device_new(fd);
+	ws->pipe = fd_pipe_new(ws->dev, FD_PIPE_3D);
+
+	ws->destroy = destroy;
+	ws->get_surface = get_surface;
+	ws->post_surface = post_surface;
+
+	return ws;
+
+fail:
+	destroy(ws);
+	return NULL;
+}
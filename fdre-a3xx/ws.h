@@ -28,11 +28,30 @@
 
 /* TODO this needs to move somewhere.. */
 #include "util.h"
+#define FD_MAX_MIP_LEVELS 14
+
 struct fd_surface {
 	struct fd_bo *bo;
+	uint32_t offset;	/* offset of the first pixel in bo, in bytes */
 	uint32_t cpp;	/* bytes per pixel */
 	uint32_t width, height, pitch;	/* width/height/pitch in pixels */
 	enum a3xx_color_fmt color;
+	/* LINEAR or TILE_32X32, see tile.h for the layout: */
+	enum a3xx_tile_mode tile_mode;
+	/* for mipmapped surfaces, the levels are packed one after the
+	 * other in the bo.  Level 0 is described by the fields above, and
+	 * nlevels is 0 for surfaces which aren't textures (ie. from ws):
+	 */
+	uint32_t nlevels;
+	struct {
+		uint32_t offset;	/* relative to offset, in bytes */
+		uint32_t pitch;	/* in pixels */
+	} levels[FD_MAX_MIP_LEVELS];
+};
+
+/* a damaged region of a surface, in pixels, inclusive: */
+struct fd_rect {
+	uint32_t x1, y1, x2, y2;
 };
 
 struct fd_winsys {
@@ -45,12 +64,64 @@ struct fd_winsys {
 	struct fd_pipe *pipe;
 
 	void (*destroy)(struct fd_winsys *ws);
+	/* returns the surface to render to for the screen.  If the winsys
+	 * has a swapchain, this is the current back buffer, and changes
+	 * each time one of the swapchain surfaces is posted:
+	 */
 	struct fd_surface * (*get_surface)(struct fd_winsys *ws,
 			uint32_t *width, uint32_t *height);
-	int (*post_surface)(struct fd_winsys *ws, struct fd_surface *surface);
+	/* display the surface.  Surfaces from get_surface() are flipped to
+	 * (or already on screen), others are copied to the screen.  Only
+	 * the damaged rects need to be copied, damage==NULL means all of
+	 * the surface changed since it was last posted:
+	 */
+	int (*post_surface)(struct fd_winsys *ws, struct fd_surface *surface,
+			const struct fd_rect *damage, uint32_t ndamage);
 };
 
+/* helper for the copy path of post_surface(), copy the damaged region
+ * of the surface to a linear buffer of the same format:
+ */
+static inline void fd_surface_copy_damage(struct fd_surface *surface,
+		void *dst, uint32_t dst_pitch, uint32_t dst_width,
+		uint32_t dst_height, const struct fd_rect *damage,
+		uint32_t ndamage)
+{
+	struct fd_rect full = {
+			0, 0, surface->width - 1, surface->height - 1,
+	};
+	uint8_t *src = (uint8_t *)fd_bo_map(surface->bo) + surface->offset;
+	uint32_t src_pitch = surface->pitch * surface->cpp;
+	uint32_t width  = min(surface->width, dst_width);
+	uint32_t height = min(surface->height, dst_height);
+	uint32_t i, y;
+
+	if (!damage) {
+		damage = &full;
+		ndamage = 1;
+	}
+
+	for (i = 0; i < ndamage; i++) {
+		uint32_t x1 = damage[i].x1, y1 = damage[i].y1;
+		uint32_t x2 = min(damage[i].x2, width - 1);
+		uint32_t y2 = min(damage[i].y2, height - 1);
+		uint32_t off = x1 * surface->cpp;
+		uint32_t len = (x2 - x1 + 1) * surface->cpp;
+
+		if ((x1 > x2) || (y1 > y2))
+			continue;
+
+		for (y = y1; y <= y2; y++) {
+			memcpy((uint8_t *)dst + (y * dst_pitch) + off,
+					src + (y * src_pitch) + off, len);
+		}
+	}
+}
+
 struct fd_winsys * fd_winsys_fbdev_open(void);
+#ifdef NULL_DEVICE
+struct fd_winsys * fd_winsys_null_open(void);
+#endif
 #ifdef HAVE_X11
 struct fd_winsys * fd_winsys_dri2_open(void);
 #endif
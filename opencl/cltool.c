@@ -25,6 +25,8 @@
 #include <string.h>
 #include <stdint.h>
 
+#include "search.h"
+
 /* note: we have to do this, instead of use stdio.h, because glibc
  * stdio.h plays some games with redirecting sscanf which doesn't
  * work with bionic libc
@@ -100,22 +102,12 @@ static char * readfile(const char *path)
 	return src;
 }
 
-/* note: we know what we are searching for is dword aligned,
- * so we get to simplify a bit based on that..
+/* skip over the copy of the shader we are searching for, the first
+ * other match is the one the disassembler uses:
  */
-static uint32_t * scan_memory(uint32_t *start, uint32_t *end,
-		uint32_t *buf, int sizedwords)
+static int skip_own_copy(void *data, int needle, const uint32_t *match)
 {
-	int i;
-	while (start < end) {
-		if (&start[sizedwords-1] >= end)
-			return NULL;
-		for (i = 0; (i < sizedwords) && (start[i] == buf[i]); i++) {}
-		if (i == sizedwords)
-			return start;
-		start++;
-	}
-	return NULL;
+	return match != data;
 }
 
 /* Feed in some pre-compiled shader to disassemble, rather than
@@ -140,6 +132,7 @@ static void poke_disasm(const char *disasm, struct cl_program *program)
 	char *line;
 	uint32_t *dwords;
 	uint32_t heap_start = 0, heap_end = 0;
+	struct search *s;
 
 	/* first we need to find the bounds of the heap: */
 	fd = open("/proc/self/maps", 0);
@@ -159,13 +152,11 @@ static void poke_disasm(const char *disasm, struct cl_program *program)
 		return;
 
 	/* now search for 2nd copy of shader: */
-	dwords = scan_memory((uint32_t *)heap_start, (uint32_t *)heap_end,
-			program->binary->dwords, program->binary->size_bytes/4);
-
-	/* if we found our own copy, keep looking: */
-	if (dwords == program->binary->dwords)
-		dwords = scan_memory(&dwords[1], (uint32_t *)heap_end,
-				program->binary->dwords, program->binary->size_bytes/4);
+	s = search_new();
+	search_add(s, program->binary->dwords, program->binary->size_bytes/4);
+	dwords = (uint32_t *)search_scan(s, (uint32_t *)heap_start,
+			(uint32_t *)heap_end, skip_own_copy, program->binary->dwords);
+	search_destroy(s);
 
 	if (!dwords)
 		return;
@@ -83,6 +83,12 @@ static void flush(PixmapPtr dest, uint32_t *timestamp)
 	CHK(c2dFlush(dest->id, &curTimestamp));
 	*timestamp = (uint32_t)curTimestamp;
 }
+
+/* c2d manages it's own cmdstream buffers: */
+static int need_flush(void)
+{
+	return 0;
+}
 #else
 #include <stdlib.h>
 #include <stdio.h>
@@ -97,6 +103,11 @@ static struct fd_device *dev;
 static struct fd_pipe *pipe;
 
 static struct fd_ringbuffer *rings[4];
+/* timestamp of the last submit of each ring, and the last timestamp we
+ * know to be retired, so a ring is only waited on if it may still be
+ * in use when it comes around again:
+ */
+static uint32_t ring_timestamps[4], retired;
 static struct fd_ringbuffer *ring;
 static struct fd_bo *context_bos[3];
 static int ring_idx;
@@ -265,11 +276,15 @@ next_ring(void)
 
 	if (rings[idx]) {
 		ring = rings[idx];
+		if (ring_timestamps[idx] > retired) {
+			fd_pipe_wait(pipe, ring_timestamps[idx]);
+			retired = ring_timestamps[idx];
+		}
 		fd_ringbuffer_reset(ring);
 		return;
 	}
 
-	ring = rings[idx] = fd_ringbuffer_new(pipe, 0x5000);
+	ring = rings[idx] = fd_ringbuffer_new(pipe, 0x10000);
 
 	memcpy(ring->start, initial_state, STATE_SIZE * sizeof(uint32_t));
 	ring->cur = &ring->start[120];
@@ -342,6 +357,12 @@ static PixmapPtr create_pixmap(uint32_t w, uint32_t h, uint32_t format)
 	return pix;
 }
 
+static void free_pixmap(PixmapPtr pix)
+{
+	fd_bo_del(pix->bo);
+	free(pix);
+}
+
 static inline void
 out_dstpix(struct fd_ringbuffer *ring, PixmapPtr pix)
 {
@@ -408,34 +429,74 @@ out_srcpix(struct fd_ringbuffer *ring, PixmapPtr pix)
 	OUT_RELOC(ring, bo);               /* GRADW_TEXBASE */
 }
 
-static void solid(PixmapPtr dest, int x1, int y1, int x2, int y2,
-		uint32_t fill)
+/* Ops are queued and only emitted at flush time.  Ops to the same dst
+ * pixmap are grouped together (as far as dependencies between pixmaps
+ * allow), so the dst surface state is only emitted once per group, and
+ * neighboring solid fills of the same color are merged:
+ */
+#define MAX_QUEUED 256
+
+static struct op2d {
+	PixmapPtr dst, src;     /* src is NULL for solid fills */
+	int x1, y1, x2, y2;     /* dst rect, x2/y2 exclusive */
+	int src_x, src_y;
+	uint32_t fill;
+	int next;               /* next op in the same group, or -1 */
+} queue[MAX_QUEUED];
+static int nqueued;
+
+static struct {
+	PixmapPtr dst;
+	int first, last;
+} groups[MAX_QUEUED];
+static int ngroups;
+
+/* pixmaps which the dst (G2D_*) and texture (GRADW_*) state currently
+ * point to, within the current ring:
+ */
+static PixmapPtr cur_dst, cur_tex;
+
+static void emit_dst(PixmapPtr dest)
+{
+	if ((cur_dst != dest) || (cur_tex != dest)) {
+		out_dstpix(ring, dest);
+		cur_dst = cur_tex = dest;
+	}
+}
+
+static void emit_solid(struct op2d *op)
 {
 	BEGIN_RING(23);
-	out_dstpix(ring, dest);
+	emit_dst(op->dst);
 	OUT_RING  (ring, REG(G2D_INPUT) | idis(G2D_INPUT_SCOORD1));
 	OUT_RING  (ring, REG(G2D_INPUT) | iena(0x0));
 	OUT_RING  (ring, REG(G2D_INPUT) | iena(G2D_INPUT_COLOR));
 	OUT_RING  (ring, REG(G2D_CONFIG) | 0x0);
 	OUT_RING  (ring, REGM(G2D_XY, 2));
-	OUT_RING  (ring, ((x1 & 0xffff) << 16) | (y1 & 0xffff));   /* G2D_XY */
-	OUT_RING  (ring, (((x2 - x1) & 0xffff) << 16) | ((y2 - y1) & 0xffff)); /* G2D_WIDTHHEIGHT */
+	OUT_RING  (ring, ((op->x1 & 0xffff) << 16) | (op->y1 & 0xffff));   /* G2D_XY */
+	OUT_RING  (ring, (((op->x2 - op->x1) & 0xffff) << 16) |
+			((op->y2 - op->y1) & 0xffff)); /* G2D_WIDTHHEIGHT */
 	OUT_RING  (ring, REGM(G2D_COLOR, 1));
-	OUT_RING  (ring, fill);
+	OUT_RING  (ring, op->fill);
 	END_RING  ();
 }
 
-static void copy(PixmapPtr dest, PixmapPtr src, int srcX, int srcY,
-		int dstX, int dstY, int width, int height)
+static void emit_copy(struct op2d *op)
 {
+	int width = op->x2 - op->x1;
+	int height = op->y2 - op->y1;
+
 	BEGIN_RING(45);
-	out_dstpix(ring, dest);
+	emit_dst(op->dst);
 	OUT_RING  (ring, REGM(G2D_FOREGROUND, 2));
 	OUT_RING  (ring, 0xff000000);      /* G2D_FOREGROUND */
 	OUT_RING  (ring, 0xff000000);      /* G2D_BACKGROUND */
 	OUT_RING  (ring, REG(G2D_BLENDERCFG) | 0x0);
 	OUT_RING  (ring, 0xd0000000);
-	out_srcpix(ring, src);
+	if (cur_tex != op->src) {
+		out_srcpix(ring, op->src);
+		cur_tex = op->src;
+	}
 	OUT_RING  (ring, 0xd5000000);
 	OUT_RING  (ring, 0xd0000000);
 	OUT_RING  (ring, REG(G2D_INPUT) | iena(G2D_INPUT_SCOORD1));
@@ -448,9 +509,9 @@ static void copy(PixmapPtr dest, PixmapPtr src, int srcX, int srcY,
 	OUT_RING  (ring, REG(G2D_INPUT) | iena(0));
 	OUT_RING  (ring, REG(G2D_CONFIG) | G2D_CONFIG_SRC1); /* we don't read from dst */
 	OUT_RING  (ring, REGM(G2D_XY, 3));
-	OUT_RING  (ring, (dstX & 0xffff) << 16 | (dstY & 0xffff));    /* G2D_XY */
-	OUT_RING  (ring, (width & 0xfff) << 16 | (height & 0xffff));  /* G2D_WIDTHHEIGHT */
-	OUT_RING  (ring, (srcX & 0xffff) << 16 | (srcY & 0xffff));    /* G2D_SXY */
+	OUT_RING  (ring, (op->x1 & 0xffff) << 16 | (op->y1 & 0xffff));      /* G2D_XY */
+	OUT_RING  (ring, (width & 0xfff) << 16 | (height & 0xffff));        /* G2D_WIDTHHEIGHT */
+	OUT_RING  (ring, (op->src_x & 0xffff) << 16 | (op->src_y & 0xffff)); /* G2D_SXY */
 	OUT_RING  (ring, 0xd0000000);
 	OUT_RING  (ring, 0xd0000000);
 	OUT_RING  (ring, 0xd0000000);
@@ -460,143 +521,436 @@ static void copy(PixmapPtr dest, PixmapPtr src, int srcX, int srcY,
 	END_RING  ();
 }
 
+/* would moving op ahead of the ops in group g change the result? */
+static int conflicts(int g, struct op2d *op)
+{
+	int i;
+
+	/* op reads what the group writes: */
+	if (op->src == groups[g].dst)
+		return 1;
+
+	/* the group reads what op writes: */
+	for (i = groups[g].first; i >= 0; i = queue[i].next)
+		if (queue[i].src == op->dst)
+			return 1;
+
+	return 0;
+}
+
+/* try to merge solid fill op into the previous op to the same dst, if
+ * the result is still a single rect:
+ */
+static int merge_solid(struct op2d *prev, struct op2d *op)
+{
+	if (prev->src || op->src || (prev->fill != op->fill))
+		return 0;
+
+	if ((op->x1 >= prev->x1) && (op->x2 <= prev->x2) &&
+			(op->y1 >= prev->y1) && (op->y2 <= prev->y2)) {
+		/* already covered */
+	} else if ((prev->x1 >= op->x1) && (prev->x2 <= op->x2) &&
+			(prev->y1 >= op->y1) && (prev->y2 <= op->y2)) {
+		prev->x1 = op->x1;
+		prev->y1 = op->y1;
+		prev->x2 = op->x2;
+		prev->y2 = op->y2;
+	} else if ((op->x1 == prev->x1) && (op->x2 == prev->x2) &&
+			(op->y1 <= prev->y2) && (op->y2 >= prev->y1)) {
+		prev->y1 = min(prev->y1, op->y1);
+		prev->y2 = max(prev->y2, op->y2);
+	} else if ((op->y1 == prev->y1) && (op->y2 == prev->y2) &&
+			(op->x1 <= prev->x2) && (op->x2 >= prev->x1)) {
+		prev->x1 = min(prev->x1, op->x1);
+		prev->x2 = max(prev->x2, op->x2);
+	} else {
+		return 0;
+	}
+
+	return 1;
+}
+
+static void queue_op(struct op2d *op)
+{
+	int g;
+
+	/* find the last group w/ the same dst that op can join: */
+	for (g = ngroups - 1; g >= 0; g--) {
+		if (groups[g].dst == op->dst)
+			break;
+		if (conflicts(g, op)) {
+			g = -1;
+			break;
+		}
+	}
+
+	if ((g >= 0) && merge_solid(&queue[groups[g].last], op))
+		return;
+
+	op->next = -1;
+	queue[nqueued] = *op;
+
+	if (g >= 0) {
+		queue[groups[g].last].next = nqueued;
+		groups[g].last = nqueued;
+	} else {
+		groups[ngroups].dst = op->dst;
+		groups[ngroups].first = groups[ngroups].last = nqueued;
+		ngroups++;
+	}
+
+	nqueued++;
+}
+
+static void emit_queued(void)
+{
+	int g, i;
+
+	for (g = 0; g < ngroups; g++) {
+		for (i = groups[g].first; i >= 0; i = queue[i].next) {
+			if (queue[i].src)
+				emit_copy(&queue[i]);
+			else
+				emit_solid(&queue[i]);
+		}
+	}
+
+	nqueued = ngroups = 0;
+}
+
+static void solid(PixmapPtr dest, int x1, int y1, int x2, int y2,
+		uint32_t fill)
+{
+	struct op2d op = {
+			.dst = dest,
+			.x1 = x1, .y1 = y1, .x2 = x2, .y2 = y2,
+			.fill = fill,
+	};
+	queue_op(&op);
+}
+
+static void copy(PixmapPtr dest, PixmapPtr src, int srcX, int srcY,
+		int dstX, int dstY, int width, int height)
+{
+	struct op2d op = {
+			.dst = dest, .src = src,
+			.x1 = dstX, .y1 = dstY,
+			.x2 = dstX + width, .y2 = dstY + height,
+			.src_x = srcX, .src_y = srcY,
+	};
+	queue_op(&op);
+}
+
 static void wait(uint32_t timestamp)
 {
 	fd_pipe_wait(pipe, timestamp);
+	if (timestamp > retired)
+		retired = timestamp;
 }
 
+/* submit the queued ops, and move on to the next ring w/out waiting for
+ * this one (next_ring() only waits if a ring is still busy when it gets
+ * reused):
+ */
 static void flush(PixmapPtr dest, uint32_t *timestamp)
 {
+	emit_queued();
 	ring_post(ring);
 	fd_ringbuffer_flush(ring);
+	*timestamp = fd_ringbuffer_timestamp(ring);
+	ring_timestamps[(ring_idx - 1) % ARRAY_SIZE(rings)] = *timestamp;
 	next_ring();
-	fd_pipe_wait(pipe, fd_ringbuffer_timestamp(ring));
 	ring_pre(ring);
+	cur_dst = cur_tex = NULL;
+}
+
+/* queue full, or not enough room in the ring for the queued ops (copy
+ * being the largest op) plus ring_post()?
+ */
+static int need_flush(void)
+{
+	return (nqueued == MAX_QUEUED) ||
+			((ring->end - ring->cur) < ((nqueued + 1) * 48));
 }
 #endif
 
-static char * readline(int fd)
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "exa-replay.h"
+
+/* Replays the EXA log, either the text log from the DDX or the binary form
+ * created from it by exaconv (preferred, it is walked in place w/out any
+ * parsing).  Environment variables:
+ *
+ *   REPLAY         - file to replay, default replay.bin, or replay.txt
+ *                    if that doesn't exist
+ *   REPLAY_BATCH   - max # of ops per submit, default 256.  Set to 0 to
+ *                    submit wherever the log has a FLUSH instead
+ *   REPLAY_VERBOSE - log each op
+ */
+
+static PixmapPtr *pixmaps;
+static uint32_t npixmaps;
+static PixmapPtr dest;
+static uint32_t timestamp;
+static uint32_t batch_max = 256, batch_ops;
+static int verbose;
+
+static struct {
+	uint64_t ops, solids, copies, submits, waits;
+	/* cpu time to emit each op, time spent in flush()/wait(): */
+	struct exa_histogram op, flush, wait;
+} stats;
+
+static uint64_t gettime_ns(void)
 {
-	static char buf[256];
-	char *line = buf;
-	while(1) {
-		int ret = read(fd, line, 1);
-		if (ret != 1) {
-			ERROR_MSG("invalid read");
-			end();
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000000) + ts.tv_nsec;
+}
+
+static void submit(void)
+{
+	uint64_t t = gettime_ns();
+	flush(dest, &timestamp);
+	exa_histogram_add(&stats.flush, gettime_ns() - t);
+	stats.submits++;
+	batch_ops = 0;
+}
+
+static void wait_idle(void)
+{
+	uint64_t t;
+
+	/* anything the log issued before the wait must be submitted: */
+	if (batch_ops)
+		submit();
+
+	t = gettime_ns();
+	wait(timestamp);
+	exa_histogram_add(&stats.wait, gettime_ns() - t);
+	stats.waits++;
+}
+
+static PixmapPtr get_pixmap(uint32_t idx)
+{
+	if ((idx >= npixmaps) || !pixmaps[idx]) {
+		ERROR_MSG("invalid pixmap: %u", idx);
+		end();
+	}
+	return pixmaps[idx];
+}
+
+static void replay(const struct exa_replay_op *op)
+{
+	uint64_t t = gettime_ns();
+
+	switch (op->type) {
+	case EXA_REPLAY_PIXMAP:
+		if (verbose)
+			DEBUG_MSG("creating pixmap %u: %ux%u", op->dst,
+					op->pixmap.width, op->pixmap.height);
+		if (op->dst >= npixmaps) {
+			uint32_t n = max(op->dst + 1, 2 * npixmaps);
+			pixmaps = realloc(pixmaps, n * sizeof(pixmaps[0]));
+			memset(&pixmaps[npixmaps], 0,
+					(n - npixmaps) * sizeof(pixmaps[0]));
+			npixmaps = n;
 		}
-		if (*line == '\n')
-			break;
-		line++;
+		if (pixmaps[op->dst]) {
+			/* the pointer got reused for a different pixmap, the old
+			 * one could still be in use by the gpu:
+			 */
+			wait_idle();
+			if (dest == pixmaps[op->dst])
+				dest = NULL;
+			free_pixmap(pixmaps[op->dst]);
+		}
+		pixmaps[op->dst] = create_pixmap(op->pixmap.width,
+				op->pixmap.height, xRGB);
+		/* don't count it as an op: */
+		return;
+	case EXA_REPLAY_SOLID:
+		if (verbose)
+			DEBUG_MSG("SOLID: x1=%d\ty1=%d\tx2=%d\ty2=%d\tfill=%08x",
+					op->solid.x1, op->solid.y1, op->solid.x2,
+					op->solid.y2, op->solid.fill);
+		dest = get_pixmap(op->dst);
+		solid(dest, op->solid.x1, op->solid.y1, op->solid.x2,
+				op->solid.y2, op->solid.fill);
+		stats.solids++;
+		batch_ops++;
+		break;
+	case EXA_REPLAY_COPY:
+		if (verbose)
+			DEBUG_MSG("COPY: srcX=%d\tsrcY=%d\tdstX=%d\tdstY=%d\twidth=%d\theight=%d",
+					op->copy.src_x, op->copy.src_y, op->copy.dst_x,
+					op->copy.dst_y, op->copy.width, op->copy.height);
+		dest = get_pixmap(op->dst);
+		copy(dest, get_pixmap(op->copy.src), op->copy.src_x,
+				op->copy.src_y, op->copy.dst_x, op->copy.dst_y,
+				op->copy.width, op->copy.height);
+		stats.copies++;
+		batch_ops++;
+		break;
+	case EXA_REPLAY_FLUSH:
+		/* when batching, consecutive solid/copy ops are collected into
+		 * a single submit, so the log's flushes only matter before a
+		 * wait:
+		 */
+		if (verbose)
+			DEBUG_MSG("flush");
+		if (!batch_max && batch_ops)
+			submit();
+		return;
+	case EXA_REPLAY_WAIT:
+		if (verbose)
+			DEBUG_MSG("wait, timestamp=%u", timestamp);
+		wait_idle();
+		return;
+	default:
+		ERROR_MSG("invalid op: %u", op->type);
+		end();
 	}
-	*(++line) = '\0';
-	return buf + 13;  // skip timestamp
+
+	stats.ops++;
+
+	/* sampled before the submit, which is counted in the flush stats: */
+	exa_histogram_add(&stats.op, gettime_ns() - t);
+
+	if ((batch_max && (batch_ops >= batch_max)) || need_flush())
+		submit();
 }
 
-static PixmapPtr get_pixmap(int fd)
+static void replay_bin(const void *buf, size_t size)
 {
-	static struct {
-		uint32_t ptr;
-		PixmapPtr pix;
-	} pixmaps[256];
-	static int npixmaps = 0;
+	const struct exa_replay_header *hdr = buf;
+	const struct exa_replay_op *op = (const void *)(hdr + 1);
+	size_t n = (size - sizeof(*hdr)) / sizeof(*op);
 
-	char *line = readline(fd);
-	if ((line == strstr(line, "EXA: SRC:")) ||
-			(line == strstr(line, "EXA: DST:"))) {
-		uint32_t ptr;
-		int w, h, p, d, i;
+	if (hdr->version != EXA_REPLAY_VERSION) {
+		ERROR_MSG("unsupported version: %u", hdr->version);
+		end();
+	}
 
-		DEBUG_MSG("line: %s", line);
+	while (n--)
+		replay(op++);
+}
 
-		line += 10;
+static void replay_txt(const char *buf, size_t size)
+{
+	const char *line = buf, *last = buf + size;
+	struct exa_parser p;
 
-		sscanf(line, "0x%x, %dx%d,%d,%d", &ptr, &w, &h, &p, &d);
-		DEBUG_MSG("GOT: 0x%x, %dx%d,%d,%d", ptr, w, h, p, d);
+	exa_parser_init(&p);
 
-		/* see if we can find the pixmap: */
-		for (i = 0; i < npixmaps; i++)
-			if (ptr == pixmaps[i].ptr)
-				return pixmaps[i].pix;
+	while (line < last) {
+		struct exa_replay_op ops[EXA_PARSE_MAX_OPS];
+		const char *eol = memchr(line, '\n', last - line);
+		int i, n;
 
-		/* ok, then we need to create a new one: */
-		DEBUG_MSG("creating pixmap: %dx%d (0x%x)", w, h, ptr);
-		pixmaps[npixmaps].ptr = ptr;
-		pixmaps[npixmaps].pix = create_pixmap(w, h, xRGB);
+		if (!eol)
+			eol = last;
 
-		return pixmaps[npixmaps++].pix;
+		n = exa_parse_line(&p, line, eol - line, ops);
+		if (n < 0) {
+			ERROR_MSG("unexpected line: %.*s", (int)(eol - line), line);
+			end();
+		}
+
+		for (i = 0; i < n; i++)
+			replay(&ops[i]);
+
+		line = eol + 1;
 	}
 
-	ERROR_MSG("unexpected line: %s", line);
-	end();
+	exa_parser_fini(&p);
+}
 
-	return NULL;
+static void print_latency(const char *name, struct exa_histogram *h)
+{
+	if (!h->count)
+		return;
+	printf("%-6s latency (us): avg %.1f, p50 %.1f, p90 %.1f, p99 %.1f, max %.1f\n",
+			name, (h->total / (double)h->count) / 1000.0,
+			exa_histogram_percentile(h, 50) / 1000.0,
+			exa_histogram_percentile(h, 90) / 1000.0,
+			exa_histogram_percentile(h, 99) / 1000.0,
+			h->max / 1000.0);
 }
 
 int main(int argc, char **argv)
 {
-	uint32_t timestamp;
-	PixmapPtr dest = NULL;
-	int fd, ret;
-
-	fd = open("replay.txt", 0);
-	if (fd < 0) {
+	const char *filename = getenv("REPLAY");
+	const char *str;
+	struct stat st;
+	uint64_t t;
+	void *buf;
+	int fd;
+
+	str = getenv("REPLAY_BATCH");
+	if (str)
+		batch_max = strtoul(str, NULL, 0);
+	verbose = !!getenv("REPLAY_VERBOSE");
+
+	if (filename) {
+		fd = open(filename, 0);
+	} else {
+		fd = open("replay.bin", 0);
+		if (fd < 0)
+			fd = open("replay.txt", 0);
+	}
+	if ((fd < 0) || fstat(fd, &st)) {
 		ERROR_MSG("could not open");
 		return -1;
 	}
 
-	RD_START("replay", "replay");
-
-	init();
-
-	while(1) {
-		char *line = readline(fd);
-
-		DEBUG_MSG("line: %s", line);
-
-		if (strstr(line, "EXA: SOLID:") == line) {
-			int x1, y1, x2, y2;
-			uint32_t fill;
+	buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (buf == MAP_FAILED) {
+		ERROR_MSG("could not mmap");
+		return -1;
+	}
 
-			sscanf(line, "EXA: SOLID: x1=%d\ty1=%d\tx2=%d\ty2=%d\tfill=%08x",
-					&x1, &y1, &x2, &y2, &fill);
+	madvise(buf, st.st_size, MADV_SEQUENTIAL);
 
-			DEBUG_MSG("GOT: SOLID: x1=%d\ty1=%d\tx2=%d\ty2=%d\tfill=%08x",
-					x1, y1, x2, y2, fill);
+	RD_START("replay", "replay");
 
-			dest = get_pixmap(fd);
+	init();
 
-			solid(dest, x1, y1, x2, y2, fill);
+	t = gettime_ns();
 
-		} else if (strstr(line, "EXA: COPY:") == line) {
-			int srcX, srcY, dstX, dstY, width, height;
-			PixmapPtr src;
+	if ((st.st_size >= sizeof(struct exa_replay_header)) &&
+			(((struct exa_replay_header *)buf)->magic == EXA_REPLAY_MAGIC))
+		replay_bin(buf, st.st_size);
+	else
+		replay_txt(buf, st.st_size);
 
-			sscanf(line, "EXA: COPY: srcX=%d\tsrcY=%d\tdstX=%d\tdstY=%d\twidth=%d\theight=%d",
-					&srcX, &srcY, &dstX, &dstY, &width, &height);
+	wait_idle();
 
-			DEBUG_MSG("GOT: COPY: srcX=%d\tsrcY=%d\tdstX=%d\tdstY=%d\twidth=%d\theight=%d",
-					srcX, srcY, dstX, dstY, width, height);
+	t = gettime_ns() - t;
 
-			dest = get_pixmap(fd);
-			src = get_pixmap(fd);
+	printf("replayed %llu ops (%llu solid, %llu copy) in %.3fs: %.0f ops/s\n",
+			(unsigned long long)stats.ops,
+			(unsigned long long)stats.solids,
+			(unsigned long long)stats.copies,
+			t / 1000000000.0, stats.ops * 1000000000.0 / max(t, 1));
+	printf("%llu submits (%.1f ops/submit), %llu waits\n",
+			(unsigned long long)stats.submits,
+			stats.ops / (double)max(stats.submits, 1),
+			(unsigned long long)stats.waits);
+	print_latency("op", &stats.op);
+	print_latency("flush", &stats.flush);
+	print_latency("wait", &stats.wait);
 
-			copy(dest, src, srcX, srcY, dstX, dstY, width, height);
+	munmap(buf, st.st_size);
+	close(fd);
 
-		} else if (strstr(line, "EXA: COMPOSITE:") == line) {
-			ERROR_MSG("TODO");
-			end();
-		} else if (strstr(line, "EXA: WAIT:") == line) {
-			DEBUG_MSG("wait, timestamp=%u", timestamp);
-			wait(timestamp);
-		} else if (strstr(line, "FLUSH:") == line) {
-			flush(dest, &timestamp);
-			DEBUG_MSG("flush, timestamp=%u", timestamp);
-		} else {
-			ERROR_MSG("unexpected line: %s", line);
-			end();
-		}
-	}
+	RD_END();
 
 	return 0;
 }
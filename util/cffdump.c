@@ -30,6 +30,8 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <fcntl.h>
 #include <string.h>
 #include <assert.h>
@@ -41,6 +43,7 @@
 #include "script.h"
 #include "io.h"
 #include "rnnutil.h"
+#include "search.h"
 
 /* ************************************************************************* */
 /* originally based on kernel recovery dump code: */
@@ -92,10 +95,27 @@ static char **querystrs;
 static int *queryvals;
 int nquery;
 
+/* registers excluded from the state hash in diff mode, resolved the same
+ * way as query registers:
+ */
+static char **ignorestrs;
+static int nignore;
+static uint8_t ignored[(0xffff + 1) / 8];
+
 static char *script;
 
+/* server, diff and trim modes, while the capture is being loaded everything
+ * is quiet and the state at each draw is recorded instead:
+ */
+static bool server;
+static bool diffing;
+static bool trimming;
+static bool silent;
+
 static bool quiet(int lvl)
 {
+	if (silent)
+		return true;
 	if ((draw_filter != -1) && (draw_filter != current_draw_count))
 		return true;
 	if ((lvl >= 3) && (summary || querystrs || script))
@@ -213,6 +233,16 @@ struct buffer {
 static struct buffer buffers[512];
 static int nbuffers;
 
+static void srv_record_draw(const char *primtype, uint32_t num_indices);
+static void srv_bind_shader(int stage, void *ptr, uint32_t sizedwords);
+static void diff_track_reg(uint32_t regbase, uint32_t val);
+static void diff_track_state(int sb, int st, uint32_t off,
+		uint32_t *dwords, uint32_t sizedwords);
+static void diff_draw(const char *primtype, uint32_t num_indices);
+static uint64_t diff_hash_dwords(const uint32_t *dwords, uint32_t sizedwords);
+static void trim_ref(uint64_t gpuaddr, uint32_t len);
+static void trim_draw(uint32_t *dwords, uint32_t count);
+
 static int buffer_contains_gpuaddr(struct buffer *buf, uint64_t gpuaddr, uint32_t len)
 {
 	return (buf->gpuaddr <= gpuaddr) && (gpuaddr < (buf->gpuaddr + buf->len));
@@ -537,6 +567,23 @@ static void disasm_gpuaddr(const char *name, uint64_t gpuaddr, int level)
 
 	gpuaddr &= 0xfffffffffffffff0;
 
+	if ((server || diffing) && hostptr(gpuaddr)) {
+		int stage = -1;
+		if (strstr(name, "SP_VS_OBJ"))
+			stage = SB_VERT_SHADER;
+		else if (strstr(name, "SP_FS_OBJ"))
+			stage = SB_FRAG_SHADER;
+		else if (strstr(name, "SP_GS_OBJ"))
+			stage = SB_GEOM_SHADER;
+		else if (strstr(name, "SP_CS_OBJ"))
+			stage = SB_COMPUTE_SHADER;
+		/* the buffer may hold more than just this shader: */
+		if (stage >= 0)
+			srv_bind_shader(stage, hostptr(gpuaddr),
+					disasm_a3xx_sizedwords(hostptr(gpuaddr),
+							hostlen(gpuaddr) / 4));
+	}
+
 	if (quiet(3))
 		return;
 
@@ -827,6 +874,20 @@ static void init_rnn(const char *gpuname)
 		}
 	}
 
+	for (int i = 0; i < nignore; i++) {
+		uint32_t val = strtol(ignorestrs[i], NULL, 0);
+
+		if (val == 0)
+			val = regbase(ignorestrs[i]);
+
+		if (!val || (val > 0xffff)) {
+			fprintf(stderr, "invalid register name: %s\n", ignorestrs[i]);
+			exit(1);
+		}
+
+		ignored[val/8] |= (1 << (val % 8));
+	}
+
 	for (unsigned idx = 0; type0_reg[idx].regname; idx++) {
 		type0_reg[idx].regbase = regbase(type0_reg[idx].regname);
 		if (!type0_reg[idx].regbase) {
@@ -868,6 +929,19 @@ static void init_a5xx(void)
 	init_rnn("a5xx");
 }
 
+static void init_gpu_id(unsigned id)
+{
+	gpu_id = id;
+	if (gpu_id >= 500)
+		init_a5xx();
+	else if (gpu_id >= 400)
+		init_a4xx();
+	else if (gpu_id >= 300)
+		init_a3xx();
+	else
+		init_a2xx();
+}
+
 static void init(void)
 {
 	if (!initialized) {
@@ -975,6 +1049,8 @@ static void dump_registers(uint32_t regbase,
 		if (needs_wfi && !is_banked_reg(regbase))
 			printl(2, "NEEDS WFI: %s (%x)\n", regname(regbase, 1), regbase);
 
+		if (diffing)
+			diff_track_reg(regbase, *dwords);
 		type0_reg_vals[regbase] = *dwords;
 		type0_reg_written[regbase/8] |= (1 << (regbase % 8));
 		type0_reg_rewritten[regbase/8] |= (1 << (regbase % 8));
@@ -1023,6 +1099,12 @@ static void do_query(const char *primtype, uint32_t num_indices)
 {
 	int i;
 	int n = 0;
+
+	if (server)
+		srv_record_draw(primtype, num_indices);
+	if (diffing)
+		diff_draw(primtype, num_indices);
+
 	for (i = 0; i < nquery; i++) {
 		uint32_t regbase = queryvals[i];
 		if (reg_written(regbase)) {
@@ -1084,6 +1166,28 @@ static void cp_im_loadi(uint32_t *dwords, uint32_t sizedwords, int level)
 		dump_shader(ext, dwords + 2, (sizedwords - 2) * 4);
 }
 
+/* size in dwords of the units of CP_LOAD_STATE's num_unit, see below: */
+static uint32_t load_state_unit(enum adreno_state_block state_block_id,
+		enum adreno_state_type state_type)
+{
+	switch (state_block_id) {
+	case SB_FRAG_SHADER:
+	case SB_GEOM_SHADER:
+	case SB_VERT_SHADER:
+	case SB_COMPUTE_SHADER:
+		if (state_type == ST_SHADER)
+			return (gpu_id >= 400) ? 32 : (gpu_id >= 300) ? 8 : 2;
+		return (gpu_id >= 400) ? 4 : 2;
+	case SB_VERT_TEX:
+	case SB_FRAG_TEX:
+		if (state_type == ST_SHADER)
+			return (gpu_id >= 500) ? 4 : 2;
+		return (gpu_id >= 500) ? 12 : (gpu_id >= 400) ? 8 : 4;
+	default:
+		return 1;
+	}
+}
+
 static void cp_load_state(uint32_t *dwords, uint32_t sizedwords, int level)
 {
 	enum adreno_state_block state_block_id = (dwords[0] >> 19) & 0x7;
@@ -1093,7 +1197,7 @@ static void cp_load_state(uint32_t *dwords, uint32_t sizedwords, int level)
 	void *contents = NULL;
 	int i;
 
-	if (quiet(2))
+	if (quiet(2) && !server && !diffing && !trimming)
 		return;
 
 	if (is_64b()) {
@@ -1114,6 +1218,22 @@ static void cp_load_state(uint32_t *dwords, uint32_t sizedwords, int level)
 	if (!contents)
 		return;
 
+	if (server || diffing || trimming) {
+		uint32_t sizedwords = num_unit *
+				load_state_unit(state_block_id, state_type);
+		if (trimming && ext_src_addr)
+			trim_ref(ext_src_addr, sizedwords * 4);
+		if (diffing || trimming)
+			diff_track_state(state_block_id, state_type,
+					dwords[0] & CP_LOAD_STATE_0_DST_OFF__MASK,
+					contents, sizedwords);
+		if ((server || diffing) && (state_type == ST_SHADER))
+			srv_bind_shader(state_block_id, contents, sizedwords);
+	}
+
+	if (quiet(2))
+		return;
+
 	switch (state_block_id) {
 	case SB_FRAG_SHADER:
 	case SB_GEOM_SHADER:
@@ -1407,6 +1527,8 @@ static void cp_event_write(uint32_t *dwords, uint32_t sizedwords, int level)
 			summary = false;
 			do_query(eventname, 0);
 			dump_register_summary(level);
+			if (trimming)
+				trim_draw(dwords - 1, sizedwords + 1);
 			draw_count++;
 			summary = saved_summary;
 		}
@@ -1515,6 +1637,9 @@ static void cp_draw_indx(uint32_t *dwords, uint32_t sizedwords, int level)
 	if (num_indices > 0)
 		dump_register_summary(level);
 
+	if (trimming)
+		trim_draw(dwords - 1, sizedwords + 1);
+
 	draw_count++;
 	summary = saved_summary;
 
@@ -1562,6 +1687,9 @@ static void cp_draw_indx_2(uint32_t *dwords, uint32_t sizedwords, int level)
 	if (num_indices > 0)
 		dump_register_summary(level);
 
+	if (trimming)
+		trim_draw(dwords - 1, sizedwords + 1);
+
 	draw_count++;
 	summary = saved_summary;
 }
@@ -1585,6 +1713,9 @@ static void cp_draw_indx_offset(uint32_t *dwords, uint32_t sizedwords, int level
 	if (num_indices > 0)
 		dump_register_summary(level);
 
+	if (trimming)
+		trim_draw(dwords - 1, sizedwords + 1);
+
 	draw_count++;
 	summary = saved_summary;
 }
@@ -1599,6 +1730,9 @@ static void cp_run_cl(uint32_t *dwords, uint32_t sizedwords, int level)
 
 	dump_register_summary(level);
 
+	if (trimming)
+		trim_draw(dwords - 1, sizedwords + 1);
+
 	draw_count++;
 	summary = saved_summary;
 }
@@ -1664,6 +1798,8 @@ static void cp_indirect(uint32_t *dwords, uint32_t sizedwords, int level)
 	}
 
 	if (ptr) {
+		if (trimming)
+			trim_ref(ibaddr, ibsize * 4);
 		ib++;
 		dump_commands(ptr, ibsize, level);
 		ib--;
@@ -1702,6 +1838,8 @@ static void cp_rmw(uint32_t *dwords, uint32_t sizedwords, int level)
 	printl(3, "%srmw (%s & 0x%08x) | 0x%08x)\n", levels[level], regname(val, 1), and, or);
 	if (needs_wfi)
 		printl(2, "NEEDS WFI: rmw (%s & 0x%08x) | 0x%08x)\n", regname(val, 1), and, or);
+	if (diffing)
+		diff_track_reg(val, (type0_reg_vals[val] & and) | or);
 	type0_reg_vals[val] = (type0_reg_vals[val] & and) | or;
 	type0_reg_written[val/8] |= (1 << (val % 8));
 	type0_reg_rewritten[val/8] |= (1 << (val % 8));
@@ -1739,6 +1877,8 @@ static void cp_set_draw_state(uint32_t *dwords, uint32_t sizedwords, int level)
 		ptr = hostptr(addr);
 
 		if (ptr) {
+			if (trimming)
+				trim_ref(addr, count * 4);
 			if (!quiet(2))
 				dump_hex(ptr, count, level+1);
 
@@ -1836,6 +1976,9 @@ static void cp_blit(uint32_t *dwords, uint32_t sizedwords, int level)
 	do_query("2DBLIT", 0);
 	dump_register_summary(level);
 
+	if (trimming)
+		trim_draw(dwords - 1, sizedwords + 1);
+
 	draw_count++;
 	summary = saved_summary;
 }
@@ -2069,212 +2212,2014 @@ static void dump_commands(uint32_t *dwords, uint32_t sizedwords, int level)
 
 static int handle_file(const char *filename, int start, int end, int draw);
 
-static void print_usage(const char *name)
+/* find mode, report every place the blobs given w/ --find show up in
+ * the captured buffers, rather than decoding the cmdstream:
+ */
+static struct search *finder;
+static const char **find_names;
+static int *find_counts;
+
+struct find_ctx {
+	int submit, idx;
+	struct buffer *buf;
+};
+
+static int find_match(void *data, int needle, const uint32_t *match)
 {
-	printf("Usage: %s [OPTIONS]... FILE...\n", name);
-	printf("    --verbose         - more verbose disassembly\n");
-	printf("    --dump-shaders    - dump each shader to raw file\n");
-	printf("    --no-color        - disable colorized output (default for non-console\n");
-	printf("                        output)\n");
-	printf("    --color           - enable colorized output (default for tty output)\n");
-	printf("    --summary         - don't show individual register writes, but just show\n");
-	printf("                        register values on draws\n");
-	printf("    --allregs         - show all registers (including ones not written since\n");
-	printf("                        previous draw) at each draw\n");
-	printf("    --start N         - decode start frame number\n");
-	printf("    --end N           - decode end frame number\n");
-	printf("    --frame N         - decode specified frame number\n");
-	printf("    --draw N          - decode specified draw number\n");
-	printf("    --textures        - dump texture contents (if possible)\n");
-	printf("    --script FILE     - run specified lua script to analyze state at draws\n");
-	printf("    --query/-q REG    - query mode, dump only specified query registers on\n");
-	printf("                        each draw; multiple --query/-q args can be given to\n");
-	printf("                        dump multiple registers; register can be specified\n");
-	printf("                        either by name or numeric offset\n");
-	printf("    --help            - show this message\n");
-}
+	struct find_ctx *ctx = data;
+	unsigned off = (void *)match - ctx->buf->hostptr;
 
+	printf("%s: submit %d, buffer %d (gpuaddr %016llx, len %u): found at %016llx (+0x%x)\n",
+			find_names[needle], ctx->submit, ctx->idx,
+			(unsigned long long)ctx->buf->gpuaddr, ctx->buf->len,
+			(unsigned long long)(ctx->buf->gpuaddr + off), off);
+	find_counts[needle]++;
 
-static pid_t pager_pid;
+	return 0;
+}
 
-static void pager_death(int n)
+static void find_in_buffer(int submit, int idx, unsigned sz)
 {
-	exit(0);
+	struct find_ctx ctx = {
+			.submit = submit,
+			.idx = idx,
+			.buf = &buffers[idx],
+	};
+	uint32_t *dwords = buffers[idx].hostptr;
+
+	search_scan(finder, dwords, dwords + sz / 4, find_match, &ctx);
 }
 
-static void pager_open(void)
+/* needle is either the contents of a file, or a list of hex dwords: */
+static int add_find(const char *arg)
 {
-	int fd[2];
+	uint32_t *dwords = NULL;
+	unsigned sizedwords = 0;
+	int fd = open(arg, O_RDONLY);
+
+	if (fd >= 0) {
+		struct stat st;
+		if ((fstat(fd, &st) < 0) || (st.st_size % 4) || !st.st_size) {
+			fprintf(stderr, "%s: size must be a non-zero multiple of 4 bytes\n", arg);
+			close(fd);
+			return -1;
+		}
+		sizedwords = st.st_size / 4;
+		dwords = malloc(st.st_size);
+		if (read(fd, dwords, st.st_size) != st.st_size) {
+			fprintf(stderr, "%s: short read\n", arg);
+			close(fd);
+			free(dwords);
+			return -1;
+		}
+		close(fd);
+	} else {
+		const char *p = arg;
+		while (*p) {
+			char *next;
+			unsigned long dw;
 
-	if (pipe(fd) < 0) {
-		fprintf(stderr, "Failed to create pager pipe: %m\n");
-		exit(-1);
-	}
+			if (isspace(*p) || (*p == ',')) {
+				p++;
+				continue;
+			}
 
-	pager_pid = fork();
-	if (pager_pid < 0) {
-		fprintf(stderr, "Failed to fork pager: %m\n");
-		exit(-1);
+			dw = strtoul(p, &next, 16);
+			if ((next == p) || (dw > 0xffffffff) ||
+					(*next && !isspace(*next) && (*next != ','))) {
+				fprintf(stderr, "invalid --find arg (not a file, or hex dwords): %s\n", arg);
+				free(dwords);
+				return -1;
+			}
+
+			dwords = realloc(dwords, (sizedwords + 1) * sizeof(*dwords));
+			dwords[sizedwords++] = dw;
+			p = next;
+		}
 	}
 
-	if (pager_pid == 0) {
-		const char* less_opts;
+	if (!sizedwords) {
+		fprintf(stderr, "empty --find arg\n");
+		return -1;
+	}
 
-		dup2(fd[0], STDIN_FILENO);
-		close(fd[0]);
-		close(fd[1]);
+	if (!finder)
+		finder = search_new();
 
-		less_opts = "FRSMKX";
-		setenv("LESS", less_opts, 1);
+	/* note: search holds on to dwords, which we never free: */
+	if (search_add(finder, dwords, sizedwords) < 0)
+		return -1;
 
-		execlp("less", "less", NULL);
+	find_names = realloc(find_names, search_count(finder) * sizeof(*find_names));
+	find_names[search_count(finder) - 1] = arg;
+	find_counts = realloc(find_counts, search_count(finder) * sizeof(*find_counts));
+	find_counts[search_count(finder) - 1] = 0;
 
-	} else {
-		/* we want to kill the parent process when pager exits: */
-		signal(SIGCHLD, pager_death);
-		dup2(fd[1], STDOUT_FILENO);
-		close(fd[0]);
-		close(fd[1]);
-	}
+	return 0;
 }
 
-static int pager_close(void)
+/* run fxn() w/ stdout redirected, and return what it printed (as a
+ * NUL terminated string), so the existing dump code can be re-used to
+ * build responses (and diffs):
+ */
+static char *capture_stdout(void (*fxn)(void *arg), void *arg, size_t *len)
 {
-	siginfo_t status;
+	static FILE *tmp;
+	int saved, fd;
+	char *buf;
+
+	if (!tmp)
+		tmp = tmpfile();
+	if (!tmp) {
+		fprintf(stderr, "could not create tmp file: %m\n");
+		exit(1);
+	}
+	fd = fileno(tmp);
 
-	close(STDOUT_FILENO);
+	fflush(stdout);
+	saved = dup(STDOUT_FILENO);
+	if (ftruncate(fd, 0) < 0) {
+		fprintf(stderr, "could not truncate tmp file: %m\n");
+		exit(1);
+	}
+	lseek(fd, 0, SEEK_SET);
+	dup2(fd, STDOUT_FILENO);
 
-	while (true) {
-		memset(&status, 0, sizeof(status));
-		if (waitid(P_PID, pager_pid, &status, WEXITED) < 0) {
-			if (errno == EINTR)
-				continue;
-			return -errno;
-		}
+	fxn(arg);
 
-		return 0;
-	}
+	fflush(stdout);
+	dup2(saved, STDOUT_FILENO);
+	close(saved);
+
+	*len = lseek(fd, 0, SEEK_CUR);
+	buf = malloc(*len + 1);
+	if (pread(fd, buf, *len, 0) != *len)
+		*len = 0;
+	buf[*len] = '\0';
+
+	return buf;
 }
 
-int main(int argc, char **argv)
-{
-	int ret, n = 1;
-	int start = 0, end = 0x7ffffff, draw = -1;
-	int interactive = isatty(STDOUT_FILENO);
+/* server mode, load the capture once and answer queries about it over
+ * a unix socket (or stdin/stdout), see cffquery.c for the client.
+ *
+ * While loading, the value of each register is recorded at every draw
+ * where it changed, along with the shaders bound at each draw.  And the
+ * buffers of each submit are kept around rather than freed.  Queries
+ * re-use the normal dump code, w/ stdout redirected to capture the
+ * result, and the results are cached.
+ *
+ * The protocol is line based, each request is a single line and each
+ * response is terminated by a line containing only ".":
+ *
+ *   info                          - capture summary
+ *   draws                         - list draws
+ *   regs DRAW [REG...]            - register values at draw (default all)
+ *   changes REG                   - draws where REG changed
+ *   shader DRAW [vs|gs|fs|cs]     - disassemble shaders bound at draw
+ *   buffer SUBMIT GPUADDR [DWORDS] - hexdump of buffer contents
+ */
 
-	no_color = !interactive;
+#define SRV_CACHE_MAX (64 * 1024 * 1024)
 
-	while (n < argc) {
-		if (!strcmp(argv[n], "--verbose")) {
-			disasm_set_debug(PRINT_RAW);
-			n++;
-			continue;
-		}
+static const char *stage_names[] = {
+		[SB_VERT_SHADER - SB_VERT_SHADER]    = "vs",
+		[SB_GEOM_SHADER - SB_VERT_SHADER]    = "gs",
+		[SB_FRAG_SHADER - SB_VERT_SHADER]    = "fs",
+		[SB_COMPUTE_SHADER - SB_VERT_SHADER] = "cs",
+};
 
-		if (!strcmp(argv[n], "--dump-shaders")) {
-			dump_shaders = true;
-			n++;
-			continue;
-		}
+static const enum shader_t stage_types[] = {
+		[SB_VERT_SHADER - SB_VERT_SHADER]    = SHADER_VERTEX,
+		[SB_GEOM_SHADER - SB_VERT_SHADER]    = SHADER_VERTEX,
+		[SB_FRAG_SHADER - SB_VERT_SHADER]    = SHADER_FRAGMENT,
+		[SB_COMPUTE_SHADER - SB_VERT_SHADER] = SHADER_COMPUTE,
+};
 
-		if (!strcmp(argv[n], "--no-color")) {
-			no_color = true;
-			n++;
-			continue;
-		}
+struct srv_shader {
+	void *ptr;
+	uint32_t sizedwords;
+	uint64_t hash;       /* of the contents, only when diffing */
+};
 
-		if (!strcmp(argv[n], "--color")) {
-			no_color = false;
-			n++;
-			continue;
-		}
+struct srv_draw {
+	int submit;
+	char *primtype;
+	uint32_t num_indices;
+	struct srv_shader shaders[ARRAY_SIZE(stage_names)];
+};
 
-		if (!strcmp(argv[n], "--summary")) {
-			summary = true;
-			n++;
-			continue;
-		}
+/* history of a register, one entry per draw where it changed: */
+struct srv_reg {
+	struct {
+		int draw;
+		uint32_t val;
+	} *vals;
+	int nvals, maxvals;
+};
 
-		if (!strcmp(argv[n], "--allregs")) {
-			allregs = true;
-			n++;
-			continue;
-		}
+struct srv_cache {
+	struct srv_cache *next;
+	char *req;
+	char *resp;
+	size_t len;
+};
 
-		if (!strcmp(argv[n], "--start")) {
-			n++;
-			start = atoi(argv[n]);
-			n++;
-			continue;
-		}
+static struct {
+	const char *filename;
+	struct srv_draw *draws;
+	int ndraws, maxdraws;
+	struct srv_reg *regs[ARRAY_SIZE(type0_reg_vals)];
+	struct {
+		struct buffer *bufs;
+		int nbufs;
+	} *submits;
+	int nsubmits, maxsubmits;
+	struct srv_shader shaders[ARRAY_SIZE(stage_names)];
+	int submit;          /* submit currently being decoded */
+	struct srv_cache *cache[256];
+	size_t cachesize;
+} srv;
+
+#define GROW(arr, n, max) do {                                          \
+		if ((n) >= (max)) {                                         \
+			(max) = (max) ? (max) * 2 : 64;                         \
+			(arr) = realloc((arr), (max) * sizeof(*(arr)));         \
+			assert(arr);                                            \
+		}                                                           \
+	} while (0)
+
+static void srv_bind_shader(int stage, void *ptr, uint32_t sizedwords)
+{
+	stage -= SB_VERT_SHADER;
+	if ((stage < 0) || (stage >= ARRAY_SIZE(srv.shaders)))
+		return;
+	/* when diffing, buffers are freed after each submit, so the bound
+	 * shader needs to be copied:
+	 */
+	if (diffing) {
+		free(srv.shaders[stage].ptr);
+		ptr = memcpy(malloc(sizedwords * 4), ptr, sizedwords * 4);
+		srv.shaders[stage].hash = diff_hash_dwords(ptr, sizedwords);
+	}
+	srv.shaders[stage].ptr = ptr;
+	srv.shaders[stage].sizedwords = sizedwords;
+}
 
-		if (!strcmp(argv[n], "--end")) {
-			n++;
-			end = atoi(argv[n]);
-			n++;
-			continue;
-		}
+static void srv_record_draw(const char *primtype, uint32_t num_indices)
+{
+	struct srv_draw *draw;
+	uint32_t i;
 
-		if (!strcmp(argv[n], "--frame")) {
-			n++;
-			end = start = atoi(argv[n]);
-			n++;
-			continue;
-		}
+	GROW(srv.draws, srv.ndraws, srv.maxdraws);
+	draw = &srv.draws[srv.ndraws];
+	draw->submit = srv.submit;
+	draw->primtype = strdup(primtype ? primtype : "?");
+	draw->num_indices = num_indices;
+	memcpy(draw->shaders, srv.shaders, sizeof(draw->shaders));
 
-		if (!strcmp(argv[n], "--draw")) {
-			n++;
-			draw = atoi(argv[n]);
-			n++;
-			continue;
-		}
+	/* only registers written since the last draw can have changed: */
+	for (i = 0; i < regcnt(); i += 8) {
+		uint32_t j;
 
-		if (!strcmp(argv[n], "--textures")) {
-			n++;
-			dump_textures = true;
+		if (!type0_reg_rewritten[i/8])
 			continue;
-		}
 
-		if (!strcmp(argv[n], "--script")) {
-			n++;
-			script = argv[n];
-			if (script_load(script)) {
-				fprintf(stderr, "error loading %s\n", argv[n]);
-				return 1;
-			}
-			n++;
-			continue;
-		}
+		for (j = i; j < i + 8; j++) {
+			struct srv_reg *reg;
 
-		if (!strcmp(argv[n], "--query") ||
-				!strcmp(argv[n], "-q")) {
-			n++;
-			querystrs = realloc(querystrs, (nquery + 1) * sizeof(*querystrs));
-			querystrs[nquery] = argv[n];
-			nquery++;
-			n++;
-			interactive = 0;
-			continue;
-		}
+			if (!reg_rewritten(j))
+				continue;
 
-		if (!strcmp(argv[n], "--help")) {
-			n++;
-			print_usage(argv[0]);
-			return 0;
-		}
+			reg = srv.regs[j];
+			if (!reg)
+				reg = srv.regs[j] = calloc(1, sizeof(*reg));
 
-		break;
-	}
+			if (reg->nvals && (reg->vals[reg->nvals-1].val == reg_val(j)))
+				continue;
 
-	if (interactive) {
-		pager_open();
+			GROW(reg->vals, reg->nvals, reg->maxvals);
+			reg->vals[reg->nvals].draw = srv.ndraws;
+			reg->vals[reg->nvals].val = reg_val(j);
+			reg->nvals++;
+		}
 	}
 
-	rnn = rnn_new(no_color);
+	srv.ndraws++;
+}
 
-	while (n < argc) {
-		ret = handle_file(argv[n], start, end, draw);
-		if (ret) {
+/* called at the first RD_GPUADDR of each submit, and at the end, to
+ * stash the buffer table for the submit(s) decoded since the last call:
+ */
+static void srv_save_buffers(int nsubmits)
+{
+	struct buffer *bufs = malloc(nbuffers * sizeof(*bufs));
+
+	memcpy(bufs, buffers, nbuffers * sizeof(*bufs));
+
+	while (srv.nsubmits < nsubmits) {
+		GROW(srv.submits, srv.nsubmits, srv.maxsubmits);
+		srv.submits[srv.nsubmits].bufs = bufs;
+		srv.submits[srv.nsubmits].nbufs = nbuffers;
+		srv.nsubmits++;
+	}
+}
+
+/* make the submit's buffers current, for hostptr() and friends: */
+static int srv_use_submit(int submit)
+{
+	if ((submit < 0) || (submit >= srv.nsubmits)) {
+		printf("invalid submit: %d\n", submit);
+		return -1;
+	}
+	nbuffers = srv.submits[submit].nbufs;
+	memcpy(buffers, srv.submits[submit].bufs, nbuffers * sizeof(buffers[0]));
+	return 0;
+}
+
+static struct srv_draw *srv_get_draw(const char *arg)
+{
+	char *end;
+	long n = strtol(arg, &end, 0);
+
+	if (*end || (n < 0) || (n >= srv.ndraws)) {
+		printf("invalid draw: %s\n", arg);
+		return NULL;
+	}
+
+	if (srv_use_submit(srv.draws[n].submit))
+		return NULL;
+
+	return &srv.draws[n];
+}
+
+static int srv_get_reg(const char *arg, uint32_t *reg)
+{
+	char *end;
+	unsigned long n = strtoul(arg, &end, 0);
+
+	if (*end)
+		n = regbase(arg);
+
+	if (!n || (n >= regcnt())) {
+		printf("invalid register: %s\n", arg);
+		return -1;
+	}
+
+	*reg = n;
+	return 0;
+}
+
+/* value of register at draw, returns index into history, or -1 if the
+ * register is not written by then:
+ */
+static int srv_reg_at(uint32_t regbase, int draw)
+{
+	struct srv_reg *reg = srv.regs[regbase];
+	int lo = 0, hi;
+
+	if (!reg)
+		return -1;
+
+	hi = reg->nvals;
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (reg->vals[mid].draw <= draw)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo - 1;
+}
+
+static void srv_print_reg(uint32_t regbase, int draw)
+{
+	int idx = srv_reg_at(regbase, draw);
+	uint32_t val;
+
+	if (idx < 0)
+		return;
+
+	val = srv.regs[regbase]->vals[idx].val;
+
+	/* reg_val() is used to decode _LO/_HI pairs: */
+	type0_reg_vals[regbase] = val;
+	if (regbase > 0)
+		type0_reg_vals[regbase-1] = (srv_reg_at(regbase-1, draw) >= 0) ?
+				srv.regs[regbase-1]->vals[srv_reg_at(regbase-1, draw)].val : 0;
+	if (regbase + 1 < regcnt())
+		type0_reg_vals[regbase+1] = (srv_reg_at(regbase+1, draw) >= 0) ?
+				srv.regs[regbase+1]->vals[srv_reg_at(regbase+1, draw)].val : 0;
+
+	printf("%s\t%08x",
+			(srv.regs[regbase]->vals[idx].draw == draw) ? "!" : " ", val);
+	dump_register_val(regbase, val, 0);
+}
+
+static void srv_cmd_info(int argc, char **argv)
+{
+	printf("file:    %s\n", srv.filename);
+	printf("gpu_id:  %u\n", gpu_id);
+	printf("submits: %d\n", srv.nsubmits);
+	printf("draws:   %d\n", srv.ndraws);
+}
+
+static void srv_cmd_draws(int argc, char **argv)
+{
+	int i;
+	for (i = 0; i < srv.ndraws; i++) {
+		struct srv_draw *draw = &srv.draws[i];
+		printf("%4d: submit %d: %s:%u\n", i, draw->submit,
+				draw->primtype, draw->num_indices);
+	}
+}
+
+static void srv_cmd_regs(int argc, char **argv)
+{
+	struct srv_draw *draw;
+	uint32_t regbase;
+	int i, n;
+
+	if (argc < 2) {
+		printf("usage: regs DRAW [REG...]\n");
+		return;
+	}
+
+	draw = srv_get_draw(argv[1]);
+	if (!draw)
+		return;
+
+	n = draw - srv.draws;
+
+	if (argc == 2) {
+		for (regbase = 0; regbase < regcnt(); regbase++)
+			srv_print_reg(regbase, n);
+		return;
+	}
+
+	for (i = 2; i < argc; i++)
+		if (!srv_get_reg(argv[i], &regbase))
+			srv_print_reg(regbase, n);
+}
+
+static void srv_cmd_changes(int argc, char **argv)
+{
+	struct srv_reg *reg;
+	uint32_t regbase;
+	int i;
+
+	if (argc != 2) {
+		printf("usage: changes REG\n");
+		return;
+	}
+
+	if (srv_get_reg(argv[1], &regbase))
+		return;
+
+	reg = srv.regs[regbase];
+	for (i = 0; reg && (i < reg->nvals); i++) {
+		int n = reg->vals[i].draw;
+		if (srv_use_submit(srv.draws[n].submit))
+			return;
+		printf("%4d: %s:%u:", n, srv.draws[n].primtype,
+				srv.draws[n].num_indices);
+		srv_print_reg(regbase, n);
+	}
+}
+
+static void srv_cmd_shader(int argc, char **argv)
+{
+	struct srv_draw *draw;
+	int i;
+
+	if (argc < 2) {
+		printf("usage: shader DRAW [vs|gs|fs|cs]\n");
+		return;
+	}
+
+	draw = srv_get_draw(argv[1]);
+	if (!draw)
+		return;
+
+	for (i = 0; i < ARRAY_SIZE(stage_names); i++) {
+		struct srv_shader *shader = &draw->shaders[i];
+
+		if ((argc > 2) && strcmp(argv[2], stage_names[i]))
+			continue;
+		if (!shader->ptr)
+			continue;
+
+		printf("%s: %u dwords\n", stage_names[i], shader->sizedwords);
+		disasm_a3xx(shader->ptr, shader->sizedwords, 1, stage_types[i]);
+	}
+}
+
+static void srv_cmd_buffer(int argc, char **argv)
+{
+	uint64_t addr;
+	uint32_t sizedwords = 64;
+	void *ptr;
+
+	if (argc < 3) {
+		printf("usage: buffer SUBMIT GPUADDR [DWORDS]\n");
+		return;
+	}
+
+	if (srv_use_submit(strtol(argv[1], NULL, 0)))
+		return;
+
+	addr = strtoull(argv[2], NULL, 0);
+	if (argc > 3)
+		sizedwords = strtoul(argv[3], NULL, 0);
+
+	ptr = hostptr(addr);
+	if (!ptr) {
+		printf("no buffer at %016llx\n", (unsigned long long)addr);
+		return;
+	}
+
+	sizedwords = min(sizedwords, hostlen(addr) / 4);
+	printf("%016llx: %u dwords\n", (unsigned long long)addr, sizedwords);
+	dump_hex(ptr, sizedwords, 0);
+}
+
+static const struct {
+	const char *name;
+	void (*fxn)(int argc, char **argv);
+} srv_cmds[] = {
+		{ "info",    srv_cmd_info },
+		{ "draws",   srv_cmd_draws },
+		{ "regs",    srv_cmd_regs },
+		{ "changes", srv_cmd_changes },
+		{ "shader",  srv_cmd_shader },
+		{ "buffer",  srv_cmd_buffer },
+};
+
+static void srv_handle(char *req)
+{
+	char *argv[32], *saveptr;
+	int i, argc = 0;
+
+	for (argv[argc] = strtok_r(req, " \t", &saveptr); argv[argc] &&
+			(argc < ARRAY_SIZE(argv) - 1);
+			argv[argc] = strtok_r(NULL, " \t", &saveptr))
+		argc++;
+
+	if (!argc)
+		return;
+
+	for (i = 0; i < ARRAY_SIZE(srv_cmds); i++) {
+		if (!strcmp(argv[0], srv_cmds[i].name)) {
+			srv_cmds[i].fxn(argc, argv);
+			return;
+		}
+	}
+
+	printf("unknown request: %s\n", argv[0]);
+	printf("requests: info, draws, regs, changes, shader, buffer\n");
+}
+
+static unsigned srv_hash(const char *str)
+{
+	unsigned h = 2166136261u;
+	while (*str)
+		h = (h ^ (uint8_t)*str++) * 16777619u;
+	return h % ARRAY_SIZE(srv.cache);
+}
+
+static void srv_handle_req(void *req)
+{
+	char *tmpreq = strdup(req);
+	srv_handle(tmpreq);
+	free(tmpreq);
+}
+
+static struct srv_cache *srv_request(const char *req)
+{
+	unsigned h = srv_hash(req);
+	struct srv_cache *entry;
+
+	for (entry = srv.cache[h]; entry; entry = entry->next)
+		if (!strcmp(entry->req, req))
+			return entry;
+
+	entry = calloc(1, sizeof(*entry));
+	entry->req = strdup(req);
+	entry->resp = capture_stdout(srv_handle_req, (void *)req, &entry->len);
+
+	/* if the cache grows too large, just start over: */
+	srv.cachesize += entry->len;
+	if (srv.cachesize > SRV_CACHE_MAX) {
+		int i;
+		for (i = 0; i < ARRAY_SIZE(srv.cache); i++) {
+			while (srv.cache[i]) {
+				struct srv_cache *e = srv.cache[i];
+				srv.cache[i] = e->next;
+				free(e->req);
+				free(e->resp);
+				free(e);
+			}
+		}
+		srv.cachesize = entry->len;
+	}
+
+	entry->next = srv.cache[h];
+	srv.cache[h] = entry;
+
+	return entry;
+}
+
+static int write_all(int fd, const char *buf, size_t len)
+{
+	while (len > 0) {
+		ssize_t ret = write(fd, buf, len);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += ret;
+		len -= ret;
+	}
+	return 0;
+}
+
+static void srv_session(int infd, int outfd)
+{
+	FILE *in = fdopen(dup(infd), "r");
+	char *line = NULL;
+	size_t n = 0;
+	ssize_t len;
+
+	if (!in)
+		return;
+
+	while ((len = getline(&line, &n, in)) > 0) {
+		struct srv_cache *resp;
+
+		while ((len > 0) && isspace(line[len-1]))
+			line[--len] = '\0';
+
+		if (!strcmp(line, "quit"))
+			break;
+
+		resp = srv_request(line);
+		if (write_all(outfd, resp->resp, resp->len) ||
+				write_all(outfd, ".\n", 2))
+			break;
+	}
+
+	free(line);
+	fclose(in);
+}
+
+static int serve(const char *filename, const char *sockpath,
+		int start, int end)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	int ret, saved, fd;
+
+	srv.filename = filename;
+
+	/* anything not covered by quiet() goes to /dev/null while loading: */
+	fflush(stdout);
+	saved = dup(STDOUT_FILENO);
+	fd = open("/dev/null", O_WRONLY);
+	dup2(fd, STDOUT_FILENO);
+	close(fd);
+
+	silent = true;
+	ret = handle_file(filename, start, end, -1);
+	silent = false;
+
+	fflush(stdout);
+	dup2(saved, STDOUT_FILENO);
+	close(saved);
+
+	if (ret)
+		return ret;
+
+	fprintf(stderr, "loaded %s: %d submits, %d draws\n", filename,
+			srv.nsubmits, srv.ndraws);
+
+	if (!strcmp(sockpath, "-")) {
+		srv_session(STDIN_FILENO, STDOUT_FILENO);
+		return 0;
+	}
+
+	if (strlen(sockpath) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "socket path too long: %s\n", sockpath);
+		return -1;
+	}
+	strcpy(addr.sun_path, sockpath);
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		fprintf(stderr, "could not create socket: %m\n");
+		return -1;
+	}
+
+	unlink(sockpath);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+			listen(fd, 4)) {
+		fprintf(stderr, "could not listen on %s: %m\n", sockpath);
+		close(fd);
+		return -1;
+	}
+
+	fprintf(stderr, "listening on %s\n", sockpath);
+
+	/* a client dropping the connection shouldn't kill us: */
+	signal(SIGPIPE, SIG_IGN);
+
+	while (true) {
+		int cfd = accept(fd, NULL, NULL);
+		if (cfd < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "accept failed: %m\n");
+			break;
+		}
+		srv_session(cfd, cfd);
+		close(cfd);
+	}
+
+	close(fd);
+	unlink(sockpath);
+
+	return -1;
+}
+
+/* diff mode, find the first draw where two or more captures diverge and
+ * show what is different at that point.
+ *
+ * Each capture is decoded by a forked child, which maintains a hash of
+ * the effective state, updated incrementally on each register write and
+ * CP_LOAD_STATE (so it costs about the same as decoding), and sends it
+ * to the parent at each draw.  The children are run in lock-step, so
+ * the captures are decoded in a single pass which stops at the first
+ * draw where the hashes (or draw params) differ.  At that point each
+ * child sends a snapshot of it's state, and the parent prints a decoded
+ * diff of the registers, shaders and constants.
+ */
+
+#define DIFF_SHADOW_DWORDS 4096
+
+/* shadow of state loaded via CP_LOAD_STATE, per state-block/type (also
+ * used by trim mode, to find buffers referenced by texture state):
+ */
+struct diff_shadow {
+	uint32_t vals[DIFF_SHADOW_DWORDS];
+	uint8_t valid[DIFF_SHADOW_DWORDS / 8];
+};
+
+struct diff_msg {
+	enum {
+		DIFF_DRAW,
+		DIFF_END,
+	} type;
+	unsigned gpu_id;
+	uint32_t draw;
+	uint32_t num_indices;
+	uint64_t hash;
+	char primtype[32];
+};
+
+/* snapshot sent from child to parent at the divergence: */
+struct diff_state {
+	struct diff_msg msg;
+	uint32_t vals[ARRAY_SIZE(type0_reg_vals)];
+	uint8_t written[ARRAY_SIZE(type0_reg_written)];
+	struct diff_shadow shadows[8][2];
+	struct srv_shader shaders[ARRAY_SIZE(stage_names)];
+};
+
+static struct {
+	int rfd, wfd;
+	uint64_t hash;
+	struct diff_shadow shadows[8][2];
+} diff;
+
+static uint64_t diff_mix(uint64_t key, uint32_t val)
+{
+	/* murmur3 finalizer: */
+	uint64_t h = (key << 32) ^ val ^ (key >> 32);
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdull;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ull;
+	h ^= h >> 33;
+	return h;
+}
+
+static uint64_t diff_hash_dwords(const uint32_t *dwords, uint32_t sizedwords)
+{
+	uint64_t h = sizedwords;
+	uint32_t i;
+	for (i = 0; i < sizedwords; i++)
+		h = diff_mix(h, dwords[i]);
+	return h;
+}
+
+/* the state hash is the xor of the hash of each (register, value) and
+ * (state-block, offset, value), so it can be updated by xor'ing out the
+ * old value and xor'ing in the new one:
+ */
+static void diff_track_reg(uint32_t regbase, uint32_t val)
+{
+	if (ignored[regbase/8] & (1 << (regbase % 8)))
+		return;
+	if (reg_written(regbase))
+		diff.hash ^= diff_mix(regbase, reg_val(regbase));
+	diff.hash ^= diff_mix(regbase, val);
+}
+
+static void diff_track_state(int sb, int st, uint32_t off,
+		uint32_t *dwords, uint32_t sizedwords)
+{
+	struct diff_shadow *shadow = &diff.shadows[sb & 0x7][st & 0x1];
+	uint64_t key = 0x10000 | (sb << 1) | st;
+	uint32_t i;
+
+	off *= load_state_unit(sb, st);
+
+	for (i = 0; (i < sizedwords) && ((off + i) < DIFF_SHADOW_DWORDS); i++) {
+		uint32_t idx = off + i;
+		uint64_t k = (key << 16) | idx;
+
+		if (shadow->valid[idx/8] & (1 << (idx % 8)))
+			diff.hash ^= diff_mix(k, shadow->vals[idx]);
+		diff.hash ^= diff_mix(k, dwords[i]);
+		shadow->vals[idx] = dwords[i];
+		shadow->valid[idx/8] |= (1 << (idx % 8));
+	}
+}
+
+static int read_all(int fd, void *buf, size_t len)
+{
+	while (len > 0) {
+		ssize_t ret = read(fd, buf, len);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (ret == 0)
+			return -1;
+		buf += ret;
+		len -= ret;
+	}
+	return 0;
+}
+
+/* child side, send the current state to the parent: */
+static void diff_send_state(struct diff_msg *msg)
+{
+	struct diff_state *state = calloc(1, sizeof(*state));
+	int i;
+
+	state->msg = *msg;
+	memcpy(state->vals, type0_reg_vals, sizeof(state->vals));
+	memcpy(state->written, type0_reg_written, sizeof(state->written));
+	memcpy(state->shadows, diff.shadows, sizeof(state->shadows));
+
+	if (write_all(diff.wfd, (void *)state, sizeof(*state)))
+		_exit(1);
+
+	/* followed by the contents of the bound shaders: */
+	for (i = 0; i < ARRAY_SIZE(srv.shaders); i++) {
+		uint32_t sizedwords = srv.shaders[i].ptr ? srv.shaders[i].sizedwords : 0;
+		if (write_all(diff.wfd, (void *)&sizedwords, sizeof(sizedwords)) ||
+				write_all(diff.wfd, srv.shaders[i].ptr, sizedwords * 4))
+			_exit(1);
+	}
+
+	free(state);
+}
+
+/* child side, report the draw and wait for the parent to tell us to
+ * continue, or to send our state and exit:
+ */
+static void diff_sync(struct diff_msg *msg)
+{
+	char reply;
+
+	msg->gpu_id = gpu_id;
+
+	if (write_all(diff.wfd, (void *)msg, sizeof(*msg)) ||
+			read_all(diff.rfd, &reply, 1))
+		_exit(1);
+
+	if (reply == 'c')
+		return;
+
+	if (reply == 'd')
+		diff_send_state(msg);
+
+	_exit(0);
+}
+
+static void diff_draw(const char *primtype, uint32_t num_indices)
+{
+	struct diff_msg msg = {
+			.type = DIFF_DRAW,
+			.draw = draw_count,
+			.num_indices = num_indices,
+	};
+	int i;
+
+	/* shaders which are not loaded via CP_LOAD_STATE (ie. a5xx) are
+	 * only known by address, so mix in the bound contents too (hashed
+	 * once at bind time):
+	 */
+	msg.hash = diff.hash;
+	for (i = 0; i < ARRAY_SIZE(srv.shaders); i++) {
+		struct srv_shader *shader = &srv.shaders[i];
+		if (shader->ptr)
+			msg.hash ^= diff_mix(i, shader->hash);
+	}
+
+	strncpy(msg.primtype, primtype ? primtype : "?", sizeof(msg.primtype) - 1);
+
+	diff_sync(&msg);
+}
+
+static pid_t diff_spawn(const char *filename, int start, int end,
+		int *rfd, int *wfd)
+{
+	int up[2], down[2], fd;
+	pid_t pid;
+
+	if (pipe(up) || pipe(down)) {
+		fprintf(stderr, "could not create pipe: %m\n");
+		return -1;
+	}
+
+	fflush(stdout);
+
+	pid = fork();
+	if (pid < 0) {
+		fprintf(stderr, "could not fork: %m\n");
+		return -1;
+	}
+
+	if (pid == 0) {
+		struct diff_msg msg = { .type = DIFF_END };
+
+		close(up[0]);
+		close(down[1]);
+		diff.wfd = up[1];
+		diff.rfd = down[0];
+
+		fd = open("/dev/null", O_WRONLY);
+		dup2(fd, STDOUT_FILENO);
+		close(fd);
+
+		diffing = true;
+		silent = true;
+		if (handle_file(filename, start, end, -1))
+			_exit(1);
+
+		msg.draw = draw_count;
+		diff_sync(&msg);
+		_exit(0);
+	}
+
+	close(up[1]);
+	close(down[0]);
+	*rfd = up[0];
+	*wfd = down[1];
+
+	return pid;
+}
+
+static struct diff_state *diff_recv_state(int fd)
+{
+	struct diff_state *state = malloc(sizeof(*state));
+	int i;
+
+	if (read_all(fd, state, sizeof(*state))) {
+		free(state);
+		return NULL;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(state->shaders); i++) {
+		uint32_t sizedwords;
+		if (read_all(fd, &sizedwords, sizeof(sizedwords)))
+			return NULL;
+		state->shaders[i].sizedwords = sizedwords;
+		state->shaders[i].ptr = NULL;
+		if (sizedwords) {
+			state->shaders[i].ptr = malloc(sizedwords * 4);
+			if (read_all(fd, state->shaders[i].ptr, sizedwords * 4))
+				return NULL;
+		}
+	}
+
+	return state;
+}
+
+static bool state_reg_written(struct diff_state *state, uint32_t regbase)
+{
+	return !!(state->written[regbase/8] & (1 << (regbase % 8)));
+}
+
+/* make a snapshot current, so reg_val() (used to decode _LO/_HI pairs)
+ * returns values from the snapshot:
+ */
+static void diff_print_reg(struct diff_state *state, const char *prefix,
+		uint32_t regbase)
+{
+	memcpy(type0_reg_vals, state->vals, sizeof(type0_reg_vals));
+	printf("%s", prefix);
+	if (state_reg_written(state, regbase))
+		dump_register_val(regbase, state->vals[regbase], 0);
+	else
+		printf("\t%s: <not written>\n", regname(regbase, 0));
+}
+
+static void diff_regs(struct diff_state *a, struct diff_state *b)
+{
+	uint32_t i;
+	int n = 0;
+
+	for (i = 0; i < regcnt(); i++) {
+		bool wa = state_reg_written(a, i), wb = state_reg_written(b, i);
+
+		if (ignored[i/8] & (1 << (i % 8)))
+			continue;
+		if (!wa && !wb)
+			continue;
+		if ((wa == wb) && (a->vals[i] == b->vals[i]))
+			continue;
+
+		if (!n++)
+			printf("registers:\n");
+
+		diff_print_reg(a, "-", i);
+		diff_print_reg(b, "+", i);
+	}
+}
+
+struct diff_disasm {
+	struct srv_shader *shader;
+	enum shader_t type;
+};
+
+static void diff_disasm(void *arg)
+{
+	struct diff_disasm *d = arg;
+	disasm_a3xx(d->shader->ptr, d->shader->sizedwords, 0, d->type);
+}
+
+static char **split_lines(char *buf, int *n)
+{
+	char **lines = NULL;
+	char *saveptr, *line;
+
+	*n = 0;
+	for (line = strtok_r(buf, "\n", &saveptr); line;
+			line = strtok_r(NULL, "\n", &saveptr)) {
+		lines = realloc(lines, (*n + 1) * sizeof(*lines));
+		lines[(*n)++] = line;
+	}
+
+	return lines;
+}
+
+/* minimal line diff of the two disassemblies, via longest common
+ * subsequence.  Shaders are small enough that O(n*m) is fine:
+ */
+static int diff_lines(char **a, int na, char **b, int nb)
+{
+	int *lcs = calloc((na + 1) * (nb + 1), sizeof(*lcs));
+	int i, j, n = 0;
+
+#define LCS(i, j) lcs[((i) * (nb + 1)) + (j)]
+	for (i = na - 1; i >= 0; i--) {
+		for (j = nb - 1; j >= 0; j--) {
+			if (!strcmp(a[i], b[j]))
+				LCS(i, j) = LCS(i + 1, j + 1) + 1;
+			else
+				LCS(i, j) = max(LCS(i + 1, j), LCS(i, j + 1));
+		}
+	}
+
+	i = j = 0;
+	while ((i < na) || (j < nb)) {
+		if ((i < na) && (j < nb) && !strcmp(a[i], b[j])) {
+			i++;
+			j++;
+		} else if ((j >= nb) || ((i < na) && (LCS(i + 1, j) >= LCS(i, j + 1)))) {
+			printf("-%s\n", a[i++]);
+			n++;
+		} else {
+			printf("+%s\n", b[j++]);
+			n++;
+		}
+	}
+#undef LCS
+
+	free(lcs);
+
+	return n;
+}
+
+static void diff_shaders(struct diff_state *a, struct diff_state *b)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(stage_names); i++) {
+		struct srv_shader *sa = &a->shaders[i], *sb = &b->shaders[i];
+		struct diff_disasm d = { .type = stage_types[i] };
+		char *bufa = strdup(""), *bufb = strdup("");
+		char **la, **lb;
+		int na, nb;
+		size_t len;
+
+		if ((sa->sizedwords == sb->sizedwords) && (!sa->sizedwords ||
+				!memcmp(sa->ptr, sb->ptr, sa->sizedwords * 4)))
+			continue;
+
+		printf("shader %s:\n", stage_names[i]);
+
+		if (sa->sizedwords) {
+			free(bufa);
+			d.shader = sa;
+			bufa = capture_stdout(diff_disasm, &d, &len);
+		}
+		if (sb->sizedwords) {
+			free(bufb);
+			d.shader = sb;
+			bufb = capture_stdout(diff_disasm, &d, &len);
+		}
+
+		la = split_lines(bufa, &na);
+		lb = split_lines(bufb, &nb);
+
+		/* if the difference is in bits the disassembler ignores, show
+		 * the raw dwords instead:
+		 */
+		if (!diff_lines(la, na, lb, nb)) {
+			uint32_t *da = sa->ptr, *db = sb->ptr;
+			uint32_t j;
+			for (j = 0; j < min(sa->sizedwords, sb->sizedwords); j++)
+				if (da[j] != db[j])
+					printf("\t[%u]: %08x -> %08x\n", j, da[j], db[j]);
+		}
+
+		free(la);
+		free(lb);
+		free(bufa);
+		free(bufb);
+	}
+}
+
+static void diff_consts(struct diff_state *a, struct diff_state *b)
+{
+	int sb, st;
+
+	for (sb = 0; sb < ARRAY_SIZE(a->shadows); sb++) {
+		for (st = 0; st < ARRAY_SIZE(a->shadows[0]); st++) {
+			struct diff_shadow *sa = &a->shadows[sb][st];
+			struct diff_shadow *sb_ = &b->shadows[sb][st];
+			bool shader = (SB_VERT_SHADER <= sb) && (sb <= SB_COMPUTE_SHADER);
+			const char *name = rnn_enumname(rnn, "adreno_state_block", sb);
+			uint32_t i;
+			int n = 0;
+
+			/* shader instructions are diff'd by diff_shaders(): */
+			if (shader && (st == ST_SHADER))
+				continue;
+
+			for (i = 0; i < DIFF_SHADOW_DWORDS; i++) {
+				bool va = !!(sa->valid[i/8] & (1 << (i % 8)));
+				bool vb = !!(sb_->valid[i/8] & (1 << (i % 8)));
+
+				if (!va && !vb)
+					continue;
+				if ((va == vb) && (sa->vals[i] == sb_->vals[i]))
+					continue;
+
+				if (!n++) {
+					printf("%s %s:\n", name ? name : "?",
+							(st == ST_SHADER) ? "shader" : "constants");
+				}
+
+				if (shader) {
+					/* shader consts, as vec4 regs: */
+					printf("\tc%u.%c:", i / 4, "xyzw"[i % 4]);
+				} else {
+					printf("\t[%u]:", i);
+				}
+
+				if (va)
+					printf(" %08x (%f)", sa->vals[i], ((float *)sa->vals)[i]);
+				else
+					printf(" <not loaded>");
+				printf(" ->");
+				if (vb)
+					printf(" %08x (%f)\n", sb_->vals[i], ((float *)sb_->vals)[i]);
+				else
+					printf(" <not loaded>\n");
+			}
+		}
+	}
+}
+
+static void diff_print_draw(const char *prefix, const char *filename,
+		struct diff_msg *msg)
+{
+	if (msg->type == DIFF_END) {
+		printf("%s %s: end of capture after %u draws\n", prefix,
+				filename, msg->draw);
+	} else {
+		printf("%s %s: draw %u: %s:%u\n", prefix, filename, msg->draw,
+				msg->primtype, msg->num_indices);
+	}
+}
+
+static void diff_print(const char *fa, struct diff_state *a,
+		const char *fb, struct diff_state *b)
+{
+	diff_print_draw("---", fa, &a->msg);
+	diff_print_draw("+++", fb, &b->msg);
+
+	diff_regs(a, b);
+	diff_shaders(a, b);
+	diff_consts(a, b);
+}
+
+static bool diff_msg_equal(struct diff_msg *a, struct diff_msg *b)
+{
+	return (a->type == b->type) && (a->hash == b->hash) &&
+			(a->num_indices == b->num_indices) &&
+			!strcmp(a->primtype, b->primtype);
+}
+
+static int diff_files(int nfiles, char **files, int start, int end)
+{
+	struct child {
+		pid_t pid;
+		int rfd, wfd;
+		struct diff_msg msg;
+		struct diff_state *state;
+	} *children = calloc(nfiles, sizeof(*children));
+	uint32_t ndraws = 0;
+	int i, diverged = -1, ret = 0;
+
+	/* the children don't need to be told that the parent went away: */
+	signal(SIGPIPE, SIG_IGN);
+
+	for (i = 0; i < nfiles; i++) {
+		children[i].pid = diff_spawn(files[i], start, end,
+				&children[i].rfd, &children[i].wfd);
+		if (children[i].pid < 0)
+			return -1;
+	}
+
+	while (diverged < 0) {
+		bool done = true;
+		char reply;
+
+		for (i = 0; i < nfiles; i++) {
+			if (read_all(children[i].rfd, &children[i].msg,
+					sizeof(children[i].msg))) {
+				fprintf(stderr, "error reading: %s\n", files[i]);
+				ret = -1;
+				goto out;
+			}
+			if (children[i].msg.type != DIFF_END)
+				done = false;
+		}
+
+		for (i = 1; i < nfiles; i++) {
+			if (!diff_msg_equal(&children[0].msg, &children[i].msg)) {
+				diverged = children[0].msg.draw;
+				break;
+			}
+		}
+
+		if (done && (diverged < 0))
+			break;
+
+		reply = (diverged >= 0) ? 'd' : 'c';
+		for (i = 0; i < nfiles; i++)
+			if (write_all(children[i].wfd, &reply, 1))
+				ret = -1;
+
+		if (diverged < 0)
+			ndraws++;
+	}
+
+	if (diverged < 0) {
+		printf("no divergence in %u draws\n", ndraws);
+		goto out;
+	}
+
+	printf("first divergence at draw %d\n", diverged);
+
+	for (i = 0; i < nfiles; i++) {
+		children[i].state = diff_recv_state(children[i].rfd);
+		if (!children[i].state) {
+			fprintf(stderr, "error reading state: %s\n", files[i]);
+			ret = -1;
+			goto out;
+		}
+	}
+
+	/* the register database is needed for decoding in the parent too: */
+	init_gpu_id(children[0].msg.gpu_id);
+
+	for (i = 1; i < nfiles; i++) {
+		if (diff_msg_equal(&children[0].msg, &children[i].msg))
+			continue;
+		diff_print(files[0], children[0].state, files[i], children[i].state);
+	}
+
+	ret = 1;
+
+out:
+	/* each child inherits the pipes of the ones forked before it, so
+	 * they won't see EOF, tell them to quit explicitly:
+	 */
+	for (i = 0; i < nfiles; i++) {
+		write_all(children[i].wfd, "q", 1);
+		close(children[i].rfd);
+		close(children[i].wfd);
+	}
+	for (i = 0; i < nfiles; i++)
+		waitpid(children[i].pid, NULL, 0);
+
+	return ret;
+}
+
+/* trim mode, write a new .rd with just the submits (or draws) of interest
+ * and only the parts of the buffers that they reference.
+ *
+ * References are collected while decoding the selected submits:
+ *
+ *  + the cmdstream, IBs, CP_SET_DRAW_STATE groups, and external source
+ *    of CP_LOAD_STATE are referenced with their exact size
+ *
+ *  + at each selected draw, the written registers, the state loaded via
+ *    CP_LOAD_STATE (ie. texture descriptors) and the draw packet itself
+ *    are scanned for values which look like addresses within one of the
+ *    submit's buffers.  The size of what they point to (shaders, vbo's,
+ *    textures, etc) is not known, so these reference until the end of
+ *    the buffer.
+ *
+ * Each buffer is then truncated to the range between the first and last
+ * referenced byte.  Draws within a selected submit but outside of the
+ * selected draw range are replaced with a CP_NOP of the same size.
+ */
+
+struct trim_patch {
+	uint64_t gpuaddr;
+	uint32_t hdr;
+	bool keep;
+};
+
+static struct {
+	FILE *out;
+	int first_draw, last_draw;
+	int ndraws;              /* selected draws in current submit */
+
+	/* referenced range of each of the current submit's buffers: */
+	struct {
+		uint32_t lo, hi;
+	} refs[ARRAY_SIZE(buffers)];
+	uint64_t minaddr, maxaddr;
+
+	struct trim_patch *patches;
+	int npatches, maxpatches;
+
+	int nsubmits, nbuffers;
+	uint64_t size;
+} trim = {
+		.first_draw = -1,
+};
+
+static void trim_write_section(enum rd_sect_type type, const void *buf, int sz)
+{
+	uint32_t hdr[4] = { ~0, ~0, type, ALIGN(sz, 4) };
+	uint32_t pad = 0;
+
+	fwrite(hdr, sizeof(hdr), 1, trim.out);
+	fwrite(buf, sz, 1, trim.out);
+	fwrite(&pad, ALIGN(sz, 4) - sz, 1, trim.out);
+}
+
+static void trim_ref(uint64_t gpuaddr, uint32_t len)
+{
+	int i;
+
+	for (i = 0; i < nbuffers; i++) {
+		if (buffer_contains_gpuaddr(&buffers[i], gpuaddr, 0)) {
+			uint32_t lo = gpuaddr - buffers[i].gpuaddr;
+			uint32_t hi = min(len, buffers[i].len - lo) + lo;
+
+			trim.refs[i].lo = min(trim.refs[i].lo, lo);
+			trim.refs[i].hi = max(trim.refs[i].hi, hi);
+			return;
+		}
+	}
+}
+
+/* a value which might be an address, reference until end of buffer: */
+static void trim_ref_ptr(uint64_t val)
+{
+	if ((val < trim.minaddr) || (val >= trim.maxaddr))
+		return;
+	trim_ref(val, ~0);
+}
+
+static void trim_scan(const uint32_t *dwords, uint32_t sizedwords)
+{
+	uint32_t i;
+
+	for (i = 0; i < sizedwords; i++) {
+		trim_ref_ptr(dwords[i]);
+		if (is_64b() && ((i + 1) < sizedwords))
+			trim_ref_ptr(dwords[i] | (((uint64_t)dwords[i + 1]) << 32));
+	}
+}
+
+static void trim_scan_regs(void)
+{
+	uint32_t i;
+
+	for (i = 0; i < regcnt(); i++) {
+		if (!type0_reg_written[i/8]) {
+			i |= 7;
+			continue;
+		}
+		if (!reg_written(i))
+			continue;
+		trim_ref_ptr(reg_val(i));
+		/* a5xx+ addresses are in _LO/_HI pairs: */
+		if (is_64b() && ((i + 1) < regcnt()) && reg_written(i + 1))
+			trim_ref_ptr(reg_val(i) | (((uint64_t)reg_val(i + 1)) << 32));
+	}
+}
+
+static void trim_scan_state(void)
+{
+	int sb, st;
+
+	for (sb = 0; sb < ARRAY_SIZE(diff.shadows); sb++) {
+		for (st = 0; st < ARRAY_SIZE(diff.shadows[0]); st++) {
+			struct diff_shadow *shadow = &diff.shadows[sb][st];
+			uint32_t i;
+
+			/* shader instructions don't contain addresses: */
+			if ((SB_VERT_SHADER <= sb) && (sb <= SB_COMPUTE_SHADER) &&
+					(st == ST_SHADER))
+				continue;
+
+			for (i = 0; i < DIFF_SHADOW_DWORDS; i++) {
+				if (!(shadow->valid[i/8] & (1 << (i % 8)))) {
+					i |= 7;
+					continue;
+				}
+				trim_ref_ptr(shadow->vals[i]);
+			}
+		}
+	}
+}
+
+/* called from dump_commands() for each packet that is a draw: */
+static void trim_draw(uint32_t *dwords, uint32_t count)
+{
+	bool selected = (trim.first_draw < 0) ||
+			((trim.first_draw <= draw_count) && (draw_count <= trim.last_draw));
+	uint64_t addr = gpuaddr(dwords);
+	struct trim_patch *patch = NULL;
+	int i;
+
+	/* the same draw packet can be executed more than once, ie. once per
+	 * tile, so it is only replaced if none of it's draws are selected:
+	 */
+	for (i = 0; i < trim.npatches; i++) {
+		if (trim.patches[i].gpuaddr == addr) {
+			patch = &trim.patches[i];
+			break;
+		}
+	}
+
+	if (!patch) {
+		uint32_t hdr = dwords[0];
+
+		/* replace the opcode with CP_NOP, keeping the size: */
+		if (pkt_is_type7(hdr)) {
+			hdr &= ~(0xff << 16);
+			hdr |= (CP_NOP << 16) | (pm4_calc_odd_parity_bit(CP_NOP) << 23);
+		} else {
+			hdr &= ~(0xff << 8);
+			hdr |= CP_NOP << 8;
+		}
+
+		GROW(trim.patches, trim.npatches, trim.maxpatches);
+		patch = &trim.patches[trim.npatches++];
+		patch->gpuaddr = addr;
+		patch->hdr = hdr;
+		patch->keep = false;
+	}
+
+	if (!selected)
+		return;
+
+	patch->keep = true;
+	trim.ndraws++;
+
+	trim_scan(dwords + 1, count - 1);
+	trim_scan_regs();
+	trim_scan_state();
+}
+
+static void trim_begin_submit(void)
+{
+	int i;
+
+	trim.ndraws = 0;
+	trim.npatches = 0;
+	trim.minaddr = ~0;
+	trim.maxaddr = 0;
+
+	for (i = 0; i < nbuffers; i++) {
+		trim.refs[i].lo = ~0;
+		trim.refs[i].hi = 0;
+		trim.minaddr = min(trim.minaddr, buffers[i].gpuaddr);
+		trim.maxaddr = max(trim.maxaddr, buffers[i].gpuaddr + buffers[i].len);
+	}
+}
+
+static void trim_end_submit(uint64_t cmdaddr, uint32_t sizedwords)
+{
+	uint32_t sect[3];
+	int i, j;
+
+	/* no selected draws in this submit: */
+	if ((trim.first_draw >= 0) && !trim.ndraws)
+		return;
+
+	for (i = 0; i < nbuffers; i++) {
+		uint32_t lo = trim.refs[i].lo & ~0x3;
+		uint32_t hi = ALIGN(trim.refs[i].hi, 4);
+		uint64_t addr = buffers[i].gpuaddr + lo;
+		void *buf;
+
+		if (trim.refs[i].lo >= trim.refs[i].hi)
+			continue;
+
+		buf = malloc(hi - lo);
+		memcpy(buf, buffers[i].hostptr + lo, hi - lo);
+
+		for (j = 0; j < trim.npatches; j++) {
+			struct trim_patch *patch = &trim.patches[j];
+			if (patch->keep || (patch->gpuaddr < addr) ||
+					(patch->gpuaddr >= (addr + hi - lo)))
+				continue;
+			*(uint32_t *)(buf + (patch->gpuaddr - addr)) = patch->hdr;
+		}
+
+		/* upper 32b of gpuaddr added after len for backwards compat */
+		sect[0] = addr;
+		sect[1] = hi - lo;
+		sect[2] = addr >> 32;
+		trim_write_section(RD_GPUADDR, sect, sizeof(sect));
+		trim_write_section(RD_BUFFER_CONTENTS, buf, hi - lo);
+
+		free(buf);
+
+		trim.nbuffers++;
+		trim.size += hi - lo;
+	}
+
+	sect[0] = cmdaddr;
+	sect[1] = sizedwords;
+	sect[2] = cmdaddr >> 32;
+	trim_write_section(RD_CMDSTREAM_ADDR, sect, sizeof(sect));
+
+	trim.nsubmits++;
+}
+
+/* is there nothing left to select? */
+static bool trim_done(void)
+{
+	return (trim.first_draw >= 0) && (draw_count > trim.last_draw);
+}
+
+static int parse_draws(const char *arg)
+{
+	char *end;
+
+	trim.first_draw = strtol(arg, &end, 0);
+	if (*end == '-')
+		trim.last_draw = strtol(end + 1, &end, 0);
+	else
+		trim.last_draw = trim.first_draw;
+
+	if (*end || (trim.first_draw < 0) || (trim.last_draw < trim.first_draw)) {
+		fprintf(stderr, "invalid draw range: %s\n", arg);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int trim_file(const char *filename, const char *outname,
+		int start, int end)
+{
+	struct stat st;
+	int ret;
+
+	if (stat(filename, &st)) {
+		fprintf(stderr, "could not open: %s: %m\n", filename);
+		return -1;
+	}
+
+	trim.out = fopen(outname, "w");
+	if (!trim.out) {
+		fprintf(stderr, "could not open: %s: %m\n", outname);
+		return -1;
+	}
+
+	trimming = true;
+	silent = true;
+
+	ret = handle_file(filename, start, end, -1);
+
+	silent = false;
+
+	if (fclose(trim.out)) {
+		fprintf(stderr, "error writing: %s: %m\n", outname);
+		return -1;
+	}
+
+	if (ret)
+		return ret;
+
+	printf("wrote %s: %d submits, %d buffers, %llu bytes (from %llu)\n",
+			outname, trim.nsubmits, trim.nbuffers,
+			(unsigned long long)trim.size,
+			(unsigned long long)st.st_size);
+
+	return 0;
+}
+
+static void print_usage(const char *name)
+{
+	printf("Usage: %s [OPTIONS]... FILE...\n", name);
+	printf("    --verbose         - more verbose disassembly\n");
+	printf("    --dump-shaders    - dump each shader to raw file\n");
+	printf("    --no-color        - disable colorized output (default for non-console\n");
+	printf("                        output)\n");
+	printf("    --color           - enable colorized output (default for tty output)\n");
+	printf("    --summary         - don't show individual register writes, but just show\n");
+	printf("                        register values on draws\n");
+	printf("    --allregs         - show all registers (including ones not written since\n");
+	printf("                        previous draw) at each draw\n");
+	printf("    --start N         - decode start frame number\n");
+	printf("    --end N           - decode end frame number\n");
+	printf("    --frame N         - decode specified frame number\n");
+	printf("    --draw N          - decode specified draw number\n");
+	printf("    --textures        - dump texture contents (if possible)\n");
+	printf("    --script FILE     - run specified lua script to analyze state at draws\n");
+	printf("    --query/-q REG    - query mode, dump only specified query registers on\n");
+	printf("                        each draw; multiple --query/-q args can be given to\n");
+	printf("                        dump multiple registers; register can be specified\n");
+	printf("                        either by name or numeric offset\n");
+	printf("    --find FILE|HEX   - find mode, instead of decoding, report every submit,\n");
+	printf("                        buffer and gpuaddr where the contents of FILE (or\n");
+	printf("                        the given list of hex dwords) occur; multiple\n");
+	printf("                        --find args can be given to search for several\n");
+	printf("                        blobs in a single pass\n");
+	printf("    --server SOCKET   - server mode, load a single FILE and then answer\n");
+	printf("                        queries about it on the unix socket SOCKET (or\n");
+	printf("                        stdin/stdout if SOCKET is -), see cffquery\n");
+	printf("    --diff            - diff mode, decode two or more FILEs in lock-step\n");
+	printf("                        and stop at the first draw where the register\n");
+	printf("                        state, shaders or constants differ, then show\n");
+	printf("                        the decoded differences at that draw\n");
+	printf("    --ignore REG      - in diff mode, ignore differences in the given\n");
+	printf("                        register (ie. timestamps); can be given multiple\n");
+	printf("                        times\n");
+	printf("    --trim OUT        - trim mode, write a new .rd to OUT with just the\n");
+	printf("                        submits selected with --start/--end/--frame and\n");
+	printf("                        the parts of the buffers they reference\n");
+	printf("    --draws N[-M]     - in trim mode, select only draws N thru M, other\n");
+	printf("                        draws in the same submits are replaced with NOPs\n");
+	printf("    --help            - show this message\n");
+}
+
+
+static pid_t pager_pid;
+
+static void pager_death(int n)
+{
+	exit(0);
+}
+
+static void pager_open(void)
+{
+	int fd[2];
+
+	if (pipe(fd) < 0) {
+		fprintf(stderr, "Failed to create pager pipe: %m\n");
+		exit(-1);
+	}
+
+	pager_pid = fork();
+	if (pager_pid < 0) {
+		fprintf(stderr, "Failed to fork pager: %m\n");
+		exit(-1);
+	}
+
+	if (pager_pid == 0) {
+		const char* less_opts;
+
+		dup2(fd[0], STDIN_FILENO);
+		close(fd[0]);
+		close(fd[1]);
+
+		less_opts = "FRSMKX";
+		setenv("LESS", less_opts, 1);
+
+		execlp("less", "less", NULL);
+
+	} else {
+		/* we want to kill the parent process when pager exits: */
+		signal(SIGCHLD, pager_death);
+		dup2(fd[1], STDOUT_FILENO);
+		close(fd[0]);
+		close(fd[1]);
+	}
+}
+
+static int pager_close(void)
+{
+	siginfo_t status;
+
+	close(STDOUT_FILENO);
+
+	while (true) {
+		memset(&status, 0, sizeof(status));
+		if (waitid(P_PID, pager_pid, &status, WEXITED) < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+
+		return 0;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	int ret, n = 1;
+	int start = 0, end = 0x7ffffff, draw = -1;
+	int interactive = isatty(STDOUT_FILENO);
+	const char *sockpath = NULL;
+	const char *trimname = NULL;
+
+	no_color = !interactive;
+
+	while (n < argc) {
+		if (!strcmp(argv[n], "--verbose")) {
+			disasm_set_debug(PRINT_RAW);
+			n++;
+			continue;
+		}
+
+		if (!strcmp(argv[n], "--dump-shaders")) {
+			dump_shaders = true;
+			n++;
+			continue;
+		}
+
+		if (!strcmp(argv[n], "--no-color")) {
+			no_color = true;
+			n++;
+			continue;
+		}
+
+		if (!strcmp(argv[n], "--color")) {
+			no_color = false;
+			n++;
+			continue;
+		}
+
+		if (!strcmp(argv[n], "--summary")) {
+			summary = true;
+			n++;
+			continue;
+		}
+
+		if (!strcmp(argv[n], "--allregs")) {
+			allregs = true;
+			n++;
+			continue;
+		}
+
+		if (!strcmp(argv[n], "--start")) {
+			if ((n + 1) >= argc) {
+				print_usage(argv[0]);
+				return 1;
+			}
+			n++;
+			start = atoi(argv[n]);
+			n++;
+			continue;
+		}
+
+		if (!strcmp(argv[n], "--end")) {
+			if ((n + 1) >= argc) {
+				print_usage(argv[0]);
+				return 1;
+			}
+			n++;
+			end = atoi(argv[n]);
+			n++;
+			continue;
+		}
+
+		if (!strcmp(argv[n], "--frame")) {
+			if ((n + 1) >= argc) {
+				print_usage(argv[0]);
+				return 1;
+			}
+			n++;
+			end = start = atoi(argv[n]);
+			n++;
+			continue;
+		}
+
+		if (!strcmp(argv[n], "--draw")) {
+			if ((n + 1) >= argc) {
+				print_usage(argv[0]);
+				return 1;
+			}
+			n++;
+			draw = atoi(argv[n]);
+			n++;
+			continue;
+		}
+
+		if (!strcmp(argv[n], "--textures")) {
+			n++;
+			dump_textures = true;
+			continue;
+		}
+
+		if (!strcmp(argv[n], "--script")) {
+			if ((n + 1) >= argc) {
+				print_usage(argv[0]);
+				return 1;
+			}
+			n++;
+			script = argv[n];
+			if (script_load(script)) {
+				fprintf(stderr, "error loading %s\n", argv[n]);
+				return 1;
+			}
+			n++;
+			continue;
+		}
+
+		if (!strcmp(argv[n], "--query") ||
+				!strcmp(argv[n], "-q")) {
+			if ((n + 1) >= argc) {
+				print_usage(argv[0]);
+				return 1;
+			}
+			n++;
+			querystrs = realloc(querystrs, (nquery + 1) * sizeof(*querystrs));
+			querystrs[nquery] = argv[n];
+			nquery++;
+			n++;
+			interactive = 0;
+			continue;
+		}
+
+		if (!strcmp(argv[n], "--find")) {
+			if ((n + 1) >= argc) {
+				print_usage(argv[0]);
+				return 1;
+			}
+			n++;
+			if (add_find(argv[n]))
+				return 1;
+			n++;
+			interactive = 0;
+			continue;
+		}
+
+		if (!strcmp(argv[n], "--server")) {
+			if ((n + 1) >= argc) {
+				print_usage(argv[0]);
+				return 1;
+			}
+			n++;
+			sockpath = argv[n];
+			server = true;
+			no_color = true;
+			n++;
+			continue;
+		}
+
+		if (!strcmp(argv[n], "--diff")) {
+			n++;
+			diffing = true;
+			no_color = true;
+			interactive = 0;
+			continue;
+		}
+
+		if (!strcmp(argv[n], "--ignore")) {
+			if ((n + 1) >= argc) {
+				print_usage(argv[0]);
+				return 1;
+			}
+			n++;
+			ignorestrs = realloc(ignorestrs, (nignore + 1) * sizeof(*ignorestrs));
+			ignorestrs[nignore] = argv[n];
+			nignore++;
+			n++;
+			continue;
+		}
+
+		if (!strcmp(argv[n], "--trim")) {
+			if ((n + 1) >= argc) {
+				print_usage(argv[0]);
+				return 1;
+			}
+			n++;
+			trimname = argv[n];
+			n++;
+			continue;
+		}
+
+		if (!strcmp(argv[n], "--draws")) {
+			if ((n + 1) >= argc) {
+				print_usage(argv[0]);
+				return 1;
+			}
+			n++;
+			if (parse_draws(argv[n]))
+				return 1;
+			n++;
+			continue;
+		}
+
+		if (!strcmp(argv[n], "--help")) {
+			n++;
+			print_usage(argv[0]);
+			return 0;
+		}
+
+		break;
+	}
+
+	if (server) {
+		if ((n + 1) != argc) {
+			print_usage(argv[0]);
+			return 1;
+		}
+		rnn = rnn_new(no_color);
+		return serve(argv[n], sockpath, start, end);
+	}
+
+	if (diffing) {
+		if ((argc - n) < 2) {
+			print_usage(argv[0]);
+			return 1;
+		}
+		/* the children set diffing again, the parent only compares: */
+		diffing = false;
+		rnn = rnn_new(no_color);
+		return diff_files(argc - n, &argv[n], start, end);
+	}
+
+	if (trimname) {
+		if ((n + 1) != argc) {
+			print_usage(argv[0]);
+			return 1;
+		}
+		rnn = rnn_new(no_color);
+		return trim_file(argv[n], trimname, start, end);
+	}
+
+	if (interactive) {
+		pager_open();
+	}
+
+	rnn = rnn_new(no_color);
+
+	while (n < argc) {
+		ret = handle_file(argv[n], start, end, draw);
+		if (ret) {
 			fprintf(stderr, "error reading: %s\n", argv[n]);
 			fprintf(stderr, "continuing..\n");
 		}
@@ -2288,6 +4233,12 @@ int main(int argc, char **argv)
 
 	script_finish();
 
+	if (finder) {
+		int i;
+		for (i = 0; i < search_count(finder); i++)
+			printf("%s: %d matches\n", find_names[i], find_counts[i]);
+	}
+
 	if (interactive) {
 		pager_close();
 	}
@@ -2425,9 +4376,14 @@ static int handle_file(const char *filename, int start, int end, int draw)
 			break;
 		case RD_GPUADDR:
 			if (needs_reset) {
-				for (i = 0; i < nbuffers; i++) {
-					free(buffers[i].hostptr);
-					buffers[i].hostptr = NULL;
+				/* in server mode the buffers are kept for queries: */
+				if (server) {
+					srv_save_buffers(submit);
+				} else {
+					for (i = 0; i < nbuffers; i++) {
+						free(buffers[i].hostptr);
+						buffers[i].hostptr = NULL;
+					}
 				}
 				nbuffers = 0;
 				needs_reset = false;
@@ -2436,36 +4392,42 @@ static int handle_file(const char *filename, int start, int end, int draw)
 			break;
 		case RD_BUFFER_CONTENTS:
 			buffers[nbuffers].hostptr = buf;
+			if (finder && (start <= submit) && (submit <= end))
+				find_in_buffer(submit, nbuffers, sz);
 			nbuffers++;
 			assert(nbuffers < ARRAY_SIZE(buffers));
 			buf = NULL;
 			break;
 		case RD_CMDSTREAM_ADDR:
-			if ((start <= submit) && (submit <= end)) {
+			if (!finder && (start <= submit) && (submit <= end)) {
 				unsigned int sizedwords;
 				uint64_t gpuaddr;
 				parse_addr(buf, sz, &sizedwords, &gpuaddr);
+				srv.submit = submit;
+				if (trimming) {
+					trim_begin_submit();
+					trim_ref(gpuaddr, sizedwords * 4);
+				}
 				printl(2, "############################################################\n");
 				printl(2, "cmdstream: %d dwords\n", sizedwords);
 				dump_commands(hostptr(gpuaddr), sizedwords, 0);
 				printl(2, "############################################################\n");
 				printl(2, "vertices: %d\n", vertices);
+				if (trimming)
+					trim_end_submit(gpuaddr, sizedwords);
 			}
 			needs_reset = true;
 			submit++;
+			/* no need to read the rest of the file: */
+			if (trimming && ((submit > end) || trim_done()))
+				goto end;
 			break;
 		case RD_GPU_ID:
 			if (!got_gpu_id) {
-				gpu_id = *((unsigned int *)buf);
+				if (trimming)
+					trim_write_section(RD_GPU_ID, buf, sz);
+				init_gpu_id(*((unsigned int *)buf));
 				printl(2, "gpu_id: %d\n", gpu_id);
-				if (gpu_id >= 500)
-					init_a5xx();
-				else if (gpu_id >= 400)
-					init_a4xx();
-				else if (gpu_id >= 300)
-					init_a3xx();
-				else
-					init_a2xx();
 				got_gpu_id = 1;
 			}
 			break;
@@ -2475,6 +4437,9 @@ static int handle_file(const char *filename, int start, int end, int draw)
 	}
 
 end:
+	if (server)
+		srv_save_buffers(submit);
+
 	script_end_cmdstream();
 
 	io_close(io);
@@ -0,0 +1,128 @@
+/* -*- mode: C; c-file-style: "k&r"; tab-width 4; indent-tabs-mode: t; -*- */
+
+/*
+ * Copyright (C) 2014 Rob Clark <robclark@freedesktop.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Authors:
+ *    Rob Clark <robclark@freedesktop.org>
+ */
+
+/* Thin client for 'cffdump --server', sends a request and prints the
+ * response.  With no request given on the cmdline, requests are read
+ * from stdin, one per line.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+static int request(int fd, FILE *in, const char *req)
+{
+	char *line = NULL;
+	size_t n = 0;
+
+	if ((write(fd, req, strlen(req)) < 0) || (write(fd, "\n", 1) < 0)) {
+		fprintf(stderr, "write failed: %m\n");
+		return -1;
+	}
+
+	/* the response is terminated by a line w/ just ".": */
+	while (getline(&line, &n, in) > 0) {
+		if (!strcmp(line, ".\n")) {
+			free(line);
+			return 0;
+		}
+		fputs(line, stdout);
+	}
+
+	free(line);
+	fprintf(stderr, "connection closed\n");
+	return -1;
+}
+
+int main(int argc, char **argv)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	FILE *in;
+	int fd, ret = 0;
+
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s SOCKET [REQUEST...]\n", argv[0]);
+		fprintf(stderr, "  see 'cffdump --server'\n");
+		return 1;
+	}
+
+	if (strlen(argv[1]) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "socket path too long: %s\n", argv[1]);
+		return 1;
+	}
+	strcpy(addr.sun_path, argv[1]);
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if ((fd < 0) || connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+		fprintf(stderr, "could not connect to %s: %m\n", argv[1]);
+		return 1;
+	}
+
+	in = fdopen(fd, "r");
+	if (!in) {
+		fprintf(stderr, "fdopen failed: %m\n");
+		return 1;
+	}
+
+	if (argc > 2) {
+		char req[4096] = "";
+		int i;
+
+		for (i = 2; i < argc; i++) {
+			if (i > 2)
+				strncat(req, " ", sizeof(req) - strlen(req) - 1);
+			strncat(req, argv[i], sizeof(req) - strlen(req) - 1);
+		}
+
+		ret = request(fd, in, req);
+	} else {
+		char *line = NULL;
+		size_t n = 0;
+		ssize_t len;
+
+		while ((len = getline(&line, &n, stdin)) > 0) {
+			if (line[len-1] == '\n')
+				line[--len] = '\0';
+			if (!len)
+				continue;
+			ret = request(fd, in, line);
+			if (ret)
+				break;
+			fflush(stdout);
+		}
+
+		free(line);
+	}
+
+	fclose(in);
+
+	return ret ? 1 : 0;
+}
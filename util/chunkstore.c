@@ -0,0 +1,521 @@
+/* -*- mode: C; c-file-style: "k&r"; tab-width 4; indent-tabs-mode: t; -*- */
+
+/*
+ * Copyright (C) 2014 Rob Clark <robclark@freedesktop.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Authors:
+ *    Rob Clark <robclark@freedesktop.org>
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "chunkstore.h"
+
+/* number of chunks to ask the kernel to start reading ahead of the one
+ * currently being read, so the reads of the (many small) chunk files
+ * are in flight in parallel:
+ */
+#define PREFETCH 32
+
+/*
+ * Content defined chunking, using a gear hash (as in FastCDC).  Each
+ * byte shifts the hash left by one, so the top bits depend on the last
+ * 64 bytes, and a boundary is placed where they are zero:
+ */
+
+static uint64_t gear[256];
+
+static uint64_t splitmix64(uint64_t *state)
+{
+	uint64_t z = (*state += 0x9e3779b97f4a7c15ull);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+	return z ^ (z >> 31);
+}
+
+static void init_gear(void)
+{
+	/* the table must be the same for every run, or the chunks of
+	 * identical buffers won't line up:
+	 */
+	uint64_t state = 0x66647264;
+	int i;
+
+	for (i = 0; i < 256; i++)
+		gear[i] = splitmix64(&state);
+}
+
+uint32_t chunk_next(const void *buf, uint32_t len)
+{
+	const uint64_t mask = ~(~0ull >> __builtin_ctz(CHUNK_AVG));
+	const uint8_t *p = buf;
+	uint64_t h = 0;
+	uint32_t i;
+
+	if (!gear[0])
+		init_gear();
+
+	if (len <= CHUNK_MIN)
+		return len;
+
+	if (len > CHUNK_MAX)
+		len = CHUNK_MAX;
+
+	for (i = CHUNK_MIN; i < len; i++) {
+		h = (h << 1) + gear[p[i]];
+		if (!(h & mask))
+			return i + 1;
+	}
+
+	return len;
+}
+
+/*
+ * MurmurHash3 x64 128b variant, not cryptographic but plenty to avoid
+ * accidental collisions between chunks:
+ */
+
+static inline uint64_t rotl64(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t fmix64(uint64_t k)
+{
+	k ^= k >> 33;
+	k *= 0xff51afd7ed558ccdull;
+	k ^= k >> 33;
+	k *= 0xc4ceb9fe1a85ec53ull;
+	k ^= k >> 33;
+	return k;
+}
+
+void chunk_hash(const void *buf, uint32_t len, uint8_t *hash)
+{
+	const uint64_t c1 = 0x87c37b91114253d5ull;
+	const uint64_t c2 = 0x4cf5ad432745937full;
+	const uint8_t *p = buf;
+	uint64_t h1 = 0, h2 = 0, k1, k2;
+	uint32_t i, nblocks = len / 16;
+
+	for (i = 0; i < nblocks; i++) {
+		memcpy(&k1, p + (i * 16), 8);
+		memcpy(&k2, p + (i * 16) + 8, 8);
+
+		k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+		h1 = rotl64(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+
+		k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+		h2 = rotl64(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+	}
+
+	/* tail: */
+	k1 = k2 = 0;
+	p += nblocks * 16;
+	for (i = len & 15; i > 8; i--)
+		k2 |= ((uint64_t)p[i - 1]) << ((i - 9) * 8);
+	for (; i > 0; i--)
+		k1 |= ((uint64_t)p[i - 1]) << ((i - 1) * 8);
+
+	if (len & 15) {
+		k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+		k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+	}
+
+	h1 ^= len;
+	h2 ^= len;
+	h1 += h2;
+	h2 += h1;
+	h1 = fmix64(h1);
+	h2 = fmix64(h2);
+	h1 += h2;
+	h2 += h1;
+
+	memcpy(hash, &h1, 8);
+	memcpy(hash + 8, &h2, 8);
+}
+
+/*
+ * Chunk store:
+ */
+
+char * chunk_path(const char *store, const uint8_t *hash)
+{
+	char hex[2 * CHUNK_HASH_SIZE + 1];
+	char *path;
+	int i;
+
+	for (i = 0; i < CHUNK_HASH_SIZE; i++)
+		sprintf(&hex[i * 2], "%02x", hash[i]);
+
+	if (asprintf(&path, "%s/%.2s/%s", store, hex, hex + 2) < 0)
+		return NULL;
+
+	return path;
+}
+
+static int write_all(int fd, const void *buf, uint32_t len)
+{
+	while (len > 0) {
+		ssize_t ret = write(fd, buf, len);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += ret;
+		len -= ret;
+	}
+	return 0;
+}
+
+int chunk_put(const char *store, const void *buf, uint32_t len, uint8_t *hash)
+{
+	char *path, *tmp = NULL, *dir;
+	int fd, ret = -1;
+
+	chunk_hash(buf, len, hash);
+
+	path = chunk_path(store, hash);
+	if (!path)
+		return -1;
+
+	if (!access(path, F_OK)) {
+		free(path);
+		return 0;
+	}
+
+	/* create the store and the fanout dir as needed: */
+	dir = strdup(path);
+	*strrchr(dir, '/') = '\0';
+	if (mkdir(store, 0755) && (errno != EEXIST))
+		goto out;
+	if (mkdir(dir, 0755) && (errno != EEXIST))
+		goto out;
+
+	/* write to a temporary file and rename, so other packers writing
+	 * to the same store never see a partial chunk:
+	 */
+	if (asprintf(&tmp, "%s.%d.tmp", path, getpid()) < 0) {
+		tmp = NULL;
+		goto out;
+	}
+
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		goto out;
+
+	if (write_all(fd, buf, len)) {
+		close(fd);
+		unlink(tmp);
+		goto out;
+	}
+
+	close(fd);
+
+	if (rename(tmp, path)) {
+		unlink(tmp);
+		goto out;
+	}
+
+	ret = 1;
+
+out:
+	if (ret < 0)
+		fprintf(stderr, "could not write chunk: %s: %m\n", path);
+	free(tmp);
+	free(dir);
+	free(path);
+	return ret;
+}
+
+/*
+ * Manifest reader:
+ */
+
+struct rdpack {
+	char *store;
+	uint8_t *manifest;
+	uint32_t size;
+	uint32_t pos;          /* offset of next record */
+	uint32_t prefetch;     /* offset of next record to prefetch */
+	int nahead;            /* chunks prefetched past pos */
+
+	/* remaining data of current record: */
+	const uint8_t *data;
+	uint32_t remaining;
+
+	uint8_t chunk[CHUNK_MAX];
+};
+
+bool rdpack_check(const char *filename)
+{
+	char magic[8];
+	int fd = open(filename, O_RDONLY);
+	bool ret;
+
+	if (fd < 0)
+		return false;
+
+	ret = (read(fd, magic, sizeof(magic)) == sizeof(magic)) &&
+			!memcmp(magic, RDPACK_MAGIC, sizeof(magic));
+
+	close(fd);
+
+	return ret;
+}
+
+struct rdpack * rdpack_open(const char *filename)
+{
+	struct rdpack *pack = calloc(1, sizeof(*pack));
+	struct rdpack_header *hdr;
+	struct stat st;
+	uint32_t off;
+	int fd;
+
+	fd = open(filename, O_RDONLY);
+	if ((fd < 0) || fstat(fd, &st))
+		goto fail;
+
+	pack->size = st.st_size;
+	pack->manifest = malloc(pack->size);
+
+	for (off = 0; off < pack->size; ) {
+		ssize_t ret = read(fd, pack->manifest + off, pack->size - off);
+		if (ret <= 0)
+			goto fail;
+		off += ret;
+	}
+
+	close(fd);
+	fd = -1;
+
+	hdr = (struct rdpack_header *)pack->manifest;
+	if ((pack->size < sizeof(*hdr)) ||
+			memcmp(hdr->magic, RDPACK_MAGIC, sizeof(hdr->magic)) ||
+			(hdr->version != RDPACK_VERSION) ||
+			(hdr->storelen > (pack->size - sizeof(*hdr)))) {
+		fprintf(stderr, "invalid manifest: %s\n", filename);
+		goto fail;
+	}
+
+	if (getenv("RDPACK_STORE"))
+		pack->store = strdup(getenv("RDPACK_STORE"));
+	else
+		pack->store = strndup((char *)(hdr + 1), hdr->storelen);
+
+	pack->pos = pack->prefetch = sizeof(*hdr) + hdr->storelen;
+
+	return pack;
+
+fail:
+	if (fd >= 0) {
+		fprintf(stderr, "could not read: %s: %m\n", filename);
+		close(fd);
+	}
+	rdpack_close(pack);
+	return NULL;
+}
+
+static uint32_t record_size(struct rdpack_record *rec)
+{
+	return sizeof(*rec) +
+			((rec->type == RDPACK_CHUNK) ? CHUNK_HASH_SIZE : rec->len);
+}
+
+/* records are not aligned (literals can be any length), so copy out the
+ * header, returns a pointer to the literal bytes or chunk hash:
+ */
+static const uint8_t * get_record(struct rdpack *pack, uint32_t off,
+		struct rdpack_record *rec)
+{
+	uint32_t sz;
+
+	if ((pack->size - off) < sizeof(*rec))
+		return NULL;
+
+	memcpy(rec, pack->manifest + off, sizeof(*rec));
+
+	sz = (rec->type == RDPACK_CHUNK) ? CHUNK_HASH_SIZE : rec->len;
+	if ((pack->size - off - sizeof(*rec)) < sz)
+		return NULL;
+
+	return pack->manifest + off + sizeof(*rec);
+}
+
+static void prefetch(struct rdpack *pack)
+{
+	while ((pack->nahead < PREFETCH) && (pack->prefetch < pack->size)) {
+		struct rdpack_record rec;
+		const uint8_t *hash = get_record(pack, pack->prefetch, &rec);
+		char *path;
+		int fd;
+
+		if (!hash)
+			break;
+
+		pack->prefetch += record_size(&rec);
+
+		if (rec.type != RDPACK_CHUNK)
+			continue;
+
+		pack->nahead++;
+
+		path = chunk_path(pack->store, hash);
+		fd = open(path, O_RDONLY);
+		if (fd >= 0) {
+			posix_fadvise(fd, 0, rec.len, POSIX_FADV_WILLNEED);
+			close(fd);
+		}
+		free(path);
+	}
+}
+
+static int load_chunk(struct rdpack *pack, struct rdpack_record *rec,
+		const uint8_t *hash)
+{
+	uint8_t check[CHUNK_HASH_SIZE];
+	char *path = chunk_path(pack->store, hash);
+	uint32_t off;
+	int fd;
+
+	if (rec->len > sizeof(pack->chunk)) {
+		fprintf(stderr, "invalid chunk size: %u\n", rec->len);
+		free(path);
+		return -1;
+	}
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "missing chunk: %s\n", path);
+		free(path);
+		return -1;
+	}
+
+	for (off = 0; off < rec->len; ) {
+		ssize_t ret = read(fd, pack->chunk + off, rec->len - off);
+		if (ret <= 0)
+			break;
+		off += ret;
+	}
+
+	close(fd);
+
+	chunk_hash(pack->chunk, off, check);
+	if ((off != rec->len) || memcmp(check, hash, sizeof(check))) {
+		fprintf(stderr, "corrupt chunk: %s\n", path);
+		free(path);
+		return -1;
+	}
+
+	free(path);
+
+	return 0;
+}
+
+static int next_record(struct rdpack *pack)
+{
+	struct rdpack_record rec;
+	const uint8_t *payload;
+
+	if (pack->pos >= pack->size)
+		return 0;
+
+	payload = get_record(pack, pack->pos, &rec);
+	if (!payload) {
+		fprintf(stderr, "truncated manifest\n");
+		return -1;
+	}
+
+	if (rec.type == RDPACK_CHUNK) {
+		/* keep the chunks after this one in flight: */
+		if (pack->prefetch > pack->pos)
+			pack->nahead--;
+		else
+			pack->prefetch = pack->pos + record_size(&rec);
+		prefetch(pack);
+
+		if (load_chunk(pack, &rec, payload))
+			return -1;
+
+		pack->data = pack->chunk;
+	} else if (rec.type == RDPACK_LITERAL) {
+		pack->data = payload;
+	} else {
+		fprintf(stderr, "invalid record type: %u\n", rec.type);
+		return -1;
+	}
+
+	pack->remaining = rec.len;
+	pack->pos += record_size(&rec);
+
+	return 1;
+}
+
+int rdpack_read(struct rdpack *pack, void *buf, int nbytes)
+{
+	uint8_t *ptr = buf;
+	int ret = 0;
+
+	while (nbytes > 0) {
+		uint32_t n;
+
+		if (!pack->remaining) {
+			int r = next_record(pack);
+			if (r < 0)
+				return r;
+			if (r == 0)
+				break;
+			continue;
+		}
+
+		n = (nbytes < pack->remaining) ? nbytes : pack->remaining;
+		memcpy(ptr, pack->data, n);
+
+		pack->data += n;
+		pack->remaining -= n;
+		ptr += n;
+		nbytes -= n;
+		ret += n;
+	}
+
+	return ret;
+}
+
+void rdpack_close(struct rdpack *pack)
+{
+	if (!pack)
+		return;
+	free(pack->store);
+	free(pack->manifest);
+	free(pack);
+}
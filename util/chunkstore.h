@@ -0,0 +1,97 @@
+/* -*- mode: C; c-file-style: "k&r"; tab-width 4; indent-tabs-mode: t; -*- */
+
+/*
+ * Copyright (C) 2014 Rob Clark <robclark@freedesktop.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Authors:
+ *    Rob Clark <robclark@freedesktop.org>
+ */
+
+#ifndef CHUNKSTORE_H_
+#define CHUNKSTORE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Content addressed chunk store, shared between repacked captures.
+ *
+ * A repacked capture (see rdpack) is a small manifest which reproduces
+ * the original .rd byte for byte, from a mix of literal bytes (section
+ * headers, cmdstream addresses, etc) and references to chunks in the
+ * store.  The contents of RD_BUFFER_CONTENTS sections are split into
+ * content-defined chunks, so the same shader/texture/context buffer
+ * appearing in different captures (even at different offsets within
+ * a buffer) is only stored once.
+ *
+ * Chunks are stored as STORE/xx/yyyy..., named by the hex of their
+ * 128b hash.  The store used is the one recorded in the manifest, or
+ * $RDPACK_STORE if set (ie. if the archive has been moved).
+ */
+
+#define RDPACK_MAGIC    "fdrdpack"
+#define RDPACK_VERSION  1
+
+/* The manifest is:
+ *
+ *    struct rdpack_header
+ *    char store[storelen]        - path to chunk store
+ *    records, each struct rdpack_record followed by either the
+ *    literal bytes or the chunk hash
+ */
+struct rdpack_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t storelen;
+};
+
+enum rdpack_record_type {
+	RDPACK_LITERAL,
+	RDPACK_CHUNK,
+};
+
+struct rdpack_record {
+	uint32_t type;
+	uint32_t len;
+};
+
+#define CHUNK_HASH_SIZE 16
+
+/* chunk sizes, min/max and average (which must be a power of two): */
+#define CHUNK_MIN  (2 * 1024)
+#define CHUNK_AVG  (8 * 1024)
+#define CHUNK_MAX  (64 * 1024)
+
+/* returns length of the next chunk at the start of buf: */
+uint32_t chunk_next(const void *buf, uint32_t len);
+void chunk_hash(const void *buf, uint32_t len, uint8_t *hash);
+char * chunk_path(const char *store, const uint8_t *hash);
+/* returns 1 if the chunk was added, 0 if already present, -1 on error: */
+int chunk_put(const char *store, const void *buf, uint32_t len, uint8_t *hash);
+
+struct rdpack;
+
+bool rdpack_check(const char *filename);
+struct rdpack * rdpack_open(const char *filename);
+int rdpack_read(struct rdpack *pack, void *buf, int nbytes);
+void rdpack_close(struct rdpack *pack);
+
+#endif /* CHUNKSTORE_H_ */
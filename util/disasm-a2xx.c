@@ -63,9 +63,14 @@ static const char chan_names[] = {
 		'0', '1', '?', '_',
 };
 
-static void print_srcreg(uint32_t num, uint32_t type,
-		uint32_t swiz, uint32_t negate, uint32_t abs)
+static void print_srcreg(const struct disasm_reg *reg)
 {
+	uint32_t num = reg->num;
+	uint32_t type = !(reg->flags & DISASM_REG_CONST);
+	uint32_t swiz = reg->swiz;
+	uint32_t negate = reg->flags & DISASM_REG_NEG;
+	uint32_t abs = reg->flags & DISASM_REG_ABS;
+
 	if (negate)
 		printf("-");
 	if (abs)
@@ -83,8 +88,12 @@ static void print_srcreg(uint32_t num, uint32_t type,
 		printf("|");
 }
 
-static void print_dstreg(uint32_t num, uint32_t mask, uint32_t dst_exp)
+static void print_dstreg(const struct disasm_reg *reg)
 {
+	uint32_t num = reg->num;
+	uint32_t mask = reg->swiz;
+	uint32_t dst_exp = reg->flags & DISASM_REG_EXPORT;
+
 	printf("%s%u", dst_exp ? "export" : "R", num);
 	if (mask != 0xf) {
 		int i;
@@ -209,20 +218,118 @@ struct {
 #undef INSTR
 };
 
-static int disasm_alu(uint32_t *dwords, uint32_t alu_off,
-		int level, int sync, enum shader_t type)
+static struct disasm_reg alu_src(uint32_t reg, uint32_t sel,
+		uint32_t swiz, uint32_t negate, uint32_t abs)
+{
+	return (struct disasm_reg){
+		.flags = (sel ? 0 : DISASM_REG_CONST) |
+				(negate ? DISASM_REG_NEG : 0) |
+				(abs ? DISASM_REG_ABS : 0),
+		.num   = reg,
+		.swiz  = swiz,
+	};
+}
+
+static struct disasm_reg alu_dst(uint32_t reg, uint32_t mask, uint32_t dst_exp)
+{
+	return (struct disasm_reg){
+		.flags = dst_exp ? DISASM_REG_EXPORT : 0,
+		.num   = reg,
+		.swiz  = mask,
+	};
+}
+
+/* decodes the vector op, and the co-issued scalar op if there is one: */
+static int decode_alu(struct disasm_instr *d, int max, uint32_t *dwords,
+		uint32_t alu_off, int sync)
 {
 	instr_alu_t *alu = (instr_alu_t *)dwords;
+	int n = 0;
+
+	d[n] = (struct disasm_instr){
+		.dwords = { dwords[0], dwords[1], dwords[2] },
+		.addr   = alu_off,
+		.cat    = DISASM_A2XX_ALU_VECTOR,
+		.opc    = alu->vector_opc,
+		.name   = vector_instructions[alu->vector_opc].name,
+		.flags  = sync ? DISASM_INSTR_SY : 0,
+		.ndst   = 1,
+		.dst    = alu_dst(alu->vector_dest, alu->vector_write_mask,
+				alu->export_data),
+	};
+
+	/* in the order they are printed: */
+	if (vector_instructions[alu->vector_opc].num_srcs == 3) {
+		d[n].src[d[n].nsrc++] = alu_src(alu->src3_reg, alu->src3_sel,
+				alu->src3_swiz, alu->src3_reg_negate, alu->src3_reg_abs);
+	}
+	d[n].src[d[n].nsrc++] = alu_src(alu->src1_reg, alu->src1_sel,
+			alu->src1_swiz, alu->src1_reg_negate, alu->src1_reg_abs);
+	if (vector_instructions[alu->vector_opc].num_srcs > 1) {
+		d[n].src[d[n].nsrc++] = alu_src(alu->src2_reg, alu->src2_sel,
+				alu->src2_swiz, alu->src2_reg_negate, alu->src2_reg_abs);
+	}
+	n++;
+
+	if ((alu->scalar_write_mask || !alu->vector_write_mask) && (n < max)) {
+		/* 2nd optional scalar op: */
+		d[n] = (struct disasm_instr){
+			.dwords = { dwords[0], dwords[1], dwords[2] },
+			.addr   = alu_off,
+			.cat    = DISASM_A2XX_ALU_SCALAR,
+			.opc    = alu->scalar_opc,
+			.name   = scalar_instructions[alu->scalar_opc].name,
+			.ndst   = 1,
+			.dst    = alu_dst(alu->scalar_dest, alu->scalar_write_mask,
+					alu->export_data),
+			.nsrc   = 1,
+			// TODO ADD/MUL must have another src?!?
+			.src    = { alu_src(alu->src3_reg, alu->src3_sel, alu->src3_swiz,
+					alu->src3_reg_negate, alu->src3_reg_abs) },
+		};
+		n++;
+	}
+
+	return n;
+}
+
+static void print_alu(const struct disasm_instr *d, int level,
+		enum shader_t type, enum debug_t debug)
+{
+	instr_alu_t *alu = (instr_alu_t *)d->dwords;
+	int i;
+
+	if (d->cat == DISASM_A2XX_ALU_SCALAR) {
+		printf("%s", levels[level]);
+		if (debug & PRINT_RAW)
+			printf("                          \t");
+
+		if (d->name) {
+			printf("\t    \t%s\t", d->name);
+		} else {
+			printf("\t    \tOP(%u)\t", d->opc);
+		}
+
+		print_dstreg(&d->dst);
+		printf(" = ");
+		print_srcreg(&d->src[0]);
+		if (alu->scalar_clamp)
+			printf(" CLAMP");
+		if (alu->export_data)
+			print_export_comment(d->dst.num, type);
+		printf("\n");
+		return;
+	}
 
 	printf("%s", levels[level]);
 	if (debug & PRINT_RAW) {
-		printf("%02x: %08x %08x %08x\t", alu_off,
-				dwords[0], dwords[1], dwords[2]);
+		printf("%02x: %08x %08x %08x\t", d->addr,
+				d->dwords[0], d->dwords[1], d->dwords[2]);
 	}
 
-	printf("   %sALU:\t", sync ? "(S)" : "   ");
+	printf("   %sALU:\t", (d->flags & DISASM_INSTR_SY) ? "(S)" : "   ");
 
-	printf("%s", vector_instructions[alu->vector_opc].name);
+	printf("%s", d->name);
 
 	if (alu->pred_select & 0x2) {
 		/* seems to work similar to conditional execution in ARM instruction
@@ -233,55 +340,21 @@ static int disasm_alu(uint32_t *dwords, uint32_t alu_off,
 
 	printf("\t");
 
-	print_dstreg(alu->vector_dest, alu->vector_write_mask, alu->export_data);
+	print_dstreg(&d->dst);
 	printf(" = ");
-	if (vector_instructions[alu->vector_opc].num_srcs == 3) {
-		print_srcreg(alu->src3_reg, alu->src3_sel, alu->src3_swiz,
-				alu->src3_reg_negate, alu->src3_reg_abs);
-		printf(", ");
-	}
-	print_srcreg(alu->src1_reg, alu->src1_sel, alu->src1_swiz,
-			alu->src1_reg_negate, alu->src1_reg_abs);
-	if (vector_instructions[alu->vector_opc].num_srcs > 1) {
-		printf(", ");
-		print_srcreg(alu->src2_reg, alu->src2_sel, alu->src2_swiz,
-				alu->src2_reg_negate, alu->src2_reg_abs);
+	for (i = 0; i < d->nsrc; i++) {
+		if (i)
+			printf(", ");
+		print_srcreg(&d->src[i]);
 	}
 
 	if (alu->vector_clamp)
 		printf(" CLAMP");
 
 	if (alu->export_data)
-		print_export_comment(alu->vector_dest, type);
+		print_export_comment(d->dst.num, type);
 
 	printf("\n");
-
-	if (alu->scalar_write_mask || !alu->vector_write_mask) {
-		/* 2nd optional scalar op: */
-
-		printf("%s", levels[level]);
-		if (debug & PRINT_RAW)
-			printf("                          \t");
-
-		if (scalar_instructions[alu->scalar_opc].name) {
-			printf("\t    \t%s\t", scalar_instructions[alu->scalar_opc].name);
-		} else {
-			printf("\t    \tOP(%u)\t", alu->scalar_opc);
-		}
-
-		print_dstreg(alu->scalar_dest, alu->scalar_write_mask, alu->export_data);
-		printf(" = ");
-		print_srcreg(alu->src3_reg, alu->src3_sel, alu->src3_swiz,
-				alu->src3_reg_negate, alu->src3_reg_abs);
-		// TODO ADD/MUL must have another src?!?
-		if (alu->scalar_clamp)
-			printf(" CLAMP");
-		if (alu->export_data)
-			print_export_comment(alu->scalar_dest, type);
-		printf("\n");
-	}
-
-	return 0;
 }
 
 
@@ -310,8 +383,10 @@ struct {
 #undef TYPE
 };
 
-static void print_fetch_dst(uint32_t dst_reg, uint32_t dst_swiz)
+static void print_fetch_dst(const struct disasm_reg *dst)
 {
+	uint32_t dst_reg = dst->num;
+	uint32_t dst_swiz = dst->swiz;
 	int i;
 	printf("\tR%u.", dst_reg);
 	for (i = 0; i < 4; i++) {
@@ -320,9 +395,9 @@ static void print_fetch_dst(uint32_t dst_reg, uint32_t dst_swiz)
 	}
 }
 
-static void print_fetch_vtx(instr_fetch_t *fetch)
+static void print_fetch_vtx(const struct disasm_instr *d)
 {
-	instr_fetch_vtx_t *vtx = &fetch->vtx;
+	instr_fetch_vtx_t *vtx = &((instr_fetch_t *)d->dwords)->vtx;
 
 	if (vtx->pred_select) {
 		/* seems to work similar to conditional execution in ARM instruction
@@ -331,9 +406,9 @@ static void print_fetch_vtx(instr_fetch_t *fetch)
 		printf(vtx->pred_condition ? "EQ" : "NE");
 	}
 
-	print_fetch_dst(vtx->dst_reg, vtx->dst_swiz);
-	printf(" = R%u.", vtx->src_reg);
-	printf("%c", chan_names[vtx->src_swiz & 0x3]);
+	print_fetch_dst(&d->dst);
+	printf(" = R%u.", d->src[0].num);
+	printf("%c", chan_names[d->src[0].swiz & 0x3]);
 	if (fetch_types[vtx->format].name) {
 		printf(" %s", fetch_types[vtx->format].name);
 	} else  {
@@ -356,7 +431,7 @@ static void print_fetch_vtx(instr_fetch_t *fetch)
 	}
 }
 
-static void print_fetch_tex(instr_fetch_t *fetch)
+static void print_fetch_tex(const struct disasm_instr *d)
 {
 	static const char *filter[] = {
 			[TEX_FILTER_POINT] = "POINT",
@@ -383,8 +458,8 @@ static void print_fetch_tex(instr_fetch_t *fetch)
 			[SAMPLE_CENTROID] = "CENTROID",
 			[SAMPLE_CENTER] = "CENTER",
 	};
-	instr_fetch_tex_t *tex = &fetch->tex;
-	uint32_t src_swiz = tex->src_swiz;
+	instr_fetch_tex_t *tex = &((instr_fetch_t *)d->dwords)->tex;
+	uint32_t src_swiz = d->src[0].swiz;
 	int i;
 
 	if (tex->pred_select) {
@@ -394,8 +469,8 @@ static void print_fetch_tex(instr_fetch_t *fetch)
 		printf(tex->pred_condition ? "EQ" : "NE");
 	}
 
-	print_fetch_dst(tex->dst_reg, tex->dst_swiz);
-	printf(" = R%u.", tex->src_reg);
+	print_fetch_dst(&d->dst);
+	printf(" = R%u.", d->src[0].num);
 	for (i = 0; i < 3; i++) {
 		printf("%c", chan_names[src_swiz & 0x3]);
 		src_swiz >>= 2;
@@ -435,8 +510,8 @@ static void print_fetch_tex(instr_fetch_t *fetch)
 
 struct {
 	const char *name;
-	void (*fxn)(instr_fetch_t *cf);
-} fetch_instructions[] = {
+	void (*fxn)(const struct disasm_instr *d);
+} fetch_instructions[0x20] = {
 #define INSTR(opc, name, fxn) [opc] = { name, fxn }
 		INSTR(VTX_FETCH, "VERTEX", print_fetch_vtx),
 		INSTR(TEX_FETCH, "SAMPLE", print_fetch_tex),
@@ -451,22 +526,52 @@ struct {
 #undef INSTR
 };
 
-static int disasm_fetch(uint32_t *dwords, uint32_t alu_off, int level, int sync)
+static void decode_fetch(struct disasm_instr *d, uint32_t *dwords,
+		uint32_t alu_off, int sync)
 {
 	instr_fetch_t *fetch = (instr_fetch_t *)dwords;
 
+	*d = (struct disasm_instr){
+		.dwords = { dwords[0], dwords[1], dwords[2] },
+		.addr   = alu_off,
+		.cat    = DISASM_A2XX_FETCH,
+		.opc    = fetch->opc,
+		.name   = fetch_instructions[fetch->opc].name,
+		.flags  = sync ? DISASM_INSTR_SY : 0,
+		.ndst   = 1,
+		.nsrc   = 1,
+	};
+
+	if (fetch->opc == VTX_FETCH) {
+		d->dst.num  = fetch->vtx.dst_reg;
+		d->dst.swiz = fetch->vtx.dst_swiz;
+		d->src[0].num  = fetch->vtx.src_reg;
+		d->src[0].swiz = fetch->vtx.src_swiz;
+	} else {
+		d->dst.num  = fetch->tex.dst_reg;
+		d->dst.swiz = fetch->tex.dst_swiz;
+		d->src[0].num  = fetch->tex.src_reg;
+		d->src[0].swiz = fetch->tex.src_swiz;
+	}
+}
+
+static void print_fetch(const struct disasm_instr *d, int level,
+		enum debug_t debug)
+{
 	printf("%s", levels[level]);
 	if (debug & PRINT_RAW) {
-		printf("%02x: %08x %08x %08x\t", alu_off,
-				dwords[0], dwords[1], dwords[2]);
+		printf("%02x: %08x %08x %08x\t", d->addr,
+				d->dwords[0], d->dwords[1], d->dwords[2]);
 	}
 
-	printf("   %sFETCH:\t", sync ? "(S)" : "   ");
-	printf("%s", fetch_instructions[fetch->opc].name);
-	fetch_instructions[fetch->opc].fxn(fetch);
+	printf("   %sFETCH:\t", (d->flags & DISASM_INSTR_SY) ? "(S)" : "   ");
+	if (d->name) {
+		printf("%s", d->name);
+		fetch_instructions[d->opc].fxn(d);
+	} else {
+		printf("OP(%u)", d->opc);
+	}
 	printf("\n");
-
-	return 0;
 }
 
 /*
@@ -573,15 +678,18 @@ struct {
 #undef INSTR
 };
 
-static void print_cf(instr_cf_t *cf, int level)
+static void print_cf(const struct disasm_instr *d, int level,
+		enum debug_t debug)
 {
+	instr_cf_t *cf = (instr_cf_t *)d->dwords;
+
 	printf("%s", levels[level]);
 	if (debug & PRINT_RAW) {
 		uint16_t *words = (uint16_t *)cf;
 		printf("    %04x %04x %04x            \t",
 				words[0], words[1], words[2]);
 	}
-	printf("%s", cf_instructions[cf->opc].name);
+	printf("%s", d->name);
 	cf_instructions[cf->opc].fxn(cf);
 	printf("\n");
 }
@@ -591,14 +699,21 @@ static void print_cf(instr_cf_t *cf, int level)
  *   1) A CF (control-flow) program, at the header of the compiled shader,
  *      which refers to ALU/FETCH instructions that follow it by address.
  *   2) ALU and FETCH instructions
+ *
+ * The decoded array has each CF instruction followed by the ALU/FETCH
+ * instructions it executes.
  */
 
-int disasm_a2xx(uint32_t *dwords, int sizedwords, int level, enum shader_t type)
+int disasm_a2xx_decode(uint32_t *dwords, int sizedwords,
+		struct disasm_instr *instrs, int max)
 {
 	instr_cf_t *cfs = (instr_cf_t *)dwords;
-	int idx, max_idx;
+	int ncfs = (sizedwords * 4) / sizeof(instr_cf_t);
+	int idx, max_idx = 0, n = 0;
+	/* with no array, just count: */
+	struct disasm_instr scratch[2];
 
-	for (idx = 0; ; idx++) {
+	for (idx = 0; idx < ncfs; idx++) {
 		instr_cf_t *cf = &cfs[idx];
 		if (cf_exec(cf)) {
 			max_idx = 2 * cf->exec.address;
@@ -606,26 +721,87 @@ int disasm_a2xx(uint32_t *dwords, int sizedwords, int level, enum shader_t type)
 		}
 	}
 
-	for (idx = 0; idx < max_idx; idx++) {
+	for (idx = 0; (idx < max_idx) && (idx < ncfs); idx++) {
 		instr_cf_t *cf = &cfs[idx];
+		struct disasm_instr *d = instrs ? &instrs[n] : scratch;
 
-		print_cf(cf, level);
+		if (instrs && (n >= max))
+			break;
+
+		memset(d, 0, sizeof(*d));
+		memcpy(d->dwords, cf, sizeof(*cf));
+		d->addr = idx;
+		d->cat  = DISASM_A2XX_CF;
+		d->opc  = cf->opc;
+		d->name = cf_instructions[cf->opc].name;
+		n++;
 
 		if (cf_exec(cf)) {
 			uint32_t sequence = cf->exec.serialize;
 			uint32_t i;
 			for (i = 0; i < cf->exec.count; i++) {
 				uint32_t alu_off = (cf->exec.address + i);
+
+				if ((alu_off + 1) * 3 > sizedwords)
+					break;
+				if (instrs && (n >= max))
+					break;
+
+				d = instrs ? &instrs[n] : scratch;
+
 				if (sequence & 0x1) {
-					disasm_fetch(dwords + alu_off * 3, alu_off, level, sequence & 0x2);
+					decode_fetch(d, dwords + alu_off * 3,
+							alu_off, sequence & 0x2);
+					n++;
 				} else {
-					disasm_alu(dwords + alu_off * 3, alu_off, level, sequence & 0x2, type);
+					n += decode_alu(d, instrs ? (max - n) : 2,
+							dwords + alu_off * 3, alu_off, sequence & 0x2);
 				}
 				sequence >>= 2;
 			}
 		}
 	}
 
+	return n;
+}
+
+void disasm_a2xx_print(const struct disasm_instr *instrs, int n,
+		int level, enum shader_t type, enum debug_t debug)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		const struct disasm_instr *d = &instrs[i];
+
+		switch (d->cat) {
+		case DISASM_A2XX_CF:
+			print_cf(d, level, debug);
+			break;
+		case DISASM_A2XX_FETCH:
+			print_fetch(d, level, debug);
+			break;
+		default:
+			print_alu(d, level, type, debug);
+			break;
+		}
+	}
+}
+
+int disasm_a2xx(uint32_t *dwords, int sizedwords, int level, enum shader_t type)
+{
+	struct disasm_instr *instrs;
+	int max = disasm_a2xx_decode(dwords, sizedwords, NULL, 0);
+	int n;
+
+	instrs = calloc(max + 1, sizeof(*instrs));
+	if (!instrs)
+		return -1;
+
+	n = disasm_a2xx_decode(dwords, sizedwords, instrs, max);
+	disasm_a2xx_print(instrs, n, level, type, debug);
+
+	free(instrs);
+
 	return 0;
 }
 
@@ -30,6 +30,9 @@
 #include "disasm.h"
 #include "instr-a3xx.h"
 
+#define min(a, b) (((a) < (b)) ? (a) : (b))
+#define max(a, b) (((a) > (b)) ? (a) : (b))
+
 typedef enum {
 	true = 1, false = 0,
 } bool;
@@ -68,10 +71,22 @@ static const char *type[] = {
 		[TYPE_S8]  = "s8",
 };
 
-static void print_reg(reg_t reg, bool full, bool r, bool c, bool im,
-		bool neg, bool abs, bool addr_rel)
+static void print_reg(const struct disasm_reg *reg, unsigned repeatidx)
 {
+	bool full = !!(reg->flags & DISASM_REG_FULL);
+	bool c = !!(reg->flags & DISASM_REG_CONST);
+	bool neg = !!(reg->flags & DISASM_REG_NEG);
+	bool abs = !!(reg->flags & DISASM_REG_ABS);
 	const char type = c ? 'c' : 'r';
+	unsigned num = reg->num >> 2, comp = reg->num & 0x3;
+	int val = reg->val;
+
+	/* (r) srcs advance with each repeat: */
+	if (reg->flags & DISASM_REG_R) {
+		num  = (reg->num + repeatidx) >> 2;
+		comp = (reg->num + repeatidx) & 0x3;
+		val += repeatidx;
+	}
 
 	// XXX I prefer - and || for neg/abs, but preserving format used
 	// by libllvm-a3xx for easy diffing..
@@ -83,30 +98,40 @@ static void print_reg(reg_t reg, bool full, bool r, bool c, bool im,
 	else if (abs)
 		printf("(abs)");
 
-	if (r)
+	if (reg->flags & DISASM_REG_R)
 		printf("(r)");
 
-	if (im) {
-		printf("%d", reg.iim_val);
-	} else if (addr_rel) {
+	if (reg->flags & DISASM_REG_IMMED) {
+		printf("%d", val);
+	} else if (reg->flags & DISASM_REG_RELATIV) {
 		/* I would just use %+d but trying to make it diff'able with
 		 * libllvm-a3xx...
 		 */
-		if (reg.iim_val < 0)
-			printf("%s%c<a0.x - %d>", full ? "" : "h", type, -reg.iim_val);
-		else if (reg.iim_val > 0)
-			printf("%s%c<a0.x + %d>", full ? "" : "h", type, reg.iim_val);
+		if (val < 0)
+			printf("%s%c<a0.x - %d>", full ? "" : "h", type, -val);
+		else if (val > 0)
+			printf("%s%c<a0.x + %d>", full ? "" : "h", type, val);
 		else
 			printf("%s%c<a0.x>", full ? "" : "h", type);
-	} else if ((reg.num == REG_A0) && !c) {
-		printf("a0.%c", component[reg.comp]);
-	} else if ((reg.num == REG_P0) && !c) {
-		printf("p0.%c", component[reg.comp]);
+	} else if ((num == REG_A0) && !c) {
+		printf("a0.%c", component[comp]);
+	} else if ((num == REG_P0) && !c) {
+		printf("p0.%c", component[comp]);
 	} else {
-		printf("%s%c%d.%c", full ? "" : "h", type, reg.num & 0x3f, component[reg.comp]);
+		printf("%s%c%d.%c", full ? "" : "h", type, num & 0x3f, component[comp]);
 	}
 }
 
+static void print_dst(const struct disasm_reg *reg, unsigned repeatidx)
+{
+	struct disasm_reg dst = *reg;
+
+	/* dst's always advance with repeat, but don't print (r): */
+	dst.num += repeatidx;
+	dst.val += repeatidx;
+	print_reg(&dst, 0);
+}
+
 /* Tracking for registers used, read-before-write (input), and
  * write-after-read (output.. but not 100%)..
  */
@@ -130,7 +155,7 @@ static void regmask_set(regmask_t *regmask, unsigned num, bool full, unsigned va
 	}
 }
 
-static unsigned regmask_get(regmask_t *regmask, unsigned num, bool full)
+static unsigned regmask_get(const regmask_t *regmask, unsigned num, bool full)
 {
 	unsigned i = num / 8;
 	unsigned j = num % 8;
@@ -147,22 +172,106 @@ static unsigned regidx(reg_t reg)
 	return (4 * reg.num) + reg.comp;
 }
 
-static reg_t idxreg(unsigned idx)
+/*
+ * Static perf model:
+ *
+ * Very rough estimate of the cost of a shader, for triaging which
+ * shaders are worth looking at.  Instructions issue in order, one per
+ * cycle (plus one per repeat).  ALU results are not interlocked (the
+ * compiler pads with nop's), while sfu (cat4) results are waited on
+ * with (ss) and tex/mem (cat5/cat6) results with (sy).  Any other
+ * read of a not-yet-ready register is counted as a stall too.
+ */
+
+/* cycles from issue until the result can be consumed, per category: */
+static const int latency[8] = {
+		[0] = 1,    /* flow control */
+		[1] = 4,    /* mov/cov */
+		[2] = 4,    /* alu */
+		[3] = 4,    /* alu (3 src) */
+		[4] = 10,   /* sfu */
+		[5] = 64,   /* tex */
+		[6] = 64,   /* mem */
+};
+
+/* wave occupancy: the register file is shared by the resident waves,
+ * half-precision registers take half the space of full ones:
+ */
+#define REGFILE_SIZE 128   /* in full vec4 registers, per wave slot */
+#define MAX_WAVES    16
+
+#define MAX_SRCS     64
+
+struct disasm_a3xx_ctx {
+	enum debug_t debug;
+
+	struct {
+		regmask_t used;
+		regmask_t rbw;      /* read before write */
+		regmask_t war;      /* write after read */
+		regmask_t cnst;     /* used consts */
+	} regs;
+
+	struct shader_stats stats;
+
+	struct {
+		/* per register (full/half): cycle the value is ready, length of
+		 * the dependency chain producing it, and the producing instr:
+		 */
+		int ready[2][MAX_REG];
+		int depth[2][MAX_REG];
+		int producer[2][MAX_REG];
+
+		int cycle;
+		int pending_ss, pending_sy;
+		int critical_end;
+
+		/* predecessor of each instruction on its longest dependency
+		 * chain:
+		 */
+		int *pred;
+		int npred;
+	} perf;
+};
+
+struct disasm_a3xx_ctx * disasm_a3xx_ctx_new(enum debug_t debug)
+{
+	struct disasm_a3xx_ctx *ctx = calloc(1, sizeof(*ctx));
+	if (ctx)
+		ctx->debug = debug;
+	return ctx;
+}
+
+void disasm_a3xx_ctx_free(struct disasm_a3xx_ctx *ctx)
 {
-	return (reg_t){
-		.comp = idx & 0x3,
-		.num  = idx >> 2,
-	};
+	if (!ctx)
+		return;
+	free(ctx->perf.pred);
+	free(ctx);
 }
 
-static struct {
-	regmask_t used;
-	regmask_t rbw;      /* read before write */
-	regmask_t war;      /* write after read */
-	regmask_t cnst;     /* used consts */
-} regs;
+/* # of vec4 regs needed to cover the highest register in the mask, and
+ * optionally the # of components used:
+ */
+static int regs_footprint(const regmask_t *regmask, bool full, int *cnt)
+{
+	int num, max = -1;
+
+	if (cnt)
+		*cnt = 0;
 
-static void print_regs(regmask_t *regmask, bool full)
+	for (num = 0; num < MAX_REG; num++) {
+		if (regmask_get(regmask, num, full)) {
+			max = num;
+			if (cnt)
+				(*cnt)++;
+		}
+	}
+
+	return (max < 0) ? 0 : (max / 4) + 1;
+}
+
+static void print_regs(const regmask_t *regmask, bool full)
 {
 	int num, max = 0, cnt = 0;
 	int first, last;
@@ -197,114 +306,92 @@ static void print_regs(regmask_t *regmask, bool full)
 	printf(" (cnt=%d, max=%d)", cnt, max);
 }
 
-static void print_reg_stats(int level)
+static void print_reg_stats(struct disasm_a3xx_ctx *ctx, int level)
 {
 	printf("%sRegister Stats:\n", levels[level]);
 	printf("%s- used (half):", levels[level]);
-	print_regs(&regs.used, false);
+	print_regs(&ctx->regs.used, false);
 	printf("\n");
 	printf("%s- used (full):", levels[level]);
-	print_regs(&regs.used, true);
+	print_regs(&ctx->regs.used, true);
 	printf("\n");
 	printf("%s- input (half):", levels[level]);
-	print_regs(&regs.rbw, false);
+	print_regs(&ctx->regs.rbw, false);
 	printf("\n");
 	printf("%s- input (full):", levels[level]);
-	print_regs(&regs.rbw, true);
+	print_regs(&ctx->regs.rbw, true);
 	printf("\n");
 	printf("%s- const (half):", levels[level]);
-	print_regs(&regs.cnst, false);
+	print_regs(&ctx->regs.cnst, false);
 	printf("\n");
 	printf("%s- const (full):", levels[level]);
-	print_regs(&regs.cnst, true);
+	print_regs(&ctx->regs.cnst, true);
 	printf("\n");
 	printf("%s- output (half):", levels[level]);
-	print_regs(&regs.war, false);
+	print_regs(&ctx->regs.war, false);
 	printf("  (estimated)\n");
 	printf("%s- output (full):", levels[level]);
-	print_regs(&regs.war, true);
+	print_regs(&ctx->regs.war, true);
 	printf("  (estimated)\n");
 }
 
-/* we have to process the dst register after src to avoid tripping up
- * the read-before-write detection
- */
-static unsigned last_dst;
-static bool last_dst_full;
-static bool last_dst_valid = false;
-
-/* current instruction repeat flag: */
-static unsigned repeat;
-/* current instruction repeat indx/offset (for --expand): */
-static unsigned repeatidx;
-
-static void process_reg_dst(void)
+static void print_perf_stats(struct disasm_a3xx_ctx *ctx, int level)
 {
-	int i;
-
-	if (!last_dst_valid)
-		return;
-
-	for (i = 0; i <= repeat; i++) {
-		unsigned dst = last_dst + i;
-
-		regmask_set(&regs.war, dst, last_dst_full, 1);
-		regmask_set(&regs.used, dst, last_dst_full, 1);
+	struct shader_stats *stats = &ctx->stats;
+	int n, len = 0;
+
+	printf("%sPerf Stats (estimated):\n", levels[level]);
+	printf("%s- cycles: %d (%d stalled)\n", levels[level],
+			stats->cycles, stats->stalls);
+	printf("%s- critical path: %d cycles:", levels[level], stats->critical);
+
+	/* printed backwards, from the last instruction on the chain: */
+	for (n = ctx->perf.critical_end; (n >= 0) && (n < ctx->perf.npred);
+			n = ctx->perf.pred[n]) {
+		printf("%s%d", len ? " <- " : " ", n);
+		if (++len >= ctx->perf.npred)
+			break;
 	}
+	printf("\n");
 
-	last_dst_valid = false;
+	printf("%s- occupancy: %d/%d waves\n", levels[level],
+			stats->waves, MAX_WAVES);
 }
 
-static void print_reg_dst(reg_t reg, bool full, bool addr_rel)
+/*
+ * Decoding:
+ */
+
+static void set_dst(struct disasm_instr *d, reg_t reg, bool full, bool addr_rel)
 {
-	/* presumably the special registers a0.c and p0.c don't count.. */
-	if (!(addr_rel || (reg.num == 61) || (reg.num == 62))) {
-		last_dst = regidx(reg);
-		last_dst_full = full;
-		last_dst_valid = true;
-	}
-	reg = idxreg(regidx(reg) + repeatidx);
-	print_reg(reg, full, false, false, false, false, false, addr_rel);
+	d->dst = (struct disasm_reg){
+		.flags = (full ? DISASM_REG_FULL : 0) |
+				(addr_rel ? DISASM_REG_RELATIV : 0),
+		.num   = regidx(reg),
+		.val   = reg.iim_val,
+	};
+	d->ndst = 1;
 }
 
-static void print_reg_src(reg_t reg, bool full, bool r, bool c, bool im,
-		bool neg, bool abs, bool addr_rel)
+static void add_src(struct disasm_instr *d, reg_t reg, bool full, bool r,
+		bool c, bool im, bool neg, bool abs, bool addr_rel)
 {
-	/* presumably the special registers a0.c and p0.c don't count.. */
-	if (!(addr_rel || c || im || (reg.num == 61) || (reg.num == 62))) {
-		int i, num = regidx(reg);
-		for (i = 0; i <= repeat; i++) {
-			unsigned src = num + i;
-
-			if (!regmask_get(&regs.used, src, full))
-				regmask_set(&regs.rbw, src, full, 1);
-
-			regmask_set(&regs.war, src, full, 0);
-			regmask_set(&regs.used, src, full, 1);
-
-			if (!r)
-				break;
-		}
-	} else if (c) {
-		int i, num = regidx(reg);
-		for (i = 0; i <= repeat; i++) {
-			unsigned src = num + i;
-
-			regmask_set(&regs.cnst, src, full, 1);
-
-			if (!r)
-				break;
-		}
-	}
-
-	if (r)
-		reg = idxreg(regidx(reg) + repeatidx);
-
-	print_reg(reg, full, r, c, im, neg, abs, addr_rel);
+	assert(d->nsrc < DISASM_MAX_SRCS);
+	d->src[d->nsrc++] = (struct disasm_reg){
+		.flags = (full ? DISASM_REG_FULL : 0) |
+				(r ? DISASM_REG_R : 0) |
+				(c ? DISASM_REG_CONST : 0) |
+				(im ? DISASM_REG_IMMED : 0) |
+				(neg ? DISASM_REG_NEG : 0) |
+				(abs ? DISASM_REG_ABS : 0) |
+				(addr_rel ? DISASM_REG_RELATIV : 0),
+		.num   = regidx(reg),
+		.val   = reg.iim_val,
+	};
 }
 
 /* TODO switch to using reginfo struct everywhere, since more readable
- * than passing a bunch of bools to print_reg_src
+ * than passing a bunch of bools to add_src
  */
 
 struct reginfo {
@@ -318,137 +405,57 @@ struct reginfo {
 	bool addr_rel;
 };
 
-static void print_src(struct reginfo *info)
+static void add_reginfo(struct disasm_instr *d, struct reginfo *info)
 {
-	print_reg_src(info->reg, info->full, info->r, info->c, info->im,
+	add_src(d, info->reg, info->full, info->r, info->c, info->im,
 			info->neg, info->abs, info->addr_rel);
 }
 
-//static void print_dst(struct reginfo *info)
-//{
-//	print_reg_dst(info->reg, info->full, info->addr_rel);
-//}
-
-static void print_instr_cat0(instr_t *instr)
+static void decode_cat0(struct disasm_instr *d, instr_t *instr)
 {
-	instr_cat0_t *cat0 = &instr->cat0;
-
-	switch (cat0->opc) {
-	case OPC_KILL:
-		printf(" %sp0.%c", cat0->inv ? "!" : "",
-				component[cat0->comp]);
-		break;
-	case OPC_BR:
-		printf(" %sp0.%c, #%d", cat0->inv ? "!" : "",
-				component[cat0->comp], cat0->immed);
-		break;
-	case OPC_JUMP:
-	case OPC_CALL:
-		printf(" #%d", cat0->immed);
-		break;
-	}
-
-	if ((debug & PRINT_VERBOSE) && (cat0->dummy1|cat0->dummy2|cat0->dummy3|cat0->dummy4))
-		printf("\t{0: %x,%x,%x,%x}", cat0->dummy1, cat0->dummy2, cat0->dummy3, cat0->dummy4);
 }
 
-static void print_instr_cat1(instr_t *instr)
+static void decode_cat1(struct disasm_instr *d, instr_t *instr)
 {
 	instr_cat1_t *cat1 = &instr->cat1;
 
-	if (cat1->ul)
-		printf("(ul)");
-
-	if (cat1->src_type == cat1->dst_type) {
-		if ((cat1->src_type == TYPE_S16) && (((reg_t)cat1->dst).num == REG_A0)) {
-			/* special case (nmemonic?): */
-			printf("mova.%s%s", type[cat1->src_type], type[cat1->dst_type]);
-		} else {
-			printf("mov.%s%s", type[cat1->src_type], type[cat1->dst_type]);
-		}
-	} else {
-		printf("cov.%s%s", type[cat1->src_type], type[cat1->dst_type]);
-	}
-
-	printf(" ");
-
-	if (cat1->even)
-		printf("(even)");
-
-	if (cat1->pos_inf)
-		printf("(pos_infinity)");
-
-	print_reg_dst((reg_t)(cat1->dst), type_size(cat1->dst_type) == 32,
+	set_dst(d, (reg_t)(cat1->dst), type_size(cat1->dst_type) == 32,
 			cat1->dst_rel);
 
-	printf(", ");
-
-	/* ugg, have to special case this.. vs print_reg().. */
 	if (cat1->src_im) {
-		if (type_float(cat1->src_type))
-			printf("(%f)", cat1->fim_val);
-		else
-			printf("%d", cat1->iim_val);
+		d->src[d->nsrc++] = (struct disasm_reg){
+			.flags = DISASM_REG_IMMED |
+					(type_float(cat1->src_type) ? DISASM_REG_FLOAT : 0),
+			.val   = cat1->iim_val,
+		};
 	} else if (cat1->src_rel && !cat1->src_c) {
-		/* I would just use %+d but trying to make it diff'able with
-		 * libllvm-a3xx...
-		 */
-		char type = cat1->src_rel_c ? 'c' : 'r';
-		if (cat1->off < 0)
-			printf("%c<a0.x - %d>", type, -cat1->off);
-		else if (cat1->off > 0)
-			printf("%c<a0.x + %d>", type, cat1->off);
-		else
-			printf("%c<a0.x>", type);
+		d->src[d->nsrc++] = (struct disasm_reg){
+			.flags = DISASM_REG_RELATIV |
+					(cat1->src_rel_c ? DISASM_REG_CONST : 0),
+			.val   = cat1->off,
+		};
 	} else {
-		print_reg_src((reg_t)(cat1->src), type_size(cat1->src_type) == 32,
+		add_src(d, (reg_t)(cat1->src), type_size(cat1->src_type) == 32,
 				cat1->src_r, cat1->src_c, cat1->src_im, false, false, false);
 	}
-
-	if ((debug & PRINT_VERBOSE) && (cat1->must_be_0))
-		printf("\t{1: %x}", cat1->must_be_0);
 }
 
-static void print_instr_cat2(instr_t *instr)
+static void decode_cat2(struct disasm_instr *d, instr_t *instr)
 {
 	instr_cat2_t *cat2 = &instr->cat2;
-	static const char *cond[] = {
-			"lt",
-			"le",
-			"gt",
-			"ge",
-			"eq",
-			"ne",
-			"?6?",
-	};
-
-	switch (cat2->opc) {
-	case OPC_CMPS_F:
-	case OPC_CMPS_U:
-	case OPC_CMPS_S:
-	case OPC_CMPV_F:
-	case OPC_CMPV_U:
-	case OPC_CMPV_S:
-		printf(".%s", cond[cat2->cond]);
-		break;
-	}
 
-	printf(" ");
-	if (cat2->ei)
-		printf("(ei)");
-	print_reg_dst((reg_t)(cat2->dst), cat2->full ^ cat2->dst_half, false);
-	printf(", ");
+	set_dst(d, (reg_t)(cat2->dst), cat2->full ^ cat2->dst_half, false);
 
 	if (cat2->c1.src1_c) {
-		print_reg_src((reg_t)(cat2->c1.src1), cat2->full, cat2->src1_r,
+		add_src(d, (reg_t)(cat2->c1.src1), cat2->full, cat2->src1_r,
 				cat2->c1.src1_c, cat2->src1_im, cat2->src1_neg,
 				cat2->src1_abs, false);
 	} else if (cat2->rel1.src1_rel) {
-		print_reg_src((reg_t)(cat2->rel1.src1), cat2->full, cat2->src1_r,
+		add_src(d, (reg_t)(cat2->rel1.src1), cat2->full, cat2->src1_r,
 				cat2->rel1.src1_c, cat2->src1_im, cat2->src1_neg,
 				cat2->src1_abs, cat2->rel1.src1_rel);
 	} else {
-		print_reg_src((reg_t)(cat2->src1), cat2->full, cat2->src1_r,
+		add_src(d, (reg_t)(cat2->src1), cat2->full, cat2->src1_r,
 				false, cat2->src1_im, cat2->src1_neg,
 				cat2->src1_abs, false);
 	}
@@ -471,17 +478,16 @@ static void print_instr_cat2(instr_t *instr)
 		/* these only have one src reg */
 		break;
 	default:
-		printf(", ");
 		if (cat2->c2.src2_c) {
-			print_reg_src((reg_t)(cat2->c2.src2), cat2->full, cat2->src2_r,
+			add_src(d, (reg_t)(cat2->c2.src2), cat2->full, cat2->src2_r,
 					cat2->c2.src2_c, cat2->src2_im, cat2->src2_neg,
 					cat2->src2_abs, false);
 		} else if (cat2->rel2.src2_rel) {
-			print_reg_src((reg_t)(cat2->rel2.src2), cat2->full, cat2->src2_r,
+			add_src(d, (reg_t)(cat2->rel2.src2), cat2->full, cat2->src2_r,
 					cat2->rel2.src2_c, cat2->src2_im, cat2->src2_neg,
 					cat2->src2_abs, cat2->rel2.src2_rel);
 		} else {
-			print_reg_src((reg_t)(cat2->src2), cat2->full, cat2->src2_r,
+			add_src(d, (reg_t)(cat2->src2), cat2->full, cat2->src2_r,
 					false, cat2->src2_im, cat2->src2_neg,
 					cat2->src2_abs, false);
 		}
@@ -489,7 +495,7 @@ static void print_instr_cat2(instr_t *instr)
 	}
 }
 
-static void print_instr_cat3(instr_t *instr)
+static void decode_cat3(struct disasm_instr *d, instr_t *instr)
 {
 	instr_cat3_t *cat3 = &instr->cat3;
 	bool full = true;
@@ -508,174 +514,121 @@ static void print_instr_cat3(instr_t *instr)
 		break;
 	}
 
-	printf(" ");
-	print_reg_dst((reg_t)(cat3->dst), full ^ cat3->dst_half, false);
-	printf(", ");
+	set_dst(d, (reg_t)(cat3->dst), full ^ cat3->dst_half, false);
+
 	if (cat3->c1.src1_c) {
-		print_reg_src((reg_t)(cat3->c1.src1), full,
+		add_src(d, (reg_t)(cat3->c1.src1), full,
 				cat3->src1_r, cat3->c1.src1_c, false, cat3->src1_neg,
 				false, false);
 	} else if (cat3->rel1.src1_rel) {
-		print_reg_src((reg_t)(cat3->rel1.src1), full,
+		add_src(d, (reg_t)(cat3->rel1.src1), full,
 				cat3->src1_r, cat3->rel1.src1_c, false, cat3->src1_neg,
 				false, cat3->rel1.src1_rel);
 	} else {
-		print_reg_src((reg_t)(cat3->src1), full,
+		add_src(d, (reg_t)(cat3->src1), full,
 				cat3->src1_r, false, false, cat3->src1_neg,
 				false, false);
 	}
-	printf(", ");
-	print_reg_src((reg_t)cat3->src2, full,
+
+	add_src(d, (reg_t)cat3->src2, full,
 			cat3->src2_r, cat3->src2_c, false, cat3->src2_neg,
 			false, false);
-	printf(", ");
+
 	if (cat3->c2.src3_c) {
-		print_reg_src((reg_t)(cat3->c2.src3), full,
+		add_src(d, (reg_t)(cat3->c2.src3), full,
 				cat3->src3_r, cat3->c2.src3_c, false, cat3->src3_neg,
 				false, false);
 	} else if (cat3->rel2.src3_rel) {
-		print_reg_src((reg_t)(cat3->rel2.src3), full,
+		add_src(d, (reg_t)(cat3->rel2.src3), full,
 				cat3->src3_r, cat3->rel2.src3_c, false, cat3->src3_neg,
 				false, cat3->rel2.src3_rel);
 	} else {
-		print_reg_src((reg_t)(cat3->src3), full,
+		add_src(d, (reg_t)(cat3->src3), full,
 				cat3->src3_r, false, false, cat3->src3_neg,
 				false, false);
 	}
 }
 
-static void print_instr_cat4(instr_t *instr)
+static void decode_cat4(struct disasm_instr *d, instr_t *instr)
 {
 	instr_cat4_t *cat4 = &instr->cat4;
 
-	printf(" ");
-	print_reg_dst((reg_t)(cat4->dst), cat4->full ^ cat4->dst_half, false);
-	printf(", ");
+	set_dst(d, (reg_t)(cat4->dst), cat4->full ^ cat4->dst_half, false);
 
 	if (cat4->c.src_c) {
-		print_reg_src((reg_t)(cat4->c.src), cat4->full,
+		add_src(d, (reg_t)(cat4->c.src), cat4->full,
 				cat4->src_r, cat4->c.src_c, cat4->src_im,
 				cat4->src_neg, cat4->src_abs, false);
 	} else if (cat4->rel.src_rel) {
-		print_reg_src((reg_t)(cat4->rel.src), cat4->full,
+		add_src(d, (reg_t)(cat4->rel.src), cat4->full,
 				cat4->src_r, cat4->rel.src_c, cat4->src_im,
 				cat4->src_neg, cat4->src_abs, cat4->rel.src_rel);
 	} else {
-		print_reg_src((reg_t)(cat4->src), cat4->full,
+		add_src(d, (reg_t)(cat4->src), cat4->full,
 				cat4->src_r, false, cat4->src_im,
 				cat4->src_neg, cat4->src_abs, false);
 	}
-
-	if ((debug & PRINT_VERBOSE) && (cat4->dummy1|cat4->dummy2))
-		printf("\t{4: %x,%x}", cat4->dummy1, cat4->dummy2);
 }
 
-static void print_instr_cat5(instr_t *instr)
+static const struct {
+	bool src1, src2, samp, tex;
+} cat5_info[0x1f] = {
+		[OPC_ISAM]     = { true,  false, true,  true,  },
+		[OPC_ISAML]    = { true,  true,  true,  true,  },
+		[OPC_ISAMM]    = { true,  false, true,  true,  },
+		[OPC_SAM]      = { true,  false, true,  true,  },
+		[OPC_SAMB]     = { true,  true,  true,  true,  },
+		[OPC_SAML]     = { true,  true,  true,  true,  },
+		[OPC_SAMGQ]    = { true,  false, true,  true,  },
+		[OPC_GETLOD]   = { true,  false, true,  true,  },
+		[OPC_CONV]     = { true,  true,  true,  true,  },
+		[OPC_CONVM]    = { true,  true,  true,  true,  },
+		[OPC_GETSIZE]  = { true,  false, false, true,  },
+		[OPC_GETBUF]   = { false, false, false, true,  },
+		[OPC_GETPOS]   = { true,  false, false, true,  },
+		[OPC_GETINFO]  = { false, false, false, true,  },
+		[OPC_DSX]      = { true,  false, false, false, },
+		[OPC_DSY]      = { true,  false, false, false, },
+		[OPC_GATHER4R] = { true,  false, true,  true,  },
+		[OPC_GATHER4G] = { true,  false, true,  true,  },
+		[OPC_GATHER4B] = { true,  false, true,  true,  },
+		[OPC_GATHER4A] = { true,  false, true,  true,  },
+		[OPC_SAMGP0]   = { true,  false, true,  true,  },
+		[OPC_SAMGP1]   = { true,  false, true,  true,  },
+		[OPC_SAMGP2]   = { true,  false, true,  true,  },
+		[OPC_SAMGP3]   = { true,  false, true,  true,  },
+		[OPC_DSXPP_1]  = { true,  false, false, false, },
+		[OPC_DSYPP_1]  = { true,  false, false, false, },
+		[OPC_RGETPOS]  = { false, false, false, false, },
+		[OPC_RGETINFO] = { false, false, false, false, },
+};
+
+static void decode_cat5(struct disasm_instr *d, instr_t *instr)
 {
-	static const struct {
-		bool src1, src2, samp, tex;
-	} info[0x1f] = {
-			[OPC_ISAM]     = { true,  false, true,  true,  },
-			[OPC_ISAML]    = { true,  true,  true,  true,  },
-			[OPC_ISAMM]    = { true,  false, true,  true,  },
-			[OPC_SAM]      = { true,  false, true,  true,  },
-			[OPC_SAMB]     = { true,  true,  true,  true,  },
-			[OPC_SAML]     = { true,  true,  true,  true,  },
-			[OPC_SAMGQ]    = { true,  false, true,  true,  },
-			[OPC_GETLOD]   = { true,  false, true,  true,  },
-			[OPC_CONV]     = { true,  true,  true,  true,  },
-			[OPC_CONVM]    = { true,  true,  true,  true,  },
-			[OPC_GETSIZE]  = { true,  false, false, true,  },
-			[OPC_GETBUF]   = { false, false, false, true,  },
-			[OPC_GETPOS]   = { true,  false, false, true,  },
-			[OPC_GETINFO]  = { false, false, false, true,  },
-			[OPC_DSX]      = { true,  false, false, false, },
-			[OPC_DSY]      = { true,  false, false, false, },
-			[OPC_GATHER4R] = { true,  false, true,  true,  },
-			[OPC_GATHER4G] = { true,  false, true,  true,  },
-			[OPC_GATHER4B] = { true,  false, true,  true,  },
-			[OPC_GATHER4A] = { true,  false, true,  true,  },
-			[OPC_SAMGP0]   = { true,  false, true,  true,  },
-			[OPC_SAMGP1]   = { true,  false, true,  true,  },
-			[OPC_SAMGP2]   = { true,  false, true,  true,  },
-			[OPC_SAMGP3]   = { true,  false, true,  true,  },
-			[OPC_DSXPP_1]  = { true,  false, false, false, },
-			[OPC_DSYPP_1]  = { true,  false, false, false, },
-			[OPC_RGETPOS]  = { false, false, false, false, },
-			[OPC_RGETINFO] = { false, false, false, false, },
-	};
 	instr_cat5_t *cat5 = &instr->cat5;
-	int i;
-
-	if (cat5->is_3d)   printf(".3d");
-	if (cat5->is_a)    printf(".a");
-	if (cat5->is_o)    printf(".o");
-	if (cat5->is_p)    printf(".p");
-	if (cat5->is_s)    printf(".s");
-	if (cat5->is_s2en) printf(".s2en");
-
-	printf(" ");
-
-	switch (cat5->opc) {
-	case OPC_DSXPP_1:
-	case OPC_DSYPP_1:
-		break;
-	default:
-		printf("(%s)", type[cat5->type]);
-		break;
-	}
 
-	printf("(");
-	for (i = 0; i < 4; i++)
-		if (cat5->wrmask & (1 << i))
-			printf("%c", "xyzw"[i]);
-	printf(")");
-
-	print_reg_dst((reg_t)(cat5->dst), type_size(cat5->type) == 32, false);
+	set_dst(d, (reg_t)(cat5->dst), type_size(cat5->type) == 32, false);
 
-	if (info[cat5->opc].src1) {
-		printf(", ");
-		print_reg_src((reg_t)(cat5->src1), cat5->full, false, false, false,
+	if (cat5_info[cat5->opc].src1) {
+		add_src(d, (reg_t)(cat5->src1), cat5->full, false, false, false,
 				false, false, false);
 	}
 
 	if (cat5->is_s2en) {
-		printf(", ");
-		print_reg_src((reg_t)(cat5->s2en.src2), cat5->full, false, false, false,
+		add_src(d, (reg_t)(cat5->s2en.src2), cat5->full, false, false, false,
 				false, false, false);
-		printf(", ");
-		print_reg_src((reg_t)(cat5->s2en.src3), false, false, false, false,
+		add_src(d, (reg_t)(cat5->s2en.src3), false, false, false, false,
 				false, false, false);
-	} else {
-		if (cat5->is_o || info[cat5->opc].src2) {
-			printf(", ");
-			print_reg_src((reg_t)(cat5->norm.src2), cat5->full,
-					false, false, false, false, false, false);
-		}
-		if (info[cat5->opc].samp)
-			printf(", s#%d", cat5->norm.samp);
-		if (info[cat5->opc].tex)
-			printf(", t#%d", cat5->norm.tex);
-	}
-
-	if (debug & PRINT_VERBOSE) {
-		if (cat5->is_s2en) {
-			if ((debug & PRINT_VERBOSE) && (cat5->s2en.dummy1|cat5->s2en.dummy2|cat5->dummy2))
-				printf("\t{5: %x,%x,%x}", cat5->s2en.dummy1, cat5->s2en.dummy2, cat5->dummy2);
-		} else {
-			if ((debug & PRINT_VERBOSE) && (cat5->norm.dummy1|cat5->dummy2))
-				printf("\t{5: %x,%x}", cat5->norm.dummy1, cat5->dummy2);
-		}
+	} else if (cat5->is_o || cat5_info[cat5->opc].src2) {
+		add_src(d, (reg_t)(cat5->norm.src2), cat5->full,
+				false, false, false, false, false, false);
 	}
 }
 
-static void print_instr_cat6(instr_t *instr)
+static void decode_cat6(struct disasm_instr *d, instr_t *instr)
 {
 	instr_cat6_t *cat6 = &instr->cat6;
-	char sd = 0, ss = 0;  /* dst/src address space */
-	bool nodst = false;
 	struct reginfo dst, src1, src2;
-	int src1off = 0, dstoff = 0;
 
 	memset(&dst, 0, sizeof(dst));
 	memset(&src1, 0, sizeof(src1));
@@ -715,7 +668,6 @@ static void print_instr_cat6(instr_t *instr)
 	switch (cat6->opc) {
 	case OPC_PREFETCH:
 	case OPC_RESINFO:
-		break;
 	case OPC_ATOMIC_ADD:
 	case OPC_ATOMIC_SUB:
 	case OPC_ATOMIC_XCHG:
@@ -727,64 +679,17 @@ static void print_instr_cat6(instr_t *instr)
 	case OPC_ATOMIC_AND:
 	case OPC_ATOMIC_OR:
 	case OPC_ATOMIC_XOR:
-		ss = cat6->g ? 'g' : 'l';
-		printf(".%c", ss);
-		printf(".%s", type[cat6->type]);
 		break;
 	default:
 		dst.im = cat6->g && !cat6->dst_off;
-		printf(".%s", type[cat6->type]);
 		break;
 	}
-	printf(" ");
-
-	switch (cat6->opc) {
-	case OPC_STG:
-		sd = 'g';
-		break;
-	case OPC_STP:
-		sd = 'p';
-		break;
-	case OPC_STL:
-	case OPC_STLW:
-		sd = 'l';
-		break;
-
-	case OPC_LDG:
-		ss = 'g';
-		break;
-	case OPC_LDP:
-		ss = 'p';
-		break;
-	case OPC_LDL:
-	case OPC_LDLW:
-	case OPC_LDLV:
-		ss = 'l';
-		break;
-
-	case OPC_L2G:
-		ss = 'l';
-		sd = 'g';
-		break;
-
-	case OPC_G2L:
-		ss = 'g';
-		sd = 'l';
-		break;
-
-	case OPC_PREFETCH:
-		ss = 'g';
-		nodst = true;
-		break;
 
-	case OPC_STI:
+	if (cat6->opc == OPC_STI)
 		dst.full = false;  // XXX or inverts??
-		break;
-	}
 
 	if (cat6->dst_off) {
 		dst.reg = (reg_t)(cat6->c.dst);
-		dstoff  = cat6->c.off;
 	} else {
 		dst.reg = (reg_t)(cat6->d.dst);
 	}
@@ -794,7 +699,6 @@ static void print_instr_cat6(instr_t *instr)
 		src1.im  = cat6->a.src1_im;
 		src2.reg = (reg_t)(cat6->a.src2);
 		src2.im  = cat6->a.src2_im;
-		src1off  = cat6->a.off;
 	} else {
 		src1.reg = (reg_t)(cat6->b.src1);
 		src1.im  = cat6->b.src1_im;
@@ -802,54 +706,366 @@ static void print_instr_cat6(instr_t *instr)
 		src2.im  = cat6->b.src2_im;
 	}
 
-	if (!nodst) {
-		if (sd)
-			printf("%c[", sd);
-		/* note: dst might actually be a src (ie. address to store to) */
-		print_src(&dst);
-		if (dstoff)
-			printf("%+d", dstoff);
-		if (sd)
-			printf("]");
-		printf(", ");
-	}
-
-	if (ss)
-		printf("%c[", ss);
+	/* note: dst might actually be a src (ie. address to store to), so
+	 * it is treated as a src:
+	 */
+	if (cat6->opc != OPC_PREFETCH)
+		add_reginfo(d, &dst);
 
 	/* can have a larger than normal immed, so hack: */
 	if (src1.im) {
-		printf("%u", src1.reg.dummy13);
+		d->src[d->nsrc++] = (struct disasm_reg){
+			.flags = DISASM_REG_IMMED,
+			.val   = src1.reg.dummy13,
+		};
 	} else {
-		print_src(&src1);
+		add_reginfo(d, &src1);
 	}
 
-	if (src1off)
-		printf("%+d", src1off);
-	if (ss)
-		printf("]");
-
 	switch (cat6->opc) {
 	case OPC_RESINFO:
 	case OPC_RESFMT:
 		break;
 	default:
+		add_reginfo(d, &src2);
+		break;
+	}
+}
+
+/*
+ * Printing:
+ */
+
+static void print_instr_cat0(struct disasm_a3xx_ctx *ctx,
+		const struct disasm_instr *d, unsigned repeatidx)
+{
+	instr_cat0_t *cat0 = &((instr_t *)d->dwords)->cat0;
+
+	switch (cat0->opc) {
+	case OPC_KILL:
+		printf(" %sp0.%c", cat0->inv ? "!" : "",
+				component[cat0->comp]);
+		break;
+	case OPC_BR:
+		printf(" %sp0.%c, #%d", cat0->inv ? "!" : "",
+				component[cat0->comp], cat0->immed);
+		break;
+	case OPC_JUMP:
+	case OPC_CALL:
+		printf(" #%d", cat0->immed);
+		break;
+	}
+
+	if ((ctx->debug & PRINT_VERBOSE) && (cat0->dummy1|cat0->dummy2|cat0->dummy3|cat0->dummy4))
+		printf("\t{0: %x,%x,%x,%x}", cat0->dummy1, cat0->dummy2, cat0->dummy3, cat0->dummy4);
+}
+
+static void print_instr_cat1(struct disasm_a3xx_ctx *ctx,
+		const struct disasm_instr *d, unsigned repeatidx)
+{
+	instr_cat1_t *cat1 = &((instr_t *)d->dwords)->cat1;
+	const struct disasm_reg *src = &d->src[0];
+
+	if (cat1->ul)
+		printf("(ul)");
+
+	if (cat1->src_type == cat1->dst_type) {
+		if ((cat1->src_type == TYPE_S16) && (((reg_t)cat1->dst).num == REG_A0)) {
+			/* special case (nmemonic?): */
+			printf("mova.%s%s", type[cat1->src_type], type[cat1->dst_type]);
+		} else {
+			printf("mov.%s%s", type[cat1->src_type], type[cat1->dst_type]);
+		}
+	} else {
+		printf("cov.%s%s", type[cat1->src_type], type[cat1->dst_type]);
+	}
+
+	printf(" ");
+
+	if (cat1->even)
+		printf("(even)");
+
+	if (cat1->pos_inf)
+		printf("(pos_infinity)");
+
+	print_dst(&d->dst, repeatidx);
+
+	printf(", ");
+
+	/* ugg, have to special case this.. vs print_reg().. */
+	if (src->flags & DISASM_REG_IMMED) {
+		if (src->flags & DISASM_REG_FLOAT) {
+			float f;
+			memcpy(&f, &src->val, sizeof(f));
+			printf("(%f)", f);
+		} else {
+			printf("%d", src->val);
+		}
+	} else if (src->flags & DISASM_REG_RELATIV) {
+		/* I would just use %+d but trying to make it diff'able with
+		 * libllvm-a3xx...
+		 */
+		char type = (src->flags & DISASM_REG_CONST) ? 'c' : 'r';
+		if (src->val < 0)
+			printf("%c<a0.x - %d>", type, -src->val);
+		else if (src->val > 0)
+			printf("%c<a0.x + %d>", type, src->val);
+		else
+			printf("%c<a0.x>", type);
+	} else {
+		print_reg(src, repeatidx);
+	}
+
+	if ((ctx->debug & PRINT_VERBOSE) && (cat1->must_be_0))
+		printf("\t{1: %x}", cat1->must_be_0);
+}
+
+static void print_instr_cat2(struct disasm_a3xx_ctx *ctx,
+		const struct disasm_instr *d, unsigned repeatidx)
+{
+	instr_cat2_t *cat2 = &((instr_t *)d->dwords)->cat2;
+	static const char *cond[] = {
+			"lt",
+			"le",
+			"gt",
+			"ge",
+			"eq",
+			"ne",
+			"?6?",
+	};
+	int i;
+
+	switch (cat2->opc) {
+	case OPC_CMPS_F:
+	case OPC_CMPS_U:
+	case OPC_CMPS_S:
+	case OPC_CMPV_F:
+	case OPC_CMPV_U:
+	case OPC_CMPV_S:
+		printf(".%s", cond[cat2->cond]);
+		break;
+	}
+
+	printf(" ");
+	if (cat2->ei)
+		printf("(ei)");
+	print_dst(&d->dst, repeatidx);
+
+	for (i = 0; i < d->nsrc; i++) {
+		printf(", ");
+		print_reg(&d->src[i], repeatidx);
+	}
+}
+
+static void print_instr_cat3(struct disasm_a3xx_ctx *ctx,
+		const struct disasm_instr *d, unsigned repeatidx)
+{
+	int i;
+
+	printf(" ");
+	print_dst(&d->dst, repeatidx);
+
+	for (i = 0; i < d->nsrc; i++) {
 		printf(", ");
-		print_src(&src2);
+		print_reg(&d->src[i], repeatidx);
+	}
+}
+
+static void print_instr_cat4(struct disasm_a3xx_ctx *ctx,
+		const struct disasm_instr *d, unsigned repeatidx)
+{
+	instr_cat4_t *cat4 = &((instr_t *)d->dwords)->cat4;
+
+	printf(" ");
+	print_dst(&d->dst, repeatidx);
+	printf(", ");
+	print_reg(&d->src[0], repeatidx);
+
+	if ((ctx->debug & PRINT_VERBOSE) && (cat4->dummy1|cat4->dummy2))
+		printf("\t{4: %x,%x}", cat4->dummy1, cat4->dummy2);
+}
+
+static void print_instr_cat5(struct disasm_a3xx_ctx *ctx,
+		const struct disasm_instr *d, unsigned repeatidx)
+{
+	instr_cat5_t *cat5 = &((instr_t *)d->dwords)->cat5;
+	int i;
+
+	if (cat5->is_3d)   printf(".3d");
+	if (cat5->is_a)    printf(".a");
+	if (cat5->is_o)    printf(".o");
+	if (cat5->is_p)    printf(".p");
+	if (cat5->is_s)    printf(".s");
+	if (cat5->is_s2en) printf(".s2en");
+
+	printf(" ");
+
+	switch (cat5->opc) {
+	case OPC_DSXPP_1:
+	case OPC_DSYPP_1:
 		break;
+	default:
+		printf("(%s)", type[cat5->type]);
+		break;
+	}
+
+	printf("(");
+	for (i = 0; i < 4; i++)
+		if (cat5->wrmask & (1 << i))
+			printf("%c", "xyzw"[i]);
+	printf(")");
+
+	print_dst(&d->dst, repeatidx);
+
+	for (i = 0; i < d->nsrc; i++) {
+		printf(", ");
+		print_reg(&d->src[i], repeatidx);
+	}
+
+	if (!cat5->is_s2en) {
+		if (cat5_info[cat5->opc].samp)
+			printf(", s#%d", cat5->norm.samp);
+		if (cat5_info[cat5->opc].tex)
+			printf(", t#%d", cat5->norm.tex);
+	}
+
+	if (ctx->debug & PRINT_VERBOSE) {
+		if (cat5->is_s2en) {
+			if (cat5->s2en.dummy1|cat5->s2en.dummy2|cat5->dummy2)
+				printf("\t{5: %x,%x,%x}", cat5->s2en.dummy1, cat5->s2en.dummy2, cat5->dummy2);
+		} else {
+			if (cat5->norm.dummy1|cat5->dummy2)
+				printf("\t{5: %x,%x}", cat5->norm.dummy1, cat5->dummy2);
+		}
+	}
+}
+
+static void print_instr_cat6(struct disasm_a3xx_ctx *ctx,
+		const struct disasm_instr *d, unsigned repeatidx)
+{
+	instr_cat6_t *cat6 = &((instr_t *)d->dwords)->cat6;
+	char sd = 0, ss = 0;  /* dst/src address space */
+	int src1off = 0, dstoff = 0;
+	int n = 0;
+
+	switch (cat6->opc) {
+	case OPC_PREFETCH:
+	case OPC_RESINFO:
+		break;
+	case OPC_ATOMIC_ADD:
+	case OPC_ATOMIC_SUB:
+	case OPC_ATOMIC_XCHG:
+	case OPC_ATOMIC_INC:
+	case OPC_ATOMIC_DEC:
+	case OPC_ATOMIC_CMPXCHG:
+	case OPC_ATOMIC_MIN:
+	case OPC_ATOMIC_MAX:
+	case OPC_ATOMIC_AND:
+	case OPC_ATOMIC_OR:
+	case OPC_ATOMIC_XOR:
+		ss = cat6->g ? 'g' : 'l';
+		printf(".%c", ss);
+		printf(".%s", type[cat6->type]);
+		break;
+	default:
+		printf(".%s", type[cat6->type]);
+		break;
+	}
+	printf(" ");
+
+	switch (cat6->opc) {
+	case OPC_STG:
+		sd = 'g';
+		break;
+	case OPC_STP:
+		sd = 'p';
+		break;
+	case OPC_STL:
+	case OPC_STLW:
+		sd = 'l';
+		break;
+
+	case OPC_LDG:
+		ss = 'g';
+		break;
+	case OPC_LDP:
+		ss = 'p';
+		break;
+	case OPC_LDL:
+	case OPC_LDLW:
+	case OPC_LDLV:
+		ss = 'l';
+		break;
+
+	case OPC_L2G:
+		ss = 'l';
+		sd = 'g';
+		break;
+
+	case OPC_G2L:
+		ss = 'g';
+		sd = 'l';
+		break;
+
+	case OPC_PREFETCH:
+		ss = 'g';
+		break;
+	}
+
+	if (cat6->dst_off)
+		dstoff = cat6->c.off;
+
+	if (cat6->src_off)
+		src1off = cat6->a.off;
+
+	if (cat6->opc != OPC_PREFETCH) {
+		if (sd)
+			printf("%c[", sd);
+		print_reg(&d->src[n++], repeatidx);
+		if (dstoff)
+			printf("%+d", dstoff);
+		if (sd)
+			printf("]");
+		printf(", ");
+	}
+
+	if (ss)
+		printf("%c[", ss);
+
+	/* can have a larger than normal immed, so hack: */
+	if (d->src[n].flags & DISASM_REG_IMMED) {
+		printf("%u", d->src[n].val);
+	} else {
+		print_reg(&d->src[n], repeatidx);
+	}
+	n++;
+
+	if (src1off)
+		printf("%+d", src1off);
+	if (ss)
+		printf("]");
+
+	if (n < d->nsrc) {
+		printf(", ");
+		print_reg(&d->src[n], repeatidx);
 	}
 }
 
 /* size of largest OPC field of all the instruction categories: */
 #define NOPC_BITS 6
 
-struct opc_info {
+typedef void (*decode_fn)(struct disasm_instr *d, instr_t *instr);
+typedef void (*print_fn)(struct disasm_a3xx_ctx *ctx,
+		const struct disasm_instr *d, unsigned repeatidx);
+
+static const struct opc_info {
 	uint16_t cat;
 	uint16_t opc;
 	const char *name;
-	void (*print)(instr_t *instr);
+	decode_fn decode;
+	print_fn print;
 } opcs[1 << (3+NOPC_BITS)] = {
-#define OPC(cat, opc, name) [((cat) << NOPC_BITS) | (opc)] = { (cat), (opc), #name, print_instr_cat##cat }
+#define OPC(cat, opc, name) [((cat) << NOPC_BITS) | (opc)] = { (cat), (opc), #name, decode_cat##cat, print_instr_cat##cat }
 	/* category 0: */
 	OPC(0, OPC_NOP,          nop),
 	OPC(0, OPC_BR,           br),
@@ -1009,7 +1225,7 @@ struct opc_info {
 #undef OPC
 };
 
-#define GETINFO(instr) (&(opcs[((instr)->opc_cat << NOPC_BITS) | getopc(instr)]))
+#define GETINFO(cat, opc) (&(opcs[((cat) << NOPC_BITS) | (opc)]))
 
 static uint32_t getopc(instr_t *instr)
 {
@@ -1025,21 +1241,251 @@ static uint32_t getopc(instr_t *instr)
 	}
 }
 
-static bool print_instr(uint32_t *dwords, int level, int n)
+static void decode_instr(struct disasm_instr *d, uint32_t *dwords, int n)
 {
 	instr_t *instr = (instr_t *)dwords;
-	uint32_t opc = getopc(instr);
-	const char *name;
+	const struct opc_info *info;
+
+	memset(d, 0, sizeof(*d));
+
+	d->dwords[0] = dwords[0];
+	d->dwords[1] = dwords[1];
+	d->addr = n;
+	d->cat  = instr->opc_cat;
+	d->opc  = getopc(instr);
+
+	if (instr->sync)
+		d->flags |= DISASM_INSTR_SY;
+	if (instr->ss && (instr->opc_cat <= 4))
+		d->flags |= DISASM_INSTR_SS;
+	if (instr->jmp_tgt)
+		d->flags |= DISASM_INSTR_JP;
+	if (instr->ul && ((2 <= instr->opc_cat) && (instr->opc_cat <= 4)))
+		d->flags |= DISASM_INSTR_UL;
+	if ((instr->opc_cat == 0) && (d->opc == OPC_END))
+		d->flags |= DISASM_INSTR_END;
 
-	printf("%s%04d[%08xx_%08xx] ", levels[level], n, dwords[1], dwords[0]);
+	if (instr->opc_cat <= 4)
+		d->repeat = instr->repeat;
+
+	info = GETINFO(d->cat, d->opc);
+	d->name = info->name;
+	if (info->name)
+		info->decode(d, instr);
+}
+
+int disasm_a3xx_decode(uint32_t *dwords, int sizedwords,
+		struct disasm_instr *instrs, int max)
+{
+	int i, n = 0;
+
+//	assert((sizedwords % 2) == 0);
+
+	for (i = 0; (i < sizedwords) && (n < max); i += 2) {
+		decode_instr(&instrs[n], &dwords[i], i/2);
+		if (instrs[n++].flags & DISASM_INSTR_END)
+			break;
+	}
+
+	return n;
+}
+
+int disasm_a3xx_sizedwords(uint32_t *dwords, int sizedwords)
+{
+	int i;
+
+	for (i = 0; (i + 1) < sizedwords; i += 2) {
+		instr_t *instr = (instr_t *)&dwords[i];
+		if ((instr->opc_cat == 0) && (getopc(instr) == OPC_END))
+			return i + 2;
+	}
+
+	return sizedwords;
+}
+
+/*
+ * Register usage and perf model:
+ */
+
+static bool is_special(const struct disasm_reg *reg)
+{
+	/* presumably the special registers a0.c and p0.c don't count.. */
+	return ((reg->num >> 2) == REG_A0) || ((reg->num >> 2) == REG_P0);
+}
+
+void disasm_a3xx_analyze(struct disasm_a3xx_ctx *ctx,
+		const struct disasm_instr *instrs, int n, struct shader_stats *out)
+{
+	struct shader_stats *stats = &ctx->stats;
+	int i, j, k, hconst, fconst, hcnt, fcnt, regs;
+
+	memset(&ctx->regs, 0, sizeof(ctx->regs));
+	memset(stats, 0, sizeof(*stats));
+
+	free(ctx->perf.pred);
+	memset(&ctx->perf, 0, sizeof(ctx->perf));
+	for (i = 0; i < MAX_REG; i++)
+		ctx->perf.producer[0][i] = ctx->perf.producer[1][i] = -1;
+	ctx->perf.pred = calloc(n + 1, sizeof(ctx->perf.pred[0]));
+	ctx->perf.npred = n;
+	ctx->perf.critical_end = -1;
+
+	for (i = 0; i < n; i++) {
+		const struct disasm_instr *d = &instrs[i];
+		int lat = latency[d->cat];
+		int start = ctx->perf.cycle, depth = 0, pred = -1;
+		unsigned srcs[MAX_SRCS];
+		bool srcs_full[MAX_SRCS];
+		int nsrcs = 0;
+
+		stats->instructions++;
+		stats->cat[d->cat]++;
+		if ((d->cat == 0) && (d->opc == OPC_NOP))
+			stats->nops++;
+		if (d->flags & DISASM_INSTR_SY)
+			stats->sy++;
+		if (d->flags & DISASM_INSTR_SS)
+			stats->ss++;
+
+		/* we have to process the dst register after src to avoid
+		 * tripping up the read-before-write detection
+		 */
+		for (j = 0; j < d->nsrc; j++) {
+			const struct disasm_reg *src = &d->src[j];
+			bool full = !!(src->flags & DISASM_REG_FULL);
+			bool r = !!(src->flags & DISASM_REG_R);
+
+			if (src->flags & (DISASM_REG_RELATIV | DISASM_REG_IMMED))
+				continue;
+
+			for (k = 0; k <= d->repeat; k++) {
+				unsigned num = src->num + k;
+
+				if (src->flags & DISASM_REG_CONST) {
+					regmask_set(&ctx->regs.cnst, num, full, 1);
+				} else if (!is_special(src)) {
+					if (!regmask_get(&ctx->regs.used, num, full))
+						regmask_set(&ctx->regs.rbw, num, full, 1);
+
+					regmask_set(&ctx->regs.war, num, full, 0);
+					regmask_set(&ctx->regs.used, num, full, 1);
+
+					if (nsrcs < MAX_SRCS) {
+						srcs[nsrcs] = num;
+						srcs_full[nsrcs] = full;
+						nsrcs++;
+					}
+				}
+
+				if (!r)
+					break;
+			}
+		}
+
+		/* perf model: */
+		if (d->flags & DISASM_INSTR_SS) {
+			start = max(start, ctx->perf.pending_ss);
+			ctx->perf.pending_ss = 0;
+		}
+
+		if (d->flags & DISASM_INSTR_SY) {
+			start = max(start, ctx->perf.pending_sy);
+			ctx->perf.pending_sy = 0;
+		}
+
+		for (j = 0; j < nsrcs; j++) {
+			unsigned src = srcs[j];
+			bool full = srcs_full[j];
+
+			start = max(start, ctx->perf.ready[full][src]);
+
+			if (ctx->perf.depth[full][src] > depth) {
+				depth = ctx->perf.depth[full][src];
+				pred = ctx->perf.producer[full][src];
+			}
+		}
+
+		stats->stalls += start - ctx->perf.cycle;
+		ctx->perf.cycle = start + d->repeat + 1;
+		depth += lat;
+
+		ctx->perf.pred[i] = pred;
+
+		if (d->cat == 4) {
+			ctx->perf.pending_ss = max(ctx->perf.pending_ss,
+					start + d->repeat + lat);
+		} else if (d->cat >= 5) {
+			ctx->perf.pending_sy = max(ctx->perf.pending_sy,
+					start + d->repeat + lat);
+		}
+
+		if (d->ndst && !(d->dst.flags & DISASM_REG_RELATIV) &&
+				!is_special(&d->dst)) {
+			bool full = !!(d->dst.flags & DISASM_REG_FULL);
+
+			for (k = 0; k <= d->repeat; k++) {
+				unsigned dst = d->dst.num + k;
+
+				regmask_set(&ctx->regs.war, dst, full, 1);
+				regmask_set(&ctx->regs.used, dst, full, 1);
+
+				ctx->perf.ready[full][dst] = start + k + lat;
+				ctx->perf.depth[full][dst] = depth + k;
+				ctx->perf.producer[full][dst] = i;
+			}
+		}
+
+		if (depth > stats->critical) {
+			stats->critical = depth;
+			ctx->perf.critical_end = i;
+		}
+	}
+
+	stats->halfreg  = regs_footprint(&ctx->regs.used, false, NULL);
+	stats->fullreg  = regs_footprint(&ctx->regs.used, true, NULL);
+	hconst = regs_footprint(&ctx->regs.cnst, false, &hcnt);
+	fconst = regs_footprint(&ctx->regs.cnst, true, &fcnt);
+	stats->constlen = max(hconst, fconst);
+	stats->consts   = hcnt + fcnt;
+
+	/* the shader isn't done until outstanding results land: */
+	stats->cycles = max(ctx->perf.cycle,
+			max(ctx->perf.pending_ss, ctx->perf.pending_sy));
+	stats->cycles = max(stats->cycles, stats->critical);
+
+	regs = max(1, stats->fullreg + (stats->halfreg + 1) / 2);
+	stats->waves = min(MAX_WAVES, max(1, REGFILE_SIZE / regs));
+
+	if (out)
+		*out = *stats;
+}
+
+static void print_instr_name(struct disasm_a3xx_ctx *ctx,
+		const struct disasm_instr *d, unsigned repeatidx)
+{
+	if (d->name) {
+		printf("%s", d->name);
+		GETINFO(d->cat, d->opc)->print(ctx, d, repeatidx);
+	} else {
+		printf("unknown(%d,%d)", d->cat, d->opc);
+	}
+}
+
+static void print_instr(struct disasm_a3xx_ctx *ctx,
+		const struct disasm_instr *d, int level)
+{
+	int i;
+
+	printf("%s%04d[%08xx_%08xx] ", levels[level], d->addr,
+			d->dwords[1], d->dwords[0]);
 
 #if 0
 	/* print unknown bits: */
-	if (debug & PRINT_RAW)
-		printf("[%08xx_%08xx] ", dwords[1] & 0x001ff800, dwords[0] & 0x00000000);
+	if (ctx->debug & PRINT_RAW)
+		printf("[%08xx_%08xx] ", d->dwords[1] & 0x001ff800, d->dwords[0] & 0x00000000);
 
-	if (debug & PRINT_VERBOSE)
-		printf("%d,%02d ", instr->opc_cat, opc);
+	if (ctx->debug & PRINT_VERBOSE)
+		printf("%d,%02d ", d->cat, d->opc);
 #endif
 
 	/* NOTE: order flags are printed is a bit fugly.. but for now I
@@ -1047,68 +1493,65 @@ static bool print_instr(uint32_t *dwords, int level, int n)
 	 * diff'ing..
 	 */
 
-	if (instr->sync)
+	if (d->flags & DISASM_INSTR_SY)
 		printf("(sy)");
-	if (instr->ss && (instr->opc_cat <= 4))
+	if (d->flags & DISASM_INSTR_SS)
 		printf("(ss)");
-	if (instr->jmp_tgt)
+	if (d->flags & DISASM_INSTR_JP)
 		printf("(jp)");
-	if (instr->repeat && (instr->opc_cat <= 4)) {
-		printf("(rpt%d)", instr->repeat);
-		repeat = instr->repeat;
-	} else {
-		repeat = 0;
-	}
-	if (instr->ul && ((2 <= instr->opc_cat) && (instr->opc_cat <= 4)))
+	if (d->repeat)
+		printf("(rpt%d)", d->repeat);
+	if (d->flags & DISASM_INSTR_UL)
 		printf("(ul)");
 
-	name = GETINFO(instr)->name;
-
-	if (name) {
-		printf("%s", name);
-		GETINFO(instr)->print(instr);
-	} else {
-		printf("unknown(%d,%d)", instr->opc_cat, opc);
-	}
+	print_instr_name(ctx, d, 0);
 
 	printf("\n");
 
-	process_reg_dst();
-
-	if ((instr->opc_cat <= 4) && (debug & EXPAND_REPEAT)) {
-		int i;
-		for (i = 0; i < instr->repeat; i++) {
-			repeatidx = i + 1;
-			printf("%s%04d[                   ] ", levels[level], n);
-
-			if (name) {
-				printf("%s", name);
-				GETINFO(instr)->print(instr);
-			} else {
-				printf("unknown(%d,%d)", instr->opc_cat, opc);
-			}
-
+	if ((d->cat <= 4) && (ctx->debug & EXPAND_REPEAT)) {
+		for (i = 0; i < d->repeat; i++) {
+			printf("%s%04d[                   ] ", levels[level], d->addr);
+			print_instr_name(ctx, d, i + 1);
 			printf("\n");
 		}
-		repeatidx = 0;
 	}
+}
+
+void disasm_a3xx_print(struct disasm_a3xx_ctx *ctx,
+		const struct disasm_instr *instrs, int n, int level)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		print_instr(ctx, &instrs[i], level);
 
-	return (instr->opc_cat == 0) && (opc == OPC_END);
+	print_reg_stats(ctx, level);
+	print_perf_stats(ctx, level);
 }
 
+/* context used by the legacy (print-only) entry point: */
+static struct disasm_a3xx_ctx *legacy_ctx;
+
 int disasm_a3xx(uint32_t *dwords, int sizedwords, int level, enum shader_t type)
 {
-	bool end = false;
-	int i;
+	struct disasm_instr *instrs;
+	int n;
 
-//	assert((sizedwords % 2) == 0);
+	if (!legacy_ctx)
+		legacy_ctx = disasm_a3xx_ctx_new(debug);
+	if (!legacy_ctx)
+		return -1;
+	legacy_ctx->debug = debug;
 
-	memset(&regs, 0, sizeof(regs));
+	instrs = calloc(sizedwords / 2 + 1, sizeof(*instrs));
+	if (!instrs)
+		return -1;
 
-	for (i = 0; i < sizedwords && !end; i += 2)
-		end = print_instr(&dwords[i], level, i/2);
+	n = disasm_a3xx_decode(dwords, sizedwords, instrs, sizedwords / 2 + 1);
+	disasm_a3xx_analyze(legacy_ctx, instrs, n, NULL);
+	disasm_a3xx_print(legacy_ctx, instrs, n, level);
 
-	print_reg_stats(level);
+	free(instrs);
 
 	return 0;
 }
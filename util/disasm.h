@@ -37,8 +37,113 @@ enum debug_t {
 	EXPAND_REPEAT  = 0x4,
 };
 
+/* statistics gathered by disasm_a3xx_analyze(): */
+struct shader_stats {
+	int instructions;       /* # of instrs, up to and including end */
+	int cat[8];             /* # of instrs per category */
+	int nops;
+	int sy, ss;             /* # of (sy)/(ss) flags */
+	int halfreg, fullreg;   /* register footprint, in vec4 regs */
+	int constlen;           /* highest const used +1, in vec4 regs */
+	int consts;             /* # of const components used */
+
+	/* static perf model estimates (see disasm-a3xx.c): */
+	int cycles;             /* estimated cycles per invocation */
+	int stalls;             /* cycles spent waiting on (ss)/(sy)/deps */
+	int critical;           /* length of longest dependency chain */
+	int waves;              /* waves resident per core */
+};
+
+/*
+ * Decoded instructions:
+ *
+ * The decoders only fill in an array of these, without printing or
+ * touching any global state.  Printing and register statistics are
+ * consumers of the decoded array.
+ */
+
+enum disasm_reg_flags {
+	DISASM_REG_FULL    = 0x001,
+	DISASM_REG_R       = 0x002,    /* (r), src advances with (rptN) */
+	DISASM_REG_CONST   = 0x004,
+	DISASM_REG_IMMED   = 0x008,    /* immediate, in val */
+	DISASM_REG_FLOAT   = 0x010,    /* float immediate, raw bits in val */
+	DISASM_REG_NEG     = 0x020,
+	DISASM_REG_ABS     = 0x040,
+	DISASM_REG_RELATIV = 0x080,    /* relative to a0.x, offset in val */
+	DISASM_REG_EXPORT  = 0x100,    /* a2xx: dst is an export */
+};
+
+struct disasm_reg {
+	uint32_t flags;
+	uint32_t num;       /* a3xx: (4 * reg) + comp, a2xx: reg */
+	int32_t  val;
+	uint32_t swiz;      /* a2xx: src swizzle or dst write mask */
+};
+
+enum disasm_instr_flags {
+	DISASM_INSTR_SY    = 0x01,     /* a3xx: (sy), a2xx: (S) */
+	DISASM_INSTR_SS    = 0x02,
+	DISASM_INSTR_JP    = 0x04,
+	DISASM_INSTR_UL    = 0x08,
+	DISASM_INSTR_END   = 0x10,
+};
+
+/* a2xx instruction kinds, in disasm_instr::cat: */
+enum disasm_a2xx_kind {
+	DISASM_A2XX_CF,
+	DISASM_A2XX_ALU_VECTOR,
+	DISASM_A2XX_ALU_SCALAR,    /* co-issued with the preceding vector op */
+	DISASM_A2XX_FETCH,
+};
+
+#define DISASM_MAX_SRCS 3
+
+struct disasm_instr {
+	uint32_t dwords[3];     /* raw instruction (a3xx: 2, a2xx: 3 dwords) */
+	uint32_t addr;          /* instruction index in the shader */
+	uint16_t cat, opc;
+	const char *name;       /* NULL if unknown */
+	uint32_t flags;         /* enum disasm_instr_flags */
+	int repeat;
+	int ndst, nsrc;
+	struct disasm_reg dst;
+	struct disasm_reg src[DISASM_MAX_SRCS];
+};
+
 int disasm_a2xx(uint32_t *dwords, int sizedwords, int level, enum shader_t type);
 int disasm_a3xx(uint32_t *dwords, int sizedwords, int level, enum shader_t type);
 void disasm_set_debug(enum debug_t debug);
 
+/* returns the # of decoded instructions (at most max), or with a NULL
+ * instrs array the # of instructions there are to decode:
+ */
+int disasm_a2xx_decode(uint32_t *dwords, int sizedwords,
+		struct disasm_instr *instrs, int max);
+void disasm_a2xx_print(const struct disasm_instr *instrs, int n,
+		int level, enum shader_t type, enum debug_t debug);
+
+/* a3xx register tracking/perf model state, allocated by the caller, one
+ * per thread:
+ */
+struct disasm_a3xx_ctx;
+
+struct disasm_a3xx_ctx * disasm_a3xx_ctx_new(enum debug_t debug);
+void disasm_a3xx_ctx_free(struct disasm_a3xx_ctx *ctx);
+
+/* decode up to and including the end instruction, returns the # of
+ * decoded instructions (at most max):
+ */
+int disasm_a3xx_decode(uint32_t *dwords, int sizedwords,
+		struct disasm_instr *instrs, int max);
+/* size of a shader found in a buffer, up to and including the end
+ * instruction (or the whole buffer if there is none):
+ */
+int disasm_a3xx_sizedwords(uint32_t *dwords, int sizedwords);
+/* register usage and perf model, must be run before printing: */
+void disasm_a3xx_analyze(struct disasm_a3xx_ctx *ctx,
+		const struct disasm_instr *instrs, int n, struct shader_stats *stats);
+void disasm_a3xx_print(struct disasm_a3xx_ctx *ctx,
+		const struct disasm_instr *instrs, int n, int level);
+
 #endif /* DISASM_H_ */
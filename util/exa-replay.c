@@ -0,0 +1,268 @@
+/*
+ * Copyright © 2012 Rob Clark <robclark@freedesktop.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "exa-replay.h"
+
+/* each line of the log starts w/ a timestamp: */
+#define TIMESTAMP_LEN 13
+
+void exa_parser_init(struct exa_parser *p)
+{
+	memset(p, 0, sizeof(*p));
+	p->nentries = 256;
+	p->entries = calloc(p->nentries, sizeof(p->entries[0]));
+}
+
+void exa_parser_fini(struct exa_parser *p)
+{
+	free(p->entries);
+	p->entries = NULL;
+}
+
+static uint32_t hash(uint32_t ptr)
+{
+	/* pixmaps are at least 16 byte aligned: */
+	return (ptr >> 4) * 2654435761u;
+}
+
+static struct exa_pixmap_entry * find_entry(struct exa_parser *p, uint32_t ptr)
+{
+	uint32_t mask = p->nentries - 1;
+	uint32_t i = hash(ptr) & mask;
+
+	while (p->entries[i].used && (p->entries[i].ptr != ptr))
+		i = (i + 1) & mask;
+
+	return &p->entries[i];
+}
+
+static void grow(struct exa_parser *p)
+{
+	struct exa_pixmap_entry *old = p->entries;
+	uint32_t i, n = p->nentries;
+
+	p->nentries *= 2;
+	p->entries = calloc(p->nentries, sizeof(p->entries[0]));
+
+	for (i = 0; i < n; i++)
+		if (old[i].used)
+			*find_entry(p, old[i].ptr) = old[i];
+
+	free(old);
+}
+
+/* map the pixmap in a "EXA: SRC:"/"EXA: DST:" line to it's index,
+ * emitting a EXA_REPLAY_PIXMAP record if it is new or has changed size:
+ */
+static int parse_pixmap(struct exa_parser *p, const char *line,
+		struct exa_replay_op *ops, int *n, uint32_t *idx)
+{
+	struct exa_pixmap_entry *e;
+	uint32_t ptr, w, h, pitch, depth;
+
+	if (sscanf(line, "0x%x, %ux%u,%u,%u", &ptr, &w, &h, &pitch, &depth) != 5)
+		return -1;
+
+	e = find_entry(p, ptr);
+	if (!e->used) {
+		/* keep the load factor under 1/2: */
+		if ((p->npixmaps + 1) * 2 > p->nentries) {
+			grow(p);
+			e = find_entry(p, ptr);
+		}
+		e->used = true;
+		e->ptr  = ptr;
+		e->idx  = p->npixmaps++;
+	} else if ((e->width == w) && (e->height == h)) {
+		*idx = e->idx;
+		return 0;
+	}
+
+	e->width  = w;
+	e->height = h;
+
+	memset(&ops[*n], 0, sizeof(ops[*n]));
+	ops[*n].type = EXA_REPLAY_PIXMAP;
+	ops[*n].dst  = e->idx;
+	ops[*n].pixmap.width  = w;
+	ops[*n].pixmap.height = h;
+	ops[*n].pixmap.pitch  = pitch;
+	ops[*n].pixmap.depth  = depth;
+	(*n)++;
+
+	*idx = e->idx;
+
+	return 0;
+}
+
+/* parse one line of the text log (w/out the trailing newline), returning
+ * the number of records written to ops (at most EXA_PARSE_MAX_OPS), or
+ * -1 if the line isn't understood:
+ */
+int exa_parse_line(struct exa_parser *p, const char *line, int len,
+		struct exa_replay_op *ops)
+{
+	struct exa_replay_op *op = &p->pending;
+	char buf[256];
+	int n = 0;
+
+	if (len == 0)
+		return 0;
+
+	if (len <= TIMESTAMP_LEN)
+		return -1;
+
+	line += TIMESTAMP_LEN;
+	len  -= TIMESTAMP_LEN;
+
+	if (len >= sizeof(buf))
+		len = sizeof(buf) - 1;
+	memcpy(buf, line, len);
+	buf[len] = '\0';
+
+	if (p->need_pixmaps) {
+		uint32_t idx;
+
+		if (strncmp(buf, "EXA: SRC: ", 10) && strncmp(buf, "EXA: DST: ", 10))
+			return -1;
+
+		if (parse_pixmap(p, buf + 10, ops, &n, &idx))
+			return -1;
+
+		/* the first pixmap is the dst, the second (for copy) the src: */
+		if ((op->type == EXA_REPLAY_COPY) && (p->need_pixmaps == 1))
+			op->copy.src = idx;
+		else
+			op->dst = idx;
+
+		if (--p->need_pixmaps == 0)
+			ops[n++] = *op;
+
+		return n;
+	}
+
+	memset(op, 0, sizeof(*op));
+
+	if (!strncmp(buf, "EXA: SOLID:", 11)) {
+		int x1, y1, x2, y2;
+		uint32_t fill;
+
+		if (sscanf(buf, "EXA: SOLID: x1=%d\ty1=%d\tx2=%d\ty2=%d\tfill=%08x",
+				&x1, &y1, &x2, &y2, &fill) != 5)
+			return -1;
+
+		op->type = EXA_REPLAY_SOLID;
+		op->solid.x1 = x1;
+		op->solid.y1 = y1;
+		op->solid.x2 = x2;
+		op->solid.y2 = y2;
+		op->solid.fill = fill;
+		p->need_pixmaps = 1;
+	} else if (!strncmp(buf, "EXA: COPY:", 10)) {
+		int src_x, src_y, dst_x, dst_y, width, height;
+
+		if (sscanf(buf, "EXA: COPY: srcX=%d\tsrcY=%d\tdstX=%d\tdstY=%d\twidth=%d\theight=%d",
+				&src_x, &src_y, &dst_x, &dst_y, &width, &height) != 6)
+			return -1;
+
+		op->type = EXA_REPLAY_COPY;
+		op->copy.src_x  = src_x;
+		op->copy.src_y  = src_y;
+		op->copy.dst_x  = dst_x;
+		op->copy.dst_y  = dst_y;
+		op->copy.width  = width;
+		op->copy.height = height;
+		p->need_pixmaps = 2;
+	} else if (!strncmp(buf, "EXA: WAIT:", 10)) {
+		op->type = EXA_REPLAY_WAIT;
+		ops[n++] = *op;
+	} else if (!strncmp(buf, "FLUSH:", 6)) {
+		op->type = EXA_REPLAY_FLUSH;
+		ops[n++] = *op;
+	} else {
+		/* including COMPOSITE, which isn't supported yet */
+		return -1;
+	}
+
+	return n;
+}
+
+/* bucket index, the top bits of the value select the power of two, and
+ * the next EXA_HIST_SUB bits the linear sub-bucket within it:
+ */
+static unsigned bucket(uint64_t val)
+{
+	unsigned e = 0;
+
+	if (val < EXA_HIST_SUB)
+		return val;
+
+	while ((val >> e) >= (2 * EXA_HIST_SUB))
+		e++;
+
+	return ((e + 1) * EXA_HIST_SUB) + ((val >> e) - EXA_HIST_SUB);
+}
+
+/* the smallest value that would land in the bucket: */
+static uint64_t bucket_base(unsigned b)
+{
+	unsigned e;
+
+	if (b < EXA_HIST_SUB)
+		return b;
+
+	e = (b / EXA_HIST_SUB) - 1;
+
+	return (uint64_t)(EXA_HIST_SUB + (b % EXA_HIST_SUB)) << e;
+}
+
+void exa_histogram_add(struct exa_histogram *h, uint64_t val)
+{
+	h->buckets[bucket(val)]++;
+	h->count++;
+	h->total += val;
+	if (val > h->max)
+		h->max = val;
+}
+
+uint64_t exa_histogram_percentile(struct exa_histogram *h, double pct)
+{
+	uint64_t target = (uint64_t)(h->count * pct / 100.0);
+	uint64_t seen = 0;
+	unsigned b, nbuckets = sizeof(h->buckets) / sizeof(h->buckets[0]);
+
+	for (b = 0; b < nbuckets - 1; b++) {
+		seen += h->buckets[b];
+		if (seen > target) {
+			/* report the top of the bucket: */
+			uint64_t val = bucket_base(b + 1) - 1;
+			return (val < h->max) ? val : h->max;
+		}
+	}
+
+	return h->max;
+}
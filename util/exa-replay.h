@@ -0,0 +1,109 @@
+/*
+ * Copyright © 2012 Rob Clark <robclark@freedesktop.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef EXA_REPLAY_H_
+#define EXA_REPLAY_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Compact binary form of the EXA debug log from the xf86-video-freedreno
+ * DDX, as replayed by tests-2d/test-replay.  The file is a header followed
+ * by fixed size records, so it can be mmap'd and walked w/out parsing.
+ *
+ * Pixmaps are referred to by index rather than by the pixmap pointer in
+ * the log.  A EXA_REPLAY_PIXMAP record (re)defines the pixmap at an index
+ * before it is first used (or when the pointer gets reused for a pixmap
+ * of a different size).
+ */
+
+#define EXA_REPLAY_MAGIC   0x52415845   /* "EXAR" */
+#define EXA_REPLAY_VERSION 1
+
+struct exa_replay_header {
+	uint32_t magic;
+	uint32_t version;
+};
+
+enum exa_replay_type {
+	EXA_REPLAY_PIXMAP = 1,
+	EXA_REPLAY_SOLID,
+	EXA_REPLAY_COPY,
+	EXA_REPLAY_FLUSH,
+	EXA_REPLAY_WAIT,
+};
+
+struct exa_replay_op {
+	uint8_t type;
+	uint8_t pad[3];
+	uint32_t dst;              /* pixmap index */
+	union {
+		struct {
+			uint32_t width, height, pitch, depth;
+		} pixmap;
+		struct {
+			int16_t x1, y1, x2, y2;
+			uint32_t fill;
+		} solid;
+		struct {
+			uint32_t src;      /* pixmap index */
+			int16_t src_x, src_y, dst_x, dst_y, width, height;
+		} copy;
+	};
+};
+
+/* max # of records a single line of the text log can turn into: */
+#define EXA_PARSE_MAX_OPS 3
+
+struct exa_parser {
+	/* open addressed hashtable of pixmap pointers seen in the log: */
+	struct exa_pixmap_entry {
+		uint32_t ptr, idx;
+		uint32_t width, height;
+		bool used;
+	} *entries;
+	uint32_t nentries, npixmaps;
+
+	/* the SOLID/COPY op waiting for it's DST:/SRC: lines: */
+	struct exa_replay_op pending;
+	int need_pixmaps;
+};
+
+void exa_parser_init(struct exa_parser *p);
+void exa_parser_fini(struct exa_parser *p);
+int exa_parse_line(struct exa_parser *p, const char *line, int len,
+		struct exa_replay_op *ops);
+
+/* log2 bucketed histogram, for latency percentiles of long replays
+ * w/out keeping every sample around:
+ */
+#define EXA_HIST_SUB 8
+struct exa_histogram {
+	uint64_t count, total, max;
+	uint32_t buckets[64 * EXA_HIST_SUB];
+};
+
+void exa_histogram_add(struct exa_histogram *h, uint64_t val);
+uint64_t exa_histogram_percentile(struct exa_histogram *h, double pct);
+
+#endif /* EXA_REPLAY_H_ */
@@ -0,0 +1,118 @@
+/*
+ * Copyright © 2012 Rob Clark <robclark@freedesktop.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* convert the text EXA log from the DDX into the binary format replayed
+ * by tests-2d/test-replay, ie:
+ *
+ *   exaconv replay.txt replay.bin
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <string.h>
+
+#include "exa-replay.h"
+
+int main(int argc, char **argv)
+{
+	struct exa_replay_header hdr = {
+			.magic   = EXA_REPLAY_MAGIC,
+			.version = EXA_REPLAY_VERSION,
+	};
+	struct exa_parser p;
+	const char *buf, *line, *end;
+	uint64_t nlines = 0, nops = 0;
+	struct stat st;
+	FILE *out;
+	int fd;
+
+	if (argc != 3) {
+		fprintf(stderr, "usage: %s replay.txt replay.bin\n", argv[0]);
+		return -1;
+	}
+
+	fd = open(argv[1], O_RDONLY);
+	if ((fd < 0) || fstat(fd, &st)) {
+		fprintf(stderr, "could not open: %s\n", argv[1]);
+		return -1;
+	}
+
+	buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (buf == MAP_FAILED) {
+		fprintf(stderr, "could not mmap: %s\n", argv[1]);
+		return -1;
+	}
+
+	madvise((void *)buf, st.st_size, MADV_SEQUENTIAL);
+
+	out = fopen(argv[2], "w");
+	if (!out) {
+		fprintf(stderr, "could not open: %s\n", argv[2]);
+		return -1;
+	}
+
+	fwrite(&hdr, sizeof(hdr), 1, out);
+
+	exa_parser_init(&p);
+
+	for (line = buf, end = buf + st.st_size; line < end; ) {
+		struct exa_replay_op ops[EXA_PARSE_MAX_OPS];
+		const char *eol = memchr(line, '\n', end - line);
+		int n;
+
+		if (!eol)
+			eol = end;
+
+		nlines++;
+
+		n = exa_parse_line(&p, line, eol - line, ops);
+		if (n < 0) {
+			fprintf(stderr, "%llu: unexpected line: %.*s\n",
+					(unsigned long long)nlines, (int)(eol - line), line);
+			return -1;
+		}
+
+		fwrite(ops, sizeof(ops[0]), n, out);
+		nops += n;
+
+		line = eol + 1;
+	}
+
+	fclose(out);
+
+	printf("%llu lines, %llu records, %u pixmaps\n",
+			(unsigned long long)nlines, (unsigned long long)nops,
+			p.npixmaps);
+
+	exa_parser_fini(&p);
+	munmap((void *)buf, st.st_size);
+	close(fd);
+
+	return 0;
+}
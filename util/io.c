@@ -35,10 +35,12 @@
 #include <archive_entry.h>
 
 #include "io.h"
+#include "chunkstore.h"
 
 struct io {
 	struct archive *a;
 	struct archive_entry *entry;
+	struct rdpack *pack;        /* for captures repacked by rdpack */
 	unsigned offset;
 };
 
@@ -84,11 +86,31 @@ static struct io * io_new(void)
 	return io;
 }
 
+static struct io * io_open_pack(const char *filename)
+{
+	struct io *io = calloc(1, sizeof(*io));
+
+	if (!io)
+		return NULL;
+
+	io->pack = rdpack_open(filename);
+	if (!io->pack) {
+		free(io);
+		return NULL;
+	}
+
+	return io;
+}
+
 struct io * io_open(const char *filename)
 {
-	struct io *io = io_new();
+	struct io *io;
 	int ret;
 
+	if (rdpack_check(filename))
+		return io_open_pack(filename);
+
+	io = io_new();
 	if (!io)
 		return NULL;
 
@@ -132,7 +154,10 @@ struct io * io_openfd(int fd)
 
 void io_close(struct io *io)
 {
-	archive_read_free(io->a);
+	if (io->pack)
+		rdpack_close(io->pack);
+	else
+		archive_read_free(io->a);
 	free(io);
 }
 
@@ -141,11 +166,16 @@ unsigned io_offset(struct io *io)
 	return io->offset;
 }
 
-#include <assert.h>
 int io_readn(struct io *io, void *buf, int nbytes)
 {
 	char *ptr = buf;
 	int ret = 0;
+	if (io->pack) {
+		ret = rdpack_read(io->pack, buf, nbytes);
+		if (ret > 0)
+			io->offset += ret;
+		return ret;
+	}
 	while (nbytes > 0) {
 		int n = archive_read_data(io->a, ptr, nbytes);
 		if (n < 0) {
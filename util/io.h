@@ -29,8 +29,9 @@
 #ifndef IO_H_
 #define IO_H_
 
-/* Simple API to abstract reading from file which might be compressed.
- * Maybe someday I'll add writing..
+/* Simple API to abstract reading from file which might be compressed,
+ * or repacked into a chunk store by rdpack.  Maybe someday I'll add
+ * writing..
  */
 
 struct io;
@@ -29,10 +29,13 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <string.h>
+#include <poll.h>
+#include <sys/wait.h>
 
 #include "redump.h"
 #include "disasm.h"
 #include "io.h"
+#include "chunkstore.h"
 
 struct pgm_header {
 	uint32_t size;
@@ -246,6 +249,78 @@ static int full_dump = 1;
 static int dump_shaders = 0;
 static int gpu_id;
 
+/*
+ * Batch mode: each input file is processed in a child process, which
+ * sends a row of stats per disassembled (a3xx) shader back to the
+ * parent over a pipe.  The parent collects the rows and prints them
+ * as a CSV or JSON table once all files are done.
+ */
+struct shader_row {
+	int file, program, seq;
+	char shader[8];
+	struct shader_stats stats;
+	uint64_t hash;
+};
+
+static int stats_fd = -1;    /* write end of the pipe, in the child */
+static int stats_file;       /* index of the file being processed */
+static int stats_program;    /* index of the program within the file */
+static int stats_seq;
+
+/* FNV-1a hash of the instructions, for finding duplicate shaders: */
+static uint64_t hash_shader(uint32_t *dwords, int sizedwords)
+{
+	uint8_t *ptr = (uint8_t *)dwords;
+	uint64_t hash = 0xcbf29ce484222325ull;
+	int i;
+
+	for (i = 0; i < sizedwords * 4; i++) {
+		hash ^= ptr[i];
+		hash *= 0x100000001b3ull;
+	}
+
+	return hash;
+}
+
+/* disassemble an a3xx shader, or in batch mode just decode it and send
+ * its stats to the parent:
+ */
+static int disasm_a3xx_shader(const char *name, int n, uint32_t *dwords,
+		int sizedwords, int level, enum shader_t type)
+{
+	static struct disasm_a3xx_ctx *ctx;
+	struct disasm_instr *instrs;
+	struct shader_row row = {
+			.file = stats_file,
+			.program = stats_program,
+			.seq = stats_seq++,
+	};
+	int ninstrs;
+
+	if (stats_fd < 0)
+		return disasm_a3xx(dwords, sizedwords, level, type);
+
+	if (!ctx)
+		ctx = disasm_a3xx_ctx_new(0);
+
+	instrs = calloc(sizedwords / 2 + 1, sizeof(*instrs));
+	if (!ctx || !instrs)
+		exit(1);
+
+	ninstrs = disasm_a3xx_decode(dwords, sizedwords, instrs, sizedwords / 2 + 1);
+	disasm_a3xx_analyze(ctx, instrs, ninstrs, &row.stats);
+	free(instrs);
+
+	snprintf(row.shader, sizeof(row.shader), "%s%d", name, n);
+	row.hash = hash_shader(dwords, min(sizedwords, ninstrs * 2));
+
+	/* rows are smaller than PIPE_BUF, so the write is atomic: */
+	if (write(stats_fd, &row, sizeof(row)) != sizeof(row))
+		exit(1);
+
+	return 0;
+}
+
 char *find_sect_end(char *buf, int sz)
 {
 	uint8_t *ptr = (uint8_t *)buf;
@@ -732,7 +807,8 @@ printf("hdr_size=%d\n", hdr_size);
 			instrs_size -= 32;
 		}
 
-		disasm_a3xx((uint32_t *)instrs, instrs_size / 4, level+1, SHADER_VERTEX);
+		disasm_a3xx_shader("vs", i, (uint32_t *)instrs, instrs_size / 4,
+				level+1, SHADER_VERTEX);
 		dump_raw_shader((uint32_t *)instrs, instrs_size / 4, i, "vo3");
 		free(vs_hdr);
 	}
@@ -811,7 +887,8 @@ printf("hdr_size=%d\n", hdr_size);
 				instrs_size -= 32;
 			}
 		}
-		disasm_a3xx((uint32_t *)instrs, instrs_size / 4, level+1, SHADER_FRAGMENT);
+		disasm_a3xx_shader("fs", i, (uint32_t *)instrs, instrs_size / 4,
+				level+1, SHADER_FRAGMENT);
 		dump_raw_shader((uint32_t *)instrs, instrs_size / 4, i, "fo3");
 		free(fs_hdr);
 	}
@@ -1035,66 +1112,14 @@ void dump_program(struct state *state)
 		free (state->uniformblocks[i].members);
 }
 
-int main(int argc, char **argv)
+static int process(const char *filename, int raw_program)
 {
 	enum rd_sect_type type = RD_NONE;
-	enum debug_t debug = 0;
 	void *buf = NULL;
-	int sz, i;
 	struct io *io;
-	int raw_program = 0;
-
-	/* lame argument parsing: */
-
-	while (1) {
-		if ((argc > 1) && !strcmp(argv[1], "--verbose")) {
-			debug |= PRINT_RAW | PRINT_VERBOSE;
-			argv++;
-			argc--;
-			continue;
-		}
-		if ((argc > 1) && !strcmp(argv[1], "--expand")) {
-			debug |= EXPAND_REPEAT;
-			argv++;
-			argc--;
-			continue;
-		}
-		if ((argc > 1) && !strcmp(argv[1], "--short")) {
-			/* only short dump, original shader, symbol table, and disassembly */
-			full_dump = 0;
-			argv++;
-			argc--;
-			continue;
-		}
-		if ((argc > 1) && !strcmp(argv[1], "--dump-shaders")) {
-			dump_shaders = 1;
-			argv++;
-			argc--;
-			continue;
-		}
-		if ((argc > 1) && !strcmp(argv[1], "--raw")) {
-			raw_program = 1;
-			argv++;
-			argc--;
-			continue;
-		}
-		if ((argc > 1) && !strcmp(argv[1], "--gpu300")) {
-			gpu_id = 320;
-			argv++;
-			argc--;
-			continue;
-		}
-		break;
-	}
-
-	if (argc != 2) {
-		fprintf(stderr, "usage: pgmdump [--verbose] [--short] [--dump-shaders] testlog.rd\n");
-		return -1;
-	}
-
-	disasm_set_debug(debug);
+	int sz;
 
-	infile = argv[1];
+	infile = filename;
 
 	io = io_open(infile);
 	if (!io) {
@@ -1122,13 +1147,16 @@ int main(int argc, char **argv)
 		printf("program:\n");
 		dump_program(&state);
 		printf("############################################################\n");
+		io_close(io);
 		return 0;
 	}
 
 	/* figure out what sort of input we are dealing with: */
-	if (!(check_extension(infile, ".rd") || check_extension(infile, ".rd.gz"))) {
+	if (!(check_extension(infile, ".rd") || check_extension(infile, ".rd.gz") ||
+			rdpack_check(infile))) {
 		int (*disasm)(uint32_t *dwords, int sizedwords, int level, enum shader_t type);
 		enum shader_t shader = 0;
+		const char *name = NULL;
 		int ret;
 		if (check_extension(infile, ".vo")) {
 			disasm = disasm_a2xx;
@@ -1139,23 +1167,34 @@ int main(int argc, char **argv)
 		} else if (check_extension(infile, ".vo3")) {
 			disasm = disasm_a3xx;
 			shader = SHADER_VERTEX;
+			name = "vs";
 		} else if (check_extension(infile, ".fo3")) {
 			disasm = disasm_a3xx;
 			shader = SHADER_FRAGMENT;
+			name = "fs";
 		} else if (check_extension(infile, ".co3")) {
 			disasm = disasm_a3xx;
 			shader = SHADER_COMPUTE;
+			name = "cs";
 		} else {
 			fprintf(stderr, "invalid input file: %s\n", infile);
+			io_close(io);
 			return -1;
 		}
 		buf = calloc(1, 100 * 1024);
 		ret = io_readn(io, buf, 100 * 1024);
+		io_close(io);
 		if (ret < 0) {
 			fprintf(stderr, "error: %m");
+			free(buf);
 			return -1;
 		}
-		return disasm(buf, ret/4, 0, shader);
+		if (name)
+			ret = disasm_a3xx_shader(name, 0, buf, ret/4, 0, shader);
+		else
+			ret = disasm(buf, ret/4, 0, shader);
+		free(buf);
+		return ret;
 	}
 
 	while ((io_readn(io, &type, sizeof(type)) > 0) && (io_readn(io, &sz, 4) > 0)) {
@@ -1187,6 +1226,7 @@ int main(int argc, char **argv)
 			printf("program:\n");
 			dump_program(&state);
 			printf("############################################################\n");
+			stats_program++;
 			break;
 		}
 		case RD_GPU_ID:
@@ -1196,8 +1236,295 @@ int main(int argc, char **argv)
 		}
 	}
 
+	free(buf);
 	io_close(io);
 
 	return 0;
 }
 
+static int rank;
+
+static int row_cmp(const void *a, const void *b)
+{
+	const struct shader_row *ra = a, *rb = b;
+	/* most expensive shaders first: */
+	if (rank && (ra->stats.cycles != rb->stats.cycles))
+		return rb->stats.cycles - ra->stats.cycles;
+	if (ra->file != rb->file)
+		return ra->file - rb->file;
+	return ra->seq - rb->seq;
+}
+
+/* print a string as a json string literal: */
+static void print_json_str(const char *str)
+{
+	putchar('"');
+	for (; *str; str++) {
+		if ((*str == '"') || (*str == '\\'))
+			printf("\\%c", *str);
+		else if ((unsigned char)*str < 0x20)
+			printf("\\u%04x", *str);
+		else
+			putchar(*str);
+	}
+	putchar('"');
+}
+
+static void print_rows(char **files, struct shader_row *rows, int nrows, int json)
+{
+	/* open-addressed set of already seen hashes, for dedupe: */
+	int i, j, nhash = 1, unique = 0;
+	uint64_t *hashes;
+
+	while (nhash < 2 * nrows)
+		nhash <<= 1;
+	hashes = calloc(nhash, sizeof(hashes[0]));
+
+	if (json)
+		printf("[\n");
+	else
+		printf("file,program,shader,instrs,cat0,cat1,cat2,cat3,cat4,cat5,cat6,"
+				"nops,sy,ss,halfregs,fullregs,constlen,consts,"
+				"cycles,stalls,critical,waves,hash,dup\n");
+
+	for (i = 0; i < nrows; i++) {
+		struct shader_row *row = &rows[i];
+		struct shader_stats *st = &row->stats;
+		uint64_t h = row->hash ? row->hash : 1;
+		int dup = 0;
+
+		for (j = h & (nhash - 1); hashes[j]; j = (j + 1) & (nhash - 1)) {
+			if (hashes[j] == h) {
+				dup = 1;
+				break;
+			}
+		}
+		if (!dup) {
+			hashes[j] = h;
+			unique++;
+		}
+
+		if (json) {
+			printf("  {\"file\": ");
+			print_json_str(files[row->file]);
+			printf(", \"program\": %d, \"shader\": \"%s\", "
+					"\"instrs\": %d, \"cat\": [%d, %d, %d, %d, %d, %d, %d], "
+					"\"nops\": %d, \"sy\": %d, \"ss\": %d, "
+					"\"halfregs\": %d, \"fullregs\": %d, "
+					"\"constlen\": %d, \"consts\": %d, "
+					"\"cycles\": %d, \"stalls\": %d, "
+					"\"critical\": %d, \"waves\": %d, "
+					"\"hash\": \"%016llx\", \"dup\": %s}%s\n",
+					row->program, row->shader,
+					st->instructions, st->cat[0], st->cat[1], st->cat[2],
+					st->cat[3], st->cat[4], st->cat[5], st->cat[6],
+					st->nops, st->sy, st->ss, st->halfreg, st->fullreg,
+					st->constlen, st->consts, st->cycles, st->stalls,
+					st->critical, st->waves, (unsigned long long)row->hash,
+					dup ? "true" : "false", (i == nrows - 1) ? "" : ",");
+		} else {
+			printf("%s,%d,%s,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,"
+					"%d,%d,%d,%d,%016llx,%d\n",
+					files[row->file], row->program, row->shader,
+					st->instructions, st->cat[0], st->cat[1], st->cat[2],
+					st->cat[3], st->cat[4], st->cat[5], st->cat[6],
+					st->nops, st->sy, st->ss, st->halfreg, st->fullreg,
+					st->constlen, st->consts, st->cycles, st->stalls,
+					st->critical, st->waves, (unsigned long long)row->hash,
+					dup);
+		}
+	}
+
+	if (json)
+		printf("]\n");
+
+	fprintf(stderr, "%d shaders, %d unique\n", nrows, unique);
+
+	free(hashes);
+}
+
+/* process files in parallel, up to 'jobs' child processes at a time: */
+static int batch(char **files, int nfiles, int jobs, int raw_program, int json)
+{
+	struct shader_row *rows = NULL;
+	int nrows = 0, maxrows = 0, failed = 0, next = 0, running = 0;
+	struct pollfd *fds = calloc(jobs, sizeof(*fds));
+	pid_t *pids = calloc(jobs, sizeof(*pids));
+	int *idx = calloc(jobs, sizeof(*idx));
+	int i;
+
+	fflush(stdout);
+
+	while ((next < nfiles) || running) {
+		/* start more children: */
+		while ((next < nfiles) && (running < jobs)) {
+			int p[2];
+
+			if (pipe(p)) {
+				fprintf(stderr, "pipe failed: %m\n");
+				return -1;
+			}
+
+			pids[running] = fork();
+			if (pids[running] < 0) {
+				fprintf(stderr, "fork failed: %m\n");
+				return -1;
+			}
+
+			if (pids[running] == 0) {
+				int null = open("/dev/null", O_WRONLY);
+				close(p[0]);
+				dup2(null, STDOUT_FILENO);
+				stats_fd = p[1];
+				stats_file = next;
+				_exit(process(files[next], raw_program) ? 1 : 0);
+			}
+
+			close(p[1]);
+			fds[running].fd = p[0];
+			fds[running].events = POLLIN;
+			idx[running] = next;
+			running++;
+			next++;
+		}
+
+		if (poll(fds, running, -1) < 0)
+			continue;
+
+		for (i = 0; i < running; i++) {
+			struct shader_row row;
+			int ret, status;
+
+			if (!fds[i].revents)
+				continue;
+
+			ret = read(fds[i].fd, &row, sizeof(row));
+			if (ret == sizeof(row)) {
+				if (nrows == maxrows) {
+					maxrows = max(64, 2 * maxrows);
+					rows = realloc(rows, maxrows * sizeof(rows[0]));
+				}
+				rows[nrows++] = row;
+				continue;
+			}
+
+			/* EOF, child is done: */
+			close(fds[i].fd);
+			waitpid(pids[i], &status, 0);
+			if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+				fprintf(stderr, "failed: %s\n", files[idx[i]]);
+				failed++;
+			}
+
+			running--;
+			fds[i] = fds[running];
+			pids[i] = pids[running];
+			idx[i] = idx[running];
+			i--;
+		}
+	}
+
+	qsort(rows, nrows, sizeof(rows[0]), row_cmp);
+	print_rows(files, rows, nrows, json);
+
+	if (failed)
+		fprintf(stderr, "%d of %d files failed\n", failed, nfiles);
+
+	free(rows);
+	free(fds);
+	free(pids);
+	free(idx);
+
+	return failed ? -1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+	enum debug_t debug = 0;
+	int raw_program = 0, batch_mode = 0, json = 0;
+	int jobs = sysconf(_SC_NPROCESSORS_ONLN);
+
+	/* lame argument parsing: */
+
+	while (1) {
+		if ((argc > 1) && !strcmp(argv[1], "--verbose")) {
+			debug |= PRINT_RAW | PRINT_VERBOSE;
+			argv++;
+			argc--;
+			continue;
+		}
+		if ((argc > 1) && !strcmp(argv[1], "--expand")) {
+			debug |= EXPAND_REPEAT;
+			argv++;
+			argc--;
+			continue;
+		}
+		if ((argc > 1) && !strcmp(argv[1], "--short")) {
+			/* only short dump, original shader, symbol table, and disassembly */
+			full_dump = 0;
+			argv++;
+			argc--;
+			continue;
+		}
+		if ((argc > 1) && !strcmp(argv[1], "--dump-shaders")) {
+			dump_shaders = 1;
+			argv++;
+			argc--;
+			continue;
+		}
+		if ((argc > 1) && !strcmp(argv[1], "--raw")) {
+			raw_program = 1;
+			argv++;
+			argc--;
+			continue;
+		}
+		if ((argc > 1) && !strcmp(argv[1], "--gpu300")) {
+			gpu_id = 320;
+			argv++;
+			argc--;
+			continue;
+		}
+		if ((argc > 1) && !strcmp(argv[1], "--batch")) {
+			/* per-shader stats table (csv) for all input files */
+			batch_mode = 1;
+			argv++;
+			argc--;
+			continue;
+		}
+		if ((argc > 1) && !strcmp(argv[1], "--json")) {
+			batch_mode = 1;
+			json = 1;
+			argv++;
+			argc--;
+			continue;
+		}
+		if ((argc > 1) && !strcmp(argv[1], "--rank")) {
+			/* sort the batch table by estimated cycles */
+			batch_mode = 1;
+			rank = 1;
+			argv++;
+			argc--;
+			continue;
+		}
+		if ((argc > 2) && !strcmp(argv[1], "--jobs")) {
+			jobs = max(1, atoi(argv[2]));
+			argv += 2;
+			argc -= 2;
+			continue;
+		}
+		break;
+	}
+
+	if ((argc < 2) || (!batch_mode && (argc != 2))) {
+		fprintf(stderr, "usage: pgmdump [--verbose] [--short] [--dump-shaders] testlog.rd\n");
+		fprintf(stderr, "       pgmdump --batch|--json [--rank] [--jobs N] file.rd|file.vo3|file.fo3...\n");
+		return -1;
+	}
+
+	disasm_set_debug(debug);
+
+	if (batch_mode)
+		return batch(&argv[1], argc - 1, max(jobs, 1), raw_program, json);
+
+	return process(argv[1], raw_program);
+}
@@ -0,0 +1,353 @@
+/* -*- mode: C; c-file-style: "k&r"; tab-width 4; indent-tabs-mode: t; -*- */
+
+/*
+ * Copyright (C) 2014 Rob Clark <robclark@freedesktop.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Authors:
+ *    Rob Clark <robclark@freedesktop.org>
+ */
+
+/* Repack .rd captures into a shared content addressed chunk store (see
+ * chunkstore.h), leaving behind a small manifest which io_open() reads
+ * transparently, so cffdump/pgmdump/redump work on repacked captures
+ * unmodified.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "redump.h"
+#include "io.h"
+#include "chunkstore.h"
+
+static struct {
+	FILE *out;
+
+	/* pending literal bytes, merged into a single record: */
+	uint8_t *lit;
+	uint32_t nlit, maxlit;
+
+	/* stats: */
+	uint64_t insize, newsize;
+	int nchunks, nnew;
+} m;
+
+static void flush_literal(void)
+{
+	struct rdpack_record rec = {
+			.type = RDPACK_LITERAL,
+			.len = m.nlit,
+	};
+
+	if (!m.nlit)
+		return;
+
+	fwrite(&rec, sizeof(rec), 1, m.out);
+	fwrite(m.lit, m.nlit, 1, m.out);
+	m.nlit = 0;
+}
+
+static void add_literal(const void *buf, uint32_t len)
+{
+	if ((m.nlit + len) > m.maxlit) {
+		m.maxlit = max(m.maxlit * 2, m.nlit + len);
+		m.lit = realloc(m.lit, m.maxlit);
+	}
+	memcpy(m.lit + m.nlit, buf, len);
+	m.nlit += len;
+}
+
+static int add_chunks(const char *store, const uint8_t *buf, uint32_t len)
+{
+	uint32_t off = 0;
+
+	flush_literal();
+
+	while (off < len) {
+		uint32_t n = chunk_next(buf + off, len - off);
+		uint8_t hash[CHUNK_HASH_SIZE];
+		struct rdpack_record rec = {
+				.type = RDPACK_CHUNK,
+				.len = n,
+		};
+		int ret = chunk_put(store, buf + off, n, hash);
+
+		if (ret < 0)
+			return -1;
+
+		if (ret) {
+			m.nnew++;
+			m.newsize += n;
+		}
+		m.nchunks++;
+
+		fwrite(&rec, sizeof(rec), 1, m.out);
+		fwrite(hash, sizeof(hash), 1, m.out);
+
+		off += n;
+	}
+
+	return 0;
+}
+
+static int pack(const char *infile, const char *outfile, const char *store)
+{
+	struct rdpack_header hdr = {
+			.magic = RDPACK_MAGIC,
+			.version = RDPACK_VERSION,
+			.storelen = strlen(store),
+	};
+	struct io *io;
+	void *buf = NULL;
+	int ret = 0;
+
+	io = io_open(infile);
+	if (!io) {
+		fprintf(stderr, "could not open: %s\n", infile);
+		return -1;
+	}
+
+	m.out = fopen(outfile, "w");
+	if (!m.out) {
+		fprintf(stderr, "could not open: %s: %m\n", outfile);
+		io_close(io);
+		return -1;
+	}
+
+	m.insize = m.newsize = 0;
+	m.nchunks = m.nnew = 0;
+
+	fwrite(&hdr, sizeof(hdr), 1, m.out);
+	fwrite(store, hdr.storelen, 1, m.out);
+
+	/* everything but the contents of buffers is kept as-is, so that the
+	 * manifest reads back exactly as the original:
+	 */
+	while (true) {
+		uint32_t arr[2];
+		int n;
+
+		n = io_readn(io, arr, 8);
+		if (n <= 0) {
+			ret = n;
+			break;
+		}
+
+		add_literal(arr, n);
+		m.insize += n;
+
+		if (n < 8)
+			break;
+
+		/* sync marker: */
+		if ((arr[0] == 0xffffffff) && (arr[1] == 0xffffffff))
+			continue;
+
+		free(buf);
+		buf = malloc(arr[1]);
+
+		n = io_readn(io, buf, arr[1]);
+		if (n < 0) {
+			ret = n;
+			break;
+		}
+
+		m.insize += n;
+
+		if (arr[0] == RD_BUFFER_CONTENTS) {
+			ret = add_chunks(store, buf, n);
+			if (ret)
+				break;
+		} else {
+			add_literal(buf, n);
+		}
+
+		if (n < arr[1])
+			break;
+	}
+
+	flush_literal();
+
+	free(buf);
+	io_close(io);
+
+	if (fclose(m.out)) {
+		fprintf(stderr, "error writing: %s: %m\n", outfile);
+		ret = -1;
+	}
+
+	return ret;
+}
+
+/* check that the manifest reads back the same as the original: */
+static int verify(const char *infile, const char *outfile)
+{
+	static char a[64 * 1024], b[64 * 1024];
+	struct io *ia = io_open(infile);
+	struct io *ib = io_open(outfile);
+	int ret = -1;
+
+	while (ia && ib) {
+		int na = io_readn(ia, a, sizeof(a));
+		int nb = io_readn(ib, b, sizeof(b));
+
+		if ((na < 0) || (na != nb) || memcmp(a, b, na))
+			break;
+
+		if (na == 0) {
+			ret = 0;
+			break;
+		}
+	}
+
+	if (ia)
+		io_close(ia);
+	if (ib)
+		io_close(ib);
+
+	if (ret)
+		fprintf(stderr, "verify failed: %s\n", outfile);
+
+	return ret;
+}
+
+static char * default_outfile(const char *infile)
+{
+	char *outfile = malloc(strlen(infile) + 5);
+
+	strcpy(outfile, infile);
+
+	if (check_extension(outfile, ".gz"))
+		outfile[strlen(outfile) - 3] = '\0';
+	if (check_extension(outfile, ".rd"))
+		outfile[strlen(outfile) - 3] = '\0';
+
+	strcat(outfile, ".rdp");
+
+	return outfile;
+}
+
+static void print_usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [OPTIONS]... FILE...\n", name);
+	fprintf(stderr, "Options:\n");
+	fprintf(stderr, "    --store DIR     - chunk store to add to (default $RDPACK_STORE)\n");
+	fprintf(stderr, "    --output FILE   - manifest to write, for a single FILE (default\n");
+	fprintf(stderr, "                      is FILE w/ .rd replaced by .rdp)\n");
+	fprintf(stderr, "    --replace       - replace each FILE with it's manifest, once it\n");
+	fprintf(stderr, "                      has been verified to read back the same\n");
+	fprintf(stderr, "    --help          - show this message\n");
+}
+
+int main(int argc, char **argv)
+{
+	const char *store = getenv("RDPACK_STORE");
+	const char *output = NULL;
+	bool replace = false;
+	char storepath[PATH_MAX];
+	int n = 1, ret = 0;
+
+	while (n < argc) {
+		if (!strcmp(argv[n], "--store") && ((n + 1) < argc)) {
+			store = argv[n + 1];
+			n += 2;
+			continue;
+		}
+
+		if (!strcmp(argv[n], "--output") && ((n + 1) < argc)) {
+			output = argv[n + 1];
+			n += 2;
+			continue;
+		}
+
+		if (!strcmp(argv[n], "--replace")) {
+			replace = true;
+			n++;
+			continue;
+		}
+
+		if (!strcmp(argv[n], "--help")) {
+			print_usage(argv[0]);
+			return 0;
+		}
+
+		break;
+	}
+
+	if ((n >= argc) || !store || (output && (replace || ((n + 1) != argc)))) {
+		print_usage(argv[0]);
+		return 1;
+	}
+
+	/* the store path is recorded in the manifests, so make it absolute
+	 * so they can be read from anywhere:
+	 */
+	if ((mkdir(store, 0755) && (errno != EEXIST)) ||
+			!realpath(store, storepath)) {
+		fprintf(stderr, "could not create store: %s: %m\n", store);
+		return 1;
+	}
+
+	for (; n < argc; n++) {
+		const char *infile = argv[n];
+		char *outfile;
+
+		if (rdpack_check(infile)) {
+			fprintf(stderr, "%s: already repacked\n", infile);
+			continue;
+		}
+
+		if (replace) {
+			outfile = malloc(strlen(infile) + 5);
+			sprintf(outfile, "%s.tmp", infile);
+		} else if (output) {
+			outfile = strdup(output);
+		} else {
+			outfile = default_outfile(infile);
+		}
+
+		if (pack(infile, outfile, storepath) ||
+				(replace && (verify(infile, outfile) ||
+						rename(outfile, infile)))) {
+			fprintf(stderr, "%s: failed\n", infile);
+			unlink(outfile);
+			free(outfile);
+			ret = 1;
+			continue;
+		}
+
+		printf("%s: %llu bytes, %d chunks, %d new (%llu bytes)\n", infile,
+				(unsigned long long)m.insize, m.nchunks, m.nnew,
+				(unsigned long long)m.newsize);
+
+		free(outfile);
+	}
+
+	return ret;
+}
@@ -31,6 +31,7 @@
 #include <string.h>
 
 #include "redump.h"
+#include "io.h"
 
 static const uint32_t patterns[] = {
 		/* these should be ordered by most inclusive pattern, ie. most 'f's */
@@ -124,7 +125,7 @@ struct param {
 };
 
 struct context {
-	int       fd;
+	struct io *io;
 	uint32_t *buf;           /* current row buffer */
 	int       sz;            /* current row buffer size */
 	uint32_t  gpuaddrs[32];
@@ -441,8 +442,8 @@ int main(int argc, char **argv)
 
 	for (i = 1; i < argc; i++) {
 		struct context *ctx = &ctxts[nctxts++];
-		ctx->fd = open(argv[i], O_RDONLY);
-		if (ctx->fd < 0) {
+		ctx->io = io_open(argv[i]);
+		if (!ctx->io) {
 			fprintf(stderr, "could not open: %s\n", argv[i]);
 			return -1;
 		}
@@ -460,8 +461,8 @@ int main(int argc, char **argv)
 			free(ctx->buf);
 			ctx->buf = NULL;
 
-			if ((read(ctx->fd, &type, sizeof(type)) > 0) &&
-					(read(ctx->fd, &ctx->sz, 4) > 0)) {
+			if ((io_readn(ctx->io, &type, sizeof(type)) > 0) &&
+					(io_readn(ctx->io, &ctx->sz, 4) > 0)) {
 				if (row_type == RD_NONE)
 					row_type = type;
 
@@ -471,7 +472,7 @@ int main(int argc, char **argv)
 					 * same size..
 					 */
 					ctx->buf = calloc(1, ctx->sz + 1 + 20);
-					read(ctx->fd, ctx->buf, ctx->sz);
+					io_readn(ctx->io, ctx->buf, ctx->sz);
 					((char *)ctx->buf)[ctx->sz] = '\0';
 				} else {
 					fprintf(stderr, "unexpected type '%d', expected '%d'\n", type, row_type);
@@ -0,0 +1,526 @@
+/* -*- mode: C; c-file-style: "k&r"; tab-width 4; indent-tabs-mode: t; -*- */
+
+/*
+ * Copyright (C) 2014 Rob Clark <robclark@freedesktop.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Authors:
+ *    Rob Clark <robclark@freedesktop.org>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+#include "rnndb.h"
+
+/* The file is:
+ *
+ *    struct rnndb_header
+ *    objects (rnndb, enums, domains, strings, etc)
+ *    uint64_t relocs[nrelocs]   - file offsets of each non-NULL pointer
+ *
+ * Pointers in the objects are stored as base + file offset of the
+ * target.  Only the parts of the db which rnndec uses for decoding are
+ * kept, ie. the copyright info and file list are dropped.
+ */
+
+#define RNNDB_MAGIC   0x62646e72   /* "rndb" */
+#define RNNDB_VERSION 1
+#define NSIZES        12
+
+/* pick a base which is well out of the way of the usual mmap/heap
+ * ranges, so that in practice the image is never relocated:
+ */
+#define RNNDB_BASE ((sizeof(void *) == 8) ? 0x3d0000000000ull : 0x70000000ull)
+
+struct rnndb_header {
+	uint32_t magic;
+	uint32_t version;
+	/* fingerprint of the librnn ABI: */
+	uint16_t sizes[NSIZES];
+	/* stamp of the xml the image was built from, see rnn_load(): */
+	uint64_t srcstamp;
+	uint64_t base;
+	uint64_t size;       /* total, including header and relocs */
+	uint64_t nrelocs;
+	uint64_t relocs;     /* file offset of relocs table */
+	uint64_t db;         /* file offset of the struct rnndb */
+};
+
+static void get_sizes(uint16_t *sizes)
+{
+	unsigned i = 0;
+	sizes[i++] = sizeof(void *);
+	sizes[i++] = sizeof(struct rnndb);
+	sizes[i++] = sizeof(struct rnnenum);
+	sizes[i++] = sizeof(struct rnnvalue);
+	sizes[i++] = sizeof(struct rnnbitset);
+	sizes[i++] = sizeof(struct rnnbitfield);
+	sizes[i++] = sizeof(struct rnndomain);
+	sizes[i++] = sizeof(struct rnndelem);
+	sizes[i++] = sizeof(struct rnnspectype);
+	sizes[i++] = sizeof(struct rnntypeinfo);
+	sizes[i++] = sizeof(struct rnnvarinfo);
+	sizes[i++] = sizeof(struct rnnvarset);
+	assert(i == NSIZES);
+}
+
+/*
+ * Writer:
+ */
+
+struct memo {
+	const void *ptr;
+	uint64_t off;
+};
+
+struct writer {
+	uint8_t *buf;
+	uint64_t size, max;
+	uint64_t *relocs;
+	uint64_t nrelocs, maxrelocs;
+	/* src pointer -> offset, so shared objects (enums referenced from
+	 * many typeinfos, etc) are only written once:
+	 */
+	struct memo *memo;
+	uint64_t nmemo, maxmemo;
+};
+
+static void * grow(void *p, uint64_t *max, uint64_t need, size_t elemsz)
+{
+	uint64_t n = *max ? *max : 64;
+	if (need <= *max)
+		return p;
+	while (n < need)
+		n *= 2;
+	p = realloc(p, n * elemsz);
+	if (!p) {
+		fprintf(stderr, "rnndb: out of memory\n");
+		exit(1);
+	}
+	*max = n;
+	return p;
+}
+
+static uint64_t alloc(struct writer *w, size_t size)
+{
+	uint64_t off = (w->size + 7) & ~7ull;
+	w->buf = grow(w->buf, &w->max, off + size, 1);
+	memset(w->buf + w->size, 0, off + size - w->size);
+	w->size = off + size;
+	return off;
+}
+
+static uint32_t memo_hash(const void *ptr, uint64_t max)
+{
+	return ((uintptr_t)ptr >> 3) * 2654435761u & (max - 1);
+}
+
+static uint64_t *memo_find(struct writer *w, const void *ptr)
+{
+	uint32_t h;
+	if (!w->maxmemo)
+		return NULL;
+	for (h = memo_hash(ptr, w->maxmemo); w->memo[h].ptr;
+			h = (h + 1) & (w->maxmemo - 1))
+		if (w->memo[h].ptr == ptr)
+			return &w->memo[h].off;
+	return NULL;
+}
+
+static void memo_add(struct writer *w, const void *ptr, uint64_t off)
+{
+	uint32_t h;
+
+	/* keep it at most half full: */
+	if ((w->nmemo + 1) * 2 > w->maxmemo) {
+		struct memo *old = w->memo;
+		uint64_t i, oldmax = w->maxmemo;
+
+		w->maxmemo = oldmax ? oldmax * 2 : 1024;
+		w->memo = calloc(w->maxmemo, sizeof(*w->memo));
+		if (!w->memo) {
+			fprintf(stderr, "rnndb: out of memory\n");
+			exit(1);
+		}
+		w->nmemo = 0;
+		for (i = 0; i < oldmax; i++)
+			if (old[i].ptr)
+				memo_add(w, old[i].ptr, old[i].off);
+		free(old);
+	}
+
+	for (h = memo_hash(ptr, w->maxmemo); w->memo[h].ptr;
+			h = (h + 1) & (w->maxmemo - 1))
+		;
+	w->memo[h].ptr = ptr;
+	w->memo[h].off = off;
+	w->nmemo++;
+}
+
+/* point the pointer at file offset 'slot' to file offset 'target': */
+static void set_ptr(struct writer *w, uint64_t slot, uint64_t target)
+{
+	uintptr_t val = (uintptr_t)(RNNDB_BASE + target);
+	memcpy(w->buf + slot, &val, sizeof(val));
+	w->relocs = grow(w->relocs, &w->maxrelocs, w->nrelocs + 1,
+			sizeof(w->relocs[0]));
+	w->relocs[w->nrelocs++] = slot;
+}
+
+static void clear_ptr(struct writer *w, uint64_t slot)
+{
+	memset(w->buf + slot, 0, sizeof(void *));
+}
+
+/* The save_x() functions write an object (if it isn't already written)
+ * and return it's offset.  The struct is copied verbatim and then each
+ * pointer field patched up.  Note that w->buf can move on each alloc(),
+ * so only offsets are held across calls.
+ */
+#define PTR(T, off, field) ((off) + offsetof(T, field))
+#define SAVE(w, T, off, field, fxn, src) do {                  \
+		if (src)                                           \
+			set_ptr(w, PTR(T, off, field), fxn(w, src));   \
+	} while (0)
+
+static uint64_t save_data(struct writer *w, const void *data, size_t size)
+{
+	uint64_t off = alloc(w, size);
+	memcpy(w->buf + off, data, size);
+	return off;
+}
+
+static uint64_t save_str(struct writer *w, const char *str)
+{
+	uint64_t *m = memo_find(w, str);
+	uint64_t off;
+	if (m)
+		return *m;
+	off = save_data(w, str, strlen(str) + 1);
+	memo_add(w, str, off);
+	return off;
+}
+
+typedef uint64_t (*save_fxn)(struct writer *w, void *obj);
+
+static uint64_t save_array(struct writer *w, void **arr, int n, save_fxn fxn)
+{
+	uint64_t off = alloc(w, n * sizeof(void *));
+	int i;
+	for (i = 0; i < n; i++) {
+		if (arr[i])
+			set_ptr(w, off + (i * sizeof(void *)), fxn(w, arr[i]));
+	}
+	return off;
+}
+
+/* return early if the object is already written, otherwise write the
+ * struct and remember it.  It is added to the memo before recursing,
+ * since there can be cycles (ie. an enum's varinfo referring back to
+ * the enum):
+ */
+#define BEGIN(w, obj, off) do {                                     \
+		uint64_t *m = memo_find(w, obj);                            \
+		if (m)                                                      \
+			return *m;                                              \
+		off = save_data(w, obj, sizeof(*(obj)));                    \
+		memo_add(w, obj, off);                                      \
+	} while (0)
+
+#define SAVE_ARRAY(w, T, off, field, fxn, src) do {                    \
+		if ((src)->field)                                          \
+			set_ptr(w, PTR(T, off, field), save_array(w,           \
+					(void **)(src)->field, (src)->field##num,      \
+					(save_fxn)fxn));                           \
+		memcpy(w->buf + PTR(T, off, field##max),                   \
+				&(src)->field##num, sizeof(int));                  \
+	} while (0)
+
+static uint64_t save_enum(struct writer *w, struct rnnenum *en);
+static uint64_t save_bitset(struct writer *w, struct rnnbitset *bs);
+static uint64_t save_spectype(struct writer *w, struct rnnspectype *st);
+static uint64_t save_bitfield(struct writer *w, struct rnnbitfield *bf);
+
+static uint64_t save_varset(struct writer *w, struct rnnvarset *vs)
+{
+	uint64_t off;
+	BEGIN(w, vs, off);
+	SAVE(w, struct rnnvarset, off, venum, save_enum, vs->venum);
+	/* one entry per value of the variant enum: */
+	if (vs->variants && vs->venum)
+		set_ptr(w, PTR(struct rnnvarset, off, variants), save_data(w,
+				vs->variants, vs->venum->valsnum * sizeof(int)));
+	return off;
+}
+
+/* embedded in the parent object at 'off': */
+static void save_varinfo(struct writer *w, uint64_t off, struct rnnvarinfo *vi)
+{
+	SAVE(w, struct rnnvarinfo, off, prefixstr, save_str, vi->prefixstr);
+	SAVE(w, struct rnnvarinfo, off, varsetstr, save_str, vi->varsetstr);
+	SAVE(w, struct rnnvarinfo, off, variantsstr, save_str, vi->variantsstr);
+	SAVE(w, struct rnnvarinfo, off, prefenum, save_enum, vi->prefenum);
+	SAVE(w, struct rnnvarinfo, off, prefix, save_str, vi->prefix);
+	SAVE_ARRAY(w, struct rnnvarinfo, off, varsets, save_varset, vi);
+}
+
+static uint64_t save_value(struct writer *w, struct rnnvalue *val)
+{
+	uint64_t off;
+	BEGIN(w, val, off);
+	SAVE(w, struct rnnvalue, off, name, save_str, val->name);
+	save_varinfo(w, PTR(struct rnnvalue, off, varinfo), &val->varinfo);
+	SAVE(w, struct rnnvalue, off, fullname, save_str, val->fullname);
+	SAVE(w, struct rnnvalue, off, file, save_str, val->file);
+	return off;
+}
+
+static void save_typeinfo(struct writer *w, uint64_t off, struct rnntypeinfo *ti)
+{
+	SAVE(w, struct rnntypeinfo, off, name, save_str, ti->name);
+	SAVE(w, struct rnntypeinfo, off, eenum, save_enum, ti->eenum);
+	SAVE(w, struct rnntypeinfo, off, ebitset, save_bitset, ti->ebitset);
+	SAVE(w, struct rnntypeinfo, off, spectype, save_spectype, ti->spectype);
+	SAVE_ARRAY(w, struct rnntypeinfo, off, fields, save_bitfield, ti);
+	SAVE_ARRAY(w, struct rnntypeinfo, off, vals, save_value, ti);
+}
+
+static uint64_t save_enum(struct writer *w, struct rnnenum *en)
+{
+	uint64_t off;
+	BEGIN(w, en, off);
+	SAVE(w, struct rnnenum, off, name, save_str, en->name);
+	save_varinfo(w, PTR(struct rnnenum, off, varinfo), &en->varinfo);
+	SAVE_ARRAY(w, struct rnnenum, off, vals, save_value, en);
+	SAVE(w, struct rnnenum, off, fullname, save_str, en->fullname);
+	SAVE(w, struct rnnenum, off, file, save_str, en->file);
+	return off;
+}
+
+static uint64_t save_bitfield(struct writer *w, struct rnnbitfield *bf)
+{
+	uint64_t off;
+	BEGIN(w, bf, off);
+	SAVE(w, struct rnnbitfield, off, name, save_str, bf->name);
+	save_varinfo(w, PTR(struct rnnbitfield, off, varinfo), &bf->varinfo);
+	save_typeinfo(w, PTR(struct rnnbitfield, off, typeinfo), &bf->typeinfo);
+	SAVE(w, struct rnnbitfield, off, fullname, save_str, bf->fullname);
+	SAVE(w, struct rnnbitfield, off, file, save_str, bf->file);
+	return off;
+}
+
+static uint64_t save_bitset(struct writer *w, struct rnnbitset *bs)
+{
+	uint64_t off;
+	BEGIN(w, bs, off);
+	SAVE(w, struct rnnbitset, off, name, save_str, bs->name);
+	save_varinfo(w, PTR(struct rnnbitset, off, varinfo), &bs->varinfo);
+	SAVE_ARRAY(w, struct rnnbitset, off, fields, save_bitfield, bs);
+	SAVE(w, struct rnnbitset, off, fullname, save_str, bs->fullname);
+	SAVE(w, struct rnnbitset, off, file, save_str, bs->file);
+	return off;
+}
+
+static uint64_t save_spectype(struct writer *w, struct rnnspectype *st)
+{
+	uint64_t off;
+	BEGIN(w, st, off);
+	SAVE(w, struct rnnspectype, off, name, save_str, st->name);
+	save_typeinfo(w, PTR(struct rnnspectype, off, typeinfo), &st->typeinfo);
+	SAVE(w, struct rnnspectype, off, file, save_str, st->file);
+	return off;
+}
+
+static uint64_t save_delem(struct writer *w, struct rnndelem *elem)
+{
+	uint64_t off;
+	BEGIN(w, elem, off);
+	SAVE(w, struct rnndelem, off, name, save_str, elem->name);
+	if (elem->offsets) {
+		set_ptr(w, PTR(struct rnndelem, off, offsets), save_data(w,
+				elem->offsets, elem->offsetsnum * sizeof(elem->offsets[0])));
+	}
+	memcpy(w->buf + PTR(struct rnndelem, off, offsetsmax),
+			&elem->offsetsnum, sizeof(int));
+	SAVE_ARRAY(w, struct rnndelem, off, subelems, save_delem, elem);
+	save_varinfo(w, PTR(struct rnndelem, off, varinfo), &elem->varinfo);
+	save_typeinfo(w, PTR(struct rnndelem, off, typeinfo), &elem->typeinfo);
+	SAVE(w, struct rnndelem, off, fullname, save_str, elem->fullname);
+	SAVE(w, struct rnndelem, off, file, save_str, elem->file);
+	return off;
+}
+
+static uint64_t save_domain(struct writer *w, struct rnndomain *dom)
+{
+	uint64_t off;
+	BEGIN(w, dom, off);
+	SAVE(w, struct rnndomain, off, name, save_str, dom->name);
+	save_varinfo(w, PTR(struct rnndomain, off, varinfo), &dom->varinfo);
+	SAVE_ARRAY(w, struct rnndomain, off, subelems, save_delem, dom);
+	SAVE(w, struct rnndomain, off, fullname, save_str, dom->fullname);
+	SAVE(w, struct rnndomain, off, file, save_str, dom->file);
+	return off;
+}
+
+static uint64_t save_db(struct writer *w, struct rnndb *db)
+{
+	uint64_t off = save_data(w, db, sizeof(*db));
+	struct rnndb *out;
+
+	/* groups are already expanded by rnn_prepdb(), and the copyright
+	 * and file list aren't needed for decoding:
+	 */
+	out = (struct rnndb *)(w->buf + off);
+	memset(&out->copyright, 0, sizeof(out->copyright));
+	clear_ptr(w, PTR(struct rnndb, off, groups));
+	out->groupsnum = out->groupsmax = 0;
+	clear_ptr(w, PTR(struct rnndb, off, files));
+	out->filesnum = out->filesmax = 0;
+
+	SAVE_ARRAY(w, struct rnndb, off, enums, save_enum, db);
+	SAVE_ARRAY(w, struct rnndb, off, bitsets, save_bitset, db);
+	SAVE_ARRAY(w, struct rnndb, off, domains, save_domain, db);
+	SAVE_ARRAY(w, struct rnndb, off, spectypes, save_spectype, db);
+
+	return off;
+}
+
+int rnndb_save(struct rnndb *db, const char *filename, uint64_t srcstamp)
+{
+	struct writer w = {0};
+	struct rnndb_header hdr = {0};
+	char tmpname[PATH_MAX];
+	uint64_t hdroff;
+	int fd, ret = -1;
+
+	hdroff = alloc(&w, sizeof(hdr));
+	assert(hdroff == 0);
+
+	hdr.magic = RNNDB_MAGIC;
+	hdr.version = RNNDB_VERSION;
+	get_sizes(hdr.sizes);
+	hdr.srcstamp = srcstamp;
+	hdr.base = RNNDB_BASE;
+	hdr.db = save_db(&w, db);
+	hdr.relocs = alloc(&w, 0);
+	hdr.nrelocs = w.nrelocs;
+	hdr.size = hdr.relocs + (w.nrelocs * sizeof(w.relocs[0]));
+	memcpy(w.buf, &hdr, sizeof(hdr));
+
+	/* write to a temp file and rename, so concurrent readers never see
+	 * a partial image:
+	 */
+	snprintf(tmpname, sizeof(tmpname), "%s.%d", filename, getpid());
+
+	fd = open(tmpname, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		goto out;
+
+	if ((write(fd, w.buf, hdr.relocs) != (ssize_t)hdr.relocs) ||
+			(write(fd, w.relocs, hdr.size - hdr.relocs) !=
+					(ssize_t)(hdr.size - hdr.relocs))) {
+		close(fd);
+		unlink(tmpname);
+		goto out;
+	}
+	close(fd);
+
+	if (rename(tmpname, filename)) {
+		unlink(tmpname);
+		goto out;
+	}
+
+	ret = 0;
+
+out:
+	free(w.buf);
+	free(w.relocs);
+	free(w.memo);
+	return ret;
+}
+
+/*
+ * Loader:
+ */
+
+struct rnndb * rnndb_load(const char *filename, uint64_t srcstamp)
+{
+	struct rnndb_header hdr;
+	uint16_t sizes[NSIZES] = {0};
+	struct stat st;
+	uint8_t *map;
+	int fd;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+
+	get_sizes(sizes);
+
+	if ((read(fd, &hdr, sizeof(hdr)) != sizeof(hdr)) ||
+			(hdr.magic != RNNDB_MAGIC) ||
+			(hdr.version != RNNDB_VERSION) ||
+			memcmp(hdr.sizes, sizes, sizeof(sizes)) ||
+			(hdr.srcstamp != srcstamp) ||
+			fstat(fd, &st) || ((uint64_t)st.st_size != hdr.size) ||
+			(hdr.relocs + (hdr.nrelocs * sizeof(uint64_t)) != hdr.size)) {
+		close(fd);
+		return NULL;
+	}
+
+	/* private+writable, so relocation (or anything in librnn which
+	 * writes to the db) only un-shares the pages it touches:
+	 */
+	map = mmap((void *)(uintptr_t)hdr.base, hdr.size,
+			PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return NULL;
+
+	if ((uintptr_t)map != hdr.base) {
+		uintptr_t delta = (uintptr_t)map - (uintptr_t)hdr.base;
+		const uint64_t *relocs = (const uint64_t *)(map + hdr.relocs);
+		uint64_t i;
+
+		for (i = 0; i < hdr.nrelocs; i++) {
+			uintptr_t val;
+			if (relocs[i] > (hdr.relocs - sizeof(val))) {
+				munmap(map, hdr.size);
+				return NULL;
+			}
+			memcpy(&val, map + relocs[i], sizeof(val));
+			val += delta;
+			memcpy(map + relocs[i], &val, sizeof(val));
+		}
+	}
+
+	return (struct rnndb *)(map + hdr.db);
+}
@@ -0,0 +1,48 @@
+/* -*- mode: C; c-file-style: "k&r"; tab-width 4; indent-tabs-mode: t; -*- */
+
+/*
+ * Copyright (C) 2014 Rob Clark <robclark@freedesktop.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Authors:
+ *    Rob Clark <robclark@freedesktop.org>
+ */
+
+#ifndef RNNDB_H_
+#define RNNDB_H_
+
+#include "rnn.h"
+
+/* Precompiled rnn database.  This is a snapshot of the prepared
+ * struct rnndb (ie. after rnn_prepdb()), w/ all the pointers laid out
+ * as if the file were mapped at a fixed base address.  If the mmap()
+ * lands there, which is the common case, the image is used in-place
+ * and shared between processes via the page cache, otherwise it is
+ * relocated after mapping.
+ *
+ * The image is only valid for the librnn it was built against, the
+ * header records the struct sizes to catch mismatches.
+ */
+
+int rnndb_save(struct rnndb *db, const char *filename, uint64_t srcstamp);
+struct rnndb * rnndb_load(const char *filename, uint64_t srcstamp);
+
+#endif /* RNNDB_H_ */
@@ -31,8 +31,12 @@
 #include <stdint.h>
 #include <string.h>
 #include <assert.h>
+#include <limits.h>
+#include <dirent.h>
+#include <sys/stat.h>
 
 #include "rnnutil.h"
+#include "rnndb.h"
 
 static struct rnndomain *finddom(struct rnn *rnn, uint32_t regbase)
 {
@@ -68,11 +72,128 @@ struct rnn *rnn_new(int nocolor)
 	return rnn;
 }
 
+/* Directory for the precompiled db images, $RNNDB_CACHE if set (set it
+ * to empty to disable the cache), otherwise ~/.cache/freedreno:
+ */
+static int cache_path(char *path, size_t len, const char *domain)
+{
+	const char *dir = getenv("RNNDB_CACHE");
+	char buf[PATH_MAX];
+
+	if (!dir) {
+		const char *home = getenv("XDG_CACHE_HOME");
+		if (home) {
+			snprintf(buf, sizeof(buf), "%s/freedreno", home);
+		} else if ((home = getenv("HOME"))) {
+			snprintf(buf, sizeof(buf), "%s/.cache", home);
+			mkdir(buf, 0755);
+			snprintf(buf, sizeof(buf), "%s/.cache/freedreno", home);
+		} else {
+			return 0;
+		}
+		mkdir(buf, 0755);
+		dir = buf;
+	}
+
+	if (!dir[0])
+		return 0;
+
+	snprintf(path, len, "%s/%s.rnndb", dir, domain);
+	return 1;
+}
+
+/* librnn's search path when $RNN_PATH isn't set, this needs to match
+ * what envytools was built with:
+ */
+#ifndef RNN_DEF_PATH
+#  define RNN_DEF_PATH "/usr/local/share/rnndb"
+#endif
+
+/* Stamp of the xml a db image is built from, so a stale image gets
+ * rebuilt.  Since the xml pulls in other files from the same directory
+ * (adreno_common.xml, adreno_pm4.xml, etc), this covers all of the .xml
+ * files next to the one we load.  The file is found the same way as
+ * librnn does, via $RNN_PATH or else RNN_DEF_PATH.  Returns 0 if it
+ * can't be found, in which case the cache must not be used:
+ */
+static int xml_stamp(const char *file, uint64_t *stamp)
+{
+	const char *rnn_path = getenv("RNN_PATH");
+	const char *subdir = strrchr(file, '/');
+
+	if (!rnn_path)
+		rnn_path = RNN_DEF_PATH;
+
+	while (rnn_path[0]) {
+		const char *end = strchr(rnn_path, ':');
+		char dirname[PATH_MAX], path[PATH_MAX];
+		struct dirent *ent;
+		struct stat st;
+		DIR *dir;
+
+		if (!end)
+			end = rnn_path + strlen(rnn_path);
+
+		snprintf(dirname, sizeof(dirname), "%.*s/%.*s",
+				(int)(end - rnn_path), rnn_path,
+				subdir ? (int)(subdir - file) : 0, file);
+		rnn_path = end[0] ? end + 1 : end;
+
+		snprintf(path, sizeof(path), "%s/%s", dirname,
+				subdir ? subdir + 1 : file);
+		if (stat(path, &st))
+			continue;
+
+		dir = opendir(dirname);
+		if (!dir)
+			return 0;
+
+		*stamp = 0;
+
+		/* order independent, readdir() order isn't stable: */
+		while ((ent = readdir(dir))) {
+			const char *ext = strrchr(ent->d_name, '.');
+			if (!ext || strcmp(ext, ".xml"))
+				continue;
+			snprintf(path, sizeof(path), "%s/%s", dirname, ent->d_name);
+			if (stat(path, &st))
+				continue;
+			*stamp += ((uint64_t)st.st_mtime * 2654435761u) ^ st.st_size;
+		}
+		closedir(dir);
+		return 1;
+	}
+
+	return 0;
+}
+
 static void init(struct rnn *rnn, char *file, char *domain)
 {
-	/* prepare rnn stuff for lookup */
-	rnn_parsefile(rnn->db, file);
-	rnn_prepdb(rnn->db);
+	struct rnndb *db = NULL;
+	char path[PATH_MAX];
+	uint64_t stamp = 0;
+	int cache;
+
+	/* prepare rnn stuff for lookup.  Parsing the xml is the bulk of
+	 * the startup time, so try the precompiled image first:
+	 */
+	cache = cache_path(path, sizeof(path), domain) &&
+			xml_stamp(file, &stamp);
+	if (cache)
+		db = rnndb_load(path, stamp);
+
+	if (db) {
+		rnn->db = db;
+		rnn->vc->db = db;
+		rnn->vc_nocolor->db = db;
+	} else {
+		rnn_parsefile(rnn->db, file);
+		rnn_prepdb(rnn->db);
+		/* errors are just reported, but don't cache a broken db: */
+		if (cache && !rnn->db->estatus)
+			rnndb_save(rnn->db, path, stamp);
+	}
+
 	rnn->dom[0] = rnn_finddomain(rnn->db, domain);
 	if ((strcmp(domain, "A2XX") == 0) || (strcmp(domain, "A3XX") == 0)) {
 		rnn->dom[1] = rnn_finddomain(rnn->db, "AXXX");
@@ -144,6 +265,26 @@ const char *rnn_enumname(struct rnn *rnn, const char *name, uint32_t val)
 	return NULL;
 }
 
+/* reverse of rnn_enumname(), returns zero on success: */
+int rnn_enumval(struct rnn *rnn, const char *name, const char *valname,
+		uint32_t *val)
+{
+	struct rnndeccontext *ctx = rnn->vc;
+	struct rnnenum *en = rnn_findenum(ctx->db, name);
+	if (en) {
+		int i;
+		for (i = 0; i < en->valsnum; i++)
+			if (en->vals[i]->valvalid && !strcmp(en->vals[i]->name, valname)) {
+				const char *variant = en->vals[i]->varinfo.variantsstr;
+				if (variant && !strstr(variant, rnn->variant))
+					continue;
+				*val = en->vals[i]->value;
+				return 0;
+			}
+	}
+	return -1;
+}
+
 static struct rnndelem *regelem(struct rnndomain *domain, const char *name)
 {
 	int i;
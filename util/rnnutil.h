@@ -56,6 +56,8 @@ uint32_t rnn_regbase(struct rnn *rnn, const char *name);
 const char *rnn_regname(struct rnn *rnn, uint32_t regbase, int color);
 struct rnndecaddrinfo *rnn_reginfo(struct rnn *rnn, uint32_t regbase);
 const char *rnn_enumname(struct rnn *rnn, const char *name, uint32_t val);
+int rnn_enumval(struct rnn *rnn, const char *name, const char *valname,
+		uint32_t *val);
 
 struct rnndelem *rnn_regelem(struct rnn *rnn, const char *name);
 enum rnnttype rnn_decodelem(struct rnn *rnn, struct rnntypeinfo *info,
@@ -0,0 +1,268 @@
+/* -*- mode: C; c-file-style: "k&r"; tab-width 4; indent-tabs-mode: t; -*- */
+
+/*
+ * Copyright (C) 2014 Rob Clark <robclark@freedesktop.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Authors:
+ *    Rob Clark <robclark@freedesktop.org>
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __ARM_NEON__
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "search.h"
+
+/* The scan is a two stage filter:
+ *
+ *  1) find candidate positions where the first dword of some needle
+ *     occurs.  With only a few distinct first dwords (the common case,
+ *     ie. looking for a single shader) this is a SIMD compare of four
+ *     dwords at a time against each of them, otherwise a scalar probe
+ *     of a bitmap indexed by a hash of the dword.
+ *
+ *  2) for each candidate, walk the needles sharing that first dword,
+ *     compare the precomputed hash of the needle against a hash of the
+ *     window at the candidate, and only memcmp() on a hash match.
+ *
+ * Needles in gpu buffers tend to start with something fairly unique
+ * (a shader instruction, a float constant), so (2) is rare and (1)
+ * runs at roughly memory bandwidth.
+ */
+
+#define MAX_SIMD_FIRST 4
+#define BITMAP_BITS    16
+
+struct needle {
+	const uint32_t *dwords;
+	unsigned sizedwords;
+	uint32_t hash;
+	int next;             /* next needle w/ same first dword, or -1 */
+};
+
+struct search {
+	struct needle *needles;
+	int nneedles, maxneedles;
+
+	/* distinct first dwords, and head of the needle list for each: */
+	uint32_t *firsts;
+	int *heads;
+	int nfirsts, maxfirsts;
+
+	/* shortest needle, no point looking closer to the end than this: */
+	unsigned minsize;
+
+	uint32_t bitmap[(1 << BITMAP_BITS) / 32];
+};
+
+static inline unsigned bitmap_idx(uint32_t dw)
+{
+	return (dw * 0x9e3779b1) >> (32 - BITMAP_BITS);
+}
+
+/* FNV-1a over the dwords of a window: */
+static uint32_t hash_dwords(const uint32_t *dwords, unsigned sizedwords)
+{
+	uint32_t hash = 2166136261u;
+	unsigned i;
+	for (i = 0; i < sizedwords; i++) {
+		hash ^= dwords[i];
+		hash *= 16777619;
+	}
+	return hash;
+}
+
+struct search * search_new(void)
+{
+	struct search *s = calloc(1, sizeof(*s));
+	if (!s)
+		return NULL;
+	s->minsize = ~0;
+	return s;
+}
+
+void search_destroy(struct search *s)
+{
+	if (!s)
+		return;
+	free(s->needles);
+	free(s->firsts);
+	free(s->heads);
+	free(s);
+}
+
+int search_count(struct search *s)
+{
+	return s->nneedles;
+}
+
+/* returns the needle index, which is passed back to the callback: */
+int search_add(struct search *s, const uint32_t *dwords, unsigned sizedwords)
+{
+	struct needle *n;
+	int i, idx;
+
+	if (!sizedwords)
+		return -1;
+
+	if (s->nneedles == s->maxneedles) {
+		int max = s->maxneedles ? s->maxneedles * 2 : 8;
+		struct needle *needles = realloc(s->needles, max * sizeof(*needles));
+		if (!needles)
+			return -1;
+		s->needles = needles;
+		s->maxneedles = max;
+	}
+
+	for (i = 0; i < s->nfirsts; i++)
+		if (s->firsts[i] == dwords[0])
+			break;
+
+	if (i == s->nfirsts) {
+		if (s->nfirsts == s->maxfirsts) {
+			int max = s->maxfirsts ? s->maxfirsts * 2 : 8;
+			uint32_t *firsts = realloc(s->firsts, max * sizeof(*firsts));
+			int *heads;
+			if (!firsts)
+				return -1;
+			s->firsts = firsts;
+			heads = realloc(s->heads, max * sizeof(*heads));
+			if (!heads)
+				return -1;
+			s->heads = heads;
+			s->maxfirsts = max;
+		}
+		s->firsts[i] = dwords[0];
+		s->heads[i] = -1;
+		s->nfirsts++;
+		s->bitmap[bitmap_idx(dwords[0]) / 32] |= 1u << (bitmap_idx(dwords[0]) % 32);
+	}
+
+	idx = s->nneedles++;
+	n = &s->needles[idx];
+	n->dwords = dwords;
+	n->sizedwords = sizedwords;
+	n->hash = hash_dwords(dwords, sizedwords);
+	n->next = s->heads[i];
+	s->heads[i] = idx;
+
+	if (sizedwords < s->minsize)
+		s->minsize = sizedwords;
+
+	return idx;
+}
+
+/* check all needles starting w/ *p, returns non-zero to stop: */
+static int check_candidate(struct search *s, const uint32_t *p,
+		const uint32_t *end, search_cb cb, void *data)
+{
+	unsigned avail = end - p;
+	int i, idx;
+
+	for (i = 0; i < s->nfirsts; i++)
+		if (s->firsts[i] == *p)
+			break;
+	if (i == s->nfirsts)
+		return 0;
+
+	for (idx = s->heads[i]; idx >= 0; idx = s->needles[idx].next) {
+		struct needle *n = &s->needles[idx];
+		if (n->sizedwords > avail)
+			continue;
+		if (hash_dwords(p, n->sizedwords) != n->hash)
+			continue;
+		if (memcmp(p, n->dwords, n->sizedwords * 4))
+			continue;
+		if (cb(data, idx, p))
+			return 1;
+	}
+
+	return 0;
+}
+
+#if defined(__ARM_NEON__) || defined(__SSE2__)
+/* returns bitmask of the lanes (of four) matching any first dword: */
+static inline unsigned simd_match4(struct search *s, const uint32_t *p)
+{
+	int i;
+#ifdef __ARM_NEON__
+	uint32x4_t v = vld1q_u32(p);
+	uint32x4_t m = vdupq_n_u32(0);
+	static const uint32_t lanebits[4] = { 1, 2, 4, 8 };
+	for (i = 0; i < s->nfirsts; i++)
+		m = vorrq_u32(m, vceqq_u32(v, vdupq_n_u32(s->firsts[i])));
+	m = vandq_u32(m, vld1q_u32(lanebits));
+	return vgetq_lane_u32(m, 0) | vgetq_lane_u32(m, 1) |
+			vgetq_lane_u32(m, 2) | vgetq_lane_u32(m, 3);
+#else
+	__m128i v = _mm_loadu_si128((const __m128i *)p);
+	__m128i m = _mm_setzero_si128();
+	for (i = 0; i < s->nfirsts; i++)
+		m = _mm_or_si128(m, _mm_cmpeq_epi32(v, _mm_set1_epi32(s->firsts[i])));
+	return _mm_movemask_ps(_mm_castsi128_ps(m));
+#endif
+}
+#endif
+
+/* Scan [start, end) for all needles, calling cb for each match.  Returns
+ * the match the callback stopped at, or NULL if the scan ran to the end.
+ */
+const uint32_t * search_scan(struct search *s, const uint32_t *start,
+		const uint32_t *end, search_cb cb, void *data)
+{
+	const uint32_t *p = start, *last;
+
+	if (!s->nneedles || (start >= end) || ((unsigned)(end - start) < s->minsize))
+		return NULL;
+
+	/* last position a needle could start: */
+	last = end - s->minsize;
+
+#if defined(__ARM_NEON__) || defined(__SSE2__)
+	if (s->nfirsts <= MAX_SIMD_FIRST) {
+		for (; p + 4 <= last + 1; p += 4) {
+			unsigned mask = simd_match4(s, p);
+			while (mask) {
+				int lane = __builtin_ctz(mask);
+				mask &= mask - 1;
+				if (check_candidate(s, p + lane, end, cb, data))
+					return p + lane;
+			}
+		}
+	}
+#endif
+
+	for (; p <= last; p++) {
+		unsigned bit = bitmap_idx(*p);
+		if (!(s->bitmap[bit / 32] & (1u << (bit % 32))))
+			continue;
+		if (check_candidate(s, p, end, cb, data))
+			return p;
+	}
+
+	return NULL;
+}
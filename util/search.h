@@ -0,0 +1,56 @@
+/* -*- mode: C; c-file-style: "k&r"; tab-width 4; indent-tabs-mode: t; -*- */
+
+/*
+ * Copyright (C) 2014 Rob Clark <robclark@freedesktop.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Authors:
+ *    Rob Clark <robclark@freedesktop.org>
+ */
+
+#ifndef SEARCH_H_
+#define SEARCH_H_
+
+#include <stdint.h>
+
+/* Search for many blobs (shaders, constant blocks, index patterns, etc)
+ * at once in big chunks of memory.  Needles and haystack are dword
+ * granular, and matches are only reported at dword aligned offsets,
+ * which is all we need for gpu buffers.
+ *
+ * The needle dwords are not copied, the caller must keep them around
+ * for as long as the search object is used.  (cltool relies on this,
+ * since it is scanning the heap the search object itself lives in.)
+ */
+
+struct search;
+
+/* return non-zero from the callback to stop the scan: */
+typedef int (*search_cb)(void *data, int needle, const uint32_t *match);
+
+struct search * search_new(void);
+void search_destroy(struct search *s);
+int search_add(struct search *s, const uint32_t *dwords, unsigned sizedwords);
+int search_count(struct search *s);
+const uint32_t * search_scan(struct search *s, const uint32_t *start,
+		const uint32_t *end, search_cb cb, void *data);
+
+#endif /* SEARCH_H_ */
@@ -706,29 +706,139 @@ static void kgsl_ioctl_device_getproperty_post(int fd,
 	hexdump(param->value, param->sizebytes);
 }
 
-static int len_from_vma(unsigned int hostptr)
+/*
+ * Cache of the process's VMAs, so we don't have to parse /proc/self/maps
+ * on every sharedmem ioctl.  Entries only ever come from /proc/self/maps
+ * (so lengths are the kernel's, including any merging of neighbouring
+ * mappings), and the mmap/munmap wrappers drop any entry overlapping or
+ * adjacent to the range they touch, since the kernel may have split or
+ * merged it.  A miss re-reads the whole maps file.  Sorted by start
+ * address, non-overlapping.  Protected by LOCK().
+ *
+ * Mappings changed behind our back (ie. by libc internally, or mremap)
+ * are not seen, so a hit on such a range can be stale.
+ */
+struct vma {
+	unsigned long start, end;
+};
+
+static struct vma *vmas;
+static unsigned int nvmas, maxvmas;
+
+/* index of first vma w/ start >= addr: */
+static unsigned int vma_lower_bound(unsigned long addr)
 {
-	long long addr, endaddr, offset, inode;
-	FILE *f;
-	int ret;
+	unsigned int lo = 0, hi = nvmas;
+	while (lo < hi) {
+		unsigned int mid = (lo + hi) / 2;
+		if (vmas[mid].start < addr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static void vma_append(unsigned long start, unsigned long end)
+{
+	if (nvmas == maxvmas) {
+		maxvmas = maxvmas ? maxvmas * 2 : 256;
+		vmas = realloc(vmas, maxvmas * sizeof(vmas[0]));
+	}
+	vmas[nvmas].start = start;
+	vmas[nvmas].end = end;
+	nvmas++;
+}
+
+/* drop cached vmas which overlap or touch a range which was (un)mapped: */
+static void vma_invalidate(void *addr, size_t length)
+{
+	unsigned long pgsz = getpagesize();
+	unsigned long start = (unsigned long)addr;
+	unsigned long end = (start + length + pgsz - 1) & ~(pgsz - 1);
+	unsigned int i, j;
+
+	if ((addr == MAP_FAILED) || !length)
+		return;
+
+	i = vma_lower_bound(start);
+	if ((i > 0) && (vmas[i-1].end >= start))
+		i--;
+
+	for (j = i; (j < nvmas) && (vmas[j].start <= end); j++)
+		;
+
+	memmove(&vmas[i], &vmas[j], (nvmas - j) * sizeof(vmas[0]));
+	nvmas -= j - i;
+}
+
+/* re-read the whole of /proc/self/maps in one go and rebuild the table: */
+static void vma_reload(void)
+{
+	static char *buf;
+	static size_t sz;
+	size_t n = 0;
+	char *p;
+	int fd, ret;
 
 	// TODO: only for debug..
 	if (0)
 		dumpfile("/proc/self/maps");
 
-	f = fopen("/proc/self/maps", "r");
+	fd = open("/proc/self/maps", O_RDONLY);
+	if (fd < 0)
+		return;
 
 	do {
-		char c;
-		ret = fscanf(f, "%llx-%llx", &addr, &endaddr);
-		if (addr == hostptr)
-			return endaddr - addr;
-		/* find end of line.. we could do this more cleverly w/ glibc.. :-( */
-		while (((ret = fscanf(f, "%c", &c)) > 0) && (c != '\n'));
+		if (n + 1 >= sz) {
+			sz = sz ? sz * 2 : 0x10000;
+			buf = realloc(buf, sz);
+		}
+		ret = read(fd, buf + n, sz - n - 1);
+		if (ret > 0)
+			n += ret;
 	} while (ret > 0);
+	close(fd);
+
+	buf[n] = '\0';
+	nvmas = 0;
+
+	/* the kernel gives us the lines already sorted by address: */
+	for (p = buf; *p; ) {
+		unsigned long start, end;
+		char *next;
+
+		start = strtoul(p, &next, 16);
+		if (*next == '-') {
+			end = strtoul(next + 1, &next, 16);
+			vma_append(start, end);
+		}
+
+		p = strchr(next, '\n');
+		if (!p)
+			break;
+		p++;
+	}
+}
+
+static int vma_len(unsigned long addr)
+{
+	unsigned int i = vma_lower_bound(addr);
+	if ((i < nvmas) && (vmas[i].start == addr))
+		return vmas[i].end - vmas[i].start;
 	return -1;
 }
 
+static int len_from_vma(unsigned int hostptr)
+{
+	int len = vma_len(hostptr);
+	if (len < 0) {
+		vma_reload();
+		len = vma_len(hostptr);
+	}
+	return len;
+}
+
 static void kgsl_ioctl_sharedmem_from_vmalloc_pre(int fd,
 		struct kgsl_sharedmem_from_vmalloc *param)
 {
@@ -1270,9 +1380,11 @@ void * mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset
 			ret = malloc(length);
 		} else {
 			ret = orig_mmap(addr, length, prot, flags, fd, offset);
+			vma_invalidate(ret, length);
 		}
 #else
 		ret = orig_mmap(addr, length, prot, flags, fd, offset);
+		vma_invalidate(ret, length);
 #endif
 	}
 
@@ -1326,9 +1438,11 @@ void *mmap64(void *addr, size_t length, int prot, int flags, int fd, int64_t off
 			ret = calloc(1, length);
 		} else {
 			ret = orig_mmap64(addr, length, prot, flags, fd, offset);
+			vma_invalidate(ret, length);
 		}
 #else
 		ret = orig_mmap64(addr, length, prot, flags, fd, offset);
+		vma_invalidate(ret, length);
 #endif
 	}
 
@@ -1373,6 +1487,8 @@ printf("fake munmap: buf=%p\n", buf);
 	}
 
 	ret = orig_munmap(addr, length);
+	if (!ret)
+		vma_invalidate(addr, length);
 out:
 	UNLOCK();
 	return ret;
@@ -46,6 +46,7 @@
 #include <inttypes.h>
 #include <errno.h>
 #include <stdio.h>
+#include <unistd.h>
 #include <assert.h>
 
 #define __user